@@ -23,6 +23,7 @@
 #include <common/log.hh>
 #include <common/settings.hh>
 
+#include <cstring>
 #include <fstream>
 
 #include <common/json.hh>
@@ -91,11 +92,24 @@ int main(int argc, char **argv)
 
         fmt::print("---- bspinfo / ericw-tools {} ----\n", ERICWTOOLS_VERSION);
         if (argc == 1) {
-            printf("usage: bspinfo bspfile [bspfiles]\n");
+            printf("usage: bspinfo [--lumps name,...] bspfile [bspfiles]\n");
             exit(1);
         }
 
-        for (int32_t i = 1; i < argc; i++) {
+        bsp_json_options_t json_options;
+        int32_t first_bsp = 1;
+
+        if (argc > 2 && !strcmp(argv[1], "--lumps")) {
+            for (std::string_view names = argv[2]; !names.empty();) {
+                const size_t comma = names.find(',');
+                json_options.lumps.emplace_back(names.substr(0, comma));
+                names = (comma == std::string_view::npos) ? std::string_view{} : names.substr(comma + 1);
+            }
+
+            first_bsp = 3;
+        }
+
+        for (int32_t i = first_bsp; i < argc; i++) {
             printf("---------------------\n");
             fs::path source = DefaultExtension(argv[i], ".bsp");
             fmt::print("{}\n", source);
@@ -111,7 +125,8 @@ int main(int argc, char **argv)
 
             ConvertBSPFormat(&bsp, &bspver_generic);
 
-            serialize_bsp(bsp, std::get<mbsp_t>(bsp.bsp), fs::path(source).replace_extension("bsp.json"));
+            serialize_bsp(
+                bsp, std::get<mbsp_t>(bsp.bsp), fs::path(source).replace_extension("bsp.json"), json_options);
 
             PrintBSPTextureUsage(std::get<mbsp_t>(bsp.bsp));
 
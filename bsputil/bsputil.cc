@@ -33,10 +33,10 @@
 #include <common/fs.hh>
 #include <common/settings.hh>
 #include <common/ostream.hh>
+#include <bsputil/check.hh>
+#include <bsputil/compare.hh>
 
 #include <map>
-#include <set>
-#include <list>
 #include <algorithm> // std::sort
 #include <string>
 #include <fstream>
@@ -144,337 +144,6 @@ static void PrintModelInfo(const mbsp_t *bsp)
     }
 }
 
-/*
- * Quick hack to check verticies of faces lie on the correct plane
- */
-constexpr vec_t PLANE_ON_EPSILON = 0.01;
-
-static void CheckBSPFacesPlanar(const mbsp_t *bsp)
-{
-    for (size_t i = 0; i < bsp->dfaces.size(); i++) {
-        const mface_t *face = BSP_GetFace(bsp, i);
-        dplane_t plane = bsp->dplanes[face->planenum];
-
-        if (face->side) {
-            plane = -plane;
-        }
-
-        for (size_t j = 0; j < face->numedges; j++) {
-            const int edgenum = bsp->dsurfedges[face->firstedge + j];
-            const int vertnum = (edgenum >= 0) ? bsp->dedges[edgenum][0] : bsp->dedges[-edgenum][1];
-            const qvec3f &point = bsp->dvertexes[vertnum];
-            const float dist = plane.distance_to(point);
-
-            if (dist < -PLANE_ON_EPSILON || dist > PLANE_ON_EPSILON)
-                fmt::print("WARNING: face {}, point {} off plane by {}\n", i, j, dist);
-        }
-    }
-}
-
-static int Node_Height(const mbsp_t *bsp, const bsp2_dnode_t *node, std::map<const bsp2_dnode_t *, int> *cache)
-{
-    // leafs have a height of 0
-    twosided<int32_t> child_heights = {0, 0};
-
-    for (int i = 0; i < 2; i++) {
-        const int child = node->children[i];
-        if (child >= 0) {
-            child_heights[i] = Node_Height(bsp, &bsp->dnodes[child], cache);
-        }
-    }
-
-    const int height = std::max(child_heights[0], child_heights[1]) + 1;
-    if (cache)
-        (*cache)[node] = height;
-    return height;
-}
-
-static void PrintNodeHeights(const mbsp_t *bsp)
-{
-    // get all the heights in one go.
-    const bsp2_dnode_t *headnode = &bsp->dnodes[bsp->dmodels[0].headnode[0]];
-    std::map<const bsp2_dnode_t *, int> cache;
-    Node_Height(bsp, headnode, &cache);
-
-    const int maxlevel = 3;
-
-    using level_t = int;
-    using visit_t = std::pair<const bsp2_dnode_t *, level_t>;
-
-    int current_level = -1;
-
-    std::list<visit_t> tovisit{std::make_pair(headnode, 0)};
-    while (!tovisit.empty()) {
-        const auto n = tovisit.front();
-        tovisit.pop_front();
-
-        const bsp2_dnode_t *node = n.first;
-        const int level = n.second;
-
-        Q_assert(level <= maxlevel);
-
-        // handle this node
-        if (level != current_level) {
-            current_level = level;
-            fmt::print("\nNode heights at level {}: ", level);
-        }
-
-        // print the level of this node
-        fmt::print("{}, ", cache.at(node));
-
-        // add child nodes to the bfs
-        if (level < maxlevel) {
-            for (int i = 0; i < 2; i++) {
-                const int child = node->children[i];
-                if (child >= 0) {
-                    tovisit.emplace_back(&bsp->dnodes[child], level + 1);
-                }
-            }
-        }
-    }
-    printf("\n");
-}
-
-static void CheckBSPFile(const mbsp_t *bsp)
-{
-    int i;
-
-    // FIXME: Should do a better reachability check where we traverse the
-    // nodes/leafs to find reachable faces.
-    std::set<int32_t> referenced_texinfos;
-    std::set<int32_t> referenced_planenums;
-    std::set<uint32_t> referenced_vertexes;
-    std::set<uint8_t> used_lightstyles;
-
-    /* faces */
-    for (i = 0; i < bsp->dfaces.size(); i++) {
-        const mface_t *face = BSP_GetFace(bsp, i);
-
-        /* texinfo bounds check */
-        if (face->texinfo < 0)
-            fmt::print("warning: face {} has negative texinfo ({})\n", i, face->texinfo);
-        if (face->texinfo >= bsp->texinfo.size())
-            fmt::print("warning: face {} has texinfo out of range ({} >= {})\n", i, face->texinfo, bsp->texinfo.size());
-        referenced_texinfos.insert(face->texinfo);
-
-        /* planenum bounds check */
-        if (face->planenum < 0)
-            fmt::print("warning: face {} has negative planenum ({})\n", i, face->planenum);
-        if (face->planenum >= bsp->dplanes.size())
-            fmt::print(
-                "warning: face {} has planenum out of range ({} >= {})\n", i, face->planenum, bsp->dplanes.size());
-        referenced_planenums.insert(face->planenum);
-
-        /* lightofs check */
-        if (face->lightofs < -1)
-            fmt::print("warning: face {} has negative light offset ({})\n", i, face->lightofs);
-        if (face->lightofs >= bsp->dlightdata.size())
-            fmt::print("warning: face {} has light offset out of range "
-                       "({} >= {})\n",
-                i, face->lightofs, bsp->dlightdata.size());
-
-        /* edge check */
-        if (face->firstedge < 0)
-            fmt::print("warning: face {} has negative firstedge ({})\n", i, face->firstedge);
-        if (face->numedges < 3)
-            fmt::print("warning: face {} has < 3 edges ({})\n", i, face->numedges);
-        if (face->firstedge + face->numedges > bsp->dsurfedges.size())
-            fmt::print("warning: face {} has edges out of range ({}..{} >= {})\n", i, face->firstedge,
-                face->firstedge + face->numedges - 1, bsp->dsurfedges.size());
-
-        for (int j = 0; j < 4; j++) {
-            used_lightstyles.insert(face->styles[j]);
-        }
-    }
-
-    /* edges */
-    for (i = 0; i < bsp->dedges.size(); i++) {
-        const bsp2_dedge_t *edge = &bsp->dedges[i];
-        int j;
-
-        for (j = 0; j < 2; j++) {
-            const uint32_t vertex = (*edge)[j];
-            if (vertex > bsp->dvertexes.size())
-                fmt::print("warning: edge {} has vertex {} out range "
-                           "({} >= {})\n",
-                    i, j, vertex, bsp->dvertexes.size());
-            referenced_vertexes.insert(vertex);
-        }
-    }
-
-    /* surfedges */
-    for (i = 0; i < bsp->dsurfedges.size(); i++) {
-        const int edgenum = bsp->dsurfedges[i];
-        if (!edgenum)
-            fmt::print("warning: surfedge {} has zero value!\n", i);
-        if (std::abs(edgenum) >= bsp->dedges.size())
-            fmt::print("warning: surfedge {} is out of range (abs({}) >= {})\n", i, edgenum, bsp->dedges.size());
-    }
-
-    /* marksurfaces */
-    for (i = 0; i < bsp->dleaffaces.size(); i++) {
-        const uint32_t surfnum = bsp->dleaffaces[i];
-        if (surfnum >= bsp->dfaces.size())
-            fmt::print("warning: marksurface {} is out of range ({} >= {})\n", i, surfnum, bsp->dfaces.size());
-    }
-
-    /* leafs */
-    for (i = 0; i < bsp->dleafs.size(); i++) {
-        const mleaf_t *leaf = &bsp->dleafs[i];
-        const uint32_t endmarksurface = leaf->firstmarksurface + leaf->nummarksurfaces;
-        if (endmarksurface > bsp->dleaffaces.size())
-            fmt::print("warning: leaf {} has marksurfaces out of range "
-                       "({}..{} >= {})\n",
-                i, leaf->firstmarksurface, endmarksurface - 1, bsp->dleaffaces.size());
-        if (leaf->visofs < -1)
-            fmt::print("warning: leaf {} has negative visdata offset ({})\n", i, leaf->visofs);
-        if (leaf->visofs >= bsp->dvis.bits.size())
-            fmt::print("warning: leaf {} has visdata offset out of range "
-                       "({} >= {})\n",
-                i, leaf->visofs, bsp->dvis.bits.size());
-    }
-
-    /* nodes */
-    for (i = 0; i < bsp->dnodes.size(); i++) {
-        const bsp2_dnode_t *node = &bsp->dnodes[i];
-        int j;
-
-        for (j = 0; j < 2; j++) {
-            const int32_t child = node->children[j];
-            if (child >= 0 && child >= bsp->dnodes.size())
-                fmt::print("warning: node {} has child {} (node) out of range "
-                           "({} >= {})\n",
-                    i, j, child, bsp->dnodes.size());
-            if (child < 0 && -child - 1 >= bsp->dleafs.size())
-                fmt::print("warning: node {} has child {} (leaf) out of range "
-                           "({} >= {})\n",
-                    i, j, -child - 1, bsp->dleafs.size());
-        }
-
-        if (node->children[0] == node->children[1]) {
-            fmt::print("warning: node {} has both children {}\n", i, node->children[0]);
-        }
-
-        referenced_planenums.insert(node->planenum);
-    }
-
-    /* clipnodes */
-    for (i = 0; i < bsp->dclipnodes.size(); i++) {
-        const bsp2_dclipnode_t *clipnode = &bsp->dclipnodes[i];
-
-        for (int j = 0; j < 2; j++) {
-            const int32_t child = clipnode->children[j];
-            if (child >= 0 && child >= bsp->dclipnodes.size())
-                fmt::print("warning: clipnode {} has child {} (clipnode) out of range "
-                           "({} >= {})\n",
-                    i, j, child, bsp->dclipnodes.size());
-            if (child < 0 && child < CONTENTS_MIN)
-                fmt::print("warning: clipnode {} has invalid contents ({}) for child {}\n", i, child, j);
-        }
-
-        if (clipnode->children[0] == clipnode->children[1]) {
-            fmt::print("warning: clipnode {} has both children {}\n", i, clipnode->children[0]);
-        }
-
-        referenced_planenums.insert(clipnode->planenum);
-    }
-
-    /* TODO: finish range checks, add "unreferenced" checks... */
-
-    /* unreferenced texinfo */
-    {
-        int num_unreferenced_texinfo = 0;
-        for (i = 0; i < bsp->texinfo.size(); i++) {
-            if (referenced_texinfos.find(i) == referenced_texinfos.end()) {
-                num_unreferenced_texinfo++;
-            }
-        }
-        if (num_unreferenced_texinfo)
-            fmt::print("warning: {} texinfos are unreferenced\n", num_unreferenced_texinfo);
-    }
-
-    /* unreferenced planes */
-    {
-        int num_unreferenced_planes = 0;
-        for (i = 0; i < bsp->dplanes.size(); i++) {
-            if (referenced_planenums.find(i) == referenced_planenums.end()) {
-                num_unreferenced_planes++;
-            }
-        }
-        if (num_unreferenced_planes)
-            fmt::print("warning: {} planes are unreferenced\n", num_unreferenced_planes);
-    }
-
-    /* unreferenced vertices */
-    {
-        int num_unreferenced_vertexes = 0;
-        for (i = 0; i < bsp->dvertexes.size(); i++) {
-            if (referenced_vertexes.find(i) == referenced_vertexes.end()) {
-                num_unreferenced_vertexes++;
-            }
-        }
-        if (num_unreferenced_vertexes)
-            fmt::print("warning: {} vertexes are unreferenced\n", num_unreferenced_vertexes);
-    }
-
-    /* tree balance */
-    PrintNodeHeights(bsp);
-
-    /* unique visofs's */
-    std::set<int32_t> visofs_set;
-    for (i = 0; i < bsp->dleafs.size(); i++) {
-        const mleaf_t *leaf = &bsp->dleafs[i];
-        if (leaf->visofs >= 0) {
-            visofs_set.insert(leaf->visofs);
-        }
-    }
-    fmt::print("{} unique visdata offsets for {} leafs\n", visofs_set.size(), bsp->dleafs.size());
-    fmt::print("{} visleafs in world model\n", bsp->dmodels[0].visleafs);
-
-    /* unique lightstyles */
-    fmt::print("{} lightstyles used:\n", used_lightstyles.size());
-    {
-        std::vector<uint8_t> v(used_lightstyles.begin(), used_lightstyles.end());
-        std::sort(v.begin(), v.end());
-        for (uint8_t style : v) {
-            fmt::print("\t{}\n", style);
-        }
-    }
-
-    fmt::print("world mins: {} maxs: {}\n", bsp->dmodels[0].mins, bsp->dmodels[0].maxs);
-}
-
-static void CompareBSPFiles(const mbsp_t &refBsp, const mbsp_t &bsp)
-{
-    fmt::print("comparing {} with {} faces\n", refBsp.dfaces.size(), bsp.dfaces.size());
-
-    const dmodelh2_t *world = BSP_GetWorldModel(&bsp);
-    const dmodelh2_t *refWorld = BSP_GetWorldModel(&refBsp);
-
-    // iterate through the refBsp world faces
-    for (int i = 0; i < refWorld->numfaces; i++) {
-        auto *refFace = BSP_GetFace(&refBsp, refWorld->firstface + i);
-        qvec3f refFaceCentroid = Face_Centroid(&refBsp, refFace);
-        qvec3d wantedNormal = Face_Normal(&refBsp, refFace);
-
-        // Search for a face in bsp touching refFaceCentroid.
-        auto *matchedFace = BSP_FindFaceAtPoint(&bsp, world, refFaceCentroid, wantedNormal);
-        if (matchedFace == nullptr) {
-            fmt::print("couldn't find a face at {} normal {}\n", refFaceCentroid, wantedNormal);
-        }
-
-        // TODO: run on some more complex maps
-        //        auto* refFaceSelfCheck = BSP_FindFaceAtPoint(refBsp, refWorld, wantedPoint, wantedNormal);
-        //        if (refFaceSelfCheck == refFace) {
-        //            matches ++;
-        //        } else {
-        //            fmt::print("not match at {} {} {} wanted {} got {}\n", wantedPoint[0], wantedPoint[1],
-        //            wantedPoint[2], refFace, refFaceSelfCheck); Face_DebugPrint(refBsp, refFace);
-        //            Face_DebugPrint(refBsp, refFaceSelfCheck); notmat++;
-        //        }
-    }
-}
-
 static void FindFaces(const mbsp_t *bsp, const qvec3d &pos, const qvec3d &normal)
 {
     for (int i = 0; i < bsp->dmodels.size(); ++i) {
@@ -496,7 +165,10 @@ static void FindLeaf(const mbsp_t *bsp, const qvec3d &pos)
         contentflags_t{leaf->contents}.to_string(bsp->loadversion->game));
 }
 
-// map file stuff
+// map file stuff; bsputil only needs the entities, so it keeps the brushes as raw text.
+// These are local to this file so they don't clash with the full ones in common/mapfile.hh.
+namespace
+{
 struct map_entity_t
 {
     entdict_t epairs;
@@ -591,6 +263,7 @@ map_file_t LoadMapOrEntFile(const fs::path &source)
 
     return map;
 }
+} // namespace
 
 struct planepoints : std::array<qvec3d, 3>
 {
@@ -693,6 +366,21 @@ struct planelist_t
     }
 };
 
+// true if the command line is a single operation that only replaces lumps, so the bsp doesn't need decoding
+static bool OnlyPatchesLumps(int argc, char **argv)
+{
+    if (argc < 3) {
+        return false;
+    }
+
+    // these two end processing once they're done, so nothing after them runs
+    if (!strcmp(argv[1], "--insert-bspx-lump") || !strcmp(argv[1], "--remove-bspx-lump")) {
+        return true;
+    }
+
+    return !strcmp(argv[1], "--replace-entities") && argc == 4;
+}
+
 int bsputil_main(int argc, char **argv)
 {
     logging::preinitialize();
@@ -703,9 +391,11 @@ int bsputil_main(int argc, char **argv)
     if (argc == 1) {
         printf(
             "usage: bsputil [--replace-entities] [--extract-entities] [--extract-textures] [--replace-textures f]\n"
-            "[--convert bsp29|bsp2|bsp2rmq|q2bsp] [--check] [--modelinfo]\n"
+            "[--convert bsp29|bsp2|bsp2rmq|q2bsp] [--check] [--check-only name,...] [--check-report file.json]\n"
+            "[--modelinfo]\n"
             "[--check] [--compare otherbsp] [--findfaces x y z nx ny nz] [--findleaf x y z] [--settexinfo facenum texinfonum]\n"
-            "[--decompile] [--decompile-geomonly] [--decompile-hull n]\n"
+            "[--compare-epsilon units] [--compare-lightmap-tolerance n] [--compare-report file.json]\n"
+            "[--decompile] [--decompile-geomonly] [--decompile-hull n] [--decompile-cache file]\n"
             "[--extract-bspx-lump lump_name output_file_name]\n"
             "[--insert-bspx-lump lump_name input_file_name]\n"
             "[--remove-bspx-lump lump_name] bspfile/mapfile\n");
@@ -723,7 +413,23 @@ int bsputil_main(int argc, char **argv)
 
     map_file_t map_file;
 
-    if (string_iequals(source.extension().string(), ".bsp")) {
+    // set by the --compare-* options, which must come before --compare
+    bsp_compare_options_t compare_options;
+    fs::path compare_report;
+
+    // set by the --check-* options, which must come before --check
+    std::vector<std::string> check_only;
+    fs::path check_report;
+    bool check_failed = false;
+
+    // set by --decompile-cache, which must come before --decompile
+    fs::path decompile_cache;
+
+    const bool source_is_bsp = string_iequals(source.extension().string(), ".bsp");
+
+    if (source_is_bsp && OnlyPatchesLumps(argc, argv)) {
+        // the operation rewrites lumps in the file directly; no need to load it
+    } else if (source_is_bsp) {
         LoadBSPFile(source, &bspdata);
 
         bspdata.version->game->init_filesystem(source, bsputil_options);
@@ -985,20 +691,22 @@ int bsputil_main(int argc, char **argv)
             fmt::print("updating {} with {}\n", source, argv[i]);
 
             // Load the .ent
-            if (std::holds_alternative<mbsp_t>(bspdata.bsp)) {
+            if (source_is_bsp) {
                 fs::data ent = fs::load(argv[i]);
 
                 if (!ent) {
                     Error("couldn't load ent file {}", argv[i]);
                 }
 
-                mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
+                bsp_patch_t patch;
+                patch.entities = std::string(reinterpret_cast<char *>(ent->data()), ent->size());
 
-                bsp.dentdata = std::string(reinterpret_cast<char *>(ent->data()), ent->size());
-
-                ConvertBSPFormat(&bspdata, bspdata.loadversion);
+                PatchBSPFile(source, patch);
 
-                WriteBSPFile(source, &bspdata);
+                // keep the loaded copy, if any, in sync for the operations after this one
+                if (mbsp_t *bsp = std::get_if<mbsp_t>(&bspdata.bsp)) {
+                    bsp->dentdata = std::move(*patch.entities);
+                }
             } else {
                 map_file_t ents = LoadMapOrEntFile(argv[i]);
 
@@ -1081,11 +789,44 @@ int bsputil_main(int argc, char **argv)
 
             fmt::print("comparing reference bsp {} with test bsp {}\n", refbspname, source);
 
-            mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
+            const mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
 
-            CompareBSPFiles(std::get<mbsp_t>(refbspdata.bsp), bsp);
+            const bsp_compare_result_t result = CompareBSPs(
+                std::get<mbsp_t>(refbspdata.bsp), refbspdata.bspx.entries, bsp, bspdata.bspx.entries, compare_options);
 
-            break;
+            PrintBSPComparison(result);
+
+            if (!compare_report.empty()) {
+                json report = result.to_json();
+                report["reference"] = refbspname.string();
+                report["bsp"] = source.string();
+
+                std::ofstream(compare_report) << report.dump(4);
+                fmt::print("wrote {}\n", compare_report);
+            }
+
+            return result.identical() ? 0 : 1;
+        } else if (!strcmp(argv[i], "--compare-epsilon")) {
+            i++;
+            if (!(i < argc - 1)) {
+                Error("--compare-epsilon requires an argument");
+            }
+
+            compare_options.position_epsilon = atof(argv[i]);
+        } else if (!strcmp(argv[i], "--compare-lightmap-tolerance")) {
+            i++;
+            if (!(i < argc - 1)) {
+                Error("--compare-lightmap-tolerance requires an argument");
+            }
+
+            compare_options.lightmap_tolerance = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--compare-report")) {
+            i++;
+            if (!(i < argc - 1)) {
+                Error("--compare-report requires an argument");
+            }
+
+            compare_report = argv[i];
         } else if (!strcmp(argv[i], "--convert")) {
             i++;
             if (!(i < argc - 1)) {
@@ -1167,9 +908,47 @@ int bsputil_main(int argc, char **argv)
         } else if (!strcmp(argv[i], "--check")) {
             printf("Beginning BSP data check...\n");
             mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
-            CheckBSPFile(&bsp);
-            CheckBSPFacesPlanar(&bsp);
+            const bsp_check_report_t report = CheckBSP(bsp, bspdata.bspx.entries, check_only);
+
+            PrintBSPCheckReport(report);
+
+            if (!check_report.empty()) {
+                json j = report.to_json();
+                j["bsp"] = source.string();
+
+                std::ofstream(check_report) << j.dump(4);
+                fmt::print("wrote {}\n", check_report);
+            }
+
+            check_failed |= !report.passed();
             printf("Done.\n");
+        } else if (!strcmp(argv[i], "--check-only")) {
+            i++;
+            if (!(i < argc - 1)) {
+                Error("--check-only requires an argument");
+            }
+
+            check_only.clear();
+
+            for (std::string_view names = argv[i]; !names.empty();) {
+                const size_t comma = names.find(',');
+                check_only.emplace_back(names.substr(0, comma));
+                names = (comma == std::string_view::npos) ? std::string_view{} : names.substr(comma + 1);
+            }
+        } else if (!strcmp(argv[i], "--check-report")) {
+            i++;
+            if (!(i < argc - 1)) {
+                Error("--check-report requires an argument");
+            }
+
+            check_report = argv[i];
+        } else if (!strcmp(argv[i], "--decompile-cache")) {
+            i++;
+            if (!(i < argc - 1)) {
+                Error("--decompile-cache requires an argument");
+            }
+
+            decompile_cache = argv[i];
         } else if (!strcmp(argv[i], "--modelinfo")) {
             mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
             PrintModelInfo(&bsp);
@@ -1262,6 +1041,12 @@ int bsputil_main(int argc, char **argv)
             options.ignoreBrushes = ignoreBrushes;
             options.hullnum = hullnum;
 
+            decomp_cache_t cache;
+            if (!decompile_cache.empty()) {
+                cache.load(decompile_cache);
+                options.cache = &cache;
+            }
+
             DecompileBSP(&bsp, options, f);
 
             f.close();
@@ -1269,6 +1054,11 @@ int bsputil_main(int argc, char **argv)
             if (!f)
                 Error("{}", strerror(errno));
 
+            if (!decompile_cache.empty()) {
+                fmt::print("reused {} of {} cached leafs/brushes\n", cache.hits(), cache.hits() + cache.misses());
+                cache.save(decompile_cache);
+            }
+
             printf("done!\n");
             return 0;
         } else if (!strcmp(argv[i], "--extract-bspx-lump")) {
@@ -1316,12 +1106,11 @@ int bsputil_main(int argc, char **argv)
 
             // put bspx lump
             fmt::print("-> inserting BSPX lump {} from {} ({} bytes)...", lump_name, input_file_name, data->size());
-            auto &entries = bspdata.bspx.entries;
-            entries[lump_name] = std::move(*data);
+            bsp_patch_t patch;
+            patch.bspx[lump_name] = std::move(*data);
 
             // Overwrite source bsp!
-            ConvertBSPFormat(&bspdata, bspdata.loadversion);
-            WriteBSPFile(source, &bspdata);
+            PatchBSPFile(source, patch);
 
             fmt::print("done.\n");
             return 0;
@@ -1336,16 +1125,11 @@ int bsputil_main(int argc, char **argv)
             // remove bspx lump
             fmt::print("-> removing bspx lump {}\n", lump_name);
 
-            auto &entries = bspdata.bspx.entries;
-            auto it = entries.find(lump_name);
-            if (it == entries.end()) {
-                FError("couldn't find bspx lump {}", lump_name);
-            }
-            entries.erase(it);
+            bsp_patch_t patch;
+            patch.bspx[lump_name] = std::nullopt;
 
             // Overwrite source bsp!
-            ConvertBSPFormat(&bspdata, bspdata.loadversion);
-            WriteBSPFile(source, &bspdata);
+            PatchBSPFile(source, patch);
 
             fmt::print("done.\n");
             return 0;
@@ -1356,5 +1140,5 @@ int bsputil_main(int argc, char **argv)
 
     printf("---------------------\n");
 
-    return 0;
+    return check_failed ? 1 : 0;
 }
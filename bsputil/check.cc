@@ -0,0 +1,966 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <bsputil/check.hh>
+
+#include <common/bsputils.hh>
+#include <common/bspxfile.hh>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include <tbb/parallel_for.h>
+
+namespace
+{
+/*
+ * Runs f(i, issues) for every i in [0, count) in parallel, then adds the
+ * issues to `result` in index order, so output doesn't depend on scheduling.
+ */
+template<typename F>
+void ParallelCheck(bsp_check_result_t &result, size_t count, F &&f)
+{
+    std::mutex lock;
+    std::vector<std::pair<size_t, bsp_check_issues_t>> chunks;
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, count, 1024), [&](const tbb::blocked_range<size_t> &range) {
+        bsp_check_issues_t issues;
+
+        for (size_t i = range.begin(); i < range.end(); i++) {
+            f(i, issues);
+        }
+
+        if (!issues.list.empty()) {
+            std::unique_lock l(lock);
+            chunks.emplace_back(range.begin(), std::move(issues));
+        }
+    });
+
+    std::sort(chunks.begin(), chunks.end(), [](auto &a, auto &b) { return a.first < b.first; });
+
+    for (auto &chunk : chunks) {
+        result.add(std::move(chunk.second));
+    }
+}
+
+/*
+ * Quick hack to check verticies of faces lie on the correct plane
+ */
+constexpr vec_t PLANE_ON_EPSILON = 0.01;
+
+void CheckFaces(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+
+    ParallelCheck(result, bsp.dfaces.size(), [&](size_t i, bsp_check_issues_t &issues) {
+        const mface_t &face = bsp.dfaces[i];
+
+        /* texinfo bounds check */
+        if (face.texinfo < 0 || face.texinfo >= bsp.texinfo.size())
+            issues.error("face {} has texinfo out of range ({}, {} texinfos)", i, face.texinfo, bsp.texinfo.size());
+
+        /* lightofs check */
+        if (face.lightofs < -1)
+            issues.error("face {} has negative light offset ({})", i, face.lightofs);
+        if (face.lightofs >= static_cast<int64_t>(bsp.dlightdata.size()))
+            issues.error("face {} has light offset out of range ({} >= {})", i, face.lightofs, bsp.dlightdata.size());
+
+        /* edge check */
+        if (face.numedges < 3)
+            issues.error("face {} has < 3 edges ({})", i, face.numedges);
+
+        const bool edges_valid = face.firstedge >= 0 && face.numedges >= 0 &&
+                                 face.firstedge + static_cast<size_t>(face.numedges) <= bsp.dsurfedges.size();
+
+        if (!edges_valid)
+            issues.error("face {} has edges out of range ({}..{}, {} surfedges)", i, face.firstedge,
+                face.firstedge + face.numedges - 1, bsp.dsurfedges.size());
+
+        /* planenum bounds check */
+        if (face.planenum < 0 || face.planenum >= bsp.dplanes.size()) {
+            issues.error("face {} has planenum out of range ({}, {} planes)", i, face.planenum, bsp.dplanes.size());
+            return;
+        }
+
+        if (!edges_valid) {
+            return;
+        }
+
+        /* points on plane */
+        dplane_t plane = bsp.dplanes[face.planenum];
+
+        if (face.side) {
+            plane = -plane;
+        }
+
+        for (int32_t j = 0; j < face.numedges; j++) {
+            const int edgenum = bsp.dsurfedges[face.firstedge + j];
+
+            if (std::abs(edgenum) >= bsp.dedges.size()) {
+                // reported by the edges check
+                continue;
+            }
+
+            const uint32_t vertnum = (edgenum >= 0) ? bsp.dedges[edgenum][0] : bsp.dedges[-edgenum][1];
+
+            if (vertnum >= bsp.dvertexes.size()) {
+                continue;
+            }
+
+            const float dist = plane.distance_to(bsp.dvertexes[vertnum]);
+
+            if (dist < -PLANE_ON_EPSILON || dist > PLANE_ON_EPSILON)
+                issues.warning("face {}, point {} off plane by {}", i, j, dist);
+        }
+    });
+}
+
+void CheckEdges(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+
+    ParallelCheck(result, bsp.dedges.size(), [&](size_t i, bsp_check_issues_t &issues) {
+        for (int j = 0; j < 2; j++) {
+            const uint32_t vertex = bsp.dedges[i][j];
+
+            if (vertex >= bsp.dvertexes.size())
+                issues.error("edge {} has vertex {} out of range ({} >= {})", i, j, vertex, bsp.dvertexes.size());
+        }
+    });
+
+    ParallelCheck(result, bsp.dsurfedges.size(), [&](size_t i, bsp_check_issues_t &issues) {
+        const int edgenum = bsp.dsurfedges[i];
+
+        if (!edgenum)
+            issues.warning("surfedge {} has zero value", i);
+        if (std::abs(edgenum) >= bsp.dedges.size())
+            issues.error("surfedge {} is out of range (abs({}) >= {})", i, edgenum, bsp.dedges.size());
+    });
+}
+
+void CheckLeafs(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+
+    ParallelCheck(result, bsp.dleaffaces.size(), [&](size_t i, bsp_check_issues_t &issues) {
+        if (bsp.dleaffaces[i] >= bsp.dfaces.size())
+            issues.error("marksurface {} is out of range ({} >= {})", i, bsp.dleaffaces[i], bsp.dfaces.size());
+    });
+
+    ParallelCheck(result, bsp.dleafs.size(), [&](size_t i, bsp_check_issues_t &issues) {
+        const mleaf_t &leaf = bsp.dleafs[i];
+        const uint64_t endmarksurface = static_cast<uint64_t>(leaf.firstmarksurface) + leaf.nummarksurfaces;
+        const uint64_t endleafbrush = static_cast<uint64_t>(leaf.firstleafbrush) + leaf.numleafbrushes;
+
+        if (endmarksurface > bsp.dleaffaces.size())
+            issues.error("leaf {} has marksurfaces out of range ({}..{} >= {})", i, leaf.firstmarksurface,
+                endmarksurface - 1, bsp.dleaffaces.size());
+        if (endleafbrush > bsp.dleafbrushes.size())
+            issues.error("leaf {} has leafbrushes out of range ({}..{} >= {})", i, leaf.firstleafbrush,
+                endleafbrush - 1, bsp.dleafbrushes.size());
+
+        // engines ignore visofs when there's no visdata at all
+        if (bsp.loadversion->game->id != GAME_QUAKE_II && !bsp.dvis.bits.empty()) {
+            if (leaf.visofs < -1)
+                issues.error("leaf {} has negative visdata offset ({})", i, leaf.visofs);
+            if (leaf.visofs >= static_cast<int64_t>(bsp.dvis.bits.size()))
+                issues.error(
+                    "leaf {} has visdata offset out of range ({} >= {})", i, leaf.visofs, bsp.dvis.bits.size());
+        }
+    });
+}
+
+void CheckNodes(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+
+    ParallelCheck(result, bsp.dnodes.size(), [&](size_t i, bsp_check_issues_t &issues) {
+        const bsp2_dnode_t &node = bsp.dnodes[i];
+
+        for (int j = 0; j < 2; j++) {
+            const int32_t child = node.children[j];
+
+            if (child >= 0 && child >= bsp.dnodes.size())
+                issues.error("node {} has child {} (node) out of range ({} >= {})", i, j, child, bsp.dnodes.size());
+            if (child < 0 && -child - 1 >= bsp.dleafs.size())
+                issues.error(
+                    "node {} has child {} (leaf) out of range ({} >= {})", i, j, -child - 1, bsp.dleafs.size());
+        }
+
+        if (node.children[0] == node.children[1])
+            issues.warning("node {} has both children {}", i, node.children[0]);
+        if (node.planenum < 0 || node.planenum >= bsp.dplanes.size())
+            issues.error("node {} has planenum out of range ({}, {} planes)", i, node.planenum, bsp.dplanes.size());
+        if (static_cast<uint64_t>(node.firstface) + node.numfaces > bsp.dfaces.size())
+            issues.error("node {} has faces out of range ({}..{} >= {})", i, node.firstface,
+                static_cast<uint64_t>(node.firstface) + node.numfaces - 1, bsp.dfaces.size());
+    });
+
+    ParallelCheck(result, bsp.dclipnodes.size(), [&](size_t i, bsp_check_issues_t &issues) {
+        const bsp2_dclipnode_t &clipnode = bsp.dclipnodes[i];
+
+        for (int j = 0; j < 2; j++) {
+            const int32_t child = clipnode.children[j];
+
+            if (child >= 0 && child >= bsp.dclipnodes.size())
+                issues.error("clipnode {} has child {} (clipnode) out of range ({} >= {})", i, j, child,
+                    bsp.dclipnodes.size());
+            if (child < 0 && child < CONTENTS_MIN)
+                issues.error("clipnode {} has invalid contents ({}) for child {}", i, child, j);
+        }
+
+        if (clipnode.children[0] == clipnode.children[1])
+            issues.warning("clipnode {} has both children {}", i, clipnode.children[0]);
+        if (clipnode.planenum < 0 || clipnode.planenum >= bsp.dplanes.size())
+            issues.error("clipnode {} has planenum out of range ({}, {} planes)", i, clipnode.planenum,
+                bsp.dplanes.size());
+    });
+}
+
+/*
+ * Walks every model's trees from its headnodes. Each node should be reached
+ * exactly once (a node reached twice is a shared subtree or a cycle), and
+ * every node and leaf should be reached by some model.
+ */
+void CheckReachability(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+    bsp_check_issues_t issues;
+
+    std::vector<uint8_t> node_reached(bsp.dnodes.size()), leaf_reached(bsp.dleafs.size());
+    std::vector<uint8_t> clipnode_reached(bsp.dclipnodes.size());
+    std::vector<int32_t> face_model(bsp.dfaces.size(), -1);
+    const size_t num_hulls = bsp.loadversion->game->get_hull_sizes().size();
+
+    for (size_t m = 0; m < bsp.dmodels.size(); m++) {
+        const dmodelh2_t &model = bsp.dmodels[m];
+        std::vector<int32_t> stack{model.headnode[0]};
+
+        while (!stack.empty()) {
+            const int32_t nodenum = stack.back();
+            stack.pop_back();
+
+            if (nodenum < 0) {
+                if (-nodenum - 1 < bsp.dleafs.size()) {
+                    leaf_reached[-nodenum - 1] = true;
+                }
+                continue;
+            }
+            if (nodenum >= bsp.dnodes.size()) {
+                issues.error("model {} reaches node {}, out of range", m, nodenum);
+                continue;
+            }
+            if (node_reached[nodenum]) {
+                issues.error("model {} reaches node {}, which was already reached", m, nodenum);
+                continue;
+            }
+
+            node_reached[nodenum] = true;
+
+            const bsp2_dnode_t &node = bsp.dnodes[nodenum];
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+
+        // clipping hulls can legitimately share clipnodes, so only track reachability
+        for (size_t h = 1; h < std::min(num_hulls, model.headnode.size()); h++) {
+            std::vector<int32_t> clipstack{model.headnode[h]};
+
+            while (!clipstack.empty()) {
+                const int32_t clipnum = clipstack.back();
+                clipstack.pop_back();
+
+                if (clipnum < 0 || clipnum >= bsp.dclipnodes.size() || clipnode_reached[clipnum]) {
+                    continue;
+                }
+
+                clipnode_reached[clipnum] = true;
+                clipstack.push_back(bsp.dclipnodes[clipnum].children[0]);
+                clipstack.push_back(bsp.dclipnodes[clipnum].children[1]);
+            }
+        }
+
+        for (int32_t f = model.firstface; f < model.firstface + model.numfaces; f++) {
+            if (f < 0 || f >= bsp.dfaces.size()) {
+                issues.error("model {} has faces out of range ({}..{} >= {})", m, model.firstface,
+                    model.firstface + model.numfaces - 1, bsp.dfaces.size());
+                break;
+            }
+            if (face_model[f] != -1) {
+                issues.error("face {} belongs to both model {} and model {}", f, face_model[f], m);
+            }
+            face_model[f] = m;
+        }
+    }
+
+    const size_t unreached_nodes = std::count(node_reached.begin(), node_reached.end(), 0);
+    // leaf 0 is the shared solid leaf, which nodes don't need to point at
+    const size_t unreached_leafs =
+        std::count(leaf_reached.begin() + std::min<size_t>(1, leaf_reached.size()), leaf_reached.end(), 0);
+    const size_t unreached_clipnodes = std::count(clipnode_reached.begin(), clipnode_reached.end(), 0);
+    const size_t modelless_faces = std::count(face_model.begin(), face_model.end(), -1);
+
+    if (unreached_nodes)
+        issues.warning("{} nodes are unreachable from any model", unreached_nodes);
+    if (unreached_leafs)
+        issues.warning("{} leafs are unreachable from any model", unreached_leafs);
+    if (unreached_clipnodes)
+        issues.warning("{} clipnodes are unreachable from any model", unreached_clipnodes);
+    if (modelless_faces)
+        issues.warning("{} faces don't belong to any model", modelless_faces);
+
+    result.add(std::move(issues));
+}
+
+void CheckUnreferenced(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+    bsp_check_issues_t issues;
+
+    auto mark = [](std::vector<uint8_t> &referenced, int64_t index) {
+        if (index >= 0 && index < referenced.size()) {
+            referenced[index] = true;
+        }
+    };
+
+    std::vector<uint8_t> texinfos(bsp.texinfo.size()), planes(bsp.dplanes.size());
+    std::vector<uint8_t> vertexes(bsp.dvertexes.size()), edges(bsp.dedges.size());
+    std::vector<uint8_t> leaffaces(bsp.dleaffaces.size());
+
+    for (auto &face : bsp.dfaces) {
+        mark(texinfos, face.texinfo);
+        mark(planes, face.planenum);
+    }
+    for (auto &node : bsp.dnodes) {
+        mark(planes, node.planenum);
+    }
+    for (auto &clipnode : bsp.dclipnodes) {
+        mark(planes, clipnode.planenum);
+    }
+    for (auto &side : bsp.dbrushsides) {
+        mark(planes, side.planenum);
+        mark(texinfos, side.texinfo);
+    }
+    for (auto &texinfo : bsp.texinfo) {
+        // animation chains
+        mark(texinfos, texinfo.nexttexinfo);
+    }
+    for (int32_t surfedge : bsp.dsurfedges) {
+        mark(edges, std::abs(surfedge));
+    }
+    for (size_t i = 0; i < bsp.dedges.size(); i++) {
+        if (edges[i]) {
+            mark(vertexes, bsp.dedges[i][0]);
+            mark(vertexes, bsp.dedges[i][1]);
+        }
+    }
+    for (auto &leaf : bsp.dleafs) {
+        for (uint64_t i = leaf.firstmarksurface; i < std::min<uint64_t>(leaf.firstmarksurface + leaf.nummarksurfaces,
+                                                         leaffaces.size());
+             i++) {
+            leaffaces[i] = true;
+        }
+    }
+
+    const std::pair<const char *, const std::vector<uint8_t> *> lumps[] = {{"texinfos", &texinfos},
+        {"planes", &planes}, {"vertexes", &vertexes}, {"edges", &edges}, {"marksurfaces", &leaffaces}};
+
+    for (auto &[name, referenced] : lumps) {
+        // edge 0 is never referenced, since surfedges can't be -0
+        const size_t first = (referenced == &edges) ? 1 : 0;
+        const size_t count =
+            std::count(referenced->begin() + std::min(first, referenced->size()), referenced->end(), 0);
+
+        result.stats[name] = count;
+
+        if (count)
+            issues.warning("{} {} are unreferenced", count, name);
+    }
+
+    result.add(std::move(issues));
+}
+
+// lightmap extents as the engine sees them, or nullopt if they can't be
+// determined from the face alone
+std::optional<std::pair<int64_t, int64_t>> Face_LightmapRange(const bsp_check_context_t &ctx, size_t facenum,
+    const std::vector<bspx_decoupled_lm_perface> &decoupled, const std::vector<uint8_t> *lmshift)
+{
+    const mbsp_t &bsp = ctx.bsp;
+    const mface_t &face = bsp.dfaces[facenum];
+
+    int numstyles = 0;
+
+    while (numstyles < MAXLIGHTMAPS && face.styles[numstyles] != INVALID_LIGHTSTYLE_OLD) {
+        numstyles++;
+    }
+
+    int64_t offset = face.lightofs;
+    int64_t samples;
+
+    if (!decoupled.empty()) {
+        offset = decoupled[facenum].offset;
+        samples = static_cast<int64_t>(decoupled[facenum].lmwidth) * decoupled[facenum].lmheight;
+    } else {
+        const float scale = lmshift ? static_cast<float>(1 << (*lmshift)[facenum]) : LMSCALE_DEFAULT;
+        samples = faceextents_t(face, bsp, scale).numsamples();
+    }
+
+    if (offset < 0 || !numstyles) {
+        return std::nullopt;
+    }
+
+    const int64_t bytes_per_sample = bsp.loadversion->game->has_rgb_lightmap ? 3 : 1;
+
+    return std::make_pair(offset, offset + (samples * numstyles * bytes_per_sample));
+}
+
+/*
+ * Every face's lightmap should lie within the lighting lump, and no two
+ * faces' lightmaps should partially overlap (identical ranges are fine;
+ * that's a shared lightmap).
+ */
+void CheckLightmapOffsets(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+
+    if (bsp.dlightdata.empty()) {
+        result.stats["skipped"] = "no lightdata";
+        return;
+    }
+
+    for (const char *lump : {"LMOFFSET", "LMSTYLE", "LMSTYLE16"}) {
+        if (ctx.bspx.count(lump)) {
+            result.stats["skipped"] = fmt::format("lightmaps located through the {} lump", lump);
+            return;
+        }
+    }
+
+    std::vector<bspx_decoupled_lm_perface> decoupled;
+
+    if (auto it = ctx.bspx.find("DECOUPLED_LM"); it != ctx.bspx.end()) {
+        if (it->second.size() != bsp.dfaces.size() * sizeof(bspx_decoupled_lm_perface)) {
+            result.stats["skipped"] = "DECOUPLED_LM lump has the wrong size";
+            return;
+        }
+
+        imemstream stream(it->second.data(), it->second.size());
+        stream >> endianness<std::endian::little>;
+        decoupled.resize(bsp.dfaces.size());
+
+        for (auto &face : decoupled) {
+            stream >= face;
+        }
+    }
+
+    const std::vector<uint8_t> *lmshift = nullptr;
+
+    if (auto it = ctx.bspx.find("LMSHIFT"); it != ctx.bspx.end() && it->second.size() == bsp.dfaces.size()) {
+        lmshift = &it->second;
+    }
+
+    struct range_t
+    {
+        int64_t start, end;
+        size_t face;
+    };
+
+    std::vector<std::optional<range_t>> face_ranges(bsp.dfaces.size());
+
+    ParallelCheck(result, bsp.dfaces.size(), [&](size_t i, bsp_check_issues_t &issues) {
+        const mface_t &face = bsp.dfaces[i];
+
+        if (face.texinfo < 0 || face.texinfo >= bsp.texinfo.size() || face.planenum < 0 ||
+            face.planenum >= bsp.dplanes.size() || face.numedges < 3 ||
+            face.firstedge + static_cast<size_t>(face.numedges) > bsp.dsurfedges.size()) {
+            // reported by the faces check
+            return;
+        }
+
+        auto range = Face_LightmapRange(ctx, i, decoupled, lmshift);
+
+        if (!range) {
+            return;
+        }
+
+        if (range->second > static_cast<int64_t>(bsp.dlightdata.size())) {
+            issues.error("face {} lightmap runs past the end of lightdata ({}..{} >= {})", i, range->first,
+                range->second - 1, bsp.dlightdata.size());
+        }
+
+        face_ranges[i] = range_t{range->first, range->second, i};
+    });
+
+    std::vector<range_t> ranges;
+
+    for (auto &range : face_ranges) {
+        if (range) {
+            ranges.push_back(*range);
+        }
+    }
+
+    std::sort(ranges.begin(), ranges.end(),
+        [](const range_t &a, const range_t &b) { return std::tie(a.start, a.end) < std::tie(b.start, b.end); });
+
+    bsp_check_issues_t issues;
+    size_t shared = 0;
+    int64_t used = 0, covered_end = 0;
+
+    for (size_t i = 0; i < ranges.size(); i++) {
+        const range_t &range = ranges[i];
+
+        if (i > 0 && range.start == ranges[i - 1].start && range.end == ranges[i - 1].end) {
+            shared++;
+            continue;
+        }
+
+        if (range.start < covered_end) {
+            issues.error("face {} lightmap ({}..{}) overlaps another face's", range.face, range.start, range.end - 1);
+        }
+
+        used += range.end - std::max(range.start, covered_end);
+        covered_end = std::max(covered_end, range.end);
+    }
+
+    result.stats["faces_with_lightmaps"] = ranges.size();
+    result.stats["shared_lightmaps"] = shared;
+    result.stats["unused_lightdata_bytes"] = static_cast<int64_t>(bsp.dlightdata.size()) - std::max<int64_t>(used, 0);
+
+    result.add(std::move(issues));
+}
+
+// decompresses one row, reporting what's wrong with it if it's malformed
+std::optional<std::string> ValidateVisRow(const std::vector<uint8_t> &bits, int64_t offset, size_t row_size)
+{
+    if (offset < 0 || offset >= bits.size()) {
+        return fmt::format("offset {} out of range ({} bytes)", offset, bits.size());
+    }
+
+    size_t in = offset, out = 0;
+
+    while (out < row_size) {
+        if (in >= bits.size()) {
+            return fmt::format("input underrun (decompressed {} of {} bytes)", out, row_size);
+        }
+
+        if (bits[in++]) {
+            out++;
+            continue;
+        }
+
+        if (in >= bits.size()) {
+            return fmt::format("input underrun in zero run (decompressed {} of {} bytes)", out, row_size);
+        }
+
+        const uint8_t run = bits[in++];
+
+        if (!run) {
+            return std::string("zero length run");
+        }
+
+        out += run;
+
+        if (out > row_size) {
+            return fmt::format("output overrun ({} > {} bytes)", out, row_size);
+        }
+    }
+
+    return std::nullopt;
+}
+
+void CheckVisdata(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+
+    if (bsp.dvis.bits.empty()) {
+        result.stats["skipped"] = "no visdata";
+        return;
+    }
+
+    const size_t row_size = DecompressedVisSize(&bsp);
+
+    // (what owns the row, row offset)
+    std::vector<std::pair<std::string, int64_t>> rows;
+
+    if (bsp.loadversion->game->id == GAME_QUAKE_II) {
+        int32_t max_cluster = -1;
+
+        for (auto &leaf : bsp.dleafs) {
+            max_cluster = std::max(max_cluster, leaf.cluster);
+        }
+
+        if (max_cluster >= static_cast<int32_t>(bsp.dvis.bit_offsets.size())) {
+            bsp_check_issues_t issues;
+            issues.error("leafs use {} clusters, but visdata has {}", max_cluster + 1, bsp.dvis.bit_offsets.size());
+            result.add(std::move(issues));
+        }
+
+        for (size_t c = 0; c < bsp.dvis.bit_offsets.size(); c++) {
+            rows.emplace_back(fmt::format("cluster {} pvs", c), bsp.dvis.get_bit_offset(VIS_PVS, c));
+            rows.emplace_back(fmt::format("cluster {} phs", c), bsp.dvis.get_bit_offset(VIS_PHS, c));
+        }
+    } else {
+        std::map<int32_t, size_t> visofs_leaf;
+
+        for (size_t i = 0; i < bsp.dleafs.size(); i++) {
+            if (bsp.dleafs[i].visofs >= 0) {
+                visofs_leaf.emplace(bsp.dleafs[i].visofs, i);
+            }
+        }
+
+        for (auto &[visofs, leaf] : visofs_leaf) {
+            rows.emplace_back(fmt::format("leaf {}", leaf), visofs);
+        }
+
+        result.stats["unique_visofs"] = visofs_leaf.size();
+        result.stats["visleafs"] = bsp.dmodels.empty() ? 0 : bsp.dmodels[0].visleafs;
+    }
+
+    result.stats["rows"] = rows.size();
+    result.stats["row_bytes"] = row_size;
+
+    ParallelCheck(result, rows.size(), [&](size_t i, bsp_check_issues_t &issues) {
+        if (auto error = ValidateVisRow(bsp.dvis.bits, rows[i].second, row_size)) {
+            issues.error("{} visdata: {}", rows[i].first, *error);
+        }
+    });
+}
+
+/*
+ * Sizes of the BSPX lumps that have a fixed size per face or per byte of
+ * lightdata, and a parse of the variable-size ones.
+ */
+void CheckBSPX(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+    bsp_check_issues_t issues;
+
+    const size_t numfaces = bsp.dfaces.size();
+
+    const std::map<std::string, size_t> expected_sizes = {
+        {"RGBLIGHTING", bsp.dlightdata.size() * 3},
+        {"LIGHTINGDIR", bsp.dlightdata.size() * 3},
+        {"LMSHIFT", numfaces},
+        {"LMOFFSET", numfaces * sizeof(int32_t)},
+        {"DECOUPLED_LM", numfaces * sizeof(bspx_decoupled_lm_perface)},
+    };
+
+    json lumps = json::object();
+
+    for (auto &[name, data] : ctx.bspx) {
+        lumps[name] = data.size();
+
+        if (auto it = expected_sizes.find(name); it != expected_sizes.end()) {
+            // RGBLIGHTING/LIGHTINGDIR are 3 bytes per mono luxel, so only apply to mono games
+            if ((name == "RGBLIGHTING" || name == "LIGHTINGDIR") && bsp.loadversion->game->has_rgb_lightmap) {
+                continue;
+            }
+            if (data.size() != it->second) {
+                issues.error("BSPX lump {} is {} bytes, expected {}", name, data.size(), it->second);
+            }
+        } else if (name == "LMSTYLE" || name == "LMSTYLE16") {
+            const size_t per_style = (name == "LMSTYLE") ? 1 : 2;
+
+            if (!numfaces || data.size() % (numfaces * per_style)) {
+                issues.error("BSPX lump {} is {} bytes, not a multiple of {} faces", name, data.size(), numfaces);
+            }
+        } else if (name == "BRUSHLIST") {
+            imemstream stream(data.data(), data.size());
+            stream >> endianness<std::endian::little>;
+
+            while (stream.tellg() < static_cast<std::streamoff>(data.size())) {
+                bspxbrushes_permodel model;
+
+                if (!(stream >= model)) {
+                    issues.error("BSPX lump BRUSHLIST is truncated");
+                    break;
+                }
+
+                for (int32_t b = 0; b < model.numbrushes && stream; b++) {
+                    bspxbrushes_perbrush brush;
+                    stream >= brush;
+
+                    for (int32_t f = 0; f < brush.numfaces && stream; f++) {
+                        bspxbrushes_perface face;
+                        stream >= face;
+                    }
+                }
+
+                if (!stream) {
+                    issues.error("BSPX lump BRUSHLIST is truncated in model {}", model.modelnum);
+                    break;
+                }
+                if (model.modelnum < 0 || model.modelnum >= bsp.dmodels.size()) {
+                    issues.error("BSPX lump BRUSHLIST references model {} out of range", model.modelnum);
+                }
+            }
+        }
+    }
+
+    result.stats["lumps"] = std::move(lumps);
+    result.add(std::move(issues));
+}
+
+/*
+ * Per model, the number of leafs at each depth, and the height (longest
+ * path to a leaf) of the nodes at the top few levels, which shows how well
+ * the tree is balanced.
+ */
+void CheckTree(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+    constexpr int TOP_LEVELS = 3;
+
+    json models = json::array();
+    std::vector<int32_t> heights(bsp.dnodes.size(), -1);
+
+    for (size_t m = 0; m < bsp.dmodels.size(); m++) {
+        const int32_t headnode = bsp.dmodels[m].headnode[0];
+
+        if (headnode < 0 || headnode >= bsp.dnodes.size()) {
+            continue;
+        }
+
+        // iterative post-order walk; (node, depth, children done)
+        std::vector<std::tuple<int32_t, int32_t, bool>> stack{{headnode, 0, false}};
+        std::map<int32_t, size_t> leaf_depths;
+        int32_t max_depth = 0;
+
+        while (!stack.empty()) {
+            auto [nodenum, depth, children_done] = stack.back();
+            stack.pop_back();
+
+            if (nodenum < 0) {
+                leaf_depths[depth]++;
+                max_depth = std::max(max_depth, depth);
+                continue;
+            }
+            if (nodenum >= bsp.dnodes.size() || (!children_done && heights[nodenum] != -1)) {
+                // out of range or already visited; reported by other checks
+                continue;
+            }
+
+            const bsp2_dnode_t &node = bsp.dnodes[nodenum];
+
+            if (!children_done) {
+                // mark as in progress, so a cycle can't loop forever
+                heights[nodenum] = 0;
+                stack.emplace_back(nodenum, depth, true);
+                stack.emplace_back(node.children[0], depth + 1, false);
+                stack.emplace_back(node.children[1], depth + 1, false);
+                continue;
+            }
+
+            // leafs have a height of 0
+            int32_t height = 0;
+
+            for (int32_t child : node.children) {
+                if (child >= 0 && child < bsp.dnodes.size()) {
+                    height = std::max(height, heights[child]);
+                }
+            }
+
+            heights[nodenum] = height + 1;
+        }
+
+        json levels = json::array();
+        std::vector<int32_t> level{headnode};
+
+        for (int l = 0; l <= TOP_LEVELS && !level.empty(); l++) {
+            std::vector<int32_t> next;
+            json level_heights = json::array();
+
+            for (int32_t nodenum : level) {
+                level_heights.push_back(heights[nodenum]);
+
+                for (int32_t child : bsp.dnodes[nodenum].children) {
+                    if (child >= 0 && child < bsp.dnodes.size()) {
+                        next.push_back(child);
+                    }
+                }
+            }
+
+            levels.push_back(std::move(level_heights));
+            level = std::move(next);
+        }
+
+        json histogram = json::object();
+
+        for (auto &[depth, count] : leaf_depths) {
+            histogram[std::to_string(depth)] = count;
+        }
+
+        json model = json::object();
+        model["model"] = m;
+        model["max_depth"] = max_depth;
+        model["leaf_depths"] = std::move(histogram);
+        model["node_heights"] = std::move(levels);
+        models.push_back(std::move(model));
+    }
+
+    result.stats["models"] = std::move(models);
+}
+
+void CheckInfo(const bsp_check_context_t &ctx, bsp_check_result_t &result)
+{
+    const mbsp_t &bsp = ctx.bsp;
+    std::vector<uint8_t> styles_used(256);
+
+    for (auto &face : bsp.dfaces) {
+        for (uint8_t style : face.styles) {
+            styles_used[style] = true;
+        }
+    }
+
+    json styles = json::array();
+
+    for (int i = 0; i < 256; i++) {
+        if (styles_used[i]) {
+            styles.push_back(i);
+        }
+    }
+
+    result.stats["lightstyles"] = std::move(styles);
+
+    if (!bsp.dmodels.empty()) {
+        result.stats["world_mins"] = bsp.dmodels[0].mins;
+        result.stats["world_maxs"] = bsp.dmodels[0].maxs;
+    }
+}
+} // namespace
+
+void bsp_check_result_t::add(bsp_check_issues_t &&new_issues)
+{
+    for (auto &issue : new_issues.list) {
+        if (issue.severity == bsp_check_severity_t::error) {
+            errors++;
+        } else {
+            warnings++;
+        }
+
+        if (issues.size() < MAX_ISSUES) {
+            issues.push_back(std::move(issue));
+        }
+    }
+}
+
+std::vector<bsp_check_t> &BSPChecks()
+{
+    static std::vector<bsp_check_t> checks{
+        {"faces", "face index ranges, and vertexes lying on the face's plane", CheckFaces},
+        {"edges", "edge and surfedge index ranges", CheckEdges},
+        {"leafs", "leaf index ranges", CheckLeafs},
+        {"nodes", "node and clipnode index ranges", CheckNodes},
+        {"reachability", "every node, leaf and face is reached exactly once from the models", CheckReachability},
+        {"unreferenced", "texinfos, planes, vertexes, edges and marksurfaces nothing refers to", CheckUnreferenced},
+        {"lightofs", "face lightmaps lie within lightdata and don't overlap", CheckLightmapOffsets},
+        {"visdata", "every PVS/PHS row decompresses to the right size", CheckVisdata},
+        {"bspx", "BSPX lump sizes and structure", CheckBSPX},
+        {"tree", "node depth histograms and balance", CheckTree},
+        {"info", "lightstyles and world bounds", CheckInfo},
+    };
+
+    return checks;
+}
+
+bool bsp_check_report_t::passed() const
+{
+    return std::all_of(results.begin(), results.end(), [](const bsp_check_result_t &r) { return !r.errors; });
+}
+
+json bsp_check_report_t::to_json() const
+{
+    json j = json::object();
+    json checks = json::object();
+
+    for (auto &result : results) {
+        json check = json::object();
+        check["errors"] = result.errors;
+        check["warnings"] = result.warnings;
+
+        json issues = json::array();
+
+        for (auto &issue : result.issues) {
+            issues.push_back({{"severity", issue.severity == bsp_check_severity_t::error ? "error" : "warning"},
+                {"message", issue.message}});
+        }
+
+        check["issues"] = std::move(issues);
+        check["stats"] = result.stats;
+        checks[result.name] = std::move(check);
+    }
+
+    j["passed"] = passed();
+    j["checks"] = std::move(checks);
+
+    return j;
+}
+
+bsp_check_report_t CheckBSP(const mbsp_t &bsp, const bspxentries_t &bspx, const std::vector<std::string> &only)
+{
+    std::vector<const bsp_check_t *> selected;
+
+    for (auto &check : BSPChecks()) {
+        if (only.empty() || std::find(only.begin(), only.end(), check.name) != only.end()) {
+            selected.push_back(&check);
+        }
+    }
+
+    for (auto &name : only) {
+        if (std::none_of(BSPChecks().begin(), BSPChecks().end(), [&](auto &check) { return check.name == name; })) {
+            FError("unknown check {}", name);
+        }
+    }
+
+    bsp_check_report_t report;
+    report.results.resize(selected.size());
+
+    const bsp_check_context_t ctx{bsp, bspx};
+
+    tbb::parallel_for(static_cast<size_t>(0), selected.size(), [&](size_t i) {
+        report.results[i].name = selected[i]->name;
+        selected[i]->run(ctx, report.results[i]);
+    });
+
+    return report;
+}
+
+void PrintBSPCheckReport(const bsp_check_report_t &report)
+{
+    for (auto &result : report.results) {
+        fmt::print("{}: {} errors, {} warnings\n", result.name, result.errors, result.warnings);
+
+        for (auto &issue : result.issues) {
+            fmt::print("    {}: {}\n", issue.severity == bsp_check_severity_t::error ? "error" : "warning",
+                issue.message);
+        }
+
+        if (result.errors + result.warnings > result.issues.size()) {
+            fmt::print("    ({} more not shown)\n", result.errors + result.warnings - result.issues.size());
+        }
+
+        for (auto &[key, value] : result.stats.items()) {
+            fmt::print("    {}: {}\n", key, value.dump());
+        }
+    }
+
+    fmt::print("{}\n", report.passed() ? "check passed" : "check FAILED");
+}
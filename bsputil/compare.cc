@@ -0,0 +1,765 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <bsputil/compare.hh>
+
+#include <common/bsputils.hh>
+#include <common/entdata.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+#include <tbb/parallel_for.h>
+
+namespace
+{
+/*
+ * Uniform grid over the faces of one model, so finding the face at a point
+ * only tests the handful of faces near it, with edge planes built once per
+ * face instead of once per query.
+ */
+class face_index_t
+{
+    static constexpr double CELL_SIZE = 256.0;
+    // faces spanning more cells than this are tested on every query instead
+    static constexpr int64_t MAX_CELLS_PER_FACE = 4096;
+
+    struct entry_t
+    {
+        const mface_t *face;
+        qplane3d plane;
+        std::vector<qplane3d> edge_planes;
+        aabb3d bounds;
+    };
+
+    std::vector<entry_t> entries;
+    std::unordered_map<uint64_t, std::vector<size_t>> cells;
+    std::vector<size_t> oversized;
+    double epsilon;
+
+    static int64_t cell_coord(double v) { return static_cast<int64_t>(std::floor(v / CELL_SIZE)); }
+
+    static uint64_t cell_key(int64_t x, int64_t y, int64_t z)
+    {
+        constexpr int64_t BIAS = 1 << 20;
+        constexpr uint64_t MASK = (1 << 21) - 1;
+
+        return ((static_cast<uint64_t>(x + BIAS) & MASK) << 42) | ((static_cast<uint64_t>(y + BIAS) & MASK) << 21) |
+               (static_cast<uint64_t>(z + BIAS) & MASK);
+    }
+
+    bool entry_contains(const entry_t &entry, const qvec3d &point, const qvec3d &normal, double normal_epsilon) const
+    {
+        if (qv::dot(entry.plane.normal, normal) < 1.0 - normal_epsilon) {
+            return false;
+        }
+        if (std::abs(entry.plane.distance_to(point)) > epsilon) {
+            return false;
+        }
+        if (!entry.bounds.containsPoint(point)) {
+            return false;
+        }
+
+        for (auto &edge : entry.edge_planes) {
+            if (edge.distance_to(point) < -epsilon) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+public:
+    face_index_t(const mbsp_t &bsp, const dmodelh2_t &model, double epsilon_)
+        : epsilon(epsilon_)
+    {
+        entries.reserve(model.numfaces);
+
+        for (int i = 0; i < model.numfaces; i++) {
+            const mface_t *face = BSP_GetFace(&bsp, model.firstface + i);
+
+            if (face->numedges < 3) {
+                continue;
+            }
+
+            entry_t &entry = entries.emplace_back();
+            entry.face = face;
+            entry.plane = Face_Plane(&bsp, face);
+
+            for (int j = 0; j < face->numedges; j++) {
+                const qvec3d v0 = GetSurfaceVertexPoint(&bsp, face, j);
+                const qvec3d v1 = GetSurfaceVertexPoint(&bsp, face, (j + 1) % face->numedges);
+                const qvec3d normal = qv::cross(qv::normalize(v1 - v0), entry.plane.normal);
+
+                entry.edge_planes.emplace_back(normal, qv::dot(normal, v0));
+                entry.bounds += v0;
+            }
+
+            entry.bounds = entry.bounds.grow(qvec3d(epsilon));
+
+            const size_t index = entries.size() - 1;
+            const int64_t x0 = cell_coord(entry.bounds.mins()[0]), x1 = cell_coord(entry.bounds.maxs()[0]);
+            const int64_t y0 = cell_coord(entry.bounds.mins()[1]), y1 = cell_coord(entry.bounds.maxs()[1]);
+            const int64_t z0 = cell_coord(entry.bounds.mins()[2]), z1 = cell_coord(entry.bounds.maxs()[2]);
+
+            if ((x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1) > MAX_CELLS_PER_FACE) {
+                oversized.push_back(index);
+                continue;
+            }
+
+            for (int64_t x = x0; x <= x1; x++)
+                for (int64_t y = y0; y <= y1; y++)
+                    for (int64_t z = z0; z <= z1; z++)
+                        cells[cell_key(x, y, z)].push_back(index);
+        }
+    }
+
+    // the lowest numbered face containing `point` and facing along `normal`
+    const mface_t *find(const qvec3d &point, const qvec3d &normal, double normal_epsilon) const
+    {
+        const mface_t *best = nullptr;
+
+        auto test = [&](size_t index) {
+            const entry_t &entry = entries[index];
+
+            if ((!best || entry.face < best) && entry_contains(entry, point, normal, normal_epsilon)) {
+                best = entry.face;
+            }
+        };
+
+        if (auto it = cells.find(cell_key(cell_coord(point[0]), cell_coord(point[1]), cell_coord(point[2])));
+            it != cells.end()) {
+            for (size_t index : it->second) {
+                test(index);
+            }
+        }
+
+        for (size_t index : oversized) {
+            test(index);
+        }
+
+        return best;
+    }
+};
+
+void AddDifference(bsp_compare_category_t &category, const bsp_compare_options_t &options, json difference)
+{
+    category.mismatched++;
+
+    if (category.differences.size() < options.max_differences) {
+        category.differences.push_back(std::move(difference));
+    }
+}
+
+std::vector<uint8_t> Face_Styles(const mface_t *face)
+{
+    std::vector<uint8_t> styles;
+
+    for (uint8_t style : face->styles) {
+        if (style != INVALID_LIGHTSTYLE_OLD) {
+            styles.push_back(style);
+        }
+    }
+
+    std::sort(styles.begin(), styles.end());
+    return styles;
+}
+
+int BytesPerLuxel(const mbsp_t &bsp)
+{
+    return bsp.loadversion->game->has_rgb_lightmap ? 3 : 1;
+}
+
+struct lightmap_diff_t
+{
+    size_t compared = 0, differing = 0;
+    int max_delta = 0;
+    bool out_of_range = false;
+};
+
+/*
+ * Compares the luxels of `ref_face` against whatever luxels of `face` land
+ * on the same world position, for every style both faces have. Luxels that
+ * don't line up (the lightmap grid moved, or the face was split
+ * differently) aren't compared.
+ */
+lightmap_diff_t CompareFaceLightmaps(const mbsp_t &ref, const mface_t *ref_face, const mbsp_t &bsp,
+    const mface_t *face, const bsp_compare_options_t &options)
+{
+    lightmap_diff_t diff;
+
+    if (ref_face->lightofs < 0 || face->lightofs < 0) {
+        return diff;
+    }
+
+    const faceextents_t ref_extents(*ref_face, ref, LMSCALE_DEFAULT);
+    const faceextents_t extents(*face, bsp, LMSCALE_DEFAULT);
+    const int ref_bpl = BytesPerLuxel(ref), bpl = BytesPerLuxel(bsp);
+
+    for (size_t ref_slot = 0; ref_slot < MAXLIGHTMAPS; ref_slot++) {
+        if (ref_face->styles[ref_slot] == INVALID_LIGHTSTYLE_OLD) {
+            break;
+        }
+
+        auto slot_it = std::find(face->styles.begin(), face->styles.end(), ref_face->styles[ref_slot]);
+
+        if (slot_it == face->styles.end()) {
+            continue;
+        }
+
+        const size_t slot = slot_it - face->styles.begin();
+        const int ref_offset = ref_face->lightofs + (ref_slot * ref_extents.numsamples() * ref_bpl);
+        const int offset = face->lightofs + (slot * extents.numsamples() * bpl);
+
+        if (ref_offset + (ref_extents.numsamples() * ref_bpl) > ref.dlightdata.size() ||
+            offset + (extents.numsamples() * bpl) > bsp.dlightdata.size()) {
+            diff.out_of_range = true;
+            return diff;
+        }
+
+        for (int t = 0; t < ref_extents.height(); t++) {
+            for (int s = 0; s < ref_extents.width(); s++) {
+                const qvec3f world = ref_extents.LMCoordToWorld(qvec2f(s, t));
+                const qvec2f coord = extents.worldToLMCoord(world);
+                const qvec2i rounded{static_cast<int>(std::round(coord[0])), static_cast<int>(std::round(coord[1]))};
+
+                if (std::abs(coord[0] - rounded[0]) > 0.01f || std::abs(coord[1] - rounded[1]) > 0.01f) {
+                    continue;
+                }
+                if (rounded[0] < 0 || rounded[1] < 0 || rounded[0] >= extents.width() ||
+                    rounded[1] >= extents.height()) {
+                    continue;
+                }
+
+                const qvec3b a = LM_Sample(&ref, nullptr, ref_extents, ref_offset, {s, t});
+                const qvec3b b = LM_Sample(&bsp, nullptr, extents, offset, rounded);
+                int delta = 0;
+
+                for (int c = 0; c < 3; c++) {
+                    delta = std::max(delta, std::abs(static_cast<int>(a[c]) - static_cast<int>(b[c])));
+                }
+
+                diff.compared++;
+                diff.max_delta = std::max(diff.max_delta, delta);
+
+                if (delta > options.lightmap_tolerance) {
+                    diff.differing++;
+                }
+            }
+        }
+    }
+
+    return diff;
+}
+
+struct face_match_t
+{
+    const mface_t *match = nullptr;
+    bool texture_differs = false, flags_differs = false, styles_differ = false;
+    lightmap_diff_t lightmap;
+};
+
+void CompareModelFaces(const mbsp_t &ref, const dmodelh2_t &ref_model, const mbsp_t &bsp,
+    const dmodelh2_t &model, int modelnum, bool compare_luxels, bsp_compare_result_t &result)
+{
+    const auto &options = result.options;
+    const face_index_t ref_index(ref, ref_model, options.position_epsilon);
+    const face_index_t index(bsp, model, options.position_epsilon);
+
+    // reference faces that must exist in the other bsp
+    std::vector<face_match_t> matches(ref_model.numfaces);
+
+    tbb::parallel_for(0, ref_model.numfaces, [&](int i) {
+        const mface_t *ref_face = BSP_GetFace(&ref, ref_model.firstface + i);
+
+        if (ref_face->numedges < 3) {
+            return;
+        }
+
+        face_match_t &m = matches[i];
+        m.match = index.find(Face_Centroid(&ref, ref_face), Face_Normal(&ref, ref_face), options.normal_epsilon);
+
+        if (!m.match) {
+            return;
+        }
+
+        m.texture_differs = strcmp(Face_TextureName(&ref, ref_face), Face_TextureName(&bsp, m.match)) != 0;
+        m.flags_differs = Face_Texinfo(&ref, ref_face)->flags.native != Face_Texinfo(&bsp, m.match)->flags.native;
+        m.styles_differ = Face_Styles(ref_face) != Face_Styles(m.match);
+
+        if (compare_luxels) {
+            m.lightmap = CompareFaceLightmaps(ref, ref_face, bsp, m.match, options);
+        }
+    });
+
+    // faces of the other bsp that must exist in the reference
+    std::vector<uint8_t> extra(model.numfaces);
+
+    tbb::parallel_for(0, model.numfaces, [&](int i) {
+        const mface_t *face = BSP_GetFace(&bsp, model.firstface + i);
+
+        if (face->numedges >= 3) {
+            extra[i] = !ref_index.find(Face_Centroid(&bsp, face), Face_Normal(&bsp, face), options.normal_epsilon);
+        }
+    });
+
+    for (int i = 0; i < ref_model.numfaces; i++) {
+        const mface_t *ref_face = BSP_GetFace(&ref, ref_model.firstface + i);
+        const face_match_t &m = matches[i];
+
+        if (ref_face->numedges < 3) {
+            continue;
+        }
+
+        auto describe = [&](const char *kind) {
+            json j = json::object();
+            j["kind"] = kind;
+            j["model"] = modelnum;
+            j["ref_face"] = Face_GetNum(&ref, ref_face);
+            j["point"] = qvec3d(Face_Centroid(&ref, ref_face));
+            j["normal"] = Face_Normal(&ref, ref_face);
+            j["ref_texture"] = Face_TextureName(&ref, ref_face);
+            if (m.match) {
+                j["face"] = Face_GetNum(&bsp, m.match);
+                j["texture"] = Face_TextureName(&bsp, m.match);
+            }
+            return j;
+        };
+
+        result.faces.compared++;
+
+        if (!m.match) {
+            AddDifference(result.faces, options, describe("missing"));
+            continue;
+        }
+        if (m.texture_differs) {
+            AddDifference(result.faces, options, describe("texture"));
+        } else if (m.flags_differs) {
+            json j = describe("flags");
+            j["ref_flags"] = Face_Texinfo(&ref, ref_face)->flags.native;
+            j["flags"] = Face_Texinfo(&bsp, m.match)->flags.native;
+            AddDifference(result.faces, options, std::move(j));
+        }
+
+        if (ref_face->lightofs < 0 && m.match->lightofs < 0) {
+            continue;
+        }
+
+        result.lightmaps.compared++;
+
+        if ((ref_face->lightofs < 0) != (m.match->lightofs < 0)) {
+            const char *kind = ref_face->lightofs < 0 ? "unexpected lightmap" : "missing lightmap";
+            AddDifference(result.lightmaps, options, describe(kind));
+        } else if (m.styles_differ) {
+            json j = describe("styles");
+            j["ref_styles"] = Face_Styles(ref_face);
+            j["styles"] = Face_Styles(m.match);
+            AddDifference(result.lightmaps, options, std::move(j));
+        } else if (m.lightmap.out_of_range) {
+            AddDifference(result.lightmaps, options, describe("lightofs out of range"));
+        } else if (m.lightmap.differing) {
+            json j = describe("luxels");
+            j["luxels_compared"] = m.lightmap.compared;
+            j["luxels_differing"] = m.lightmap.differing;
+            j["max_delta"] = m.lightmap.max_delta;
+            AddDifference(result.lightmaps, options, std::move(j));
+        }
+    }
+
+    for (int i = 0; i < model.numfaces; i++) {
+        if (!extra[i]) {
+            continue;
+        }
+
+        const mface_t *face = BSP_GetFace(&bsp, model.firstface + i);
+
+        json j = json::object();
+        j["kind"] = "extra";
+        j["model"] = modelnum;
+        j["face"] = Face_GetNum(&bsp, face);
+        j["point"] = qvec3d(Face_Centroid(&bsp, face));
+        j["normal"] = Face_Normal(&bsp, face);
+        j["texture"] = Face_TextureName(&bsp, face);
+
+        result.faces.compared++;
+        AddDifference(result.faces, options, std::move(j));
+    }
+}
+
+void CompareModels(const mbsp_t &ref, const mbsp_t &bsp, bsp_compare_result_t &result)
+{
+    const auto &options = result.options;
+
+    if (ref.dmodels.size() != bsp.dmodels.size()) {
+        json j = json::object();
+        j["kind"] = "count";
+        j["ref_count"] = ref.dmodels.size();
+        j["count"] = bsp.dmodels.size();
+        AddDifference(result.models, options, std::move(j));
+    }
+
+    for (size_t i = 0; i < std::min(ref.dmodels.size(), bsp.dmodels.size()); i++) {
+        const dmodelh2_t &a = ref.dmodels[i], &b = bsp.dmodels[i];
+
+        result.models.compared++;
+
+        if (!qv::epsilonEqual(a.mins, b.mins, static_cast<float>(options.position_epsilon)) ||
+            !qv::epsilonEqual(a.maxs, b.maxs, static_cast<float>(options.position_epsilon)) ||
+            !qv::epsilonEqual(a.origin, b.origin, static_cast<float>(options.position_epsilon))) {
+            json j = json::object();
+            j["kind"] = "bounds";
+            j["model"] = i;
+            j["ref_mins"] = a.mins;
+            j["ref_maxs"] = a.maxs;
+            j["mins"] = b.mins;
+            j["maxs"] = b.maxs;
+            AddDifference(result.models, options, std::move(j));
+        }
+    }
+}
+
+struct leaf_sample_t
+{
+    qvec3d point;
+    const mleaf_t *ref_leaf, *leaf;
+};
+
+/*
+ * Leafs are matched by their bounds' center, when that point actually lies
+ * in the leaf (leafs are convex, but the center of their bounds need not be
+ * inside them).
+ */
+std::vector<leaf_sample_t> SampleLeafs(const mbsp_t &ref, const mbsp_t &bsp)
+{
+    const dmodelh2_t *ref_world = BSP_GetWorldModel(&ref);
+    const dmodelh2_t *world = BSP_GetWorldModel(&bsp);
+    std::vector<std::optional<leaf_sample_t>> samples(ref.dleafs.size());
+
+    // leaf 0 is the shared solid leaf
+    tbb::parallel_for(static_cast<size_t>(1), ref.dleafs.size(), [&](size_t i) {
+        const mleaf_t &ref_leaf = ref.dleafs[i];
+
+        if (!(ref_leaf.mins[0] < ref_leaf.maxs[0] && ref_leaf.mins[1] < ref_leaf.maxs[1] &&
+                ref_leaf.mins[2] < ref_leaf.maxs[2])) {
+            return;
+        }
+
+        const qvec3d point = (qvec3d(ref_leaf.mins) + qvec3d(ref_leaf.maxs)) * 0.5;
+
+        if (BSP_FindLeafAtPoint(&ref, ref_world, point) != &ref_leaf) {
+            return;
+        }
+
+        samples[i] = leaf_sample_t{point, &ref_leaf, BSP_FindLeafAtPoint(&bsp, world, point)};
+    });
+
+    std::vector<leaf_sample_t> result;
+
+    for (auto &sample : samples) {
+        if (sample) {
+            result.push_back(*sample);
+        }
+    }
+
+    return result;
+}
+
+void CompareLeafs(const mbsp_t &ref, const mbsp_t &bsp, const std::vector<leaf_sample_t> &samples,
+    bsp_compare_result_t &result)
+{
+    for (auto &sample : samples) {
+        result.leafs.compared++;
+
+        if (sample.ref_leaf->contents != sample.leaf->contents) {
+            json j = json::object();
+            j["kind"] = "contents";
+            j["point"] = sample.point;
+            j["ref_leaf"] = sample.ref_leaf - ref.dleafs.data();
+            j["leaf"] = sample.leaf - bsp.dleafs.data();
+            j["ref_contents"] = contentflags_t{sample.ref_leaf->contents}.to_string(ref.loadversion->game);
+            j["contents"] = contentflags_t{sample.leaf->contents}.to_string(bsp.loadversion->game);
+            AddDifference(result.leafs, result.options, std::move(j));
+        }
+    }
+}
+
+// key into DecompressAllVis' result for a leaf's PVS row, or -1
+int Leaf_VisKey(const mbsp_t &bsp, const mleaf_t *leaf)
+{
+    return bsp.loadversion->game->id == GAME_QUAKE_II ? leaf->cluster : leaf->visofs;
+}
+
+// bit index of a leaf within a PVS row, or -1 if it can never be visible
+int Leaf_VisBit(const mbsp_t &bsp, const mleaf_t *leaf)
+{
+    if (bsp.loadversion->game->id == GAME_QUAKE_II) {
+        return leaf->cluster;
+    }
+
+    const int visleaf = LeafnumToVisleaf(leaf - bsp.dleafs.data());
+    return (visleaf >= 0 && visleaf < bsp.dmodels[0].visleafs) ? visleaf : -1;
+}
+
+/*
+ * For every pair of sampled leafs, checks whether both bsps agree on the
+ * first seeing the second.
+ */
+void ComparePVS(const mbsp_t &ref, const mbsp_t &bsp, const std::vector<leaf_sample_t> &samples,
+    bsp_compare_result_t &result)
+{
+    if (ref.dvis.bits.empty() && bsp.dvis.bits.empty()) {
+        result.pvs.skipped = "neither bsp has visdata";
+        return;
+    } else if (ref.dvis.bits.empty() != bsp.dvis.bits.empty()) {
+        json j = json::object();
+        j["kind"] = ref.dvis.bits.empty() ? "unexpected visdata" : "missing visdata";
+        result.pvs.compared++;
+        AddDifference(result.pvs, result.options, std::move(j));
+        return;
+    }
+
+    const auto ref_rows = DecompressAllVis(&ref);
+    const auto rows = DecompressAllVis(&bsp);
+
+    auto row_of = [](const auto &all, int key) -> const std::vector<uint8_t> * {
+        auto it = all.find(key);
+        return it == all.end() ? nullptr : &it->second;
+    };
+
+    std::vector<int> ref_bits(samples.size()), bits(samples.size());
+
+    for (size_t i = 0; i < samples.size(); i++) {
+        ref_bits[i] = Leaf_VisBit(ref, samples[i].ref_leaf);
+        bits[i] = Leaf_VisBit(bsp, samples[i].leaf);
+    }
+
+    struct row_diff_t
+    {
+        bool compared = false, row_missing = false;
+        size_t differing = 0;
+        size_t first_differing = 0;
+    };
+
+    std::vector<row_diff_t> diffs(samples.size());
+
+    tbb::parallel_for(static_cast<size_t>(0), samples.size(), [&](size_t i) {
+        const auto *ref_row = row_of(ref_rows, Leaf_VisKey(ref, samples[i].ref_leaf));
+        const auto *row = row_of(rows, Leaf_VisKey(bsp, samples[i].leaf));
+        row_diff_t &diff = diffs[i];
+
+        if (!ref_row && !row) {
+            return;
+        }
+
+        diff.compared = true;
+
+        if (!ref_row || !row) {
+            diff.row_missing = true;
+            return;
+        }
+
+        auto visible = [](const std::vector<uint8_t> &r, int bit) {
+            return bit >= 0 && static_cast<size_t>(bit >> 3) < r.size() && (r[bit >> 3] & (1 << (bit & 7)));
+        };
+
+        for (size_t j = 0; j < samples.size(); j++) {
+            if (visible(*ref_row, ref_bits[j]) != visible(*row, bits[j])) {
+                if (!diff.differing) {
+                    diff.first_differing = j;
+                }
+                diff.differing++;
+            }
+        }
+    });
+
+    for (size_t i = 0; i < samples.size(); i++) {
+        const row_diff_t &diff = diffs[i];
+
+        if (!diff.compared) {
+            continue;
+        }
+
+        result.pvs.compared++;
+
+        if (diff.row_missing || diff.differing) {
+            json j = json::object();
+            j["kind"] = diff.row_missing ? "missing row" : "row";
+            j["point"] = samples[i].point;
+            j["ref_leaf"] = samples[i].ref_leaf - ref.dleafs.data();
+            j["leaf"] = samples[i].leaf - bsp.dleafs.data();
+            if (diff.differing) {
+                j["leafs_differing"] = diff.differing;
+                j["first_differing_point"] = samples[diff.first_differing].point;
+            }
+            AddDifference(result.pvs, result.options, std::move(j));
+        }
+    }
+}
+
+void CompareEntities(const mbsp_t &ref, const mbsp_t &bsp, bsp_compare_result_t &result)
+{
+    const auto ref_ents = EntData_Parse(ref);
+    const auto ents = EntData_Parse(bsp);
+
+    if (ref_ents.size() != ents.size()) {
+        json j = json::object();
+        j["kind"] = "count";
+        j["ref_count"] = ref_ents.size();
+        j["count"] = ents.size();
+        AddDifference(result.entities, result.options, std::move(j));
+    }
+
+    for (size_t i = 0; i < std::min(ref_ents.size(), ents.size()); i++) {
+        const std::map<std::string, std::string> a(ref_ents[i].begin(), ref_ents[i].end());
+        const std::map<std::string, std::string> b(ents[i].begin(), ents[i].end());
+
+        result.entities.compared++;
+
+        if (a == b) {
+            continue;
+        }
+
+        json changed = json::object();
+
+        for (auto &[key, value] : a) {
+            auto it = b.find(key);
+
+            if (it == b.end()) {
+                changed[key] = json::array({value, nullptr});
+            } else if (it->second != value) {
+                changed[key] = json::array({value, it->second});
+            }
+        }
+        for (auto &[key, value] : b) {
+            if (!a.count(key)) {
+                changed[key] = json::array({nullptr, value});
+            }
+        }
+
+        json j = json::object();
+        j["kind"] = "keys";
+        j["entity"] = i;
+        j["classname"] = ref_ents[i].get("classname");
+        // key: [reference value, value], null where the key is absent
+        j["keys"] = std::move(changed);
+        AddDifference(result.entities, result.options, std::move(j));
+    }
+}
+
+json CategoryToJson(const bsp_compare_category_t &category)
+{
+    json j = json::object();
+    j["compared"] = category.compared;
+    j["mismatched"] = category.mismatched;
+    if (!category.skipped.empty()) {
+        j["skipped"] = category.skipped;
+    }
+    j["differences"] = category.differences;
+    return j;
+}
+} // namespace
+
+bool bsp_compare_result_t::identical() const
+{
+    for (auto *category : {&models, &faces, &leafs, &pvs, &lightmaps, &entities}) {
+        if (category->mismatched) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+json bsp_compare_result_t::to_json() const
+{
+    json j = json::object();
+
+    j["identical"] = identical();
+    j["options"] = {{"position_epsilon", options.position_epsilon}, {"normal_epsilon", options.normal_epsilon},
+        {"lightmap_tolerance", options.lightmap_tolerance}, {"max_differences", options.max_differences}};
+    j["models"] = CategoryToJson(models);
+    j["faces"] = CategoryToJson(faces);
+    j["leafs"] = CategoryToJson(leafs);
+    j["pvs"] = CategoryToJson(pvs);
+    j["lightmaps"] = CategoryToJson(lightmaps);
+    j["entities"] = CategoryToJson(entities);
+
+    return j;
+}
+
+bsp_compare_result_t CompareBSPs(const mbsp_t &ref, const bspxentries_t &ref_bspx, const mbsp_t &bsp,
+    const bspxentries_t &bspx, const bsp_compare_options_t &options)
+{
+    bsp_compare_result_t result;
+    result.options = options;
+
+    // luxels are located with the vanilla 16 unit grid, which doesn't
+    // apply when either bsp stores lightmaps at another scale
+    bool compare_luxels = true;
+
+    for (const char *lump : {"LMSHIFT", "DECOUPLED_LM"}) {
+        if (ref_bspx.count(lump) || bspx.count(lump)) {
+            result.lightmaps.skipped = fmt::format("luxels not compared; {} lump present", lump);
+            compare_luxels = false;
+        }
+    }
+
+    CompareModels(ref, bsp, result);
+
+    for (size_t i = 0; i < std::min(ref.dmodels.size(), bsp.dmodels.size()); i++) {
+        CompareModelFaces(ref, ref.dmodels[i], bsp, bsp.dmodels[i], static_cast<int>(i), compare_luxels, result);
+    }
+
+    const auto samples = SampleLeafs(ref, bsp);
+    CompareLeafs(ref, bsp, samples, result);
+    ComparePVS(ref, bsp, samples, result);
+
+    CompareEntities(ref, bsp, result);
+
+    return result;
+}
+
+void PrintBSPComparison(const bsp_compare_result_t &result)
+{
+    // differences printed per category; the json report has the rest
+    constexpr size_t PRINT_LIMIT = 10;
+
+    const std::pair<const char *, const bsp_compare_category_t *> categories[] = {{"models", &result.models},
+        {"faces", &result.faces}, {"leafs", &result.leafs}, {"pvs", &result.pvs},
+        {"lightmaps", &result.lightmaps}, {"entities", &result.entities}};
+
+    for (auto &[name, category] : categories) {
+        fmt::print("{:<10} {:8} compared {:8} mismatched\n", name, category->compared, category->mismatched);
+
+        if (!category->skipped.empty()) {
+            fmt::print("    ({})\n", category->skipped);
+        }
+
+        for (size_t i = 0; i < std::min(PRINT_LIMIT, category->differences.size()); i++) {
+            fmt::print("    {}\n", category->differences[i].dump());
+        }
+    }
+
+    fmt::print("{}\n", result.identical() ? "bsps match" : "bsps differ");
+}
@@ -0,0 +1,175 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <common/atlas.hh>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+skyline_packer_t::skyline_packer_t(int width, int height)
+    : width(width),
+      height(height),
+      skyline{{0, 0, width}}
+{
+}
+
+// the y a w x h rectangle would sit at with its left edge at skyline[index], if it fits there
+std::optional<int> skyline_packer_t::fit(size_t index, int w, int h) const
+{
+    const int x = skyline[index].x;
+
+    if (x + w > width) {
+        return std::nullopt;
+    }
+
+    int y = 0;
+    int remaining = w;
+
+    for (size_t i = index; remaining > 0; i++) {
+        y = std::max(y, skyline[i].y);
+
+        if (y + h > height) {
+            return std::nullopt;
+        }
+
+        remaining -= skyline[i].width;
+    }
+
+    return y;
+}
+
+bool skyline_packer_t::insert(int w, int h, int &x, int &y)
+{
+    size_t best_index = 0;
+    int best_top = std::numeric_limits<int>::max();
+    int best_width = std::numeric_limits<int>::max();
+    int best_y = 0;
+
+    // bottom-left: lowest top edge, then the narrowest segment to waste less
+    for (size_t i = 0; i < skyline.size(); i++) {
+        auto fit_y = fit(i, w, h);
+
+        if (!fit_y) {
+            continue;
+        }
+
+        const int top = *fit_y + h;
+
+        if (top < best_top || (top == best_top && skyline[i].width < best_width)) {
+            best_index = i;
+            best_top = top;
+            best_width = skyline[i].width;
+            best_y = *fit_y;
+        }
+    }
+
+    if (best_top == std::numeric_limits<int>::max()) {
+        return false;
+    }
+
+    x = skyline[best_index].x;
+    y = best_y;
+
+    skyline.insert(skyline.begin() + best_index, segment_t{x, y + h, w});
+
+    // shrink or remove the segments the new one covers
+    for (size_t i = best_index + 1; i < skyline.size();) {
+        const segment_t &previous = skyline[i - 1];
+        segment_t &segment = skyline[i];
+
+        if (segment.x >= previous.x + previous.width) {
+            break;
+        }
+
+        const int shrink = previous.x + previous.width - segment.x;
+        segment.x += shrink;
+        segment.width -= shrink;
+
+        if (segment.width <= 0) {
+            skyline.erase(skyline.begin() + i);
+        } else {
+            break;
+        }
+    }
+
+    // merge neighbours at the same height
+    for (size_t i = 0; i + 1 < skyline.size();) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        } else {
+            i++;
+        }
+    }
+
+    return true;
+}
+
+atlas_layout_t PackAtlas(std::vector<atlas_rect_t> &rects, int page_size)
+{
+    atlas_layout_t layout;
+    layout.page_size = page_size;
+
+    for (auto &rect : rects) {
+        while (rect.width > layout.page_size || rect.height > layout.page_size) {
+            layout.page_size *= 2;
+        }
+    }
+
+    // tallest first, then widest; ties keep their order so the result is deterministic
+    std::vector<size_t> order(rects.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&rects](size_t a, size_t b) {
+        if (rects[a].height != rects[b].height) {
+            return rects[a].height > rects[b].height;
+        }
+        return rects[a].width > rects[b].width;
+    });
+
+    std::vector<skyline_packer_t> pages;
+
+    for (size_t index : order) {
+        atlas_rect_t &rect = rects[index];
+
+        if (rect.width <= 0 || rect.height <= 0) {
+            rect.page = -1;
+            continue;
+        }
+
+        bool placed = false;
+
+        for (size_t p = 0; p < pages.size() && !placed; p++) {
+            if (pages[p].insert(rect.width, rect.height, rect.x, rect.y)) {
+                rect.page = p;
+                placed = true;
+            }
+        }
+
+        if (!placed) {
+            pages.emplace_back(layout.page_size, layout.page_size);
+            pages.back().insert(rect.width, rect.height, rect.x, rect.y);
+            rect.page = pages.size() - 1;
+        }
+    }
+
+    layout.num_pages = pages.size();
+
+    return layout;
+}
@@ -32,7 +32,11 @@
 #include <fmt/core.h>
 
 #include <atomic>
+#include <cstring>
 #include <mutex>
+#include <numeric>
+
+#include <tbb/parallel_for.h>
 
 void lump_t::stream_write(std::ostream &s) const
 {
@@ -2039,18 +2043,25 @@ inline void CopyArray(T &in, T &out)
     out = in;
 }
 
+// elements are independent, so large lumps are converted in parallel;
+// overflow errors thrown by a worker propagate out of parallel_for
+constexpr size_t CONVERT_GRAIN_SIZE = 4096;
+
 // convert structured data if we're different types
 template<typename T, typename F, typename = std::enable_if_t<!std::is_same_v<T, F>>>
 inline void CopyArray(std::vector<F> &from, std::vector<T> &to)
 {
-    to.reserve(from.size());
-
-    for (auto &v : from) {
-        if constexpr (std::is_arithmetic_v<T> && std::is_arithmetic_v<F>)
-            to.emplace_back(numeric_cast<T>(v));
-        else
-            to.emplace_back(v);
-    }
+    to.resize(from.size());
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, from.size(), CONVERT_GRAIN_SIZE),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i < range.end(); i++) {
+                if constexpr (std::is_arithmetic_v<T> && std::is_arithmetic_v<F>)
+                    to[i] = numeric_cast<T>(from[i]);
+                else
+                    to[i] = T(from[i]);
+            }
+        });
 }
 
 // move structured data if the input and output
@@ -2066,13 +2077,28 @@ inline void CopyArray(F &in, T &out)
 template<typename T, typename F, size_t N, typename = std::enable_if_t<!std::is_same_v<T, F>>>
 inline void CopyArray(std::vector<std::array<F, N>> &from, std::vector<std::array<T, N>> &to)
 {
-    to.reserve(from.size());
+    to.resize(from.size());
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, from.size(), CONVERT_GRAIN_SIZE),
+        [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t i = range.begin(); i < range.end(); i++) {
+                if constexpr (std::is_arithmetic_v<T> && std::is_arithmetic_v<F>)
+                    to[i] = array_cast<std::array<T, N>>(from[i]);
+                else
+                    to[i] = std::array<T, N>(from[i]);
+            }
+        });
+}
 
-    for (auto &v : from) {
-        if constexpr (std::is_arithmetic_v<T> && std::is_arithmetic_v<F>)
-            to.emplace_back(array_cast<std::array<T, N>>(v));
-        else
-            to.emplace_back(v);
+// like CopyArray, but the source is discarded afterwards, so data that
+// doesn't need converting can be moved instead of copied
+template<typename T, typename F>
+inline void MoveArray(F &from, T &to)
+{
+    if constexpr (std::is_same_v<T, F>) {
+        to = std::move(from);
+    } else {
+        CopyArray(from, to);
     }
 }
 
@@ -2080,24 +2106,24 @@ inline void CopyArray(std::vector<std::array<F, N>> &from, std::vector<std::arra
 template<typename T>
 inline void ConvertQ1BSPToGeneric(T &bsp, mbsp_t &mbsp)
 {
-    CopyArray(bsp.dentdata, mbsp.dentdata);
-    CopyArray(bsp.dplanes, mbsp.dplanes);
-    CopyArray(bsp.dtex, mbsp.dtex);
-    CopyArray(bsp.dvertexes, mbsp.dvertexes);
-    CopyArray(bsp.dvisdata, mbsp.dvis.bits);
-    CopyArray(bsp.dnodes, mbsp.dnodes);
-    CopyArray(bsp.texinfo, mbsp.texinfo);
-    CopyArray(bsp.dfaces, mbsp.dfaces);
-    CopyArray(bsp.dlightdata, mbsp.dlightdata);
-    CopyArray(bsp.dclipnodes, mbsp.dclipnodes);
-    CopyArray(bsp.dleafs, mbsp.dleafs);
-    CopyArray(bsp.dmarksurfaces, mbsp.dleaffaces);
-    CopyArray(bsp.dedges, mbsp.dedges);
-    CopyArray(bsp.dsurfedges, mbsp.dsurfedges);
+    MoveArray(bsp.dentdata, mbsp.dentdata);
+    MoveArray(bsp.dplanes, mbsp.dplanes);
+    MoveArray(bsp.dtex, mbsp.dtex);
+    MoveArray(bsp.dvertexes, mbsp.dvertexes);
+    MoveArray(bsp.dvisdata, mbsp.dvis.bits);
+    MoveArray(bsp.dnodes, mbsp.dnodes);
+    MoveArray(bsp.texinfo, mbsp.texinfo);
+    MoveArray(bsp.dfaces, mbsp.dfaces);
+    MoveArray(bsp.dlightdata, mbsp.dlightdata);
+    MoveArray(bsp.dclipnodes, mbsp.dclipnodes);
+    MoveArray(bsp.dleafs, mbsp.dleafs);
+    MoveArray(bsp.dmarksurfaces, mbsp.dleaffaces);
+    MoveArray(bsp.dedges, mbsp.dedges);
+    MoveArray(bsp.dsurfedges, mbsp.dsurfedges);
     if (std::holds_alternative<dmodelh2_vector>(bsp.dmodels)) {
-        CopyArray(std::get<dmodelh2_vector>(bsp.dmodels), mbsp.dmodels);
+        MoveArray(std::get<dmodelh2_vector>(bsp.dmodels), mbsp.dmodels);
     } else {
-        CopyArray(std::get<dmodelq1_vector>(bsp.dmodels), mbsp.dmodels);
+        MoveArray(std::get<dmodelq1_vector>(bsp.dmodels), mbsp.dmodels);
     }
 }
 
@@ -2105,24 +2131,24 @@ inline void ConvertQ1BSPToGeneric(T &bsp, mbsp_t &mbsp)
 template<typename T>
 inline void ConvertQ2BSPToGeneric(T &bsp, mbsp_t &mbsp)
 {
-    CopyArray(bsp.dentdata, mbsp.dentdata);
-    CopyArray(bsp.dplanes, mbsp.dplanes);
-    CopyArray(bsp.dvertexes, mbsp.dvertexes);
-    CopyArray(bsp.dvis, mbsp.dvis);
-    CopyArray(bsp.dnodes, mbsp.dnodes);
-    CopyArray(bsp.texinfo, mbsp.texinfo);
-    CopyArray(bsp.dfaces, mbsp.dfaces);
-    CopyArray(bsp.dlightdata, mbsp.dlightdata);
-    CopyArray(bsp.dleafs, mbsp.dleafs);
-    CopyArray(bsp.dleaffaces, mbsp.dleaffaces);
-    CopyArray(bsp.dleafbrushes, mbsp.dleafbrushes);
-    CopyArray(bsp.dedges, mbsp.dedges);
-    CopyArray(bsp.dsurfedges, mbsp.dsurfedges);
-    CopyArray(bsp.dmodels, mbsp.dmodels);
-    CopyArray(bsp.dbrushes, mbsp.dbrushes);
-    CopyArray(bsp.dbrushsides, mbsp.dbrushsides);
-    CopyArray(bsp.dareas, mbsp.dareas);
-    CopyArray(bsp.dareaportals, mbsp.dareaportals);
+    MoveArray(bsp.dentdata, mbsp.dentdata);
+    MoveArray(bsp.dplanes, mbsp.dplanes);
+    MoveArray(bsp.dvertexes, mbsp.dvertexes);
+    MoveArray(bsp.dvis, mbsp.dvis);
+    MoveArray(bsp.dnodes, mbsp.dnodes);
+    MoveArray(bsp.texinfo, mbsp.texinfo);
+    MoveArray(bsp.dfaces, mbsp.dfaces);
+    MoveArray(bsp.dlightdata, mbsp.dlightdata);
+    MoveArray(bsp.dleafs, mbsp.dleafs);
+    MoveArray(bsp.dleaffaces, mbsp.dleaffaces);
+    MoveArray(bsp.dleafbrushes, mbsp.dleafbrushes);
+    MoveArray(bsp.dedges, mbsp.dedges);
+    MoveArray(bsp.dsurfedges, mbsp.dsurfedges);
+    MoveArray(bsp.dmodels, mbsp.dmodels);
+    MoveArray(bsp.dbrushes, mbsp.dbrushes);
+    MoveArray(bsp.dbrushsides, mbsp.dbrushsides);
+    MoveArray(bsp.dareas, mbsp.dareas);
+    MoveArray(bsp.dareaportals, mbsp.dareaportals);
 }
 
 // Convert from a Q1-esque format to Generic
@@ -2310,6 +2336,47 @@ static bool isHexen2(const dheader_t *header, const bspversion_t *bspversion)
     return true;
 }
 
+/*
+ * Whether a lump of T can be copied to or from the file as one block of
+ * memory, instead of an element at a time through the stream operators.
+ *
+ * That holds when T's in-memory bytes are exactly its (little endian) file
+ * record. Rather than trusting each struct's layout, this is checked once
+ * per type by round-tripping a record whose bytes are all distinct through
+ * T's stream functions: padding, reordered fields and byte swapping (on big
+ * endian hosts) all show up as a mismatch, and leave T on the slow path.
+ */
+template<typename T>
+static bool IsBulkLumpType()
+{
+    if constexpr (!std::is_trivially_copyable_v<T> || !std::is_default_constructible_v<T> || sizeof(T) > 256) {
+        return false;
+    } else {
+        static const bool bulk = []() {
+            std::array<uint8_t, sizeof(T)> pattern, written{};
+            std::iota(pattern.begin(), pattern.end(), 0);
+
+            T value{};
+            imemstream in(pattern.data(), pattern.size());
+            in >> endianness<std::endian::little>;
+            in >= value;
+
+            if (!in || in.tellg() != static_cast<std::streamoff>(sizeof(T)) ||
+                memcmp(&value, pattern.data(), sizeof(T)) != 0) {
+                return false;
+            }
+
+            omemstream out(written.data(), written.size());
+            out << endianness<std::endian::little>;
+            out <= value;
+
+            return out && out.tellp() == static_cast<std::streamoff>(sizeof(T)) && written == pattern;
+        }();
+
+        return bulk;
+    }
+}
+
 struct lump_reader
 {
     std::istream &s;
@@ -2343,7 +2410,10 @@ struct lump_reader
 
         s.seekg(lump.fileofs);
 
-        if (lumpspec.size > 1) {
+        if (lumpspec.size > 1 && IsBulkLumpType<T>()) {
+            buffer.resize(length);
+            s.read(reinterpret_cast<char *>(buffer.data()), lump.filelen);
+        } else if (lumpspec.size > 1) {
             for (size_t i = 0; i < length; i++) {
                 T &val = buffer.emplace_back();
                 s >= val;
@@ -2606,6 +2676,7 @@ void LoadBSPFile(fs::path &filename, bspdata_t *bspdata)
 
 /* ========================================================================= */
 #include <fstream>
+#include <sstream>
 
 struct bspfile_t
 {
@@ -2639,8 +2710,12 @@ private:
 
         lump.fileofs = stream.tellp();
 
-        for (auto &v : data)
-            stream <= v;
+        if (IsBulkLumpType<T>()) {
+            stream.write(reinterpret_cast<const char *>(data.data()), data.size() * sizeof(T));
+        } else {
+            for (auto &v : data)
+                stream <= v;
+        }
 
         auto written = static_cast<int32_t>(stream.tellp()) - lump.fileofs;
 
@@ -2853,6 +2928,301 @@ void WriteBSPFile(const fs::path &filename, bspdata_t *bspdata)
     }
 }
 
+/*
+ * =============
+ * PatchBSPFile
+ * =============
+ */
+
+// where the lumps of a bsp file are, read without decoding any of them
+struct raw_bsp_layout_t
+{
+    // offset of the lump table in the header
+    size_t lump_table_ofs;
+    std::vector<lump_t> lumps;
+    size_t entities_lump, lighting_lump;
+    // BSPX lumps, in file order
+    std::vector<std::pair<std::string, lump_t>> bspx;
+};
+
+static raw_bsp_layout_t ReadRawBSPLayout(const fs::path &filename, const std::vector<uint8_t> &data)
+{
+    imemstream stream(data.data(), data.size());
+    stream >> endianness<std::endian::little>;
+
+    raw_bsp_layout_t layout;
+    bspversion_t temp_version{};
+
+    stream >= temp_version.ident;
+    stream.seekg(0);
+
+    if (temp_version.ident == Q2_BSPIDENT || temp_version.ident == Q2_QBISMIDENT) {
+        q2_dheader_t q2header;
+        stream >= q2header;
+
+        temp_version.version = q2header.version;
+        layout.lump_table_ofs = sizeof(q2header.ident) + sizeof(q2header.version);
+        layout.lumps.assign(q2header.lumps.begin(), q2header.lumps.end());
+    } else {
+        dheader_t q1header;
+        stream >= q1header;
+
+        layout.lump_table_ofs = sizeof(q1header.ident);
+        layout.lumps.assign(q1header.lumps.begin(), q1header.lumps.end());
+    }
+
+    const bspversion_t *version;
+
+    if (!stream || !BSPVersionSupported(temp_version.ident, temp_version.version, &version)) {
+        FError("{} isn't a supported bsp", filename);
+    }
+
+    const bool q2 = version->game->id == GAME_QUAKE_II;
+    layout.entities_lump = q2 ? static_cast<size_t>(Q2_LUMP_ENTITIES) : static_cast<size_t>(LUMP_ENTITIES);
+    layout.lighting_lump = q2 ? static_cast<size_t>(Q2_LUMP_LIGHTING) : static_cast<size_t>(LUMP_LIGHTING);
+
+    size_t end = 0;
+
+    for (auto &lump : layout.lumps) {
+        if (lump.fileofs < 0 || lump.filelen < 0 ||
+            static_cast<size_t>(lump.fileofs) + static_cast<size_t>(lump.filelen) > data.size()) {
+            FError("{} has a lump outside of the file", filename);
+        }
+
+        end = std::max(end, static_cast<size_t>(lump.fileofs + lump.filelen));
+    }
+
+    // same rule as LoadBSPFile
+    const size_t bspxofs = (end + 3) & ~3;
+
+    if (bspxofs + sizeof(bspx_header_t) <= data.size()) {
+        stream.seekg(bspxofs);
+
+        bspx_header_t bspx;
+
+        if (!(stream >= bspx) || memcmp(bspx.id.data(), "BSPX", 4)) {
+            return layout;
+        }
+
+        for (size_t i = 0; i < bspx.numlumps; i++) {
+            bspx_lump_t xlump;
+
+            if (!(stream >= xlump) || static_cast<size_t>(xlump.fileofs) + xlump.filelen > data.size()) {
+                FError("{} has an invalid BSPX lump at index {}", filename, i);
+            }
+
+            layout.bspx.emplace_back(std::string(xlump.lumpname.data(), strnlen(xlump.lumpname.data(), 24)),
+                lump_t{static_cast<int32_t>(xlump.fileofs), static_cast<int32_t>(xlump.filelen)});
+        }
+    }
+
+    return layout;
+}
+
+bool PatchBSPFile(const fs::path &filename, const bsp_patch_t &patch)
+{
+    std::vector<uint8_t> data(fs::file_size(filename));
+
+    {
+        std::ifstream stream(filename, std::ios_base::in | std::ios_base::binary);
+        stream.read(reinterpret_cast<char *>(data.data()), data.size());
+
+        if (!stream) {
+            FError("can't read {}", filename);
+        }
+    }
+
+    raw_bsp_layout_t layout = ReadRawBSPLayout(filename, data);
+
+    // new contents, by lump number
+    std::vector<std::optional<std::vector<uint8_t>>> replaced(layout.lumps.size());
+
+    if (patch.entities) {
+        auto &lump = replaced[layout.entities_lump].emplace(patch.entities->begin(), patch.entities->end());
+        lump.push_back(0);
+    }
+
+    if (patch.lighting) {
+        replaced[layout.lighting_lump] = *patch.lighting;
+    }
+
+    for (auto &[name, contents] : patch.bspx) {
+        if (!contents && std::none_of(layout.bspx.begin(), layout.bspx.end(),
+                             [&name = name](auto &lump) { return lump.first == name; })) {
+            FError("{} has no BSPX lump {} to remove", filename, name);
+        }
+    }
+
+    // a lump can be overwritten where it is if it fits, unless it's the last one and
+    // shrinking it would move the end of the lumps, which is where BSPX data is found
+    size_t end = 0;
+    for (auto &lump : layout.lumps) {
+        end = std::max(end, static_cast<size_t>(lump.fileofs + lump.filelen));
+    }
+
+    bool in_place = patch.bspx.empty();
+
+    for (size_t i = 0; i < layout.lumps.size() && in_place; i++) {
+        if (!replaced[i]) {
+            continue;
+        }
+
+        const lump_t &lump = layout.lumps[i];
+        const size_t size = replaced[i]->size();
+
+        if (size > static_cast<size_t>(lump.filelen)) {
+            in_place = false;
+        } else if (lump.fileofs + lump.filelen == end && ((lump.fileofs + size + 3) & ~3) != ((end + 3) & ~3)) {
+            in_place = false;
+        }
+    }
+
+    if (in_place) {
+        std::fstream stream(filename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+        stream << endianness<std::endian::little>;
+
+        for (size_t i = 0; i < layout.lumps.size(); i++) {
+            if (!replaced[i]) {
+                continue;
+            }
+
+            lump_t &lump = layout.lumps[i];
+            const std::vector<uint8_t> &contents = *replaced[i];
+
+            stream.seekp(lump.fileofs);
+            stream.write(reinterpret_cast<const char *>(contents.data()), contents.size());
+            stream <= padding_n(lump.filelen - contents.size());
+
+            lump.filelen = contents.size();
+        }
+
+        stream.seekp(layout.lump_table_ofs);
+
+        for (auto &lump : layout.lumps) {
+            stream <= lump;
+        }
+
+        if (!stream) {
+            FError("can't write {}", filename);
+        }
+
+        logging::print("Patched {} in place\n", filename);
+        return true;
+    }
+
+    // repack: copy the lumps over in their original order, with the replaced ones swapped in
+    std::ostringstream stream(std::ios_base::out | std::ios_base::binary);
+    stream << endianness<std::endian::little>;
+
+    const size_t header_size = layout.lump_table_ofs + layout.lumps.size() * sizeof(lump_t);
+    stream.write(reinterpret_cast<const char *>(data.data()), header_size);
+
+    std::vector<size_t> order(layout.lumps.size());
+    std::iota(order.begin(), order.end(), 0);
+    // empty lumps sit at the offset of the lump after them, so they go first
+    std::stable_sort(order.begin(), order.end(), [&layout](size_t a, size_t b) {
+        return std::make_pair(layout.lumps[a].fileofs, layout.lumps[a].filelen) <
+               std::make_pair(layout.lumps[b].fileofs, layout.lumps[b].filelen);
+    });
+
+    std::vector<lump_t> lumps(layout.lumps.size());
+
+    auto write_lump = [&](const uint8_t *bytes, size_t size) {
+        const lump_t result{static_cast<int32_t>(stream.tellp()), static_cast<int32_t>(size)};
+
+        stream.write(reinterpret_cast<const char *>(bytes), size);
+
+        if (size % 4) {
+            stream <= padding_n(4 - (size % 4));
+        }
+
+        return result;
+    };
+
+    for (size_t i : order) {
+        if (replaced[i]) {
+            lumps[i] = write_lump(replaced[i]->data(), replaced[i]->size());
+        } else {
+            lumps[i] = write_lump(data.data() + layout.lumps[i].fileofs, layout.lumps[i].filelen);
+        }
+    }
+
+    // existing BSPX lumps keep their order; new ones go after them
+    std::vector<std::pair<std::string, std::pair<const uint8_t *, size_t>>> bspx;
+
+    for (auto &[name, lump] : layout.bspx) {
+        auto it = patch.bspx.find(name);
+
+        if (it == patch.bspx.end()) {
+            bspx.emplace_back(name, std::make_pair(data.data() + lump.fileofs, lump.filelen));
+        } else if (it->second) {
+            bspx.emplace_back(name, std::make_pair(it->second->data(), it->second->size()));
+        }
+    }
+
+    std::vector<std::string> added;
+
+    for (auto &[name, contents] : patch.bspx) {
+        if (contents && std::none_of(layout.bspx.begin(), layout.bspx.end(),
+                            [&name = name](auto &lump) { return lump.first == name; })) {
+            added.push_back(name);
+        }
+    }
+
+    std::sort(added.begin(), added.end());
+
+    for (auto &name : added) {
+        auto &contents = *patch.bspx.at(name);
+        bspx.emplace_back(name, std::make_pair(contents.data(), contents.size()));
+    }
+
+    if (!bspx.empty()) {
+        stream <= bspx_header_t(bspx.size());
+
+        // the data follows the directory
+        size_t ofs = static_cast<size_t>(stream.tellp()) + bspx.size() * sizeof(bspx_lump_t);
+
+        for (auto &[name, contents] : bspx) {
+            bspx_lump_t lump{};
+            lump.fileofs = ofs;
+            lump.filelen = contents.second;
+            memcpy(lump.lumpname.data(), name.c_str(), std::min(name.size(), lump.lumpname.size() - 1));
+            stream <= lump;
+
+            ofs += (contents.second + 3) & ~3;
+        }
+
+        for (auto &[name, contents] : bspx) {
+            write_lump(contents.first, contents.second);
+        }
+    }
+
+    stream.seekp(layout.lump_table_ofs);
+
+    for (auto &lump : lumps) {
+        stream <= lump;
+    }
+
+    // write a new file and move it over the old one, so a failed write can't leave a broken bsp behind
+    fs::path temp = filename;
+    temp += ".tmp";
+
+    {
+        std::ofstream file(temp, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+        const std::string bytes = stream.str();
+        file.write(bytes.data(), bytes.size());
+
+        if (!file) {
+            FError("can't write {}", temp);
+        }
+    }
+
+    fs::rename(temp, filename);
+
+    logging::print("Repacked {} with the patched lumps\n", filename);
+    return false;
+}
+
 /* ========================================================================= */
 
 inline void PrintLumpSize(const lumpspec_t &lump, size_t count)
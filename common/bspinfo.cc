@@ -21,31 +21,22 @@
 #include <common/log.hh>
 #include <common/cmdlib.hh>
 #include <common/bspfile.hh>
-#include <common/ostream.hh>
 
 #include <fstream>
-#include <iomanip>
 #include <fmt/core.h>
 #include <common/json.hh>
+#include <common/json_stream.hh>
 #include "common/fs.hh"
 #include "common/imglib.hh"
+#include <common/atlas.hh>
+
+#include <tbb/parallel_for.h>
 
 #define STB_IMAGE_WRITE_STATIC
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define STBI_WRITE_NO_STDIO
 #include "../3rdparty/stb_image_write.h"
 
-static std::string hex_string(const uint8_t *bytes, const size_t count)
-{
-    std::string str;
-
-    for (size_t i = 0; i < count; ++i) {
-        fmt::format_to(std::back_inserter(str), "{:x}", bytes[i]);
-    }
-
-    return str;
-}
-
 /**
  * returns a JSON array of models
  */
@@ -242,13 +233,12 @@ full_atlas_t build_lightmap_atlas(const mbsp_t &bsp, const bspxentries_t &bspx,
         const mface_t *face;
         faceextents_t extents;
         int32_t lightofs;
-        std::optional<img::texture> texture = std::nullopt;
-        size_t atlas = 0;
         size_t x = 0, y = 0;
     };
 
-    constexpr size_t atlas_size = 512;
+    constexpr int atlas_size = 512;
     const uint8_t *lightdata_source;
+    size_t lightdata_size;
     bool is_rgb;
     bool is_lit;
 
@@ -256,21 +246,15 @@ full_atlas_t build_lightmap_atlas(const mbsp_t &bsp, const bspxentries_t &bspx,
         is_lit = true;
         is_rgb = true;
         lightdata_source = litdata.data();
+        lightdata_size = litdata.size();
     } else {
         is_lit = false;
         is_rgb = bsp.loadversion->game->has_rgb_lightmap;
         lightdata_source = bsp.dlightdata.data();
+        lightdata_size = bsp.dlightdata.size();
     }
 
-    struct atlas
-    {
-        size_t current_x = 0, current_y = 0;
-        size_t tallest = 0;
-    };
-
-    std::vector<atlas> atlasses;
     std::vector<face_rect> rectangles;
-    size_t current_atlas = 0;
     rectangles.reserve(bsp.dfaces.size());
 
     imemstream bspx_lmoffset(nullptr, 0);
@@ -320,114 +304,98 @@ full_atlas_t build_lightmap_atlas(const mbsp_t &bsp, const bspxentries_t &bspx,
         return {};
     }
 
-    // sort faces
-    std::sort(rectangles.begin(), rectangles.end(), [](const face_rect &a, const face_rect &b) -> bool {
-        int32_t a_height = a.extents.height();
-        int32_t b_height = b.extents.height();
-
-        if (a_height == b_height) {
-            return b.face > a.face;
-        }
-
-        return a_height > b_height;
-    });
-
     // pack
-    for (auto &rect : rectangles) {
-        while (true) {
-            if (current_atlas == atlasses.size()) {
-                atlasses.emplace_back();
-            }
-
-            atlas &atl = atlasses[current_atlas];
-
-            if (atl.current_x + rect.extents.width() >= atlas_size) {
-                atl.current_x = 0;
-                atl.current_y += atl.tallest;
-                atl.tallest = 0;
-            }
-
-            if (atl.current_y + rect.extents.height() >= atlas_size) {
-                current_atlas++;
-                continue;
-            }
-
-            atl.tallest = std::max(atl.tallest, (size_t)rect.extents.height());
-            rect.x = atl.current_x;
-            rect.y = atl.current_y;
-            rect.atlas = current_atlas;
+    std::vector<atlas_rect_t> packed(rectangles.size());
 
-            atl.current_x += rect.extents.width();
-            break;
-        }
+    for (size_t i = 0; i < rectangles.size(); i++) {
+        packed[i].width = rectangles[i].extents.width();
+        packed[i].height = rectangles[i].extents.height();
     }
 
-    // calculate final atlas texture size
+    const atlas_layout_t layout = PackAtlas(packed, atlas_size);
+
+    // lay the pages out in a square grid, and trim the unused right/bottom edges
     img::texture full_atlas;
-    size_t sqrt_count = ceil(sqrt(atlasses.size()));
+    const size_t sqrt_count = std::max(1, static_cast<int>(ceil(sqrt(layout.num_pages))));
     size_t trimmed_width = 0, trimmed_height = 0;
 
-    for (size_t i = 0; i < atlasses.size(); i++) {
-        size_t atlas_x = (i % sqrt_count) * atlas_size;
-        size_t atlas_y = (i / sqrt_count) * atlas_size;
+    for (size_t i = 0; i < rectangles.size(); i++) {
+        auto &rect = rectangles[i];
 
-        for (auto &rect : rectangles) {
-            if (rect.atlas == i) {
-                rect.x += atlas_x;
-                rect.y += atlas_y;
-                trimmed_width = std::max(trimmed_width, rect.x + rect.extents.width());
-                trimmed_height = std::max(trimmed_height, rect.y + rect.extents.height());
-            }
-#if 0
-            for (size_t x = 0; x < rect.texture->width; x++) {
-                for (size_t y = 0; y < rect.texture->height; y++) {
-                    auto &src_pixel = rect.texture->pixels[(y * rect.texture->width) + x];
-                    auto &dst_pixel = full_atlas.pixels[((atlas_y + y + rect.y) * full_atlas.width) + (atlas_x + x + rect.x)];
-                    dst_pixel = src_pixel;
-                }
-            }
-#endif
+        if (packed[i].page == -1) {
+            continue;
         }
+
+        rect.x = packed[i].x + (packed[i].page % sqrt_count) * layout.page_size;
+        rect.y = packed[i].y + (packed[i].page / sqrt_count) * layout.page_size;
+        trimmed_width = std::max(trimmed_width, rect.x + rect.extents.width());
+        trimmed_height = std::max(trimmed_height, rect.y + rect.extents.height());
     }
 
     full_atlas.width = full_atlas.meta.width = trimmed_width;
     full_atlas.height = full_atlas.meta.height = trimmed_height;
-    full_atlas.pixels.resize(full_atlas.width * full_atlas.height);
 
     full_atlas_t result;
 
     // compile all of the styles that are available
     // TODO: LMSTYLE16
-    for (size_t i = 0; i < INVALID_LIGHTSTYLE_OLD - 1; i++) {
-        bool any_written = false;
+    std::vector<uint8_t> styles;
+
+    if (!bsp.dlightdata.empty()) {
+        std::array<bool, INVALID_LIGHTSTYLE_OLD> used{};
 
         for (auto &rect : rectangles) {
+            for (size_t s = 0; s < MAXLIGHTMAPS; s++) {
+                if (rect.face->styles[s] < INVALID_LIGHTSTYLE_OLD - 1) {
+                    used[rect.face->styles[s]] = true;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < used.size(); i++) {
+            if (used[i]) {
+                styles.push_back(i);
+            }
+        }
+    }
+
+    // each style's atlas, and each face within it, is written independently
+    std::vector<img::texture> style_atlases(styles.size(), full_atlas);
+
+    tbb::parallel_for(static_cast<size_t>(0), styles.size(), [&](size_t style_num) {
+        img::texture &atlas = style_atlases[style_num];
+        atlas.pixels.resize(atlas.width * atlas.height);
+
+        tbb::parallel_for(static_cast<size_t>(0), rectangles.size(), [&](size_t rect_num) {
+            const face_rect &rect = rectangles[rect_num];
             int32_t style_index = -1;
 
             for (size_t s = 0; s < MAXLIGHTMAPS; s++) {
-                if (rect.face->styles[s] == i) {
+                if (rect.face->styles[s] == styles[style_num]) {
                     style_index = s;
                     break;
                 }
             }
 
-            if (style_index == -1) {
-                continue;
+            if (style_index == -1 || rect.lightofs < 0) {
+                return;
             }
 
-            if (bsp.dlightdata.empty()) {
-                continue;
+            const size_t samples = rect.extents.numsamples() * (is_rgb ? 3 : 1);
+            const size_t offset = ((is_lit ? 3 : 1) * rect.lightofs) + (samples * style_index);
+
+            if (offset + samples > lightdata_size) {
+                return;
             }
 
-            auto in_pixel =
-                lightdata_source + ((is_lit ? 3 : 1) * rect.lightofs) + (rect.extents.numsamples() * (is_rgb ? 3 : 1) * style_index);
+            auto in_pixel = lightdata_source + offset;
 
             for (size_t y = 0; y < rect.extents.height(); y++) {
                 for (size_t x = 0; x < rect.extents.width(); x++) {
                     size_t ox = rect.x + x;
                     size_t oy = rect.y + y;
 
-                    auto &out_pixel = full_atlas.pixels[(oy * full_atlas.width) + ox];
+                    auto &out_pixel = atlas.pixels[(oy * atlas.width) + ox];
                     out_pixel[3] = 255;
 
                     if (is_rgb) {
@@ -439,21 +407,14 @@ full_atlas_t build_lightmap_atlas(const mbsp_t &bsp, const bspxentries_t &bspx,
                     }
                 }
             }
+        });
+    });
 
-            any_written = true;
-        }
-
-        if (!any_written) {
-            continue;
-        }
-
-        // copy out the atlas texture
-        result.style_to_lightmap_atlas[i] = full_atlas;
-
-        memset(full_atlas.pixels.data(), 0, sizeof(*full_atlas.pixels.data()) * full_atlas.pixels.size());
+    for (size_t i = 0; i < styles.size(); i++) {
+        result.style_to_lightmap_atlas[styles[i]] = std::move(style_atlases[i]);
     }
 
-    auto ExportLightmapUVs = [&full_atlas, &result](const mbsp_t *bsp, const face_rect &face) {
+    auto ExportLightmapUVs = [&full_atlas](const mbsp_t *bsp, const face_rect &face) {
         std::vector<qvec2f> face_lightmap_uvs;
 
         for (int i = 0; i < face.face->numedges; i++) {
@@ -474,11 +435,16 @@ full_atlas_t build_lightmap_atlas(const mbsp_t &bsp, const bspxentries_t &bspx,
             face_lightmap_uvs.push_back(tc);
         }
 
-        result.facenum_to_lightmap_uvs[Face_GetNum(bsp, face.face)] = std::move(face_lightmap_uvs);
+        return face_lightmap_uvs;
     };
 
-    for (auto &rect : rectangles) {
-        ExportLightmapUVs(&bsp, rect);
+    std::vector<std::vector<qvec2f>> uvs(rectangles.size());
+
+    tbb::parallel_for(static_cast<size_t>(0), rectangles.size(),
+        [&](size_t i) { uvs[i] = ExportLightmapUVs(&bsp, rectangles[i]); });
+
+    for (size_t i = 0; i < rectangles.size(); i++) {
+        result.facenum_to_lightmap_uvs[Face_GetNum(&bsp, rectangles[i].face)] = std::move(uvs[i]);
     }
 
     return result;
@@ -494,20 +460,32 @@ static void export_obj_and_lightmaps(const mbsp_t &bsp, const bspxentries_t &bsp
         return;
     }
 
-    // write .png's, one per style
+    // write .png's, one per style, encoding them in parallel
+    std::vector<std::pair<int, const img::texture *>> style_atlases;
+    std::vector<fs::path> style_paths;
+
     for (const auto &[i, full_atlas] : atlas.style_to_lightmap_atlas) {
-        lightmaps_path.replace_filename(lightmaps_path.stem().string() + "_" + std::to_string(i) + ".png");
-        std::ofstream strm(lightmaps_path, std::ofstream::out | std::ofstream::binary);
+        style_atlases.emplace_back(i, &full_atlas);
+        style_paths.push_back(fs::path(lightmaps_path)
+                                  .replace_filename(lightmaps_path.stem().string() + "_" + std::to_string(i) + ".png"));
+    }
+
+    tbb::parallel_for(static_cast<size_t>(0), style_atlases.size(), [&](size_t i) {
+        const img::texture &full_atlas = *style_atlases[i].second;
+        std::ofstream strm(style_paths[i], std::ofstream::out | std::ofstream::binary);
         stbi_write_png_to_func(
             [](void *context, void *data, int size) {
                 std::ofstream &strm = *((std::ofstream *)context);
                 strm.write((const char *)data, size);
             },
             &strm, full_atlas.width, full_atlas.height, 4, full_atlas.pixels.data(), full_atlas.width * 4);
-        logging::print("wrote {}\n", lightmaps_path);
+    });
+
+    for (auto &path : style_paths) {
+        logging::print("wrote {}\n", path);
     }
 
-    auto ExportObjFace = [&atlas](std::ostream &f, const mbsp_t *bsp, int face_num, int &vertcount) {
+    auto ExportObjFace = [&atlas](std::string &f, const mbsp_t *bsp, int face_num, int vertcount) {
         const auto *face = BSP_GetFace(bsp, face_num);
 
         const auto &tcs = atlas.facenum_to_lightmap_uvs.at(face_num);
@@ -517,34 +495,45 @@ static void export_obj_and_lightmaps(const mbsp_t &bsp, const bspxentries_t &bsp
             const int vertnum = Face_VertexAtIndex(bsp, face, i);
             const qvec3f normal = bsp->dplanes[face->planenum].normal;
             const qvec3f &pos = bsp->dvertexes[vertnum];
-            ewt::print(f, "v {:.9} {:.9} {:.9}\n", pos[0], pos[1], pos[2]);
-            ewt::print(f, "vn {:.9} {:.9} {:.9}\n", normal[0], normal[1], normal[2]);
+            fmt::format_to(std::back_inserter(f), "v {:.9} {:.9} {:.9}\n", pos[0], pos[1], pos[2]);
+            fmt::format_to(std::back_inserter(f), "vn {:.9} {:.9} {:.9}\n", normal[0], normal[1], normal[2]);
 
             qvec2f tc = tcs[i];
 
             tc[1] = 1.0 - tc[1];
 
-            ewt::print(f, "vt {:.9} {:.9}\n", tc[0], tc[1]);
+            fmt::format_to(std::back_inserter(f), "vt {:.9} {:.9}\n", tc[0], tc[1]);
         }
 
-        f << "f";
+        f += "f";
         for (int i = 0; i < face->numedges; i++) {
             // .obj vertexes start from 1
             // .obj faces are CCW, quake is CW, so reverse the order
             const int vertindex = vertcount + (face->numedges - 1 - i) + 1;
-            ewt::print(f, " {0}/{0}/{0}", vertindex);
+            fmt::format_to(std::back_inserter(f), " {0}/{0}/{0}", vertindex);
         }
-        f << '\n';
-
-        vertcount += face->numedges;
+        f += '\n';
     };
 
     auto ExportObj = [&ExportObjFace, &obj_path](const mbsp_t *bsp) {
-        std::ofstream objstream(obj_path, std::ofstream::out);
+        // each face's first vertex index, so faces can be formatted in parallel
+        std::vector<int> vertcounts(bsp->dfaces.size());
         int vertcount = 0;
 
-        for (int i = 0; i < bsp->dfaces.size(); ++i) {
-            ExportObjFace(objstream, bsp, i, vertcount);
+        for (size_t i = 0; i < bsp->dfaces.size(); ++i) {
+            vertcounts[i] = vertcount;
+            vertcount += bsp->dfaces[i].numedges;
+        }
+
+        std::vector<std::string> faces(bsp->dfaces.size());
+
+        tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(),
+            [&](size_t i) { ExportObjFace(faces[i], bsp, i, vertcounts[i]); });
+
+        std::ofstream objstream(obj_path, std::ofstream::out);
+
+        for (auto &face : faces) {
+            objstream << face;
         }
     };
 
@@ -553,135 +542,125 @@ static void export_obj_and_lightmaps(const mbsp_t &bsp, const bspxentries_t &bsp
     logging::print("wrote {}\n", obj_path);
 }
 
-void serialize_bsp(const bspdata_t &bspdata, const mbsp_t &bsp, const fs::path &name)
-{
-    json j = json::object();
+// members of the json output, in the (sorted) order they're written
+static constexpr std::string_view BSP_JSON_LUMPS[] = {"brushes", "brushsides", "bspxentries", "clipnodes", "edges",
+    "entdata", "faces", "leafbrushes", "leaffaces", "leafs", "lightdata", "models", "nodes", "planes", "surfedges",
+    "texinfo", "textures", "vertexes", "visdata"};
 
-    if (!bsp.dmodels.empty()) {
-        json &models = (j.emplace("models", json::array())).first.value();
+// elements built and formatted in parallel per batch; images are much larger than other elements
+constexpr size_t ELEMENT_BATCH = 4096;
+constexpr size_t IMAGE_BATCH = 64;
 
-        for (auto &src_model : bsp.dmodels) {
-            json &model = models.insert(models.end(), json::object()).value();
+/**
+ * Writes one array member, where f(i) returns element i.
+ */
+template<typename F>
+static void write_array_lump(json_stream_writer_t &writer, std::string_view name, size_t count, size_t batch, F &&f)
+{
+    writer.key(name);
+    writer.begin_array();
+    writer.elements(count, batch, std::forward<F>(f));
+    writer.end_array();
+}
 
-            model.push_back({"mins", src_model.mins});
-            model.push_back({"maxs", src_model.maxs});
-            model.push_back({"origin", src_model.origin});
-            model.push_back({"headnode", src_model.headnode});
-            model.push_back({"visleafs", src_model.visleafs});
-            model.push_back({"firstface", src_model.firstface});
-            model.push_back({"numfaces", src_model.numfaces});
+void serialize_bsp(const bspdata_t &bspdata, const mbsp_t &bsp, std::ostream &stream, const bsp_json_options_t &options)
+{
+    for (auto &name : options.lumps) {
+        if (std::find(std::begin(BSP_JSON_LUMPS), std::end(BSP_JSON_LUMPS), name) == std::end(BSP_JSON_LUMPS)) {
+            FError("unknown lump \"{}\"", name);
         }
     }
 
-    if (bsp.dvis.bits.size()) {
+    auto wanted = [&options](std::string_view name) {
+        return options.lumps.empty() ||
+               std::find(options.lumps.begin(), options.lumps.end(), name) != options.lumps.end();
+    };
 
-        if (bsp.dvis.bit_offsets.size()) {
-            json &visdata = (j.emplace("visdata", json::object())).first.value();
+    json_stream_writer_t writer(stream);
+    writer.begin_object();
 
-            json &pvs = (visdata.emplace("pvs", json::array())).first.value();
-            json &phs = (visdata.emplace("pvs", json::array())).first.value();
+    if (!bsp.dbrushes.empty() && wanted("brushes")) {
+        write_array_lump(writer, "brushes", bsp.dbrushes.size(), ELEMENT_BATCH, [&](size_t i) {
+            auto &src_brush = bsp.dbrushes[i];
+            json brush = json::object();
 
-            for (auto &offset : bsp.dvis.bit_offsets) {
-                pvs.push_back(offset[VIS_PVS]);
-                phs.push_back(offset[VIS_PHS]);
-            }
-
-            visdata["bits"] = hex_string(bsp.dvis.bits.data(), bsp.dvis.bits.size());
-        } else {
-            j["visdata"] = hex_string(bsp.dvis.bits.data(), bsp.dvis.bits.size());
-        }
-    }
-
-    if (bsp.dlightdata.size()) {
-        j["lightdata"] = hex_string(bsp.dlightdata.data(), bsp.dlightdata.size());
-    }
+            brush.push_back({"firstside", src_brush.firstside});
+            brush.push_back({"numsides", src_brush.numsides});
+            brush.push_back({"contents", src_brush.contents});
 
-    if (!bsp.dentdata.empty()) {
-        j["entdata"] = bsp.dentdata + '\0';
+            return brush;
+        });
     }
 
-    if (!bsp.dleafs.empty()) {
-        json &leafs = (j.emplace("leafs", json::array())).first.value();
+    if (!bsp.dbrushsides.empty() && wanted("brushsides")) {
+        write_array_lump(writer, "brushsides", bsp.dbrushsides.size(), ELEMENT_BATCH, [&](size_t i) {
+            auto &src_brushside = bsp.dbrushsides[i];
+            json brushside = json::object();
 
-        for (auto &src_leaf : bsp.dleafs) {
-            json &leaf = leafs.insert(leafs.end(), json::object()).value();
+            brushside.push_back({"planenum", src_brushside.planenum});
+            brushside.push_back({"texinfo", src_brushside.texinfo});
 
-            leaf.push_back({"contents", src_leaf.contents});
-            leaf.push_back({"visofs", src_leaf.visofs});
-            leaf.push_back({"mins", src_leaf.mins});
-            leaf.push_back({"maxs", src_leaf.maxs});
-            leaf.push_back({"firstmarksurface", src_leaf.firstmarksurface});
-            leaf.push_back({"nummarksurfaces", src_leaf.nummarksurfaces});
-            leaf.push_back({"ambient_level", src_leaf.ambient_level});
-            leaf.push_back({"cluster", src_leaf.cluster});
-            leaf.push_back({"area", src_leaf.area});
-            leaf.push_back({"firstleafbrush", src_leaf.firstleafbrush});
-            leaf.push_back({"numleafbrushes", src_leaf.numleafbrushes});
-        }
+            return brushside;
+        });
     }
 
-    if (!bsp.dplanes.empty()) {
-        json &planes = (j.emplace("planes", json::array())).first.value();
+    if (!bspdata.bspx.entries.empty() && wanted("bspxentries")) {
+        writer.key("bspxentries");
+        writer.begin_array();
 
-        for (auto &src_plane : bsp.dplanes) {
-            json &plane = planes.insert(planes.end(), json::object()).value();
-
-            plane.push_back({"normal", src_plane.normal});
-            plane.push_back({"dist", src_plane.dist});
-            plane.push_back({"type", src_plane.type});
-        }
-    }
+        for (auto &lump : bspdata.bspx.entries) {
+            writer.begin_object();
 
-    if (!bsp.dvertexes.empty()) {
-        json &vertexes = (j.emplace("vertexes", json::array())).first.value();
+            if (lump.first == "BRUSHLIST") {
+                writer.key("lumpname");
+                writer.value(lump.first);
+                writer.key("models");
+                writer.value(serialize_bspxbrushlist(lump.second));
+            } else if (lump.first == "DECOUPLED_LM") {
+                writer.key("faces");
+                writer.value(serialize_bspx_decoupled_lm(lump.second));
+                writer.key("lumpname");
+                writer.value(lump.first);
+            } else {
+                // unhandled BSPX lump, just write the raw data
+                writer.key("lumpdata");
+                writer.hex_value(lump.second.data(), lump.second.size());
+                writer.key("lumpname");
+                writer.value(lump.first);
+            }
 
-        for (auto &src_vertex : bsp.dvertexes) {
-            vertexes.insert(vertexes.end(), src_vertex);
+            writer.end_object();
         }
-    }
 
-    if (!bsp.dnodes.empty()) {
-        json &nodes = (j.emplace("nodes", json::array())).first.value();
+        writer.end_array();
+    }
 
-        for (auto &src_node : bsp.dnodes) {
-            json &node = nodes.insert(nodes.end(), json::object()).value();
+    if (!bsp.dclipnodes.empty() && wanted("clipnodes")) {
+        write_array_lump(writer, "clipnodes", bsp.dclipnodes.size(), ELEMENT_BATCH, [&](size_t i) {
+            auto &src_clipnodes = bsp.dclipnodes[i];
+            json clipnode = json::object();
 
-            node.push_back({"planenum", src_node.planenum});
-            node.push_back({"children", src_node.children});
-            node.push_back({"mins", src_node.mins});
-            node.push_back({"maxs", src_node.maxs});
-            node.push_back({"firstface", src_node.firstface});
-            node.push_back({"numfaces", src_node.numfaces});
+            clipnode.push_back({"planenum", src_clipnodes.planenum});
+            clipnode.push_back({"children", src_clipnodes.children});
 
-            // human-readable plane
-            auto &plane = bsp.dplanes.at(src_node.planenum);
-            node.push_back({"plane", json::array({plane.normal[0], plane.normal[1], plane.normal[2], plane.dist})});
-        }
+            return clipnode;
+        });
     }
 
-    if (!bsp.texinfo.empty()) {
-        json &texinfos = (j.emplace("texinfo", json::array())).first.value();
-
-        for (auto &src_texinfo : bsp.texinfo) {
-            json &texinfo = texinfos.insert(texinfos.end(), json::object()).value();
-
-            texinfo.push_back({"vecs", json::array({json::array({src_texinfo.vecs.at(0, 0), src_texinfo.vecs.at(0, 1),
-                                                        src_texinfo.vecs.at(0, 2), src_texinfo.vecs.at(0, 3)}),
-                                           json::array({src_texinfo.vecs.at(1, 0), src_texinfo.vecs.at(1, 1),
-                                               src_texinfo.vecs.at(1, 2), src_texinfo.vecs.at(1, 3)})})});
-            texinfo.push_back({"flags", src_texinfo.flags.native});
-            texinfo.push_back({"miptex", src_texinfo.miptex});
-            texinfo.push_back({"value", src_texinfo.value});
-            texinfo.push_back({"texture", std::string(src_texinfo.texture.data())});
-            texinfo.push_back({"nexttexinfo", src_texinfo.nexttexinfo});
-        }
+    if (!bsp.dedges.empty() && wanted("edges")) {
+        write_array_lump(
+            writer, "edges", bsp.dedges.size(), ELEMENT_BATCH, [&](size_t i) { return json(bsp.dedges[i]); });
     }
 
-    if (!bsp.dfaces.empty()) {
-        json &faces = (j.emplace("faces", json::array())).first.value();
+    if (!bsp.dentdata.empty() && wanted("entdata")) {
+        writer.key("entdata");
+        writer.value(bsp.dentdata + '\0');
+    }
 
-        for (auto &src_face : bsp.dfaces) {
-            json &face = faces.insert(faces.end(), json::object()).value();
+    if (!bsp.dfaces.empty() && wanted("faces")) {
+        write_array_lump(writer, "faces", bsp.dfaces.size(), ELEMENT_BATCH, [&](size_t i) {
+            auto &src_face = bsp.dfaces[i];
+            json face = json::object();
 
             face.push_back({"planenum", src_face.planenum});
             face.push_back({"side", src_face.side});
@@ -700,90 +679,131 @@ void serialize_bsp(const bspdata_t &bspdata, const mbsp_t &bsp, const fs::path &
             }
             face.push_back({"vertices", verts});
 
-#if 0
-            if (auto lm = get_lightmap_face(bsp, src_face, false)) {
-                face.push_back({"lightmap", serialize_image(lm)});
-            }
-#endif
-        }
+            return face;
+        });
     }
 
-    if (!bsp.dclipnodes.empty()) {
-        json &clipnodes = (j.emplace("clipnodes", json::array())).first.value();
-
-        for (auto &src_clipnodes : bsp.dclipnodes) {
-            json &clipnode = clipnodes.insert(clipnodes.end(), json::object()).value();
+    if (!bsp.dleafbrushes.empty() && wanted("leafbrushes")) {
+        write_array_lump(writer, "leafbrushes", bsp.dleafbrushes.size(), ELEMENT_BATCH,
+            [&](size_t i) { return json(bsp.dleafbrushes[i]); });
+    }
 
-            clipnode.push_back({"planenum", src_clipnodes.planenum});
-            clipnode.push_back({"children", src_clipnodes.children});
-        }
+    if (!bsp.dleaffaces.empty() && wanted("leaffaces")) {
+        write_array_lump(writer, "leaffaces", bsp.dleaffaces.size(), ELEMENT_BATCH,
+            [&](size_t i) { return json(bsp.dleaffaces[i]); });
     }
 
-    if (!bsp.dedges.empty()) {
-        json &edges = (j.emplace("edges", json::array())).first.value();
+    if (!bsp.dleafs.empty() && wanted("leafs")) {
+        write_array_lump(writer, "leafs", bsp.dleafs.size(), ELEMENT_BATCH, [&](size_t i) {
+            auto &src_leaf = bsp.dleafs[i];
+            json leaf = json::object();
 
-        for (auto &src_edge : bsp.dedges) {
-            edges.insert(edges.end(), src_edge);
-        }
-    }
+            leaf.push_back({"contents", src_leaf.contents});
+            leaf.push_back({"visofs", src_leaf.visofs});
+            leaf.push_back({"mins", src_leaf.mins});
+            leaf.push_back({"maxs", src_leaf.maxs});
+            leaf.push_back({"firstmarksurface", src_leaf.firstmarksurface});
+            leaf.push_back({"nummarksurfaces", src_leaf.nummarksurfaces});
+            leaf.push_back({"ambient_level", src_leaf.ambient_level});
+            leaf.push_back({"cluster", src_leaf.cluster});
+            leaf.push_back({"area", src_leaf.area});
+            leaf.push_back({"firstleafbrush", src_leaf.firstleafbrush});
+            leaf.push_back({"numleafbrushes", src_leaf.numleafbrushes});
 
-    if (!bsp.dleaffaces.empty()) {
-        json &leaffaces = (j.emplace("leaffaces", json::array())).first.value();
+            return leaf;
+        });
+    }
 
-        for (auto &src_leafface : bsp.dleaffaces) {
-            leaffaces.insert(leaffaces.end(), src_leafface);
-        }
+    if (bsp.dlightdata.size() && wanted("lightdata")) {
+        writer.key("lightdata");
+        writer.hex_value(bsp.dlightdata.data(), bsp.dlightdata.size());
     }
 
-    if (!bsp.dsurfedges.empty()) {
-        json &surfedges = (j.emplace("surfedges", json::array())).first.value();
+    if (!bsp.dmodels.empty() && wanted("models")) {
+        write_array_lump(writer, "models", bsp.dmodels.size(), ELEMENT_BATCH, [&](size_t i) {
+            auto &src_model = bsp.dmodels[i];
+            json model = json::object();
 
-        for (auto &src_surfedges : bsp.dsurfedges) {
-            surfedges.insert(surfedges.end(), src_surfedges);
-        }
+            model.push_back({"mins", src_model.mins});
+            model.push_back({"maxs", src_model.maxs});
+            model.push_back({"origin", src_model.origin});
+            model.push_back({"headnode", src_model.headnode});
+            model.push_back({"visleafs", src_model.visleafs});
+            model.push_back({"firstface", src_model.firstface});
+            model.push_back({"numfaces", src_model.numfaces});
+
+            return model;
+        });
     }
 
-    if (!bsp.dbrushsides.empty()) {
-        json &brushsides = (j.emplace("brushsides", json::array())).first.value();
+    if (!bsp.dnodes.empty() && wanted("nodes")) {
+        write_array_lump(writer, "nodes", bsp.dnodes.size(), ELEMENT_BATCH, [&](size_t i) {
+            auto &src_node = bsp.dnodes[i];
+            json node = json::object();
 
-        for (auto &src_brushside : bsp.dbrushsides) {
-            json &brushside = brushsides.insert(brushsides.end(), json::object()).value();
+            node.push_back({"planenum", src_node.planenum});
+            node.push_back({"children", src_node.children});
+            node.push_back({"mins", src_node.mins});
+            node.push_back({"maxs", src_node.maxs});
+            node.push_back({"firstface", src_node.firstface});
+            node.push_back({"numfaces", src_node.numfaces});
 
-            brushside.push_back({"planenum", src_brushside.planenum});
-            brushside.push_back({"texinfo", src_brushside.texinfo});
-        }
+            // human-readable plane
+            auto &plane = bsp.dplanes.at(src_node.planenum);
+            node.push_back({"plane", json::array({plane.normal[0], plane.normal[1], plane.normal[2], plane.dist})});
+
+            return node;
+        });
     }
 
-    if (!bsp.dbrushes.empty()) {
-        json &brushes = (j.emplace("brushes", json::array())).first.value();
+    if (!bsp.dplanes.empty() && wanted("planes")) {
+        write_array_lump(writer, "planes", bsp.dplanes.size(), ELEMENT_BATCH, [&](size_t i) {
+            auto &src_plane = bsp.dplanes[i];
+            json plane = json::object();
 
-        for (auto &src_brush : bsp.dbrushes) {
-            json &brush = brushes.insert(brushes.end(), json::object()).value();
+            plane.push_back({"normal", src_plane.normal});
+            plane.push_back({"dist", src_plane.dist});
+            plane.push_back({"type", src_plane.type});
 
-            brush.push_back({"firstside", src_brush.firstside});
-            brush.push_back({"numsides", src_brush.numsides});
-            brush.push_back({"contents", src_brush.contents});
-        }
+            return plane;
+        });
     }
 
-    if (!bsp.dleafbrushes.empty()) {
-        json &leafbrushes = (j.emplace("leafbrushes", json::array())).first.value();
+    if (!bsp.dsurfedges.empty() && wanted("surfedges")) {
+        write_array_lump(writer, "surfedges", bsp.dsurfedges.size(), ELEMENT_BATCH,
+            [&](size_t i) { return json(bsp.dsurfedges[i]); });
+    }
 
-        for (auto &src_leafbrush : bsp.dleafbrushes) {
-            leafbrushes.push_back(src_leafbrush);
-        }
+    if (!bsp.texinfo.empty() && wanted("texinfo")) {
+        write_array_lump(writer, "texinfo", bsp.texinfo.size(), ELEMENT_BATCH, [&](size_t i) {
+            auto &src_texinfo = bsp.texinfo[i];
+            json texinfo = json::object();
+
+            texinfo.push_back({"vecs", json::array({json::array({src_texinfo.vecs.at(0, 0), src_texinfo.vecs.at(0, 1),
+                                                        src_texinfo.vecs.at(0, 2), src_texinfo.vecs.at(0, 3)}),
+                                           json::array({src_texinfo.vecs.at(1, 0), src_texinfo.vecs.at(1, 1),
+                                               src_texinfo.vecs.at(1, 2), src_texinfo.vecs.at(1, 3)})})});
+            texinfo.push_back({"flags", src_texinfo.flags.native});
+            texinfo.push_back({"miptex", src_texinfo.miptex});
+            texinfo.push_back({"value", src_texinfo.value});
+            texinfo.push_back({"texture", std::string(src_texinfo.texture.data())});
+            texinfo.push_back({"nexttexinfo", src_texinfo.nexttexinfo});
+
+            return texinfo;
+        });
     }
 
-    if (bsp.dtex.textures.size()) {
-        json &textures = (j.emplace("textures", json::array())).first.value();
+    if (bsp.dtex.textures.size() && wanted("textures")) {
+        // the mip images are PNG encoded in parallel, IMAGE_BATCH at a time
+        write_array_lump(writer, "textures", bsp.dtex.textures.size(), IMAGE_BATCH, [&](size_t i) {
+            auto &src_tex = bsp.dtex.textures[i];
 
-        for (auto &src_tex : bsp.dtex.textures) {
             if (src_tex.null_texture) {
                 // use json null to indicate offset -1
-                textures.insert(textures.end(), json(nullptr));
-                continue;
+                return json(nullptr);
             }
-            json &tex = textures.insert(textures.end(), json::object()).value();
+
+            json tex = json::object();
 
             tex.push_back({"name", src_tex.name});
             tex.push_back({"width", src_tex.width});
@@ -794,43 +814,50 @@ void serialize_bsp(const bspdata_t &bspdata, const mbsp_t &bsp, const fs::path &
                 mips.emplace_back(
                     serialize_image(img::load_mip(src_tex.name, src_tex.data, false, bspdata.loadversion->game)));
             }
-        }
+
+            return tex;
+        });
     }
 
-    if (!bspdata.bspx.entries.empty()) {
-        json &bspxentries = (j.emplace("bspxentries", json::array())).first.value();
+    if (!bsp.dvertexes.empty() && wanted("vertexes")) {
+        write_array_lump(writer, "vertexes", bsp.dvertexes.size(), ELEMENT_BATCH,
+            [&](size_t i) { return json(bsp.dvertexes[i]); });
+    }
 
-        for (auto &lump : bspdata.bspx.entries) {
-            json &entry = bspxentries.insert(bspxentries.end(), json::object()).value();
-            entry["lumpname"] = lump.first;
+    if (bsp.dvis.bits.size() && wanted("visdata")) {
+        writer.key("visdata");
 
-            if (lump.first == "BRUSHLIST") {
-                entry["models"] = serialize_bspxbrushlist(lump.second);
-            } else if (lump.first == "DECOUPLED_LM") {
-                entry["faces"] = serialize_bspx_decoupled_lm(lump.second);
-            } else {
-                // unhandled BSPX lump, just write the raw data
-                entry["lumpdata"] = hex_string(lump.second.data(), lump.second.size());
+        if (bsp.dvis.bit_offsets.size()) {
+            json pvs = json::array(), phs = json::array();
+
+            for (auto &offset : bsp.dvis.bit_offsets) {
+                pvs.push_back(offset[VIS_PVS]);
+                phs.push_back(offset[VIS_PHS]);
             }
+
+            writer.begin_object();
+            writer.key("bits");
+            writer.hex_value(bsp.dvis.bits.data(), bsp.dvis.bits.size());
+            writer.key("phs");
+            writer.value(phs);
+            writer.key("pvs");
+            writer.value(pvs);
+            writer.end_object();
+        } else {
+            writer.hex_value(bsp.dvis.bits.data(), bsp.dvis.bits.size());
         }
     }
 
-    // lightmap atlas
-#if 0
-    for (int32_t i = 0; i < MAXLIGHTMAPS; i++) {
-        if (auto lm = generate_lightmap_atlases(bsp, bspdata.bspx.entries, false); !lm.empty()) {
-            j.emplace("lightmaps", std::move(lm));
-        }
+    writer.end_object();
+}
 
-        if (bspdata.bspx.entries.find("LMOFFSET") != bspdata.bspx.entries.end()) {
-            if (auto lm = generate_lightmap_atlases(bsp, bspdata.bspx.entries, true); !lm.empty()) {
-                j.emplace("bspx_lightmaps", std::move(lm));
-            }
-        }
+void serialize_bsp(const bspdata_t &bspdata, const mbsp_t &bsp, const fs::path &name, const bsp_json_options_t &options)
+{
+    {
+        std::ofstream stream(name, std::fstream::out | std::fstream::trunc);
+        serialize_bsp(bspdata, bsp, stream, options);
     }
-#endif
+
     export_obj_and_lightmaps(bsp, bspdata.bspx.entries, false, true, fs::path(name).replace_extension(".geometry.obj"),
         fs::path(name).replace_extension(".lm.png"));
-
-    std::ofstream(name, std::fstream::out | std::fstream::trunc) << std::setw(4) << j;
 }
@@ -26,6 +26,16 @@
 #include <common/log.hh>
 #include <common/qvec.hh>
 
+#include <tbb/parallel_for.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PVS_USE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PVS_USE_NEON
+#endif
+
 const dmodelh2_t *BSP_GetWorldModel(const mbsp_t *bsp)
 {
     // We only support .bsp's that have a world model
@@ -751,6 +761,295 @@ std::unordered_map<int, std::vector<uint8_t>> DecompressAllVis(const mbsp_t *bsp
     return result;
 }
 
+pvs_matrix_t::pvs_matrix_t(const mbsp_t *bsp)
+    : m_leaf_rows(bsp->dleafs.size(), -1),
+      m_leaf_bits(bsp->dleafs.size(), -1)
+{
+    if (bsp->dvis.bits.empty()) {
+        return;
+    }
+
+    m_row_size = DecompressedVisSize(bsp);
+    m_row_stride = ((m_row_size + PVS_ROW_ALIGNMENT - 1) / PVS_ROW_ALIGNMENT) * PVS_ROW_ALIGNMENT;
+
+    // compressed visdata offset for each row
+    std::vector<int32_t> row_visofs;
+
+    if (bsp->loadversion->game->id == GAME_QUAKE_II) {
+        const int num_clusters = bsp->dvis.bit_offsets.size();
+        std::vector<int32_t> cluster_rows(num_clusters, -1);
+
+        for (int cluster = 0; cluster < num_clusters; ++cluster) {
+            const int32_t visofs = bsp->dvis.get_bit_offset(VIS_PVS, cluster);
+
+            if (visofs >= bsp->dvis.bits.size()) {
+                logging::print("pvs_matrix_t: invalid visofs for cluster {}\n", cluster);
+                continue;
+            }
+
+            cluster_rows[cluster] = row_visofs.size();
+            row_visofs.push_back(visofs);
+        }
+
+        for (size_t leafnum = 0; leafnum < bsp->dleafs.size(); ++leafnum) {
+            const int cluster = bsp->dleafs[leafnum].cluster;
+
+            if (cluster < 0 || cluster >= num_clusters || cluster_rows[cluster] < 0) {
+                continue;
+            }
+
+            m_leaf_rows[leafnum] = cluster_rows[cluster];
+            m_leaf_bits[leafnum] = cluster;
+        }
+    } else {
+        // func_detail leafs share a visofs; only decompress each one once
+        std::unordered_map<int32_t, int32_t> visofs_rows;
+
+        for (size_t leafnum = 0; leafnum < bsp->dleafs.size(); ++leafnum) {
+            const int32_t visofs = bsp->dleafs[leafnum].visofs;
+            const int visleaf = LeafnumToVisleaf(leafnum);
+
+            // leaf 0 is the shared solid leaf, and can't be seen into
+            if (leafnum != 0 && visleaf < bsp->dmodels[0].visleafs) {
+                m_leaf_bits[leafnum] = visleaf;
+            }
+
+            if (visofs < 0) {
+                continue;
+            }
+
+            if (auto it = visofs_rows.find(visofs); it != visofs_rows.end()) {
+                m_leaf_rows[leafnum] = it->second;
+                continue;
+            }
+
+            if (visofs >= bsp->dvis.bits.size()) {
+                logging::print("pvs_matrix_t: invalid visofs for leaf {}\n", leafnum);
+                continue;
+            }
+
+            const int32_t row = row_visofs.size();
+            visofs_rows.emplace(visofs, row);
+            row_visofs.push_back(visofs);
+            m_leaf_rows[leafnum] = row;
+        }
+    }
+
+    // padding bytes stay zero, so whole-stride unions/intersections are safe
+    m_bits.resize(row_visofs.size() * m_row_stride);
+
+    tbb::parallel_for(static_cast<size_t>(0), row_visofs.size(), [&](const size_t &row) {
+        uint8_t *out = m_bits.data() + (row * m_row_stride);
+        DecompressVis(bsp->dvis.bits.data() + row_visofs[row], bsp->dvis.bits.data() + bsp->dvis.bits.size(), out,
+            out + m_row_size);
+    });
+}
+
+void Pvs_Union(uint8_t *dst, const uint8_t *src, size_t numbytes)
+{
+    size_t i = 0;
+
+#if defined(PVS_USE_SSE2)
+    for (; i + 16 <= numbytes; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_or_si128(a, b));
+    }
+#elif defined(PVS_USE_NEON)
+    for (; i + 16 <= numbytes; i += 16) {
+        vst1q_u8(dst + i, vorrq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+    }
+#endif
+
+    for (; i < numbytes; i++) {
+        dst[i] |= src[i];
+    }
+}
+
+bool Pvs_Intersects(const uint8_t *a, const uint8_t *b, size_t numbytes)
+{
+    size_t i = 0;
+
+#if defined(PVS_USE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= numbytes; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(va, vb), zero)) != 0xFFFF) {
+            return true;
+        }
+    }
+#elif defined(PVS_USE_NEON)
+    for (; i + 16 <= numbytes; i += 16) {
+        const uint8x16_t both = vandq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        if (vmaxvq_u8(both) != 0) {
+            return true;
+        }
+    }
+#endif
+
+    for (; i < numbytes; i++) {
+        if (a[i] & b[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// cells are roughly this many units on each side, capped at LEAF_LOCATOR_MAX_CELLS per axis
+constexpr double LEAF_LOCATOR_CELL_SIZE = 128.0;
+constexpr int32_t LEAF_LOCATOR_MAX_CELLS = 64;
+// cells are grown by this much when classified against node planes, so points that round
+// into a neighbouring cell still get a start node that contains them
+constexpr double LEAF_LOCATOR_CELL_EPSILON = 0.1;
+
+leaf_locator_t::leaf_locator_t(const mbsp_t *bsp, const dmodelh2_t *model)
+    : m_bsp(bsp),
+      m_headnode(model->headnode[0])
+{
+    m_nodes.resize(bsp->dnodes.size());
+
+    for (size_t i = 0; i < bsp->dnodes.size(); i++) {
+        const bsp2_dnode_t &in = bsp->dnodes[i];
+        const dplane_t &plane = bsp->dplanes[in.planenum];
+        node_t &out = m_nodes[i];
+
+        // match dplane_t::distance_to_fast, which ignores the normal of axial planes
+        switch (static_cast<plane_type_t>(plane.type)) {
+            case plane_type_t::PLANE_X: out.normal = {1, 0, 0}; break;
+            case plane_type_t::PLANE_Y: out.normal = {0, 1, 0}; break;
+            case plane_type_t::PLANE_Z: out.normal = {0, 0, 1}; break;
+            default: out.normal = plane.normal; break;
+        }
+
+        out.dist = plane.dist;
+        out.children = in.children;
+    }
+
+    // build the jump table over the model bounds
+    const qvec3d mins = qvec3d(model->mins) - qvec3d(1, 1, 1);
+    const qvec3d maxs = qvec3d(model->maxs) + qvec3d(1, 1, 1);
+    qvec3d cell_size;
+
+    for (int i = 0; i < 3; i++) {
+        const double extent = maxs[i] - mins[i];
+
+        if (!(extent > 0)) {
+            return;
+        }
+
+        m_grid_size[i] =
+            std::clamp(static_cast<int32_t>(ceil(extent / LEAF_LOCATOR_CELL_SIZE)), 1, LEAF_LOCATOR_MAX_CELLS);
+        cell_size[i] = extent / m_grid_size[i];
+        m_inv_cell_size[i] = 1.0 / cell_size[i];
+    }
+
+    m_grid_mins = mins;
+    m_cells.resize(static_cast<size_t>(m_grid_size[0]) * m_grid_size[1] * m_grid_size[2]);
+
+    tbb::parallel_for(static_cast<size_t>(0), m_cells.size(), [&](size_t i) {
+        const size_t x = i % m_grid_size[0];
+        const size_t y = (i / m_grid_size[0]) % m_grid_size[1];
+        const size_t z = i / (static_cast<size_t>(m_grid_size[0]) * m_grid_size[1]);
+
+        const qvec3d half = (cell_size * 0.5) + qvec3d(LEAF_LOCATOR_CELL_EPSILON);
+        const qvec3d center = m_grid_mins + (qvec3d(x + 0.5, y + 0.5, z + 0.5) * cell_size);
+
+        // descend as long as the whole cell is on one side of the node
+        int32_t num = m_headnode;
+
+        while (num >= 0) {
+            const node_t &node = m_nodes[num];
+            const double d = qv::dot(center, node.normal) - node.dist;
+            const double r = fabs(node.normal[0]) * half[0] + fabs(node.normal[1]) * half[1] +
+                             fabs(node.normal[2]) * half[2];
+
+            if (d - r >= 0) {
+                num = node.children[0];
+            } else if (d + r < 0) {
+                num = node.children[1];
+            } else {
+                break;
+            }
+        }
+
+        m_cells[i] = num;
+    });
+}
+
+int32_t leaf_locator_t::start_node(const qvec3d &point) const
+{
+    if (m_cells.empty()) {
+        return m_headnode;
+    }
+
+    const qvec3d local = (point - m_grid_mins) * m_inv_cell_size;
+
+    // written so NaN also falls back to the head node
+    if (!(local[0] >= 0 && local[0] < m_grid_size[0] && local[1] >= 0 && local[1] < m_grid_size[1] &&
+            local[2] >= 0 && local[2] < m_grid_size[2])) {
+        return m_headnode;
+    }
+
+    const size_t x = static_cast<size_t>(local[0]);
+    const size_t y = static_cast<size_t>(local[1]);
+    const size_t z = static_cast<size_t>(local[2]);
+
+    return m_cells[x + m_grid_size[0] * (y + m_grid_size[1] * z)];
+}
+
+const mleaf_t *leaf_locator_t::find_leaf(const qvec3d &point) const
+{
+    int32_t num = start_node(point);
+
+    while (num >= 0) {
+        num = step(m_nodes[num], point);
+    }
+
+    return &m_bsp->dleafs[-1 - num];
+}
+
+template<typename T>
+void leaf_locator_t::find_leafs(const qvec<T, 3> *points, size_t count, const mleaf_t **out) const
+{
+    // number of points descended together; each step of a lane is independent of the
+    // others, so their node loads can be in flight at the same time
+    constexpr size_t LANES = 4;
+
+    size_t i = 0;
+
+    for (; i + LANES <= count; i += LANES) {
+        std::array<qvec3d, LANES> p;
+        std::array<int32_t, LANES> num;
+
+        for (size_t k = 0; k < LANES; k++) {
+            p[k] = qvec3d(points[i + k]);
+            num[k] = start_node(p[k]);
+        }
+
+        // all lanes are done once every index is negative (a leaf). finished lanes keep
+        // stepping through node 0 and discard the result, so the loop body has no branches
+        while ((num[0] & num[1] & num[2] & num[3]) >= 0) {
+            for (size_t k = 0; k < LANES; k++) {
+                const int32_t next = step(m_nodes[std::max(num[k], 0)], p[k]);
+                num[k] = (num[k] >= 0) ? next : num[k];
+            }
+        }
+
+        for (size_t k = 0; k < LANES; k++) {
+            out[i + k] = &m_bsp->dleafs[-1 - num[k]];
+        }
+    }
+
+    for (; i < count; i++) {
+        out[i] = find_leaf(qvec3d(points[i]));
+    }
+}
+
+template void leaf_locator_t::find_leafs<float>(const qvec3f *points, size_t count, const mleaf_t **out) const;
+template void leaf_locator_t::find_leafs<double>(const qvec3d *points, size_t count, const mleaf_t **out) const;
+
 static void BSP_VisitAllLeafs_R(
     const mbsp_t &bsp, const int nodenum, const std::function<void(const mleaf_t &)> &visitor)
 {
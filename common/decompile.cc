@@ -30,7 +30,12 @@
 #include <common/log.hh>
 #include <common/ostream.hh>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <mutex>
+#include <numeric>
+#include <sstream>
 #include <vector>
 #include <cstdio>
 #include <string>
@@ -40,6 +45,7 @@
 #include <fmt/core.h>
 
 #include "tbb/parallel_for.h"
+#include "tbb/task_arena.h"
 
 // texturing
 
@@ -137,6 +143,7 @@ struct wal_metadata_t
 };
 
 static std::unordered_map<std::string, wal_metadata_t> wals;
+static std::mutex wals_mutex;
 
 struct compiled_brush_t
 {
@@ -145,7 +152,7 @@ struct compiled_brush_t
     std::optional<qvec3d> brush_offset;
     contentflags_t contents;
 
-    inline void write(const mbsp_t *bsp, std::ofstream &stream)
+    inline void write(const mbsp_t *bsp, std::ostream &stream)
     {
         if (!sides.size()) {
             return;
@@ -189,6 +196,8 @@ struct compiled_brush_t
             if (bsp->loadversion->game->id == GAME_QUAKE_II && (contents.native || side.flags.native || side.value)) {
                 wal_metadata_t *meta = nullptr;
 
+                // brushes are written from several threads at once
+                std::unique_lock wals_lock(wals_mutex);
                 auto it = wals.find(side.texture_name);
 
                 if (it != wals.end()) {
@@ -1095,10 +1104,388 @@ static std::vector<compiled_brush_t> DecompileBrushTask(
     }
 }
 
+// MARK: - task scheduling and caching
+
+/**
+ * FNV-1a; used for decomp_cache_t keys, which only need to be stable
+ * between runs of the same build.
+ */
+struct decomp_hasher_t
+{
+    uint64_t value = 14695981039346656037ull;
+
+    void bytes(const void *data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++) {
+            value ^= static_cast<const uint8_t *>(data)[i];
+            value *= 1099511628211ull;
+        }
+    }
+
+    template<typename T>
+    void add(const T &v)
+    {
+        static_assert(std::is_arithmetic_v<T>);
+        bytes(&v, sizeof(v));
+    }
+
+    void add(std::string_view s)
+    {
+        add(s.size());
+        bytes(s.data(), s.size());
+    }
+
+    void add(const qplane3d &plane)
+    {
+        for (auto &v : plane.normal) {
+            add(v);
+        }
+        add(plane.dist);
+    }
+
+    void add(const mtexinfo_t &texinfo)
+    {
+        for (size_t i = 0; i < 2; i++) {
+            for (size_t j = 0; j < 4; j++) {
+                add(texinfo.vecs.at(i, j));
+            }
+        }
+        add(texinfo.flags.native);
+        add(texinfo.value);
+    }
+};
+
+/**
+ * Hash of everything about a node that the leafs below it read: its plane
+ * and the faces on it. Only computed when there's a cache.
+ */
+static std::vector<uint64_t> HashNodes(const mbsp_t *bsp)
+{
+    std::vector<uint64_t> result(bsp->dnodes.size());
+
+    tbb::parallel_for(static_cast<size_t>(0), bsp->dnodes.size(), [&](size_t i) {
+        const bsp2_dnode_t &node = bsp->dnodes[i];
+        decomp_hasher_t hasher;
+
+        hasher.add(qplane3d(bsp->dplanes[node.planenum]));
+        hasher.add(node.numfaces);
+
+        for (int j = 0; j < node.numfaces; j++) {
+            const mface_t *face = BSP_GetFace(bsp, node.firstface + j);
+
+            hasher.add(face->planenum);
+            hasher.add(face->side);
+            hasher.add(std::string_view(Face_TextureName(bsp, face)));
+
+            if (const mtexinfo_t *texinfo = Face_Texinfo(bsp, face)) {
+                hasher.add(*texinfo);
+            }
+
+            hasher.add(face->numedges);
+
+            for (int k = 0; k < face->numedges; k++) {
+                for (auto &v : Face_PointAtIndex(bsp, face, k)) {
+                    hasher.add(v);
+                }
+            }
+        }
+
+        result[i] = hasher.value;
+    });
+
+    return result;
+}
+
+// what a task's output depends on other than the task itself
+struct decomp_entity_t
+{
+    std::optional<qvec3d> brush_offset;
+    bool is_trigger = false;
+    const std::vector<uint64_t> *node_hashes = nullptr;
+};
+
+static uint64_t HashTask(
+    const mbsp_t *bsp, const decomp_options &options, const decomp_entity_t &entity, const leaf_decompile_task &task)
+{
+    decomp_hasher_t hasher;
+
+    hasher.add(options.geometryOnly);
+    hasher.add(options.ignoreBrushes);
+    hasher.add(options.hullnum);
+    hasher.add(static_cast<int>(bsp->loadversion->game->id));
+    hasher.add(entity.is_trigger);
+    hasher.add(entity.brush_offset.has_value());
+
+    if (entity.brush_offset) {
+        for (auto &v : *entity.brush_offset) {
+            hasher.add(v);
+        }
+    }
+
+    hasher.add(task.leaf ? task.leaf->contents : task.contents.value_or(0));
+
+    for (auto &plane : task.allPlanes) {
+        hasher.add(static_cast<const qplane3d &>(plane));
+        hasher.add(plane.node ? (*entity.node_hashes)[plane.node - bsp->dnodes.data()] : 0);
+    }
+
+    if (task.brush) {
+        // the brush number ends up in the output as a comment
+        hasher.add(static_cast<ptrdiff_t>(task.brush - bsp->dbrushes.data()));
+        hasher.add(task.brush->contents);
+
+        for (int32_t i = 0; i < task.brush->numsides; i++) {
+            const q2_dbrushside_qbism_t &side = bsp->dbrushsides[task.brush->firstside + i];
+
+            hasher.add(qplane3d(bsp->dplanes[side.planenum]));
+
+            if (side.texinfo >= 0) {
+                const mtexinfo_t &texinfo = bsp->texinfo[side.texinfo];
+                const char *name = texinfo.texture.data();
+                hasher.add(std::string_view(name, strnlen(name, texinfo.texture.size())));
+                hasher.add(texinfo);
+            }
+        }
+    }
+
+    return hasher.value;
+}
+
+/**
+ * Rough relative cost of a task: every plane clips the initial brush and
+ * the faces on every other plane.
+ */
+static size_t EstimateTaskCost(const leaf_decompile_task &task)
+{
+    const size_t planes = task.allPlanes.size() + (task.brush ? task.brush->numsides : 0);
+    size_t faces = 0;
+
+    for (auto &plane : task.allPlanes) {
+        if (plane.node) {
+            faces += plane.node->numfaces;
+        }
+    }
+
+    return planes * (planes + faces);
+}
+
+static void FinishBrushes(const mbsp_t *bsp, std::vector<compiled_brush_t> &brushes, bool is_trigger)
+{
+    // If we run into a trigger brush, replace all of its faces with trigger texture.
+    if (is_trigger) {
+        for (auto &brush : brushes) {
+            for (auto &side : brush.sides) {
+                DefaultTriggerSide(side, bsp);
+            }
+        }
+    }
+
+    // cleanup step: we're left with visible faces having textures, but
+    // things that aren't output in BSP faces will use a skip texture.
+    // we'll find the best matching texture that we think would work well.
+    for (auto &brush : brushes) {
+        for (auto &side : brush.sides) {
+            if (side.texture_name != DefaultSkipTexture(bsp)) {
+                continue;
+            }
+
+            // check all of the other sides, find the one with the nearest opposite plane
+            qvec3d normal_to_check = -side.plane.normal;
+            vec_t closest_dot = -DBL_MAX;
+            compiled_brush_side_t *closest = nullptr;
+
+            for (auto &side2 : brush.sides) {
+                if (&side2 == &side) {
+                    continue;
+                }
+
+                if (side2.texture_name == DefaultSkipTexture(bsp)) {
+                    continue;
+                }
+
+                vec_t d = qv::dot(normal_to_check, side2.plane.normal);
+
+                if (!closest || d > closest_dot) {
+                    closest_dot = d;
+                    closest = &side2;
+                }
+            }
+
+            if (closest) {
+                side.texture_name = closest->texture_name;
+            } else {
+                side.texture_name = DefaultTextureForContents(bsp, brush.contents);
+            }
+        }
+    }
+}
+
+/**
+ * Runs `decompile` on each task and returns the text of each task's
+ * brushes, in task order. Leafs vary a lot in cost (a leaf under a deep
+ * stack of detailed nodes can take far longer than the rest of the model),
+ * so tasks are handed out most expensive first, one at a time, to keep a
+ * big one from being started last.
+ */
+template<typename F>
+static std::vector<std::string> DecompileTasks(const mbsp_t *bsp, const decomp_options &options,
+    const decomp_entity_t &entity, std::vector<leaf_decompile_task> &tasks, F &&decompile)
+{
+    std::vector<size_t> costs(tasks.size());
+    for (size_t i = 0; i < tasks.size(); i++) {
+        costs[i] = EstimateTaskCost(tasks[i]);
+    }
+
+    std::vector<size_t> order(tasks.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&costs](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+    std::vector<std::string> result(tasks.size());
+    std::atomic_size_t next = 0;
+
+    auto worker = [&](size_t) {
+        for (size_t k; (k = next++) < order.size();) {
+            leaf_decompile_task &task = tasks[order[k]];
+            std::string &text = result[order[k]];
+            uint64_t key = 0;
+
+            // hash before decompiling; decompiling modifies the plane list
+            if (options.cache) {
+                key = HashTask(bsp, options, entity, task);
+
+                if (auto cached = options.cache->find(key)) {
+                    text = std::move(*cached);
+                    continue;
+                }
+            }
+
+            std::vector<compiled_brush_t> brushes = decompile(task);
+            FinishBrushes(bsp, brushes, entity.is_trigger);
+
+            std::ostringstream stream;
+            for (auto &brush : brushes) {
+                brush.write(bsp, stream);
+            }
+            text = stream.str();
+
+            if (options.cache) {
+                options.cache->insert(key, text);
+            }
+        }
+    };
+
+    const size_t num_workers = std::min(order.size(), static_cast<size_t>(tbb::this_task_arena::max_concurrency()));
+    tbb::parallel_for(static_cast<size_t>(0), num_workers, worker);
+
+    return result;
+}
+
+std::optional<std::string> decomp_cache_t::find(uint64_t key)
+{
+    std::unique_lock guard(lock);
+    auto it = entries.find(key);
+
+    if (it == entries.end()) {
+        num_misses++;
+        return std::nullopt;
+    }
+
+    num_hits++;
+    return it->second;
+}
+
+void decomp_cache_t::insert(uint64_t key, std::string text)
+{
+    std::unique_lock guard(lock);
+    entries.insert_or_assign(key, std::move(text));
+}
+
+size_t decomp_cache_t::size() const
+{
+    std::unique_lock guard(lock);
+    return entries.size();
+}
+
+size_t decomp_cache_t::hits() const
+{
+    std::unique_lock guard(lock);
+    return num_hits;
+}
+
+size_t decomp_cache_t::misses() const
+{
+    std::unique_lock guard(lock);
+    return num_misses;
+}
+
+static constexpr std::array<char, 8> DECOMP_CACHE_MAGIC = {'D', 'E', 'C', 'O', 'M', 'P', 'C', '1'};
+
+bool decomp_cache_t::load(const fs::path &path)
+{
+    std::ifstream stream(path, std::ios_base::in | std::ios_base::binary);
+
+    if (!stream) {
+        return false;
+    }
+
+    std::array<char, 8> magic;
+    uint64_t count;
+
+    if (!stream.read(magic.data(), magic.size()) || magic != DECOMP_CACHE_MAGIC ||
+        !stream.read(reinterpret_cast<char *>(&count), sizeof(count))) {
+        return false;
+    }
+
+    std::unique_lock guard(lock);
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t key;
+        uint32_t length;
+
+        if (!stream.read(reinterpret_cast<char *>(&key), sizeof(key)) ||
+            !stream.read(reinterpret_cast<char *>(&length), sizeof(length))) {
+            return false;
+        }
+
+        std::string text(length, '\0');
+
+        if (!stream.read(text.data(), length)) {
+            return false;
+        }
+
+        entries.insert_or_assign(key, std::move(text));
+    }
+
+    return true;
+}
+
+void decomp_cache_t::save(const fs::path &path) const
+{
+    std::ofstream stream(path, std::ios_base::out | std::ios_base::binary);
+
+    if (!stream) {
+        FError("can't write {}", path);
+    }
+
+    std::unique_lock guard(lock);
+    const uint64_t count = entries.size();
+
+    stream.write(DECOMP_CACHE_MAGIC.data(), DECOMP_CACHE_MAGIC.size());
+    stream.write(reinterpret_cast<const char *>(&count), sizeof(count));
+
+    for (auto &[key, text] : entries) {
+        const uint32_t length = text.size();
+
+        stream.write(reinterpret_cast<const char *>(&key), sizeof(key));
+        stream.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        stream.write(text.data(), length);
+    }
+}
+
 #include "common/parser.hh"
 
-static void DecompileEntity(
-    const mbsp_t *bsp, const decomp_options &options, std::ofstream &file, const entdict_t &dict, bool isWorld)
+static void DecompileEntity(const mbsp_t *bsp, const decomp_options &options, const std::vector<uint64_t> &node_hashes,
+    std::ostream &file, const entdict_t &dict, bool isWorld)
 {
     // we use -1 to indicate it's not a brush model
     int modelNum = -1;
@@ -1167,7 +1554,12 @@ static void DecompileEntity(
         ewt::print(file, "\"{}\" \"{}\"\n", keyValue.first, keyValue.second);
     }
 
-    std::vector<std::vector<compiled_brush_t>> compiledBrushes;
+    decomp_entity_t entity;
+    entity.brush_offset = brush_offset;
+    entity.is_trigger = modelNum > 0 && dict.find("classname")->second.compare(0, 8, "trigger_") == 0;
+    entity.node_hashes = &node_hashes;
+
+    std::vector<std::string> compiledBrushes;
 
     // Print brushes if any
     if (modelNum >= 0) {
@@ -1185,9 +1577,8 @@ static void DecompileEntity(
             DecompileClipNode(stack, bsp, &bsp->dclipnodes[model->headnode[options.hullnum]], tasks);
 
             // decompile the leafs in parallel
-            compiledBrushes.resize(tasks.size());
-            tbb::parallel_for(static_cast<size_t>(0), tasks.size(), [&](const size_t &i) {
-                compiledBrushes[i] = DecompileLeafTaskGeometryOnly(bsp, tasks[i], brush_offset);
+            compiledBrushes = DecompileTasks(bsp, options, entity, tasks, [&](leaf_decompile_task &task) {
+                return DecompileLeafTaskGeometryOnly(bsp, task, brush_offset);
             });
         } else if (bsp->loadversion->game->id == GAME_QUAKE_II && !options.ignoreBrushes) {
             std::unordered_map<const dbrush_t *, leaf_decompile_task> brushes;
@@ -1234,12 +1625,12 @@ static void DecompileEntity(
             std::transform(
                 brushes.begin(), brushes.end(), std::back_inserter(brushesVector), [](auto &v) { return v.second; });
 
-            compiledBrushes.resize(brushes.size());
-            size_t t = brushes.size();
+            // write them in brush order rather than hash map order, so the output is the same every run
+            std::sort(brushesVector.begin(), brushesVector.end(),
+                [](const leaf_decompile_task &a, const leaf_decompile_task &b) { return a.brush < b.brush; });
 
-            tbb::parallel_for(static_cast<size_t>(0), brushes.size(), [&](const size_t &i) {
-                compiledBrushes[i] = DecompileBrushTask(bsp, options, brushesVector[i], brush_offset);
-                t--;
+            compiledBrushes = DecompileTasks(bsp, options, entity, brushesVector, [&](leaf_decompile_task &task) {
+                return DecompileBrushTask(bsp, options, task, brush_offset);
             });
         } else {
             // recursively visit the nodes to gather up a list of leafs to decompile
@@ -1252,77 +1643,29 @@ static void DecompileEntity(
             DecompileNode(stack, bsp, headnode, tasks);
 
             // decompile the leafs in parallel
-            compiledBrushes.resize(tasks.size());
-            tbb::parallel_for(static_cast<size_t>(0), tasks.size(), [&](const size_t &i) {
+            compiledBrushes = DecompileTasks(bsp, options, entity, tasks, [&](leaf_decompile_task &task) {
                 if (options.geometryOnly) {
-                    compiledBrushes[i] = DecompileLeafTaskGeometryOnly(bsp, tasks[i], brush_offset);
+                    return DecompileLeafTaskGeometryOnly(bsp, task, brush_offset);
                 } else {
-                    compiledBrushes[i] = DecompileLeafTask(bsp, options, tasks[i], brush_offset);
+                    return DecompileLeafTask(bsp, options, task, brush_offset);
                 }
             });
         }
     } else if (areaportal_brush) {
-        leaf_decompile_task task;
-        task.brush = areaportal_brush;
-        compiledBrushes.push_back(DecompileBrushTask(bsp, options, task, brush_offset));
+        std::vector<leaf_decompile_task> tasks(1);
+        tasks[0].brush = areaportal_brush;
+        compiledBrushes = DecompileTasks(bsp, options, entity, tasks, [&](leaf_decompile_task &task) {
+            return DecompileBrushTask(bsp, options, task, brush_offset);
+        });
     }
 
-    // If we run into a trigger brush, replace all of its faces with trigger texture.
-    if (modelNum > 0 && dict.find("classname")->second.compare(0, 8, "trigger_") == 0) {
-        for (auto &brushlist : compiledBrushes) {
-            for (auto &brush : brushlist) {
-                for (auto &side : brush.sides) {
-                    DefaultTriggerSide(side, bsp);
-                }
-            }
-        }
-    }
-
-    // cleanup step: we're left with visible faces having textures, but
-    // things that aren't output in BSP faces will use a skip texture.
-    // we'll find the best matching texture that we think would work well.
-    for (auto &brushlist : compiledBrushes) {
-        for (auto &brush : brushlist) {
-            for (auto &side : brush.sides) {
-                if (side.texture_name != DefaultSkipTexture(bsp)) {
-                    continue;
-                }
-
-                // check all of the other sides, find the one with the nearest opposite plane
-                qvec3d normal_to_check = -side.plane.normal;
-                vec_t closest_dot = -DBL_MAX;
-                compiled_brush_side_t *closest = nullptr;
-
-                for (auto &side2 : brush.sides) {
-                    if (&side2 == &side) {
-                        continue;
-                    }
-
-                    if (side2.texture_name == DefaultSkipTexture(bsp)) {
-                        continue;
-                    }
-
-                    vec_t d = qv::dot(normal_to_check, side2.plane.normal);
-
-                    if (!closest || d > closest_dot) {
-                        closest_dot = d;
-                        closest = &side2;
-                    }
-                }
-
-                if (closest) {
-                    side.texture_name = closest->texture_name;
-                } else {
-                    side.texture_name = DefaultTextureForContents(bsp, brush.contents);
-                }
-            }
-        }
+    for (auto &text : compiledBrushes) {
+        file << text;
     }
 
     // add the origin brush, if we have one
     if (brush_offset.has_value()) {
-        std::vector<compiled_brush_t> &brushlist = compiledBrushes.emplace_back();
-        compiled_brush_t &brush = brushlist.emplace_back();
+        compiled_brush_t brush;
         brush.brush_offset = brush_offset;
         brush.contents = {Q2_CONTENTS_ORIGIN};
 
@@ -1341,24 +1684,35 @@ static void DecompileEntity(
             side.texture_name = DefaultOriginTexture(bsp);
             side.valve = plane.normal;
         }
-    }
 
-    for (auto &brushlist : compiledBrushes) {
-        for (auto &brush : brushlist) {
-            brush.write(bsp, file);
-        }
+        brush.write(bsp, file);
     }
 
     ewt::print(file, "}}\n");
 }
 
-void DecompileBSP(const mbsp_t *bsp, const decomp_options &options, std::ofstream &file)
+void DecompileBSP(const mbsp_t *bsp, const decomp_options &options, std::ostream &file)
 {
     auto entdicts = EntData_Parse(*bsp);
 
-    for (size_t i = 0; i < entdicts.size(); ++i) {
+    std::vector<uint64_t> node_hashes;
+    if (options.cache) {
+        node_hashes = HashNodes(bsp);
+    }
+
+    // brush entities are usually too small to keep every thread busy on
+    // their own, so decompile the entities in parallel too
+    std::vector<std::string> entities(entdicts.size());
+
+    tbb::parallel_for(static_cast<size_t>(0), entdicts.size(), [&](size_t i) {
+        std::ostringstream stream;
         // entity 0 is implicitly worldspawn (model 0)
-        DecompileEntity(bsp, options, file, entdicts[i], i == 0);
+        DecompileEntity(bsp, options, node_hashes, stream, entdicts[i], i == 0);
+        entities[i] = stream.str();
+    });
+
+    for (auto &text : entities) {
+        file << text;
     }
 }
 
@@ -26,6 +26,8 @@
 #include <memory>
 #include <array>
 #include <list>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <unordered_map>
 
@@ -64,6 +66,8 @@ struct directory_archive : archive_like
 struct pak_archive : archive_like
 {
     std::ifstream pakstream;
+    // guards pakstream, so files can be loaded from multiple threads
+    std::mutex pakstream_lock;
 
     struct pak_header
     {
@@ -125,9 +129,10 @@ struct pak_archive : archive_like
             return std::nullopt;
         }
 
-        pakstream.seekg(std::get<0>(it->second));
         uintmax_t size = std::get<1>(it->second);
         std::vector<uint8_t> data(size);
+        std::scoped_lock lock(pakstream_lock);
+        pakstream.seekg(std::get<0>(it->second));
         pakstream.read(reinterpret_cast<char *>(data.data()), size);
         return data;
     }
@@ -136,6 +141,8 @@ struct pak_archive : archive_like
 struct wad_archive : archive_like
 {
     std::ifstream wadstream;
+    // guards wadstream, so files can be loaded from multiple threads
+    std::mutex wadstream_lock;
 
     // WAD Format
     struct wad_header
@@ -203,9 +210,10 @@ struct wad_archive : archive_like
             return std::nullopt;
         }
 
-        wadstream.seekg(std::get<0>(it->second));
         uintmax_t size = std::get<1>(it->second);
         std::vector<uint8_t> data(size);
+        std::scoped_lock lock(wadstream_lock);
+        wadstream.seekg(std::get<0>(it->second));
         wadstream.read(reinterpret_cast<char *>(data.data()), size);
         return data;
     }
@@ -213,16 +221,21 @@ struct wad_archive : archive_like
 
 static std::shared_ptr<directory_archive> absrel_dir = std::make_shared<directory_archive>("", false);
 std::list<std::shared_ptr<archive_like>> archives, directories;
+// guards archives/directories; where() only reads them, so it takes a shared lock
+static std::shared_mutex archives_lock;
 
 /** It's possible to compile quake 1/hexen 2 maps without a qdir */
 void clear()
 {
+    std::unique_lock lock(archives_lock);
     archives.clear();
     directories.clear();
 }
 
 inline std::shared_ptr<archive_like> addArchiveInternal(const path &p, bool external)
 {
+    std::unique_lock lock(archives_lock);
+
     if (is_directory(p)) {
         for (auto &dir : directories) {
             if (equivalent(dir->pathname, p)) {
@@ -297,6 +310,8 @@ resolve_result where(const path &p, bool prefer_loose)
         }
     }
 
+    std::shared_lock lock(archives_lock);
+
     for (int32_t pass = 0; pass < 2; pass++) {
         if (prefer_loose != !!pass) {
             // check absolute + relative
@@ -1,4 +1,5 @@
 #include <vector>
+#include <fstream>
 #include <common/fs.hh>
 #include <common/imglib.hh>
 #include <common/entdata.h>
@@ -6,6 +7,17 @@
 #include <common/log.hh>
 #include <common/settings.hh>
 
+#include <tbb/parallel_for_each.h>
+
+#include <atomic>
+#include <random>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "../3rdparty/stb_image.h"
 
@@ -326,6 +338,148 @@ qvec3b calculate_average(const std::vector<qvec4b> &pixels)
     return avg /= n;
 }
 
+/*
+============================================================================
+DECODED TEXTURE CACHE
+
+-texturecache <dir> keeps the decoded RGBA of stb_image-loaded textures
+(png/jpg/tga), which are by far the slowest to load. Entries are keyed on the
+texture name, where it was resolved to, and the mtime + size of the file or
+archive it came from, so edited or moved files miss the cache.
+Paletted formats (wal/mip) are cheap to convert and aren't cached.
+============================================================================
+*/
+
+constexpr std::array<char, 4> TEXTURE_CACHE_MAGIC{'T', 'X', 'C', '1'};
+
+static std::string TextureCacheKey(const std::string_view &name, const fs::resolve_result &pos)
+{
+    // loose files are keyed on the file itself, archived ones on their archive
+    fs::path source = pos.archive->pathname;
+
+    if (source.empty()) {
+        source = pos.filename;
+    } else if (fs::is_directory(source)) {
+        source /= pos.filename;
+    }
+
+    std::error_code ec;
+    const auto mtime = fs::last_write_time(source, ec);
+
+    if (ec) {
+        return {};
+    }
+
+    const auto size = fs::file_size(source, ec);
+
+    if (ec) {
+        return {};
+    }
+
+    return fmt::format("{}|{}|{}|{}|{}", name, fs::absolute(source).generic_string(), pos.filename.generic_string(),
+        mtime.time_since_epoch().count(), size);
+}
+
+static fs::path TextureCachePath(const fs::path &dir, const std::string &key)
+{
+    return dir / fmt::format("{:016x}.tex", std::hash<std::string>{}(key));
+}
+
+static std::optional<texture> LoadCachedTexture(const fs::path &dir, const std::string &key, ext id)
+{
+    std::ifstream stream(TextureCachePath(dir, key), std::ios_base::in | std::ios_base::binary);
+
+    if (!stream) {
+        return std::nullopt;
+    }
+
+    stream >> endianness<std::endian::little>;
+
+    std::array<char, 4> magic;
+    uint32_t key_length;
+    stream >= magic >= key_length;
+
+    if (!stream || magic != TEXTURE_CACHE_MAGIC || key_length != key.size()) {
+        return std::nullopt;
+    }
+
+    // different key with a colliding hash
+    std::string stored_key(key_length, '\0');
+    stream.read(stored_key.data(), key_length);
+
+    if (stored_key != key) {
+        return std::nullopt;
+    }
+
+    uint32_t width, height;
+    stream >= width >= height;
+
+    texture tex;
+    tex.meta.extension = id;
+    tex.meta.width = tex.width = width;
+    tex.meta.height = tex.height = height;
+    tex.pixels.resize(static_cast<size_t>(width) * height);
+    stream.read(reinterpret_cast<char *>(tex.pixels.data()), tex.pixels.size() * sizeof(qvec4b));
+
+    if (!stream) {
+        return std::nullopt;
+    }
+
+    return tex;
+}
+
+// unique among every thread of every process that shares the cache directory
+static std::string TempFileSuffix()
+{
+    static const uint64_t nonce = (static_cast<uint64_t>(std::random_device{}()) << 32) | std::random_device{}();
+    static std::atomic_uint64_t counter = 0;
+
+#ifdef _WIN32
+    const int pid = _getpid();
+#else
+    const int pid = getpid();
+#endif
+
+    return fmt::format(".{}.{:016x}.{}.tmp", pid, nonce, counter++);
+}
+
+static void StoreCachedTexture(const fs::path &dir, const std::string &key, const texture &tex)
+{
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+
+    // write to a temporary and rename it into place, so other processes never see a partial file
+    const fs::path path = TextureCachePath(dir, key);
+    fs::path temp_path = path;
+    temp_path += TempFileSuffix();
+
+    {
+        std::ofstream stream(temp_path, std::ios_base::out | std::ios_base::binary);
+
+        if (!stream) {
+            return;
+        }
+
+        stream << endianness<std::endian::little>;
+        stream <= TEXTURE_CACHE_MAGIC <= static_cast<uint32_t>(key.size());
+        stream.write(key.data(), key.size());
+        stream <= tex.width <= tex.height;
+        stream.write(reinterpret_cast<const char *>(tex.pixels.data()), tex.pixels.size() * sizeof(qvec4b));
+
+        if (!stream) {
+            stream.close();
+            fs::remove(temp_path, ec);
+            return;
+        }
+    }
+
+    fs::rename(temp_path, path, ec);
+
+    if (ec) {
+        fs::remove(temp_path, ec);
+    }
+}
+
 std::tuple<std::optional<img::texture>, fs::resolve_result, fs::data> load_texture(const std::string_view &name,
     bool meta_only, const gamedef_t *game, const settings::common_settings &options, bool no_prefix)
 {
@@ -340,7 +494,38 @@ std::tuple<std::optional<img::texture>, fs::resolve_result, fs::data> load_textu
 
         if (auto pos = fs::where(p, options.filepriority.value() == settings::search_priority_t::LOOSE)) {
             if (auto data = fs::load(pos)) {
-                if (auto texture = ext.loader(name.data(), data, meta_only, game)) {
+                const fs::path &cache_dir = options.texturecache.value();
+
+                if (cache_dir.empty() || ext.loader != load_stb) {
+                    if (auto texture = ext.loader(name.data(), data, meta_only, game)) {
+                        return {texture, pos, data};
+                    }
+                    continue;
+                }
+
+                const std::string key = TextureCacheKey(name, pos);
+                std::optional<texture> texture;
+
+                if (!key.empty()) {
+                    texture = LoadCachedTexture(cache_dir, key, ext.id);
+                }
+
+                // stb decodes the whole image even for meta_only, so always cache the pixels
+                if (!texture) {
+                    texture = ext.loader(name.data(), data, false, game);
+
+                    if (texture && !key.empty()) {
+                        StoreCachedTexture(cache_dir, key, *texture);
+                    }
+                }
+
+                if (texture) {
+                    texture->meta.name = name;
+
+                    if (meta_only) {
+                        texture->pixels = {};
+                    }
+
                     return {texture, pos, data};
                 }
             }
@@ -560,17 +745,29 @@ static qvec3b increase_saturation(const qvec3b &color)
     return color_int;
 }
 
-// Load the specified texture from the BSP
-static void AddTextureName(
-    const std::string_view &textureName, const mbsp_t *bsp, const settings::common_settings &options)
+static void FinishTexture(img::texture &tex, const settings::common_settings &options)
 {
-    if (img::find(textureName)) {
-        return;
+    if (tex.meta.color_override) {
+        tex.averageColor = *tex.meta.color_override;
+    } else {
+        tex.averageColor = img::calculate_average(tex.pixels);
+
+        if (options.tex_saturation_boost.value() > 0.0f) {
+            tex.averageColor =
+                mix(tex.averageColor, increase_saturation(tex.averageColor), options.tex_saturation_boost.value());
+        }
     }
 
-    // always add entry
-    auto &tex = img::textures.emplace(textureName, img::texture{}).first->second;
+    if (tex.meta.width && tex.meta.height) {
+        tex.width_scale = (float)tex.width / (float)tex.meta.width;
+        tex.height_scale = (float)tex.height / (float)tex.meta.height;
+    }
+}
 
+// Load the specified texture into its (already added) texture cache entry
+static void LoadTextureName(
+    const std::string_view &textureName, img::texture &tex, const mbsp_t *bsp, const settings::common_settings &options)
+{
     // find texture & meta
     auto [texture, _0, _1] = img::load_texture(textureName, false, bsp->loadversion->game, options);
 
@@ -588,30 +785,29 @@ static void AddTextureName(
         tex.meta = std::move(texture_meta.value());
     }
 
-    if (tex.meta.color_override) {
-        tex.averageColor = *tex.meta.color_override;
-    } else {
-        tex.averageColor = img::calculate_average(tex.pixels);
-
-        if (options.tex_saturation_boost.value() > 0.0f) {
-            tex.averageColor =
-                mix(tex.averageColor, increase_saturation(tex.averageColor), options.tex_saturation_boost.value());
-        }
-    }
-
-    if (tex.meta.width && tex.meta.height) {
-        tex.width_scale = (float)tex.width / (float)tex.meta.width;
-        tex.height_scale = (float)tex.height / (float)tex.meta.height;
-    }
+    FinishTexture(tex, options);
 }
 
 // Load all of the referenced textures from the BSP texinfos into
 // the texture cache.
 static void LoadTextures(const mbsp_t *bsp, const settings::common_settings &options)
 {
+    // entries are added up front, so the loads below never touch the map
+    std::vector<std::pair<std::string_view, img::texture *>> to_load;
+
+    auto add_texture_name = [&](const std::string_view &textureName) {
+        if (img::find(textureName)) {
+            return;
+        }
+
+        // always add entry
+        auto it = img::textures.emplace(textureName, img::texture{}).first;
+        to_load.emplace_back(it->first, &it->second);
+    };
+
     // gather all loadable textures...
     for (auto &texinfo : bsp->texinfo) {
-        AddTextureName(texinfo.texture.data(), bsp, options);
+        add_texture_name(texinfo.texture.data());
     }
 
     // gather textures used by _project_texture.
@@ -621,10 +817,15 @@ static void LoadTextures(const mbsp_t *bsp, const settings::common_settings &opt
         if (entdict.get("classname").find("light") == 0) {
             const auto &tex = entdict.get("_project_texture");
             if (!tex.empty()) {
-                AddTextureName(tex.c_str(), bsp, options);
+                add_texture_name(tex.c_str());
             }
         }
     }
+
+    // decoding dominates, so load them all in parallel
+    tbb::parallel_for_each(to_load, [&](const std::pair<std::string_view, img::texture *> &entry) {
+        LoadTextureName(entry.first, *entry.second, bsp, options);
+    });
 }
 
 // Load all of the paletted textures from the BSP into
@@ -635,6 +836,9 @@ static void ConvertTextures(const mbsp_t *bsp, const settings::common_settings &
         return;
     }
 
+    // entries are added up front, so the conversions below never touch the map
+    std::vector<std::pair<const miptex_t *, img::texture *>> to_convert;
+
     for (auto &miptex : bsp->dtex.textures) {
         if (img::find(miptex.name)) {
             logging::funcprint("WARNING: Texture {} duplicated\n", miptex.name);
@@ -642,7 +846,12 @@ static void ConvertTextures(const mbsp_t *bsp, const settings::common_settings &
         }
 
         // always add entry
-        auto &tex = img::textures.emplace(miptex.name, img::texture{}).first->second;
+        to_convert.emplace_back(&miptex, &img::textures.emplace(miptex.name, img::texture{}).first->second);
+    }
+
+    tbb::parallel_for_each(to_convert, [&](const std::pair<const miptex_t *, img::texture *> &entry) {
+        const miptex_t &miptex = *entry.first;
+        img::texture &tex = *entry.second;
 
         // if the miptex entry isn't a dummy, use it as our base
         if (miptex.data.size() >= sizeof(dmiptex_t)) {
@@ -660,25 +869,11 @@ static void ConvertTextures(const mbsp_t *bsp, const settings::common_settings &
 
         if (!tex.pixels.size() || !tex.width || !tex.meta.width) {
             logging::funcprint("WARNING: invalid size data for {}\n", miptex.name);
-            continue;
-        }
-
-        if (tex.meta.color_override) {
-            tex.averageColor = *tex.meta.color_override;
-        } else {
-            tex.averageColor = img::calculate_average(tex.pixels);
-
-            if (options.tex_saturation_boost.value() > 0.0f) {
-                tex.averageColor =
-                    mix(tex.averageColor, increase_saturation(tex.averageColor), options.tex_saturation_boost.value());
-            }
+            return;
         }
 
-        if (tex.meta.width && tex.meta.height) {
-            tex.width_scale = (float)tex.width / (float)tex.meta.width;
-            tex.height_scale = (float)tex.height / (float)tex.meta.height;
-        }
-    }
+        FinishTexture(tex, options);
+    });
 }
 
 void load_textures(const mbsp_t *bsp, const settings::common_settings &options)
@@ -0,0 +1,356 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <common/json_stream.hh>
+#include <common/log.hh>
+
+#include <fstream>
+
+json_stream_writer_t::json_stream_writer_t(std::ostream &stream, int indent)
+    : stream(stream),
+      indent(indent)
+{
+}
+
+void json_stream_writer_t::begin_value()
+{
+    if (after_key) {
+        after_key = false;
+        return;
+    }
+
+    if (empty.empty()) {
+        // root value
+        return;
+    }
+
+    stream << (empty.back() ? "\n" : ",\n");
+    stream << std::string(empty.size() * indent, ' ');
+    empty.back() = false;
+}
+
+std::string json_stream_writer_t::indented(const json &j) const
+{
+    const std::string dumped = j.dump(indent);
+    const std::string newline = "\n" + std::string(empty.size() * indent, ' ');
+
+    std::string result;
+    result.reserve(dumped.size());
+
+    for (char c : dumped) {
+        if (c == '\n') {
+            result += newline;
+        } else {
+            result += c;
+        }
+    }
+
+    return result;
+}
+
+void json_stream_writer_t::begin_object()
+{
+    begin_value();
+    stream << '{';
+    empty.push_back(true);
+}
+
+void json_stream_writer_t::end_object()
+{
+    Q_assert(!empty.empty());
+
+    const bool was_empty = empty.back();
+    empty.pop_back();
+
+    if (!was_empty) {
+        stream << '\n' << std::string(empty.size() * indent, ' ');
+    }
+
+    stream << '}';
+}
+
+void json_stream_writer_t::begin_array()
+{
+    begin_value();
+    stream << '[';
+    empty.push_back(true);
+}
+
+void json_stream_writer_t::end_array()
+{
+    Q_assert(!empty.empty());
+
+    const bool was_empty = empty.back();
+    empty.pop_back();
+
+    if (!was_empty) {
+        stream << '\n' << std::string(empty.size() * indent, ' ');
+    }
+
+    stream << ']';
+}
+
+void json_stream_writer_t::key(std::string_view key)
+{
+    Q_assert(!empty.empty() && !after_key);
+
+    begin_value();
+    stream << json(key).dump() << ": ";
+    after_key = true;
+}
+
+void json_stream_writer_t::value(const json &j)
+{
+    begin_value();
+    stream << indented(j);
+}
+
+void json_stream_writer_t::hex_value(const uint8_t *bytes, size_t count)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    constexpr size_t chunk_size = 65536;
+
+    begin_value();
+    stream << '"';
+
+    std::string chunk;
+
+    for (size_t start = 0; start < count; start += chunk_size) {
+        const size_t end = std::min(count, start + chunk_size);
+        chunk.resize((end - start) * 2);
+
+        for (size_t i = start; i < end; i++) {
+            chunk[(i - start) * 2] = digits[bytes[i] >> 4];
+            chunk[(i - start) * 2 + 1] = digits[bytes[i] & 15];
+        }
+
+        stream << chunk;
+    }
+
+    stream << '"';
+}
+
+/*
+ * SAX handler that builds json values only for the parts of the document
+ * that were asked for, and skips everything else without storing it.
+ */
+class member_sax_t
+{
+public:
+    using number_integer_t = json::number_integer_t;
+    using number_unsigned_t = json::number_unsigned_t;
+    using number_float_t = json::number_float_t;
+    using string_t = json::string_t;
+    using binary_t = json::binary_t;
+
+private:
+    // member of the root object to read; empty to only collect keys
+    std::string_view target;
+    // call the callback per array element, rather than with the whole member
+    bool split_arrays;
+    const std::function<void(json &&)> *callback;
+
+    // containers open in the document, including the root object
+    size_t depth = 0;
+    std::string member;
+    // the target member is an array being split into elements
+    bool in_target_array = false;
+
+    // value under construction
+    json value;
+    std::vector<json *> building;
+    std::string building_key;
+
+    bool wanted() const
+    {
+        if (target.empty()) {
+            return false;
+        }
+
+        return (depth == 1 && member == target) || (in_target_array && depth == 2);
+    }
+
+    // adds a value to the one being built; returns false to stop parsing
+    bool add(json &&v, bool container)
+    {
+        json *slot;
+
+        if (building.empty()) {
+            value = std::move(v);
+            slot = &value;
+        } else if (building.back()->is_array()) {
+            building.back()->push_back(std::move(v));
+            slot = &building.back()->back();
+        } else {
+            slot = &((*building.back())[building_key] = std::move(v));
+        }
+
+        if (container) {
+            building.push_back(slot);
+            return true;
+        }
+
+        return building.empty() ? finish() : true;
+    }
+
+    bool finish()
+    {
+        (*callback)(std::move(value));
+        value = json();
+
+        // a whole member was read, so there's nothing more to do
+        return in_target_array;
+    }
+
+    bool scalar(json &&v)
+    {
+        if (building.empty() && !wanted()) {
+            return true;
+        }
+
+        return add(std::move(v), false);
+    }
+
+    bool start_container(json &&v)
+    {
+        bool result = true;
+
+        if (!building.empty() || wanted()) {
+            result = add(std::move(v), true);
+        }
+
+        depth++;
+        return result;
+    }
+
+    bool end_container()
+    {
+        depth--;
+
+        if (!building.empty()) {
+            building.pop_back();
+            return building.empty() ? finish() : true;
+        }
+
+        if (in_target_array && depth == 1) {
+            // end of the target array
+            return false;
+        }
+
+        return true;
+    }
+
+public:
+    std::vector<std::string> keys;
+    bool found = false;
+
+    member_sax_t(std::string_view target, bool split_arrays, const std::function<void(json &&)> *callback)
+        : target(target),
+          split_arrays(split_arrays),
+          callback(callback)
+    {
+    }
+
+    bool null() { return scalar(nullptr); }
+    bool boolean(bool val) { return scalar(val); }
+    bool number_integer(number_integer_t val) { return scalar(val); }
+    bool number_unsigned(number_unsigned_t val) { return scalar(val); }
+    bool number_float(number_float_t val, const string_t &) { return scalar(val); }
+    bool string(string_t &val) { return scalar(std::move(val)); }
+    bool binary(binary_t &val) { return scalar(json::binary(std::move(val))); }
+
+    bool start_object(size_t) { return start_container(json::object()); }
+    bool end_object() { return end_container(); }
+
+    bool start_array(size_t)
+    {
+        if (building.empty() && split_arrays && depth == 1 && member == target) {
+            in_target_array = true;
+            depth++;
+            return true;
+        }
+
+        return start_container(json::array());
+    }
+
+    bool end_array() { return end_container(); }
+
+    bool key(string_t &val)
+    {
+        if (!building.empty()) {
+            building_key = std::move(val);
+        } else if (depth == 1) {
+            if (val == target) {
+                found = true;
+            }
+
+            member = std::move(val);
+            keys.push_back(member);
+        }
+
+        return true;
+    }
+
+    bool parse_error(size_t position, const std::string &, const nlohmann::detail::exception &ex)
+    {
+        FError("JSON parse error at byte {}: {}", position, ex.what());
+    }
+};
+
+json_stream_reader_t::json_stream_reader_t(const fs::path &path)
+    : path(path)
+{
+}
+
+static void ParseMembers(const fs::path &path, member_sax_t &sax)
+{
+    std::ifstream stream(path, std::ios_base::in | std::ios_base::binary);
+
+    if (!stream) {
+        FError("can't open {}", path);
+    }
+
+    json::sax_parse(stream, &sax);
+}
+
+std::vector<std::string> json_stream_reader_t::keys() const
+{
+    member_sax_t sax({}, false, nullptr);
+    ParseMembers(path, sax);
+    return std::move(sax.keys);
+}
+
+std::optional<json> json_stream_reader_t::read(std::string_view key) const
+{
+    std::optional<json> result;
+    const std::function<void(json &&)> store = [&result](json &&j) { result = std::move(j); };
+
+    member_sax_t sax(key, false, &store);
+    ParseMembers(path, sax);
+
+    return result;
+}
+
+bool json_stream_reader_t::for_each_element(std::string_view key, const std::function<void(json &&)> &f) const
+{
+    member_sax_t sax(key, true, &f);
+    ParseMembers(path, sax);
+
+    return sax.found;
+}
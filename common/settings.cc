@@ -742,7 +742,9 @@ common_settings::common_settings()
       defaultpaths{this, "defaultpaths", true, &game_group,
           "whether the compiler should attempt to automatically derive game/base paths for games that support it"},
       tex_saturation_boost{this, "tex_saturation_boost", 0.0f, 0.0f, 1.0f, &game_group,
-          "increase texture saturation to match original Q2 tools"}
+          "increase texture saturation to match original Q2 tools"},
+      texturecache{this, "texturecache", "", &performance_group,
+          "directory to keep decoded textures in, so later runs (of any tool) can skip decoding them"}
 {
 }
 
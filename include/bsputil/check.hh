@@ -0,0 +1,117 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+#include <common/json.hh>
+#include <common/bspfile.hh>
+
+#include <fmt/core.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * bsputil --check: a set of independent validation passes over a bsp.
+ *
+ * Errors are data that engines can't load or that breaks invariants the
+ * tools rely on (out of range indices, malformed visdata); warnings are
+ * things that are legal but suspicious (unreferenced data, faces off their
+ * plane). Checks run in parallel with each other, and large checks are
+ * parallel internally.
+ */
+enum class bsp_check_severity_t
+{
+    warning,
+    error
+};
+
+struct bsp_check_issue_t
+{
+    bsp_check_severity_t severity;
+    std::string message;
+};
+
+class bsp_check_issues_t
+{
+public:
+    std::vector<bsp_check_issue_t> list;
+
+    template<typename... T>
+    void error(fmt::format_string<T...> format, T &&...args)
+    {
+        list.push_back({bsp_check_severity_t::error, fmt::format(format, std::forward<T>(args)...)});
+    }
+
+    template<typename... T>
+    void warning(fmt::format_string<T...> format, T &&...args)
+    {
+        list.push_back({bsp_check_severity_t::warning, fmt::format(format, std::forward<T>(args)...)});
+    }
+};
+
+struct bsp_check_result_t
+{
+    // issues kept per check; the counts are always complete
+    static constexpr size_t MAX_ISSUES = 1000;
+
+    std::string name;
+    size_t errors = 0, warnings = 0;
+    std::vector<bsp_check_issue_t> issues;
+    // check-specific numbers, e.g. histograms
+    json stats = json::object();
+
+    void add(bsp_check_issues_t &&issues);
+};
+
+struct bsp_check_context_t
+{
+    const mbsp_t &bsp;
+    const bspxentries_t &bspx;
+};
+
+struct bsp_check_t
+{
+    std::string name;
+    std::string description;
+    std::function<void(const bsp_check_context_t &, bsp_check_result_t &)> run;
+};
+
+/**
+ * The registered checks; append to this to add more.
+ */
+std::vector<bsp_check_t> &BSPChecks();
+
+struct bsp_check_report_t
+{
+    std::vector<bsp_check_result_t> results;
+
+    // no check reported errors
+    bool passed() const;
+    json to_json() const;
+};
+
+/**
+ * Runs the checks named in `only` (all of them, if empty)
+ */
+bsp_check_report_t CheckBSP(
+    const mbsp_t &bsp, const bspxentries_t &bspx, const std::vector<std::string> &only = {});
+
+void PrintBSPCheckReport(const bsp_check_report_t &report);
@@ -0,0 +1,71 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+#include <common/json.hh>
+#include <common/bspfile.hh>
+
+#include <cstddef>
+#include <string>
+
+/*
+ * Structural comparison of two compiles of the same map.
+ *
+ * Nothing is compared by index except models and entities, since face,
+ * leaf and plane numbering routinely changes between compiler versions.
+ * Faces are matched geometrically (a face of one bsp must cover the
+ * centroid of a face of the other, facing the same way), leafs by sampling
+ * points, and PVS rows through those leaf matches.
+ */
+struct bsp_compare_options_t
+{
+    // world units; point-on-face and bounds checks
+    double position_epsilon = 0.01;
+    // maximum 1 - dot() between matched normals
+    double normal_epsilon = 0.001;
+    // maximum per-channel difference between matched luxels
+    int lightmap_tolerance = 0;
+    // detailed differences kept per category; counts are always complete
+    size_t max_differences = 100;
+};
+
+struct bsp_compare_category_t
+{
+    size_t compared = 0;
+    size_t mismatched = 0;
+    // set when the category couldn't be compared at all
+    std::string skipped;
+    json differences = json::array();
+};
+
+struct bsp_compare_result_t
+{
+    bsp_compare_options_t options;
+    bsp_compare_category_t models, faces, leafs, pvs, lightmaps, entities;
+
+    bool identical() const;
+    json to_json() const;
+};
+
+bsp_compare_result_t CompareBSPs(const mbsp_t &ref, const bspxentries_t &ref_bspx, const mbsp_t &bsp,
+    const bspxentries_t &bspx, const bsp_compare_options_t &options = {});
+
+// prints one line per category, plus the first few differences
+void PrintBSPComparison(const bsp_compare_result_t &result);
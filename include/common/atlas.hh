@@ -0,0 +1,72 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+/**
+ * A rectangle to pack; width and height are inputs, the rest outputs.
+ */
+struct atlas_rect_t
+{
+    int width = 0, height = 0;
+
+    int page = -1;
+    int x = 0, y = 0;
+};
+
+struct atlas_layout_t
+{
+    // pages are square
+    int page_size = 0;
+    int num_pages = 0;
+};
+
+/**
+ * Skyline bottom-left packer for a single page.
+ */
+class skyline_packer_t
+{
+    struct segment_t
+    {
+        int x, y, width;
+    };
+
+    int width, height;
+    // the top edge of the packed area, left to right, covering the page width
+    std::vector<segment_t> skyline;
+
+    std::optional<int> fit(size_t index, int w, int h) const;
+
+public:
+    skyline_packer_t(int width, int height);
+
+    // finds a place for a w x h rectangle and reserves it, or returns false if it doesn't fit
+    bool insert(int w, int h, int &x, int &y);
+};
+
+/**
+ * Packs `rects` into as few square pages of `page_size` as it can, tallest
+ * first; the page size is grown to the next power of two when a single
+ * rectangle doesn't fit. Rects keep their order; the results are written
+ * into them.
+ */
+atlas_layout_t PackAtlas(std::vector<atlas_rect_t> &rects, int page_size = 512);
@@ -27,6 +27,7 @@
 #include <unordered_map>
 #include <any>
 #include <optional>
+#include <string>
 
 #include <common/fs.hh>
 #include <common/qvec.hh>
@@ -449,6 +450,25 @@ constexpr const bspversion_t *const bspversions[] = {&bspver_generic, &bspver_q1
 
 void LoadBSPFile(fs::path &filename, bspdata_t *bspdata); // returns the filename as contained inside a bsp
 void WriteBSPFile(const fs::path &filename, bspdata_t *bspdata);
+
+// lumps to replace with PatchBSPFile; anything left unset is kept as it is
+struct bsp_patch_t
+{
+    // entity lump text, without the null terminator
+    std::optional<std::string> entities;
+    std::optional<std::vector<uint8_t>> lighting;
+    // BSPX lumps to add or replace; nullopt removes one
+    std::unordered_map<std::string, std::optional<std::vector<uint8_t>>> bspx;
+};
+
+/**
+ * Replaces lumps of the bsp at `filename` without decoding the rest of it.
+ * When every replaced lump fits in the space the old one took up, only
+ * those lumps and the lump table are overwritten; otherwise the raw lumps
+ * are repacked into a new file, which then replaces the old one. Returns
+ * true if the file was patched in place.
+ */
+bool PatchBSPFile(const fs::path &filename, const bsp_patch_t &patch);
 void PrintBSPFileSizes(const bspdata_t *bspdata);
 /**
  * Returns false if the conversion failed.
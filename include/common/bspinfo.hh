@@ -27,6 +27,8 @@
 #include <nlohmann/json_fwd.hpp>
 
 #include <map>
+#include <ostream>
+#include <string>
 #include <vector>
 
 struct bspdata_t;
@@ -45,6 +47,21 @@ struct full_atlas_t
 
 full_atlas_t build_lightmap_atlas(const mbsp_t &bsp, const bspxentries_t &bspx, const std::vector<uint8_t> &litdata, bool use_bspx, bool use_decoupled);
 
-void serialize_bsp(const bspdata_t &bspdata, const mbsp_t &bsp, const fs::path &name);
+struct bsp_json_options_t
+{
+    // names of the members to write (e.g. "faces"); empty writes all of them
+    std::vector<std::string> lumps;
+};
+
+/**
+ * Writes the bsp as JSON, one lump at a time, to `name`; also exports the
+ * geometry as .obj and the lightmap atlases as .png's alongside it.
+ */
+void serialize_bsp(
+    const bspdata_t &bspdata, const mbsp_t &bsp, const fs::path &name, const bsp_json_options_t &options = {});
+
+// only the JSON, to a stream. Read it back with json_stream_reader_t.
+void serialize_bsp(
+    const bspdata_t &bspdata, const mbsp_t &bsp, std::ostream &stream, const bsp_json_options_t &options = {});
 
 nlohmann::json serialize_bspxbrushlist(const std::vector<uint8_t> &lump);
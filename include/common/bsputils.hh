@@ -25,6 +25,7 @@
 #include <common/qvec.hh>
 #include <common/aabb.hh>
 #include <common/polylib.hh>
+#include <common/aligned_allocator.hh>
 
 #include <iterator>
 #include <string>
@@ -117,6 +118,123 @@ bool Pvs_LeafVisible(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, const m
 void DecompressVis(const uint8_t *in, const uint8_t *inend, uint8_t *out, uint8_t *outend);
 std::unordered_map<int, std::vector<uint8_t>> DecompressAllVis(const mbsp_t *bsp, bool trans_water = false);
 
+/**
+ * Decompressed visdata for the entire map, stored as one contiguous bit matrix
+ * plus per-leaf lookup tables.
+ *
+ *  - Q2: one row per cluster
+ *  - Q1/others: one row per unique visofs (func_detail leafs share rows)
+ *
+ * Rows are padded to PVS_ROW_ALIGNMENT bytes and the storage is aligned to the same
+ * boundary, so Pvs_Union()/Pvs_Intersects() can process whole rows with wide loads.
+ */
+constexpr size_t PVS_ROW_ALIGNMENT = 64;
+
+class pvs_matrix_t
+{
+    // number of meaningful bytes in a row (DecompressedVisSize())
+    size_t m_row_size = 0;
+    // distance between rows, m_row_size rounded up to PVS_ROW_ALIGNMENT
+    size_t m_row_stride = 0;
+    std::vector<uint8_t, aligned_allocator<uint8_t, PVS_ROW_ALIGNMENT>> m_bits;
+    // leafnum -> row index, or -1 if the leaf has no (valid) visdata
+    std::vector<int32_t> m_leaf_rows;
+    // leafnum -> bit index within a row that represents this leaf, or -1 if it can't be seen
+    std::vector<int32_t> m_leaf_bits;
+
+public:
+    pvs_matrix_t() = default;
+    explicit pvs_matrix_t(const mbsp_t *bsp);
+
+    inline bool empty() const { return m_bits.empty(); }
+    inline size_t row_size() const { return m_row_size; }
+    inline size_t row_stride() const { return m_row_stride; }
+    inline size_t num_rows() const { return m_row_stride ? m_bits.size() / m_row_stride : 0; }
+
+    // returns the decompressed pvs row for the given leaf, or nullptr if it has none
+    inline const uint8_t *leaf_row(size_t leafnum) const
+    {
+        if (leafnum >= m_leaf_rows.size() || m_leaf_rows[leafnum] < 0) {
+            return nullptr;
+        }
+        return m_bits.data() + (m_leaf_rows[leafnum] * m_row_stride);
+    }
+
+    // returns the bit index within a row that represents leafnum, or -1 if it can't be seen
+    inline int32_t leaf_bit(size_t leafnum) const { return m_leaf_bits[leafnum]; }
+
+    // returns true if the given pvs row (of at least row_size() bytes) can see leafnum.
+    // equivalent to Pvs_LeafVisible() but without the per-call validation.
+    inline bool leaf_visible(const uint8_t *row, size_t leafnum) const
+    {
+        const int32_t bit = m_leaf_bits[leafnum];
+        return bit >= 0 && (row[bit >> 3] & (1 << (bit & 7)));
+    }
+};
+
+// dst |= src, for numbytes bytes
+void Pvs_Union(uint8_t *dst, const uint8_t *src, size_t numbytes);
+// returns true if (a & b) has any bits set, for numbytes bytes
+bool Pvs_Intersects(const uint8_t *a, const uint8_t *b, size_t numbytes);
+
+/**
+ * Point -> leaf lookup for one model's hull 0, built for callers that locate many points
+ * (sample points, lightgrid points, VPLs).
+ *
+ *  - the node tree is flattened into a contiguous array of 32-byte nodes, with axial
+ *    planes expanded to unit normals so every step is the same branch-free dot product
+ *  - a coarse uniform grid over the model bounds stores, per cell, the deepest node (or
+ *    leaf) whose subtree contains the entire cell, so most queries skip the top of the tree
+ *  - find_leafs() descends several points in lock-step to hide the memory latency of
+ *    each step
+ *
+ * Results are identical to BSP_FindLeafAtPoint() (points exactly on a plane go to the front).
+ */
+class leaf_locator_t
+{
+    struct node_t
+    {
+        qvec3f normal;
+        float dist;
+        // >= 0: index into m_nodes, < 0: -(leafnum + 1)
+        std::array<int32_t, 2> children;
+        int32_t pad[2];
+    };
+
+    const mbsp_t *m_bsp = nullptr;
+    std::vector<node_t> m_nodes;
+    int32_t m_headnode = 0;
+
+    // jump table
+    qvec3d m_grid_mins{};
+    qvec3d m_inv_cell_size{};
+    qvec3i m_grid_size{};
+    std::vector<int32_t> m_cells;
+
+    int32_t start_node(const qvec3d &point) const;
+
+    // returns the child of node that point is in front of / behind
+    static inline int32_t step(const node_t &node, const qvec3d &point)
+    {
+        const double d = point[0] * node.normal[0] + point[1] * node.normal[1] + point[2] * node.normal[2];
+        return node.children[(d - node.dist) < 0];
+    }
+
+public:
+    leaf_locator_t() = default;
+    leaf_locator_t(const mbsp_t *bsp, const dmodelh2_t *model);
+
+    inline bool empty() const { return m_bsp == nullptr; }
+    // the bsp this locator was built for
+    inline const mbsp_t *bsp() const { return m_bsp; }
+
+    const mleaf_t *find_leaf(const qvec3d &point) const;
+
+    // out[i] = leaf containing points[i], for i in [0, count)
+    template<typename T>
+    void find_leafs(const qvec<T, 3> *points, size_t count, const mleaf_t **out) const;
+};
+
 void BSP_VisitAllLeafs(const mbsp_t &bsp, const dmodelh2_t &model, const std::function<void(const mleaf_t &)> &visitor);
 
 bspx_decoupled_lm_perface BSPX_DecoupledLM(const bspxentries_t &entries, int face_num);
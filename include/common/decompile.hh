@@ -3,13 +3,45 @@
 #include <common/polylib.hh>
 #include <common/bspfile.hh>
 
+#include <common/fs.hh>
+
+#include <cstdint>
+#include <mutex>
 #include <optional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <iosfwd>
 
 struct mbsp_t;
 struct bsp2_dnode_t;
 
+/**
+ * Decompiled text of individual leafs/brushes, keyed by a hash of
+ * everything that goes into them (the planes bounding the leaf, the faces
+ * on those planes, contents, options). Passing the same cache to repeated
+ * decompiles of a bsp that was only partly changed reuses the unchanged
+ * parts; it can be saved to and loaded from a file between runs.
+ */
+class decomp_cache_t
+{
+    mutable std::mutex lock;
+    std::unordered_map<uint64_t, std::string> entries;
+    size_t num_hits = 0, num_misses = 0;
+
+public:
+    std::optional<std::string> find(uint64_t key);
+    void insert(uint64_t key, std::string text);
+
+    size_t size() const;
+    size_t hits() const;
+    size_t misses() const;
+
+    // returns false if the file doesn't exist or isn't a cache file
+    bool load(const fs::path &path);
+    void save(const fs::path &path) const;
+};
+
 struct decomp_options
 {
     /**
@@ -26,9 +58,14 @@ struct decomp_options
     bool ignoreBrushes = false;
 
     int hullnum = 0;
+
+    /**
+     * If set, leafs/brushes are looked up in and added to this cache.
+     */
+    decomp_cache_t *cache = nullptr;
 };
 
-void DecompileBSP(const mbsp_t *bsp, const decomp_options &options, std::ofstream &file);
+void DecompileBSP(const mbsp_t *bsp, const decomp_options &options, std::ostream &file);
 
 struct leaf_visualization_t
 {
@@ -0,0 +1,114 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+// Incremental JSON output and input, for documents too large to hold as one json value
+
+#include <common/json.hh>
+#include <common/fs.hh>
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+
+/**
+ * Writes a document piece by piece. The output is byte-identical to
+ * `stream << std::setw(indent) << j` for the equivalent json value `j`,
+ * provided object members are written in sorted key order.
+ */
+class json_stream_writer_t
+{
+    std::ostream &stream;
+    int indent;
+    // one entry per open container: whether it has no members yet
+    std::vector<bool> empty;
+    // a key was just written, so the next value follows it on the same line
+    bool after_key = false;
+
+    void begin_value();
+    std::string indented(const json &j) const;
+
+public:
+    explicit json_stream_writer_t(std::ostream &stream, int indent = 4);
+
+    void begin_object();
+    void end_object();
+    void begin_array();
+    void end_array();
+
+    void key(std::string_view key);
+    void value(const json &j);
+    // a string value of lowercase hex digits, two per byte
+    void hex_value(const uint8_t *bytes, size_t count);
+
+    /**
+     * Writes `count` array elements, where f(i) returns element i. Elements
+     * are built and formatted in parallel, `batch` at a time, so at most
+     * `batch` of them are in memory at once.
+     */
+    template<typename F>
+    void elements(size_t count, size_t batch, F &&f)
+    {
+        std::vector<std::string> formatted;
+
+        for (size_t start = 0; start < count; start += batch) {
+            const size_t end = std::min(count, start + batch);
+            formatted.resize(end - start);
+
+            tbb::parallel_for(start, end, [&](size_t i) { formatted[i - start] = indented(f(i)); });
+
+            for (auto &s : formatted) {
+                begin_value();
+                stream << s;
+            }
+        }
+    }
+};
+
+/**
+ * Reads members of a document whose root is an object without parsing the
+ * rest of it; parsing stops as soon as the requested member has been read.
+ */
+class json_stream_reader_t
+{
+    fs::path path;
+
+public:
+    explicit json_stream_reader_t(const fs::path &path);
+
+    // names of the root object's members, in file order
+    std::vector<std::string> keys() const;
+
+    // the whole value of the member `key`
+    std::optional<json> read(std::string_view key) const;
+
+    /**
+     * Calls f with each element of the member `key` in turn, only holding
+     * one element in memory at once; if the member isn't an array, f is
+     * called once with its value. Returns false if there's no such member.
+     */
+    bool for_each_element(std::string_view key, const std::function<void(json &&)> &f) const;
+};
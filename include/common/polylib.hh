@@ -8,6 +8,7 @@
 #include <common/bspfile.hh>
 #include <common/cmdlib.hh>
 #include <common/aabb.hh>
+#include <common/qvec_simd.hh>
 #include <variant>
 #include <array>
 #include <vector>
@@ -119,6 +120,13 @@ public:
 
     inline size_t size() const { return count; }
 
+    // calls f(points, count) for each contiguous run of points, in order
+    template<typename F>
+    inline void for_each_span(F &&f) const
+    {
+        f(array.data(), count);
+    }
+
     inline qvec3d &at(const size_t &index)
     {
 #ifdef _DEBUG
@@ -243,6 +251,13 @@ public:
 
     inline size_t size() const { return values.size(); }
 
+    // calls f(points, count) for each contiguous run of points, in order
+    template<typename F>
+    inline void for_each_span(F &&f) const
+    {
+        f(values.data(), values.size());
+    }
+
     inline qvec3d &at(const size_t &index) { return values[index]; }
 
     inline const qvec3d &at(const size_t &index) const { return values[index]; }
@@ -479,6 +494,17 @@ public:
 
     inline size_t vector_size() const { return vector.size(); }
 
+    // calls f(points, count) for each contiguous run of points, in order
+    template<typename F>
+    inline void for_each_span(F &&f) const
+    {
+        f(array.data(), std::min(count, N));
+
+        if (count > N) {
+            f(vector.data(), count - N);
+        }
+    }
+
     inline qvec3d &at(const size_t &index)
     {
 #ifdef _DEBUG
@@ -862,44 +888,40 @@ public:
         return result;
     }
 
-    // dists/sides can be null, or must have (size() + 1) reserved
+    // dists must have (size() + 1) reserved
+    inline void calc_dists(const qplane3d &plane, vec_t *dists) const
+    {
+        size_t offset = 0;
+
+        storage.for_each_span([&](const qvec3d *points, size_t count) {
+            qv::plane_distances(plane, points, count, dists + offset);
+            offset += count;
+        });
+
+        dists[offset] = dists[0];
+    }
+
+    // sides can be null, or must have (size() + 1) reserved
     inline std::array<size_t, SIDE_TOTAL> calc_sides(
-        const qplane3d &plane, vec_t *dists, planeside_t *sides, const vec_t &on_epsilon = DEFAULT_ON_EPSILON) const
+        const qplane3d &plane, planeside_t *sides, const vec_t &on_epsilon = DEFAULT_ON_EPSILON) const
     {
         std::array<size_t, SIDE_TOTAL> counts{};
 
         /* determine sides for each point */
-        size_t i;
+        planeside_t *point_sides = sides ? sides : (planeside_t *)alloca(sizeof(planeside_t) * (size() + 1));
+        size_t offset = 0;
 
-        for (i = 0; i < size(); i++) {
-            vec_t dot = plane.distance_to(at(i));
+        storage.for_each_span([&](const qvec3d *points, size_t count) {
+            const auto span_counts = qv::classify_points(plane, points, count, on_epsilon, point_sides + offset);
 
-            if (dists) {
-                dists[i] = dot;
+            for (size_t side = 0; side < SIDE_TOTAL; side++) {
+                counts[side] += span_counts[side];
             }
 
-            planeside_t side;
-
-            if (dot > on_epsilon)
-                side = SIDE_FRONT;
-            else if (dot < -on_epsilon)
-                side = SIDE_BACK;
-            else
-                side = SIDE_ON;
-
-            counts[side]++;
-
-            if (sides) {
-                sides[i] = side;
-            }
-        }
+            offset += count;
+        });
 
-        if (sides) {
-            sides[i] = sides[SIDE_FRONT];
-        }
-        if (dists) {
-            dists[i] = dists[SIDE_FRONT];
-        }
+        point_sides[offset] = point_sides[0];
 
         return counts;
     }
@@ -932,7 +954,8 @@ public:
         vec_t *dists = (vec_t *)alloca(sizeof(vec_t) * (size() + 1));
         planeside_t *sides = (planeside_t *)alloca(sizeof(planeside_t) * (size() + 1));
 
-        std::array<size_t, SIDE_TOTAL> counts = calc_sides(plane, dists, sides, on_epsilon);
+        // the distances are only needed, and computed, if the winding is split
+        std::array<size_t, SIDE_TOTAL> counts = calc_sides(plane, sides, on_epsilon);
 
         if (keepon && !counts[SIDE_FRONT] && !counts[SIDE_BACK])
             return {this->clone<TStor>(), std::nullopt};
@@ -942,6 +965,8 @@ public:
         else if (!counts[SIDE_BACK])
             return {this->clone<TStor>(), std::nullopt};
 
+        calc_dists(plane, dists);
+
         twosided<winding_base_t<TStor>> results{};
 
         for (auto &w : results) {
@@ -1003,7 +1028,8 @@ public:
         vec_t *dists = (vec_t *)alloca(sizeof(vec_t) * (size() + 1));
         planeside_t *sides = (planeside_t *)alloca(sizeof(planeside_t) * (size() + 1));
 
-        std::array<size_t, SIDE_TOTAL> counts = calc_sides(plane, dists, sides, on_epsilon);
+        // the distances are only needed, and computed, if the winding is split
+        std::array<size_t, SIDE_TOTAL> counts = calc_sides(plane, sides, on_epsilon);
 
         if (keepon && !counts[SIDE_FRONT] && !counts[SIDE_BACK])
             return std::move(*this);
@@ -1013,6 +1039,8 @@ public:
         else if (!counts[SIDE_BACK])
             return std::move(*this);
 
+        calc_dists(plane, dists);
+
         winding_base_t result;
         result.reserve(size() + 4);
 
@@ -1067,7 +1095,8 @@ public:
         vec_t *dists = (vec_t *)alloca(sizeof(vec_t) * (size() + 1));
         planeside_t *sides = (planeside_t *)alloca(sizeof(planeside_t) * (size() + 1));
 
-        std::array<size_t, SIDE_TOTAL> counts = calc_sides(plane, dists, sides, on_epsilon);
+        // the distances are only needed, and computed, if the winding is split
+        std::array<size_t, SIDE_TOTAL> counts = calc_sides(plane, sides, on_epsilon);
 
         if (keepon && !counts[SIDE_FRONT] && !counts[SIDE_BACK])
             return std::nullopt;
@@ -1077,6 +1106,8 @@ public:
         else if (!counts[SIDE_BACK])
             return std::nullopt;
 
+        calc_dists(plane, dists);
+
         winding_base_t result;
         result.reserve(size() + 4);
 
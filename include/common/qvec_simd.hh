@@ -0,0 +1,449 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+// Vector math over many points at once, vectorized across the points
+
+#include <common/qvec.hh>
+#include <common/aabb.hh>
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define QVEC_USE_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QVEC_USE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define QVEC_USE_NEON
+#endif
+
+namespace qv::simd
+{
+/**
+ * `width` lanes of T, with the few operations the batch functions need.
+ * The primary template is the scalar fallback; each lane computes exactly
+ * what the scalar code would, so results don't depend on the instruction set.
+ */
+template<typename T>
+struct lanes
+{
+    static constexpr size_t width = 1;
+
+    T v;
+
+    static lanes set1(T a) { return {a}; }
+    static lanes load(const T *p) { return {*p}; }
+    // component c of points[0 .. width)
+    static lanes gather(const qvec<T, 3> *points, size_t c) { return {points[0][c]}; }
+    void store(T *p) const { *p = v; }
+
+    friend lanes operator+(lanes a, lanes b) { return {a.v + b.v}; }
+    friend lanes operator-(lanes a, lanes b) { return {a.v - b.v}; }
+    friend lanes operator*(lanes a, lanes b) { return {a.v * b.v}; }
+    friend lanes min(lanes a, lanes b) { return {std::min(a.v, b.v)}; }
+    friend lanes max(lanes a, lanes b) { return {std::max(a.v, b.v)}; }
+
+    // comparisons return a mask with bit i set if they hold for lane i
+    friend unsigned greater(lanes a, lanes b) { return a.v > b.v; }
+    friend unsigned less(lanes a, lanes b) { return a.v < b.v; }
+};
+
+#if defined(QVEC_USE_AVX)
+template<>
+struct lanes<float>
+{
+    static constexpr size_t width = 8;
+
+    __m256 v;
+
+    static lanes set1(float a) { return {_mm256_set1_ps(a)}; }
+    static lanes load(const float *p) { return {_mm256_loadu_ps(p)}; }
+    static lanes gather(const qvec3f *p, size_t c)
+    {
+        return {_mm256_set_ps(p[7][c], p[6][c], p[5][c], p[4][c], p[3][c], p[2][c], p[1][c], p[0][c])};
+    }
+    void store(float *p) const { _mm256_storeu_ps(p, v); }
+
+    friend lanes operator+(lanes a, lanes b) { return {_mm256_add_ps(a.v, b.v)}; }
+    friend lanes operator-(lanes a, lanes b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    friend lanes operator*(lanes a, lanes b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    // operands swapped so that, like std::min/max, a is returned when they compare equal
+    friend lanes min(lanes a, lanes b) { return {_mm256_min_ps(b.v, a.v)}; }
+    friend lanes max(lanes a, lanes b) { return {_mm256_max_ps(b.v, a.v)}; }
+
+    friend unsigned greater(lanes a, lanes b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+    friend unsigned less(lanes a, lanes b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+};
+
+template<>
+struct lanes<double>
+{
+    static constexpr size_t width = 4;
+
+    __m256d v;
+
+    static lanes set1(double a) { return {_mm256_set1_pd(a)}; }
+    static lanes load(const double *p) { return {_mm256_loadu_pd(p)}; }
+    static lanes gather(const qvec3d *p, size_t c) { return {_mm256_set_pd(p[3][c], p[2][c], p[1][c], p[0][c])}; }
+    void store(double *p) const { _mm256_storeu_pd(p, v); }
+
+    friend lanes operator+(lanes a, lanes b) { return {_mm256_add_pd(a.v, b.v)}; }
+    friend lanes operator-(lanes a, lanes b) { return {_mm256_sub_pd(a.v, b.v)}; }
+    friend lanes operator*(lanes a, lanes b) { return {_mm256_mul_pd(a.v, b.v)}; }
+    friend lanes min(lanes a, lanes b) { return {_mm256_min_pd(b.v, a.v)}; }
+    friend lanes max(lanes a, lanes b) { return {_mm256_max_pd(b.v, a.v)}; }
+
+    friend unsigned greater(lanes a, lanes b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ)); }
+    friend unsigned less(lanes a, lanes b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)); }
+};
+#elif defined(QVEC_USE_SSE2)
+template<>
+struct lanes<float>
+{
+    static constexpr size_t width = 4;
+
+    __m128 v;
+
+    static lanes set1(float a) { return {_mm_set1_ps(a)}; }
+    static lanes load(const float *p) { return {_mm_loadu_ps(p)}; }
+    static lanes gather(const qvec3f *p, size_t c) { return {_mm_set_ps(p[3][c], p[2][c], p[1][c], p[0][c])}; }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+
+    friend lanes operator+(lanes a, lanes b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend lanes operator-(lanes a, lanes b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend lanes operator*(lanes a, lanes b) { return {_mm_mul_ps(a.v, b.v)}; }
+    // operands swapped so that, like std::min/max, a is returned when they compare equal
+    friend lanes min(lanes a, lanes b) { return {_mm_min_ps(b.v, a.v)}; }
+    friend lanes max(lanes a, lanes b) { return {_mm_max_ps(b.v, a.v)}; }
+
+    friend unsigned greater(lanes a, lanes b) { return _mm_movemask_ps(_mm_cmpgt_ps(a.v, b.v)); }
+    friend unsigned less(lanes a, lanes b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+};
+
+template<>
+struct lanes<double>
+{
+    static constexpr size_t width = 2;
+
+    __m128d v;
+
+    static lanes set1(double a) { return {_mm_set1_pd(a)}; }
+    static lanes load(const double *p) { return {_mm_loadu_pd(p)}; }
+    static lanes gather(const qvec3d *p, size_t c) { return {_mm_set_pd(p[1][c], p[0][c])}; }
+    void store(double *p) const { _mm_storeu_pd(p, v); }
+
+    friend lanes operator+(lanes a, lanes b) { return {_mm_add_pd(a.v, b.v)}; }
+    friend lanes operator-(lanes a, lanes b) { return {_mm_sub_pd(a.v, b.v)}; }
+    friend lanes operator*(lanes a, lanes b) { return {_mm_mul_pd(a.v, b.v)}; }
+    friend lanes min(lanes a, lanes b) { return {_mm_min_pd(b.v, a.v)}; }
+    friend lanes max(lanes a, lanes b) { return {_mm_max_pd(b.v, a.v)}; }
+
+    friend unsigned greater(lanes a, lanes b) { return _mm_movemask_pd(_mm_cmpgt_pd(a.v, b.v)); }
+    friend unsigned less(lanes a, lanes b) { return _mm_movemask_pd(_mm_cmplt_pd(a.v, b.v)); }
+};
+#elif defined(QVEC_USE_NEON)
+template<>
+struct lanes<float>
+{
+    static constexpr size_t width = 4;
+
+    float32x4_t v;
+
+    static lanes set1(float a) { return {vdupq_n_f32(a)}; }
+    static lanes load(const float *p) { return {vld1q_f32(p)}; }
+    static lanes gather(const qvec3f *p, size_t c)
+    {
+        const float a[4] = {p[0][c], p[1][c], p[2][c], p[3][c]};
+        return {vld1q_f32(a)};
+    }
+    void store(float *p) const { vst1q_f32(p, v); }
+
+    friend lanes operator+(lanes a, lanes b) { return {vaddq_f32(a.v, b.v)}; }
+    friend lanes operator-(lanes a, lanes b) { return {vsubq_f32(a.v, b.v)}; }
+    friend lanes operator*(lanes a, lanes b) { return {vmulq_f32(a.v, b.v)}; }
+    friend lanes min(lanes a, lanes b) { return {vminq_f32(a.v, b.v)}; }
+    friend lanes max(lanes a, lanes b) { return {vmaxq_f32(a.v, b.v)}; }
+
+    static unsigned bits(uint32x4_t m)
+    {
+        const uint32x4_t weights = {1, 2, 4, 8};
+        return vaddvq_u32(vandq_u32(m, weights));
+    }
+    friend unsigned greater(lanes a, lanes b) { return bits(vcgtq_f32(a.v, b.v)); }
+    friend unsigned less(lanes a, lanes b) { return bits(vcltq_f32(a.v, b.v)); }
+};
+
+template<>
+struct lanes<double>
+{
+    static constexpr size_t width = 2;
+
+    float64x2_t v;
+
+    static lanes set1(double a) { return {vdupq_n_f64(a)}; }
+    static lanes load(const double *p) { return {vld1q_f64(p)}; }
+    static lanes gather(const qvec3d *p, size_t c)
+    {
+        const double a[2] = {p[0][c], p[1][c]};
+        return {vld1q_f64(a)};
+    }
+    void store(double *p) const { vst1q_f64(p, v); }
+
+    friend lanes operator+(lanes a, lanes b) { return {vaddq_f64(a.v, b.v)}; }
+    friend lanes operator-(lanes a, lanes b) { return {vsubq_f64(a.v, b.v)}; }
+    friend lanes operator*(lanes a, lanes b) { return {vmulq_f64(a.v, b.v)}; }
+    friend lanes min(lanes a, lanes b) { return {vminq_f64(a.v, b.v)}; }
+    friend lanes max(lanes a, lanes b) { return {vmaxq_f64(a.v, b.v)}; }
+
+    static unsigned bits(uint64x2_t m)
+    {
+        const uint64x2_t weights = {1, 2};
+        return vaddvq_u64(vandq_u64(m, weights));
+    }
+    friend unsigned greater(lanes a, lanes b) { return bits(vcgtq_f64(a.v, b.v)); }
+    friend unsigned less(lanes a, lanes b) { return bits(vcltq_f64(a.v, b.v)); }
+};
+#endif
+
+// same operation order as qplane3::distance_to
+template<typename T>
+inline lanes<T> distance_to(const lanes<T> (&plane)[4], lanes<T> x, lanes<T> y, lanes<T> z)
+{
+    return x * plane[0] + (y * plane[1] + z * plane[2]) - plane[3];
+}
+
+template<typename T>
+inline void splat(const qplane3<T> &plane, lanes<T> (&out)[4])
+{
+    out[0] = lanes<T>::set1(plane.normal[0]);
+    out[1] = lanes<T>::set1(plane.normal[1]);
+    out[2] = lanes<T>::set1(plane.normal[2]);
+    out[3] = lanes<T>::set1(plane.dist);
+}
+} // namespace qv::simd
+
+namespace qv
+{
+/**
+ * Points stored as separate x, y and z arrays, for testing many points
+ * against a plane without gathering their components.
+ */
+template<typename T>
+struct points_soa_t
+{
+    std::vector<T> x, y, z;
+
+    points_soa_t() = default;
+
+    template<typename Iter>
+    points_soa_t(Iter first, Iter last)
+    {
+        for (; first != last; ++first) {
+            push_back(*first);
+        }
+    }
+
+    inline size_t size() const { return x.size(); }
+
+    inline void push_back(const qvec<T, 3> &p)
+    {
+        x.push_back(p[0]);
+        y.push_back(p[1]);
+        z.push_back(p[2]);
+    }
+};
+
+// out[i] = plane.distance_to(points[i])
+template<typename T>
+inline void plane_distances(const qplane3<T> &plane, const qvec<T, 3> *points, size_t count, T *out)
+{
+    using L = simd::lanes<T>;
+
+    L p[4];
+    simd::splat(plane, p);
+
+    size_t i = 0;
+
+    for (; i + L::width <= count; i += L::width) {
+        const qvec<T, 3> *block = points + i;
+        simd::distance_to(p, L::gather(block, 0), L::gather(block, 1), L::gather(block, 2)).store(out + i);
+    }
+
+    for (; i < count; i++) {
+        out[i] = plane.distance_to(points[i]);
+    }
+}
+
+// out[i] = plane.distance_to(point i of `points`)
+template<typename T>
+inline void plane_distances(const qplane3<T> &plane, const points_soa_t<T> &points, T *out)
+{
+    using L = simd::lanes<T>;
+
+    L p[4];
+    simd::splat(plane, p);
+
+    const size_t count = points.size();
+    size_t i = 0;
+
+    for (; i + L::width <= count; i += L::width) {
+        simd::distance_to(p, L::load(&points.x[i]), L::load(&points.y[i]), L::load(&points.z[i])).store(out + i);
+    }
+
+    for (; i < count; i++) {
+        out[i] = plane.distance_to(qvec<T, 3>{points.x[i], points.y[i], points.z[i]});
+    }
+}
+
+// the bounds of `count` points; same as adding them to an empty aabb one at a time
+template<typename T>
+inline aabb<T, 3> bounds(const qvec<T, 3> *points, size_t count)
+{
+    using L = simd::lanes<T>;
+
+    if (count < L::width) {
+        aabb<T, 3> result;
+        for (size_t i = 0; i < count; i++) {
+            result += points[i];
+        }
+        return result;
+    }
+
+    L mins[3], maxs[3];
+
+    for (size_t c = 0; c < 3; c++) {
+        mins[c] = maxs[c] = L::gather(points, c);
+    }
+
+    size_t i = L::width;
+
+    for (; i + L::width <= count; i += L::width) {
+        for (size_t c = 0; c < 3; c++) {
+            const L v = L::gather(points + i, c);
+            mins[c] = min(mins[c], v);
+            maxs[c] = max(maxs[c], v);
+        }
+    }
+
+    qvec<T, 3> result_mins, result_maxs;
+
+    for (size_t c = 0; c < 3; c++) {
+        T lo[L::width], hi[L::width];
+        mins[c].store(lo);
+        maxs[c].store(hi);
+
+        result_mins[c] = *std::min_element(lo, lo + L::width);
+        result_maxs[c] = *std::max_element(hi, hi + L::width);
+
+        for (size_t j = i; j < count; j++) {
+            result_mins[c] = std::min(result_mins[c], points[j][c]);
+            result_maxs[c] = std::max(result_maxs[c], points[j][c]);
+        }
+    }
+
+    return {result_mins, result_maxs};
+}
+
+inline planeside_t classify_distance(double dist, double epsilon)
+{
+    if (dist > epsilon) {
+        return SIDE_FRONT;
+    } else if (dist < -epsilon) {
+        return SIDE_BACK;
+    }
+
+    return SIDE_ON;
+}
+
+namespace simd
+{
+// sides of four points, indexed by the masks of those in front | those behind << 4
+inline constexpr auto side_table = [] {
+    std::array<std::array<planeside_t, 4>, 256> table{};
+
+    for (unsigned masks = 0; masks < 256; masks++) {
+        for (unsigned j = 0; j < 4; j++) {
+            const bool front = (masks >> j) & 1, back = (masks >> (j + 4)) & 1;
+            table[masks][j] = front ? SIDE_FRONT : back ? SIDE_BACK : SIDE_ON;
+        }
+    }
+
+    return table;
+}();
+
+inline constexpr uint8_t popcount_table[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+// writes the sides of `width` points given masks of the lanes in front of and behind the plane
+template<size_t width>
+inline void store_sides(unsigned front, unsigned back, planeside_t *sides, size_t &num_front, size_t &num_back)
+{
+    for (size_t j = 0; j < width; j += 4) {
+        const unsigned f = (front >> j) & 15, b = (back >> j) & 15;
+
+        std::copy_n(side_table[f | (b << 4)].begin(), std::min<size_t>(width - j, 4), sides + j);
+
+        num_front += popcount_table[f];
+        num_back += popcount_table[b];
+    }
+}
+} // namespace simd
+
+// sides[i] = the side of plane points[i] is on; returns the number of points on each side
+inline std::array<size_t, SIDE_TOTAL> classify_points(
+    const qplane3d &plane, const qvec3d *points, size_t count, double epsilon, planeside_t *sides)
+{
+    // kept in locals rather than the result so they stay in registers
+    size_t num_front = 0, num_back = 0;
+    size_t i = 0;
+
+    using L = simd::lanes<double>;
+
+    L p[4];
+    simd::splat(plane, p);
+
+    const L eps = L::set1(epsilon);
+    const L neg_eps = L::set1(-epsilon);
+
+    for (; i + L::width <= count; i += L::width) {
+        const qvec3d *block = points + i;
+        const L dist = simd::distance_to(p, L::gather(block, 0), L::gather(block, 1), L::gather(block, 2));
+
+        simd::store_sides<L::width>(greater(dist, eps), less(dist, neg_eps), sides + i, num_front, num_back);
+    }
+
+    for (; i < count; i++) {
+        sides[i] = classify_distance(plane.distance_to(points[i]), epsilon);
+        num_front += sides[i] == SIDE_FRONT;
+        num_back += sides[i] == SIDE_BACK;
+    }
+
+    std::array<size_t, SIDE_TOTAL> counts;
+    counts[SIDE_FRONT] = num_front;
+    counts[SIDE_BACK] = num_back;
+    counts[SIDE_ON] = count - num_front - num_back;
+
+    return counts;
+}
+} // namespace qv
@@ -602,6 +602,7 @@ public:
     setting_bool q2rtx;
     setting_invertible_bool defaultpaths;
     setting_scalar tex_saturation_boost;
+    setting_path texturecache;
 
     common_settings();
 
@@ -0,0 +1,123 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * Growable output storage for the lightmaps of every face.
+ *
+ * Offsets are counted in samples; the greyscale plane stores 1 byte per
+ * sample and the color/direction planes 3, so a face's lit/lux data lives
+ * at 3x its greyscale offset, as in the bsp and .lit/.lux files.
+ *
+ * Storage is a list of chunks that never move once allocated, so pointers
+ * handed out stay valid while other threads keep reserving. Reserving
+ * within the current chunk is a single CAS; when a reservation doesn't fit,
+ * the chunk is sealed at its current fill and a new one starts right after
+ * it, so the offset space has no gaps and the planes can be concatenated
+ * (or streamed out) as-is.
+ */
+class lightmap_arena_t
+{
+public:
+    enum class plane_t
+    {
+        mono,
+        lit,
+        lux
+    };
+
+    // samples in a chunk, unless a single reservation needs more
+    static constexpr size_t DEFAULT_CHUNK_SAMPLES = 1 << 20;
+
+    struct span_t
+    {
+        int offset;
+        // nullptr for planes that aren't stored
+        uint8_t *mono, *lit, *lux;
+    };
+
+    /**
+     * Discards all data and selects which planes are stored
+     */
+    void reset(bool mono, bool lit, bool lux, size_t chunk_samples = DEFAULT_CHUNK_SAMPLES);
+    void clear();
+
+    /**
+     * Reserves zeroed space for `samples` samples (rounded up to a multiple
+     * of 4). Thread safe.
+     */
+    span_t reserve(size_t samples);
+
+    /**
+     * Pointers to previously reserved space at `offset`. Not safe to call
+     * while other threads are reserving.
+     */
+    span_t at(size_t offset);
+
+    bool has_plane(plane_t plane) const;
+
+    // total samples reserved
+    size_t size() const;
+
+    /**
+     * Copies the first `samples` samples of a plane into one buffer, zero
+     * padded if fewer have been reserved
+     */
+    std::vector<uint8_t> compact(plane_t plane, size_t samples) const;
+
+    /**
+     * Same as compact, but writes straight to a stream
+     */
+    void write(std::ostream &stream, plane_t plane, size_t samples) const;
+
+private:
+    struct chunk_t
+    {
+        size_t start, capacity;
+        // samples reserved, or SEALED once the next chunk has been started
+        std::atomic<size_t> used{0};
+        size_t sealed_length = 0;
+        std::unique_ptr<uint8_t[]> planes[3];
+
+        size_t length() const;
+    };
+
+    static constexpr size_t SEALED = SIZE_MAX / 2;
+
+    span_t make_span(chunk_t &chunk, size_t offset_in_chunk) const;
+    void grow(chunk_t *full, size_t samples);
+
+    template<typename F>
+    void for_each_range(plane_t plane, size_t samples, F &&f) const;
+
+    bool planes_enabled[3] = {};
+    size_t chunk_samples = DEFAULT_CHUNK_SAMPLES;
+
+    std::mutex chunks_lock;
+    std::vector<std::unique_ptr<chunk_t>> chunks;
+    std::atomic<chunk_t *> current{nullptr};
+};
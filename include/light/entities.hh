@@ -142,6 +142,28 @@ const std::vector<entdict_t> &GetEntdicts();
 std::vector<sun_t> &GetSuns();
 std::vector<entdict_t> &GetRadLights();
 
+/**
+ * Lights (or suns) that cast identical shadow rays, i.e. same position (or
+ * direction), _deviance/_samples, shadow casters and sign, and only differ
+ * in style, color, attenuation etc. Direct lighting traces each group's rays
+ * once and accumulates every member into its own style's lightmap.
+ *
+ * Only lights that are directly cast onto faces are grouped
+ * (no _localmin or _nostaticlight lights).
+ */
+struct light_group_t
+{
+    std::vector<const light_t *> lights;
+};
+
+struct sun_group_t
+{
+    std::vector<const sun_t *> suns;
+};
+
+const std::vector<light_group_t> &GetLightGroups();
+const std::vector<sun_group_t> &GetSunGroups();
+
 const std::vector<std::unique_ptr<light_t>> &GetSurfaceLightTemplates();
 
 bool FaceMatchesSurfaceLightTemplate(
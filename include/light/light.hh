@@ -124,6 +124,15 @@ struct lightsurf_t
         fully occluded. dirtgain/dirtscale are not applied yet
         */
         float occlusion;
+        /*
+        if set, another (coplanar) lightsurf has a sample at the same point,
+        so direct, dirt and bounce lighting aren't computed here but gathered
+        from that sample; see ShareLightmapSurfaceSamples
+        */
+        int32_t source_facenum = -1;
+        int32_t source_index = -1;
+
+        bool shared() const { return source_facenum != -1; }
     };
 
     std::vector<sample_data_t> samples;
@@ -376,6 +385,8 @@ public:
     setting_bool novanilla;
     setting_scalar gate;
     setting_int32 sunsamples;
+    setting_bool sortrays;
+    setting_bool noshareluxels;
     setting_bool arghradcompat;
     setting_bool nolighting;
     setting_vec3 debugface;
@@ -430,11 +441,12 @@ public:
 
 extern settings::light_settings light_options;
 
-extern std::vector<uint8_t> filebase;
-extern std::vector<uint8_t> lit_filebase;
-extern std::vector<uint8_t> lux_filebase;
-
-const std::unordered_map<int, std::vector<uint8_t>> &UncompressedVis();
+class lightmap_arena_t;
+// lightmap output of the current run; see GetFileSpace
+const lightmap_arena_t &LightmapArena();
+const pvs_matrix_t &UncompressedVis();
+// hull 0 point -> leaf lookup for the world model; see Light_PointInLeaf
+const leaf_locator_t &WorldLeafLocator();
 
 bool IsOutputtingSupplementaryData();
 
@@ -446,7 +458,7 @@ extern std::vector<surfflags_t> extended_texinfo_flags;
 // public functions
 
 void FixupGlobalSettings(void);
-void GetFileSpace(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int size);
+int GetFileSpace(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int size);
 void GetFileSpace_PreserveOffsetInBsp(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int lightofs);
 const modelinfo_t *ModelInfoForModel(const mbsp_t *bsp, int modelnum);
 /**
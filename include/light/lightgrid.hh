@@ -23,5 +23,6 @@
 
 struct bspdata_t;
 
-std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp, qvec3d world_point);
+std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(
+    const mbsp_t *bsp, qvec3d world_point, const mleaf_t *leaf = nullptr);
 void LightGrid(bspdata_t *bspdata);
@@ -23,9 +23,11 @@
 
 #include <atomic>
 #include <memory>
+#include <vector>
 
 struct mface_t;
 struct mbsp_t;
+struct mleaf_t;
 
 namespace settings
 {
@@ -48,6 +50,8 @@ vec_t GetLightValue(const settings::worldspawn_keys &cfg, const light_t *entity,
 void SetupDirt(settings::worldspawn_keys &cfg);
 std::unique_ptr<lightsurf_t> CreateLightmapSurface(const mbsp_t *bsp, const mface_t *face, const facesup_t *facesup,
     const bspx_decoupled_lm_perface *facesup_decoupled, const settings::worldspawn_keys &cfg);
+void ShareLightmapSurfaceSamples(const mbsp_t *bsp, std::vector<std::unique_ptr<lightsurf_t>> &surfaces);
+void GatherSharedSamples(const mbsp_t *bsp, std::vector<std::unique_ptr<lightsurf_t>> &surfaces);
 bool Face_IsLightmapped(const mbsp_t *bsp, const mface_t *face);
 bool Face_IsEmissive(const mbsp_t *bsp, const mface_t *face);
 void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
@@ -88,5 +92,6 @@ struct lightgrid_samples_t
     bool operator==(const lightgrid_samples_t &other) const;
 };
 
-lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3d &world_point);
+// leaf, if given, must be the leaf containing world_point; saves a lookup when the caller already has it
+lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3d &world_point, const mleaf_t *leaf = nullptr);
 void ResetLtFace();
@@ -0,0 +1,92 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#include <common/qvec.hh>
+
+/*
+ * Sample sets shared by soft (_deviance) lights, sun penumbrae and dirt.
+ *
+ * Sample sets are low-discrepancy (Sobol, or jittered strata), and
+ * decorrelated per luxel by a scramble/rotation derived from a tiled
+ * blue-noise mask, so neighbouring luxels get different but evenly spread
+ * sets. The remaining error shows up as fine, high-frequency noise instead
+ * of the clumping and banding of independent random samples.
+ */
+namespace sampler
+{
+// dimensions supported by sobol()
+constexpr int SOBOL_DIMENSIONS = 3;
+
+// side length of the tiled blue noise mask
+constexpr int BLUE_NOISE_SIZE = 64;
+
+/**
+ * Component `dim` of the `index`th point of the Sobol sequence, in [0, 1).
+ * A non-zero scramble XORs the point's bits, which keeps the sequence
+ * stratified while decorrelating it from other scrambles.
+ */
+float sobol(uint32_t index, int dim, uint32_t scramble = 0);
+
+qvec2f sobol2(uint32_t index, uint32_t scramble = 0);
+qvec3f sobol3(uint32_t index, uint32_t scramble = 0);
+
+/**
+ * The `index`th of `count` jittered strata of [0, 1)^2, laid out on the
+ * most square grid that fits; jitter in [0, 1)^2 positions the point
+ * within its stratum.
+ */
+qvec2f stratified2(uint32_t index, uint32_t count, const qvec2f &jitter);
+
+/**
+ * Value of a tiled BLUE_NOISE_SIZE^2 blue noise mask in [0, 1).
+ * Every value in the tile is distinct, and equal thresholds give evenly
+ * spread (blue noise) point sets.
+ */
+float blue_noise(int x, int y);
+
+// two decorrelated channels of the blue noise mask
+qvec2f blue_noise2(int x, int y);
+
+// a per-luxel scramble for sobol(), derived from the blue noise mask
+uint32_t luxel_scramble(int x, int y);
+
+/**
+ * Cranley-Patterson rotation: offsets a point in [0, 1)^N by `shift`,
+ * wrapping around, so it stays evenly distributed.
+ */
+template<size_t N>
+inline qvec<float, N> rotate(const qvec<float, N> &point, const qvec<float, N> &shift)
+{
+    qvec<float, N> result;
+
+    for (size_t i = 0; i < N; i++) {
+        result[i] = point[i] + shift[i];
+        result[i] -= std::floor(result[i]);
+    }
+
+    return result;
+}
+
+// maps [0, 1)^2 to the unit disk, preserving stratification (Shirley-Chiu)
+qvec2f concentric_disk(const qvec2f &u);
+} // namespace sampler
@@ -48,6 +48,9 @@ struct surfacelight_t
 
     std::vector<qvec3f> points;
     std::vector<const mleaf_t *> leaves;
+    // the pvs bits of all of `leaves` OR'ed together, so the whole light can be vis culled
+    // with one Pvs_Intersects(). empty if any of the points can't be vis culled.
+    std::vector<uint8_t> leaf_pvs_bits;
 
     // Surface light settings...
     struct per_style_t
@@ -77,3 +80,4 @@ size_t GetSurflightPoints();
 std::optional<std::tuple<int32_t, int32_t, qvec3d, light_t *>> IsSurfaceLitFace(const mbsp_t *bsp, const mface_t *face);
 const std::vector<int> &SurfaceLightsForFaceNum(int facenum);
 void MakeRadiositySurfaceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp);
+void SurfaceLight_SetupLeafPvsBits(const mbsp_t *bsp, surfacelight_t &l);
@@ -21,6 +21,8 @@
 
 #include <common/qvec.hh>
 
+#include <vector>
+
 namespace img
 {
 struct texture;
@@ -33,6 +35,72 @@ uint32_t clamp_texcoord(vec_t in, uint32_t width);
 qvec4b SampleTexture(const mface_t *face, const mtexinfo_t *tex, const img::texture *texture, const mbsp_t *bsp,
     const qvec3d &point); // mxd. Palette index -> RGBA
 
+enum class texture_opacity_t : uint8_t
+{
+    MIXED,
+    OPAQUE, // every pixel has alpha 255
+    TRANSPARENT // no pixel has alpha 255 (or there's no texture)
+};
+
+/**
+ * A texture prepared for repeated nearest-neighbour sampling from ray filter callbacks:
+ *
+ *  - opacity() lets fence tests skip sampling entirely for fully opaque/transparent textures
+ *  - opaque_at() reads a 1 bit per pixel "alpha == 255" plane instead of the RGBA pixels
+ *  - sample() can read from box-filtered mip levels, for callers that know their ray footprint
+ *  - power-of-two sizes wrap with a mask instead of clamp_texcoord()'s modulo
+ *
+ * A default-constructed prepared_texture_t stands in for a missing texture; it is
+ * TRANSPARENT and samples as {0, 0, 0, 0}, same as SampleTexture().
+ */
+class prepared_texture_t
+{
+    struct level_t
+    {
+        uint32_t width = 0, height = 0;
+        // width - 1 / height - 1 if power of two, otherwise 0
+        uint32_t width_mask = 0, height_mask = 0;
+        const qvec4b *pixels = nullptr;
+
+        inline uint32_t wrap_x(vec_t in) const
+        {
+            return width_mask ? (static_cast<int64_t>(floor(in)) & width_mask) : clamp_texcoord(in, width);
+        }
+        inline uint32_t wrap_y(vec_t in) const
+        {
+            return height_mask ? (static_cast<int64_t>(floor(in)) & height_mask) : clamp_texcoord(in, height);
+        }
+    };
+
+    texture_opacity_t m_opacity = texture_opacity_t::TRANSPARENT;
+    float m_width_scale = 1, m_height_scale = 1;
+    // level 0 points at the img::texture's pixels, the rest at m_mip_pixels
+    std::vector<level_t> m_levels;
+    std::vector<std::vector<qvec4b>> m_mip_pixels;
+    // bit (x + y * m_opaque_stride * 64) is set if pixel (x, y) of level 0 has alpha 255
+    std::vector<uint64_t> m_opaque_bits;
+    uint32_t m_opaque_stride = 0;
+
+public:
+    prepared_texture_t() = default;
+    explicit prepared_texture_t(const img::texture &texture);
+    // levels point into this object's storage
+    prepared_texture_t(const prepared_texture_t &) = delete;
+    prepared_texture_t(prepared_texture_t &&) = default;
+    prepared_texture_t &operator=(prepared_texture_t &&) = default;
+
+    inline texture_opacity_t opacity() const { return m_opacity; }
+    inline int num_levels() const { return static_cast<int>(m_levels.size()); }
+
+    // texcoord is in the texinfo's texture space (WorldToTexCoord), as for SampleTexture
+    bool opaque_at(const qvec2d &texcoord) const;
+    // nearest sample from the given mip level (clamped to the smallest level)
+    qvec4b sample(const qvec2d &texcoord, int level = 0) const;
+};
+
 class modelinfo_t;
 struct mleaf_t;
 const mleaf_t *Light_PointInLeaf(const mbsp_t *bsp, const qvec3d &point);
+// batch version of Light_PointInLeaf: out[i] = leaf containing points[i]
+void Light_PointsInLeafs(const mbsp_t *bsp, const qvec3d *points, size_t count, const mleaf_t **out);
+void Light_PointsInLeafs(const mbsp_t *bsp, const qvec3f *points, size_t count, const mleaf_t **out);
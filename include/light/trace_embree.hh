@@ -52,6 +52,10 @@ public:
     int _numrays = 0;
     int _maxrays = 0;
 
+    // reorder rays for coherent traversal before tracing them
+    bool _sort_rays = false;
+    std::vector<std::pair<uint64_t, uint32_t>> _ray_order;
+
 public:
     inline raystream_embree_common_t() = default;
     virtual ~raystream_embree_common_t() = default;
@@ -70,13 +74,24 @@ public:
         _ray_dynamic_styles.resize(size);
     }
 
+    // grows the stream to hold at least size rays
+    inline void reserve(size_t size)
+    {
+        if (size > static_cast<size_t>(_maxrays)) {
+            resize(size);
+        }
+    }
+
     constexpr size_t numPushedRays() { return _numrays; }
 
     inline int &getPushedRayPointIndex(size_t j) { return _point_indices[j]; }
 
-    inline qvec3f getPushedRayColor(size_t j)
+    inline qvec3f getPushedRayColor(size_t j) { return tintPushedRayColor(j, _ray_colors[j]); }
+
+    // applies whatever glass ray j passed through to the given color
+    inline qvec3f tintPushedRayColor(size_t j, const qvec3f &color)
     {
-        qvec3f result = _ray_colors[j];
+        qvec3f result = color;
 
         if (_ray_hit_glass[j]) {
             const qvec3f glasscolor = _ray_glass_color[j];
@@ -98,6 +113,8 @@ public:
     inline int &getPushedRayDynamicStyle(size_t j) { return _ray_dynamic_styles[j]; }
 
     inline void clearPushedRays() { _numrays = 0; }
+
+    inline void setSortRays(bool sort) { _sort_rays = sort; }
 };
 
 #ifdef HAVE_EMBREE4
@@ -110,6 +127,55 @@ public:
 
 extern RTCScene scene;
 
+// batches smaller than this aren't worth sorting
+constexpr int MIN_SORTED_RAYS = 64;
+
+/**
+ * Fills order with count (key, ray index) pairs, sorted so that rays with the
+ * same direction octant are together, and within an octant, ordered along a
+ * Morton curve through (origin, direction) space. Neighbouring rays in this
+ * order tend to visit the same BVH nodes.
+ *
+ * rays are stride bytes apart.
+ */
+void Embree_CoherentRayOrder(
+    const RTCRay *rays, size_t stride, size_t count, std::vector<std::pair<uint64_t, uint32_t>> &order);
+
+inline const RTCRay &Embree_GetRay(const RTCRay &ray)
+{
+    return ray;
+}
+
+inline const RTCRay &Embree_GetRay(const RTCRayHit &ray)
+{
+    return ray.ray;
+}
+
+// copies the first count rays into sorted_rays, in coherent order
+template<typename T>
+inline void Embree_GatherCoherentRays(const aligned_vector<T> &rays, int count,
+    std::vector<std::pair<uint64_t, uint32_t>> &order, aligned_vector<T> &sorted_rays)
+{
+    Embree_CoherentRayOrder(&Embree_GetRay(rays[0]), sizeof(T), count, order);
+
+    sorted_rays.resize(count);
+
+    for (int k = 0; k < count; k++) {
+        sorted_rays[k] = rays[order[k].second];
+    }
+}
+
+// copies traced rays back to their original slots; ray ids are untouched by
+// sorting, so the filter function's per-ray results already line up
+template<typename T>
+inline void Embree_ScatterCoherentRays(aligned_vector<T> &rays, int count,
+    const std::vector<std::pair<uint64_t, uint32_t>> &order, const aligned_vector<T> &sorted_rays)
+{
+    for (int k = 0; k < count; k++) {
+        rays[order[k].second] = sorted_rays[k];
+    }
+}
+
 class light_t;
 struct mface_t;
 struct mtexinfo_t;
@@ -117,6 +183,7 @@ namespace img
 {
 struct texture;
 }
+class prepared_texture_t;
 
 inline RTCRayHit SetupRay(unsigned rayindex, const qvec3d &start, const qvec3d &dir, vec_t dist)
 {
@@ -172,6 +239,11 @@ struct triinfo
     float alpha;
     bool is_fence, is_glass;
 
+    // only set for fence/glass faces
+    const prepared_texture_t *prepared_texture;
+    // texture pixels per world unit, for picking a mip level from a ray's footprint
+    float pixels_per_unit;
+
     // cached from modelinfo for faster access
     bool shadowworldonly;
     bool shadowself;
@@ -216,6 +288,18 @@ class raystream_intersection_t : public raystream_embree_common_t
 {
 private:
     aligned_vector<RTCRayHit> _rays;
+    aligned_vector<RTCRayHit> _sorted_rays;
+
+    inline void intersect(RTCRayHit *rays, int count, ray_source_info &ctx)
+    {
+#ifdef HAVE_EMBREE4
+        RTCIntersectArguments embree4_args = ctx.setup_intersection_arguments();
+        for (int i = 0; i < count; ++i)
+            rtcIntersect1(scene, &rays[i], &embree4_args);
+#else
+        rtcIntersect1M(scene, &ctx, rays, count, sizeof(rays[0]));
+#endif
+    }
 
 public:
     inline raystream_intersection_t() = default;
@@ -253,13 +337,13 @@ public:
 
         ray_source_info ctx2(this, self, shadowmask);
 
-#ifdef HAVE_EMBREE4
-        RTCIntersectArguments embree4_args = ctx2.setup_intersection_arguments();
-        for (int i = 0; i < _numrays; ++i)
-            rtcIntersect1(scene, &_rays[i], &embree4_args);
-#else
-        rtcIntersect1M(scene, &ctx2, _rays.data(), _numrays, sizeof(_rays[0]));
-#endif
+        if (_sort_rays && _numrays >= MIN_SORTED_RAYS) {
+            Embree_GatherCoherentRays(_rays, _numrays, _ray_order, _sorted_rays);
+            intersect(_sorted_rays.data(), _numrays, ctx2);
+            Embree_ScatterCoherentRays(_rays, _numrays, _ray_order, _sorted_rays);
+        } else {
+            intersect(_rays.data(), _numrays, ctx2);
+        }
     }
 
     inline qvec3d getPushedRayDir(size_t j) { return {_rays[j].ray.dir_x, _rays[j].ray.dir_y, _rays[j].ray.dir_z}; }
@@ -298,6 +382,18 @@ class raystream_occlusion_t : public raystream_embree_common_t
 {
 private:
     aligned_vector<RTCRay> _rays;
+    aligned_vector<RTCRay> _sorted_rays;
+
+    inline void occluded(RTCRay *rays, int count, ray_source_info &ctx)
+    {
+#ifdef HAVE_EMBREE4
+        RTCOccludedArguments embree4_args = ctx.setup_occluded_arguments();
+        for (int i = 0; i < count; ++i)
+            rtcOccluded1(scene, &rays[i], &embree4_args);
+#else
+        rtcOccluded1M(scene, &ctx, rays, count, sizeof(rays[0]));
+#endif
+    }
 
 public:
     inline raystream_occlusion_t() = default;
@@ -333,13 +429,14 @@ public:
             return;
 
         ray_source_info ctx2(this, self, shadowmask);
-#ifdef HAVE_EMBREE4
-        RTCOccludedArguments embree4_args = ctx2.setup_occluded_arguments();
-        for (int i = 0; i < _numrays; ++i)
-            rtcOccluded1(scene, &_rays[i], &embree4_args);
-#else
-        rtcOccluded1M(scene, &ctx2, _rays.data(), _numrays, sizeof(_rays[0]));
-#endif
+
+        if (_sort_rays && _numrays >= MIN_SORTED_RAYS) {
+            Embree_GatherCoherentRays(_rays, _numrays, _ray_order, _sorted_rays);
+            occluded(_sorted_rays.data(), _numrays, ctx2);
+            Embree_ScatterCoherentRays(_rays, _numrays, _ray_order, _sorted_rays);
+        } else {
+            occluded(_rays.data(), _numrays, ctx2);
+        }
     }
 
     inline bool getPushedRayOccluded(size_t j) { return (_rays[j].tfar < 0.0f); }
@@ -0,0 +1,39 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+See file, 'COPYING', for details.
+*/
+
+
+#pragma once
+
+#include <common/fs.hh>
+
+#include <string>
+
+struct maputil_batch_options_t
+{
+    // files to run the script on: a directory followed by a file name that
+    // may contain * and ?, such as maps/*.map. Ending the directory in **,
+    // as in maps/**/*.ent, also searches the subdirectories below it.
+    std::string pattern;
+    fs::path script;
+    // write changed maps here, keeping their path below the pattern's directory, rather than over the originals
+    fs::path output_dir;
+};
+
+// returns the number of files the script failed on
+size_t maputil_batch(const maputil_batch_options_t &options);
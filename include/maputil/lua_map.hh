@@ -0,0 +1,63 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+See file, 'COPYING', for details.
+*/
+
+
+#pragma once
+
+#ifdef USE_LUA
+
+#include <cstdint>
+#include <vector>
+
+struct lua_State;
+struct map_file_t;
+
+/**
+ * The map a Lua state's `map` handles point at. Handles are looked up by
+ * index on every access, so they stay valid when entities or brushes are
+ * added. Removing one shifts the indices after it, so that bumps a
+ * generation which the affected handles check, making them error out
+ * rather than silently pick up a neighbour; so does swapping `map` for
+ * another one.
+ */
+struct lua_map_ref_t
+{
+    map_file_t *map = nullptr;
+    // bump whenever `map` changes
+    uint64_t serial = 0;
+    // bumped when an entity is removed; invalidates entity, brush and side handles
+    uint64_t entities_generation = 0;
+    // per entity, bumped when one of its brushes is removed; invalidates its brush and side handles
+    std::vector<uint64_t> brushes_generation;
+    // set by any edit made through a handle
+    bool dirty = false;
+
+    void reset(map_file_t *new_map);
+
+    // call after replacing map->entities by other means than the handles
+    void entities_replaced();
+};
+
+// registers the handle metatables; call once per state
+void maputil_register_map_types(lua_State *state);
+
+// pushes a handle for the whole map onto the stack
+void maputil_push_map(lua_State *state, lua_map_ref_t *ref);
+
+#endif
@@ -19,4 +19,11 @@ See file, 'COPYING', for details.
 
 #pragma once
 
+#ifdef USE_LUA
+struct lua_State;
+
+// registers the functions and constants scripts can use (see docs/maputil.rst)
+void maputil_setup_functions(lua_State *state);
+#endif
+
 int maputil_main(int argc, char **argv);
@@ -207,6 +207,7 @@ public:
     setting_scalar worldextent;
     setting_int32 leakdist;
     setting_bool forceprt1;
+    setting_int32 clustertarget;
     setting_tjunc tjunc;
     setting_bool objexport;
     setting_bool noextendedsurfflags;
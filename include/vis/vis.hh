@@ -190,6 +190,7 @@ struct visstats_t
     int64_t c_chains = 0;
     int64_t c_leafskip = 0;
     int64_t c_portalskip = 0;
+    int64_t c_overbudget = 0; // portals that hit -portalbudget
 
     visstats_t operator+(const visstats_t& other) const {
         visstats_t result;
@@ -203,6 +204,7 @@ struct visstats_t
         result.c_chains = this->c_chains + other.c_chains;
         result.c_leafskip = this->c_leafskip + other.c_leafskip;
         result.c_portalskip = this->c_portalskip + other.c_portalskip;
+        result.c_overbudget = this->c_overbudget + other.c_overbudget;
         return result;
     }
 };
@@ -237,6 +239,10 @@ void BasePortalVis(void);
 
 visstats_t PortalFlow(visportal_t *p);
 
+void ApproximatePortalVis(const mbsp_t *bsp);
+
+void SimplifyPortals(prtfile_t &prtfile);
+
 void CalcAmbientSounds(mbsp_t *bsp);
 
 void CalcPHS(mbsp_t *bsp);
@@ -259,7 +265,15 @@ class vis_settings : public common_settings
 {
 public:
     setting_bool fast{this, "fast", false, &performance_group, "run very simple & fast vis procedure"};
+    setting_bool approx{this, "approx", false, &performance_group,
+        "estimate vis by casting rays out of the portals, instead of the full portal flow"};
+    setting_int32 approxrays{
+        this, "approxrays", 256, 1, 1 << 20, &vis_advanced_group, "number of rays cast from each portal by -approx"};
+    setting_bool simplifyportals{this, "simplifyportals", false, &performance_group,
+        "merge coplanar portals between the same leafs, and drop degenerate ones, before vis"};
     setting_int32 level{this, "level", 4, 0, 4, &vis_advanced_group, "number of iterations for tests"};
+    setting_int32 portalbudget{this, "portalbudget", 0, 0, std::numeric_limits<int32_t>::max(), &vis_advanced_group,
+        "leafs a portal may flow through before the rest of its flow falls back to mightsee, 0 for no limit"};
     setting_bool noambientsky{this, "noambientsky", false, &vis_output_group, "don't output ambient sky sounds"};
     setting_bool noambientwater{this, "noambientwater", false, &vis_output_group, "don't output ambient water sounds"};
     setting_bool noambientslime{this, "noambientslime", false, &vis_output_group, "don't output ambient slime sounds"};
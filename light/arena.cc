@@ -0,0 +1,213 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <light/arena.hh>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <ostream>
+
+#include <common/log.hh>
+
+static constexpr size_t PlaneBytesPerSample(lightmap_arena_t::plane_t plane)
+{
+    return plane == lightmap_arena_t::plane_t::mono ? 1 : 3;
+}
+
+size_t lightmap_arena_t::chunk_t::length() const
+{
+    const size_t u = used.load(std::memory_order_acquire);
+    return u == SEALED ? sealed_length : u;
+}
+
+void lightmap_arena_t::reset(bool mono, bool lit, bool lux, size_t chunk_samples_)
+{
+    clear();
+
+    planes_enabled[static_cast<size_t>(plane_t::mono)] = mono;
+    planes_enabled[static_cast<size_t>(plane_t::lit)] = lit;
+    planes_enabled[static_cast<size_t>(plane_t::lux)] = lux;
+    chunk_samples = chunk_samples_;
+}
+
+void lightmap_arena_t::clear()
+{
+    std::unique_lock lock(chunks_lock);
+
+    current.store(nullptr);
+    chunks.clear();
+
+    for (auto &enabled : planes_enabled) {
+        enabled = false;
+    }
+}
+
+lightmap_arena_t::span_t lightmap_arena_t::make_span(chunk_t &chunk, size_t offset_in_chunk) const
+{
+    span_t span{static_cast<int>(chunk.start + offset_in_chunk), nullptr, nullptr, nullptr};
+
+    if (chunk.planes[0]) {
+        span.mono = chunk.planes[0].get() + offset_in_chunk;
+    }
+    if (chunk.planes[1]) {
+        span.lit = chunk.planes[1].get() + (offset_in_chunk * 3);
+    }
+    if (chunk.planes[2]) {
+        span.lux = chunk.planes[2].get() + (offset_in_chunk * 3);
+    }
+
+    return span;
+}
+
+lightmap_arena_t::span_t lightmap_arena_t::reserve(size_t samples)
+{
+    // keep offsets 4-aligned, and lit/lux offsets 12-aligned
+    samples = (samples + 3) & ~size_t(3);
+
+    while (true) {
+        chunk_t *chunk = current.load(std::memory_order_acquire);
+
+        if (chunk) {
+            size_t used = chunk->used.load(std::memory_order_relaxed);
+
+            while (used + samples <= chunk->capacity) {
+                if (chunk->used.compare_exchange_weak(used, used + samples, std::memory_order_relaxed)) {
+                    return make_span(*chunk, used);
+                }
+            }
+        }
+
+        grow(chunk, samples);
+    }
+}
+
+void lightmap_arena_t::grow(chunk_t *full, size_t samples)
+{
+    std::unique_lock lock(chunks_lock);
+
+    if (current.load(std::memory_order_relaxed) != full) {
+        // another thread got here first
+        return;
+    }
+
+    size_t start = 0;
+
+    if (full) {
+        // no reservation fits in the chunk after this, so its length is final
+        full->sealed_length = full->used.exchange(SEALED, std::memory_order_acq_rel);
+        start = full->start + full->sealed_length;
+    }
+
+    if (start + samples > static_cast<size_t>(std::numeric_limits<int>::max()) / 3) {
+        FError("lightmap data exceeds {} samples", std::numeric_limits<int>::max() / 3);
+    }
+
+    auto chunk = std::make_unique<chunk_t>();
+    chunk->start = start;
+    chunk->capacity = std::max(chunk_samples, samples);
+
+    for (size_t i = 0; i < 3; i++) {
+        if (planes_enabled[i]) {
+            chunk->planes[i] = std::make_unique<uint8_t[]>(chunk->capacity * PlaneBytesPerSample(plane_t(i)));
+        }
+    }
+
+    chunks.push_back(std::move(chunk));
+    current.store(chunks.back().get(), std::memory_order_release);
+}
+
+lightmap_arena_t::span_t lightmap_arena_t::at(size_t offset)
+{
+    auto it = std::upper_bound(chunks.begin(), chunks.end(), offset,
+        [](size_t value, const std::unique_ptr<chunk_t> &chunk) { return value < chunk->start; });
+
+    Q_assert(it != chunks.begin());
+    chunk_t &chunk = **std::prev(it);
+    Q_assert(offset < chunk.start + chunk.length());
+
+    return make_span(chunk, offset - chunk.start);
+}
+
+bool lightmap_arena_t::has_plane(plane_t plane) const
+{
+    return planes_enabled[static_cast<size_t>(plane)];
+}
+
+size_t lightmap_arena_t::size() const
+{
+    if (chunks.empty()) {
+        return 0;
+    }
+
+    return chunks.back()->start + chunks.back()->length();
+}
+
+template<typename F>
+void lightmap_arena_t::for_each_range(plane_t plane, size_t samples, F &&f) const
+{
+    const size_t bpp = PlaneBytesPerSample(plane);
+    size_t remaining = samples;
+
+    for (auto &chunk : chunks) {
+        if (!remaining) {
+            break;
+        }
+
+        const size_t count = std::min(chunk->length(), remaining);
+        const uint8_t *data = chunk->planes[static_cast<size_t>(plane)].get();
+
+        if (count) {
+            f(data, count * bpp);
+        }
+
+        remaining -= count;
+    }
+
+    if (remaining) {
+        f(nullptr, remaining * bpp);
+    }
+}
+
+std::vector<uint8_t> lightmap_arena_t::compact(plane_t plane, size_t samples) const
+{
+    std::vector<uint8_t> result(samples * PlaneBytesPerSample(plane));
+    uint8_t *out = result.data();
+
+    for_each_range(plane, samples, [&out](const uint8_t *data, size_t bytes) {
+        if (data) {
+            memcpy(out, data, bytes);
+        }
+        out += bytes;
+    });
+
+    return result;
+}
+
+void lightmap_arena_t::write(std::ostream &stream, plane_t plane, size_t samples) const
+{
+    for_each_range(plane, samples, [&stream](const uint8_t *data, size_t bytes) {
+        if (data) {
+            stream.write(reinterpret_cast<const char *>(data), bytes);
+        } else {
+            const std::vector<char> zeroes(bytes);
+            stream.write(zeroes.data(), bytes);
+        }
+    });
+}
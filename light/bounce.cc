@@ -27,7 +27,7 @@
 #include <light/entities.hh> // for EstimateVisibleBoundsAtPoint
 #include <light/ltface.hh>
 #include <light/surflight.hh>
-#include <light/trace.hh> // for Light_PointInLeaf
+#include <light/trace.hh> // for Light_PointsInLeafs
 
 #include <common/polylib.hh>
 #include <common/bsputils.hh>
@@ -115,10 +115,12 @@ static void MakeBounceLight(const mbsp_t *bsp, const settings::worldspawn_keys &
             l->bounds = EstimateVisibleBoundsAtPoint(facemidpoint);
         }
 
-        for (auto &pt : l->points) {
-            if (light_options.visapprox.value() == visapprox_t::VIS) {
-                l->leaves.push_back(Light_PointInLeaf(bsp, pt));
-            } else if (light_options.visapprox.value() == visapprox_t::RAYS) {
+        if (light_options.visapprox.value() == visapprox_t::VIS) {
+            l->leaves.resize(l->points.size());
+            Light_PointsInLeafs(bsp, l->points.data(), l->points.size(), l->leaves.data());
+            SurfaceLight_SetupLeafPvsBits(bsp, *l);
+        } else if (light_options.visapprox.value() == visapprox_t::RAYS) {
+            for (auto &pt : l->points) {
                 l->bounds += EstimateVisibleBoundsAtPoint(pt);
             }
         }
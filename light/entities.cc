@@ -22,6 +22,8 @@
 #include <algorithm>
 #include <cstring>
 #include <fstream>
+#include <map>
+#include <optional>
 #include <common/imglib.hh> // for img::find
 #include <common/log.hh>
 #include <common/cmdlib.hh>
@@ -31,11 +33,16 @@
 #include <light/trace.hh>
 #include <light/trace_embree.hh>
 #include <light/light.hh>
+#include <light/sampler.hh>
 #include <common/bsputils.hh>
 #include <common/parallel.hh>
 
+#include <tbb/concurrent_unordered_map.h>
+
 static std::vector<std::unique_ptr<light_t>> all_lights;
 static std::vector<sun_t> all_suns;
+static std::vector<light_group_t> light_groups;
+static std::vector<sun_group_t> sun_groups;
 static std::vector<entdict_t> entdicts;
 static std::vector<entdict_t> radlights;
 static std::vector<std::pair<std::string, int>> lightstyleForTargetname;
@@ -43,6 +50,18 @@ static std::vector<std::unique_ptr<light_t>> surfacelight_templates;
 static std::ofstream surflights_dump_file;
 static fs::path surflights_dump_filename;
 
+// EstimateVisibleBoundsAtPoint results, keyed on the exact point; lights differing only by
+// style, and the bounce and surface lights of a face, trace from the same points
+struct visible_bounds_hash_t
+{
+    size_t operator()(const qvec3d &point) const noexcept
+    {
+        const std::hash<vec_t> hash;
+        return hash(point[0]) ^ (hash(point[1]) * 31) ^ (hash(point[2]) * 961);
+    }
+};
+static tbb::concurrent_unordered_map<qvec3d, aabb3d, visible_bounds_hash_t> visible_bounds_cache;
+
 /**
  * Resets global data in this file
  */
@@ -50,6 +69,8 @@ void ResetLightEntities()
 {
     all_lights.clear();
     all_suns.clear();
+    light_groups.clear();
+    sun_groups.clear();
     entdicts.clear();
     radlights.clear();
 
@@ -58,6 +79,8 @@ void ResetLightEntities()
     surfacelight_templates.clear();
     surflights_dump_file = {};
     surflights_dump_filename.clear();
+
+    visible_bounds_cache.clear();
 }
 
 std::vector<std::unique_ptr<light_t>> &GetLights()
@@ -80,6 +103,16 @@ std::vector<entdict_t> &GetRadLights()
     return radlights;
 }
 
+const std::vector<light_group_t> &GetLightGroups()
+{
+    return light_groups;
+}
+
+const std::vector<sun_group_t> &GetSunGroups()
+{
+    return sun_groups;
+}
+
 /* surface lights */
 static void MakeSurfaceLights(const mbsp_t *bsp);
 
@@ -420,7 +453,6 @@ static void SetupSun(const settings::worldspawn_keys &cfg, vec_t light, const qv
     int i;
     int sun_num_samples = (sun_deviance == 0 ? 1 : light_options.sunsamples.value()); // mxd
     vec_t sun_deviance_rad = DEG2RAD(sun_deviance); // mxd
-    vec_t sun_deviance_sq = sun_deviance * sun_deviance; // mxd
 
     qvec3d sunvec = qv::normalize(sunvec_in);
 
@@ -442,11 +474,10 @@ static void SetupSun(const settings::worldspawn_keys &cfg, vec_t light, const qv
             vec_t angle = atan2(sunvec[1], sunvec[0]);
             vec_t elevation = atan2(sunvec[2], d);
 
-            /* jitter the angles (loop to keep random sample within sun->deviance steridians) */
-            do {
-                da = (Random() * 2.0f - 1.0f) * sun_deviance_rad;
-                de = (Random() * 2.0f - 1.0f) * sun_deviance_rad;
-            } while ((da * da + de * de) > sun_deviance_sq);
+            /* jitter the angles within sun->deviance steridians, spreading the samples evenly over the disk */
+            const qvec2f offset = sampler::concentric_disk(sampler::sobol2(i));
+            da = offset[0] * sun_deviance_rad;
+            de = offset[1] * sun_deviance_rad;
             angle += da;
             elevation += de;
 
@@ -650,6 +681,9 @@ static std::unique_ptr<light_t> DuplicateEntity(const light_t &src)
  *
  * Creates jittered copies of the light if specified using the "_samples" and "_deviance" keys.
  *
+ * Only _localmin lights are still cloned; other lights jitter the origin
+ * per shadow ray instead (see LightFace_Entity).
+ *
  * From q3map2
  * =============
  */
@@ -660,6 +694,10 @@ static void JitterEntity(const light_t &entity)
         return;
     }
 
+    if (entity.getFormula() != LF_LOCALMIN) {
+        return;
+    }
+
     std::vector<std::unique_ptr<light_t>> new_lights;
 
     /* jitter the light */
@@ -1115,34 +1153,154 @@ inline qvec3d UniformPointOnSphere(vec_t u1, vec_t u2)
     return dir;
 }
 
-aabb3d EstimateVisibleBoundsAtPoint(const qvec3d &point)
+// EstimateVisibleBoundsAtPoint samples directions on a grid of VISIBLE_BOUNDS_RES intervals
+// in each of the two sphere parameters, but starts out tracing only every
+// VISIBLE_BOUNDS_COARSE_STEP'th one. Cells whose corner rays disagree by more than
+// VISIBLE_BOUNDS_REFINE_RATIO, and the cells around them, are split in half until they
+// reach the full resolution. An opening that fits between the rays of a cell whose
+// corners, and whose neighbours' corners, all agree is still missed.
+constexpr size_t VISIBLE_BOUNDS_RES = 32;
+constexpr size_t VISIBLE_BOUNDS_COARSE_STEP = 2;
+constexpr vec_t VISIBLE_BOUNDS_REFINE_RATIO = 1.5;
+
+static aabb3d TraceVisibleBoundsAtPoint(const qvec3d &point)
 {
-    constexpr size_t N = 32;
-    constexpr size_t N2 = N * N;
+    constexpr size_t N = VISIBLE_BOUNDS_RES + 1;
 
-    raystream_intersection_t rs{N2};
+    raystream_intersection_t rs{N * N};
+    // hit distance of each grid direction, or -1 if not traced yet
+    std::array<vec_t, N * N> dists;
+    dists.fill(-1);
 
     aabb3d bounds = point;
 
-    for (size_t x = 0; x < N; x++) {
-        for (size_t y = 0; y < N; y++) {
-            const vec_t u1 = static_cast<vec_t>(x) / static_cast<vec_t>(N - 1);
-            const vec_t u2 = static_cast<vec_t>(y) / static_cast<vec_t>(N - 1);
+    auto push = [&](size_t x, size_t y) {
+        const size_t i = x + (y * N);
+
+        if (dists[i] >= 0) {
+            return;
+        }
+        dists[i] = 0;
+
+        const vec_t u1 = static_cast<vec_t>(x) / static_cast<vec_t>(N - 1);
+        const vec_t u2 = static_cast<vec_t>(y) / static_cast<vec_t>(N - 1);
+
+        rs.pushRay(i, point, UniformPointOnSphere(u1, u2), 65536.0);
+    };
+
+    auto trace = [&]() {
+        rs.tracePushedRaysIntersection(nullptr, CHANNEL_MASK_DEFAULT);
+
+        for (size_t j = 0; j < rs.numPushedRays(); j++) {
+            const vec_t dist = rs.getPushedRayHitDist(j);
+
+            dists[rs.getPushedRayPointIndex(j)] = dist;
 
-            rs.pushRay(0, point, UniformPointOnSphere(u1, u2), 65536.0);
+            // get the intersection point
+            bounds += point + (rs.getPushedRayDir(j) * dist);
+        }
+
+        rs.clearPushedRays();
+    };
+
+    // lower corners of the cells to consider at the current step
+    std::vector<qvec2i> cells;
+    size_t step = VISIBLE_BOUNDS_COARSE_STEP;
+
+    for (size_t y = 0; y < N; y += step) {
+        for (size_t x = 0; x < N; x += step) {
+            push(x, y);
+
+            if (x + step < N && y + step < N) {
+                cells.emplace_back(x, y);
+            }
         }
     }
 
-    rs.tracePushedRaysIntersection(nullptr, CHANNEL_MASK_DEFAULT);
+    trace();
+
+    // cells whose corners disagree at the current step, by lower corner
+    std::array<bool, N * N> disagree;
+
+    while (step > 1) {
+        disagree.fill(false);
+
+        for (const qvec2i &cell : cells) {
+            const vec_t d00 = dists[cell[0] + (cell[1] * N)];
+            const vec_t d10 = dists[cell[0] + step + (cell[1] * N)];
+            const vec_t d01 = dists[cell[0] + ((cell[1] + step) * N)];
+            const vec_t d11 = dists[cell[0] + step + ((cell[1] + step) * N)];
+
+            const vec_t mind = std::min({d00, d10, d01, d11});
+            const vec_t maxd = std::max({d00, d10, d01, d11});
+
+            disagree[cell[0] + (cell[1] * N)] = maxd > std::max(mind, 1.0) * VISIBLE_BOUNDS_REFINE_RATIO;
+        }
+
+        // refine the cells that disagree and their neighbours; x is the angle around the
+        // sphere, so it wraps around
+        auto needs_refining = [&](const qvec2i &cell) {
+            for (int dy = -1; dy <= 1; dy++) {
+                const int y = cell[1] + (dy * static_cast<int>(step));
+
+                if (y < 0 || y + step >= N) {
+                    continue;
+                }
+
+                for (int dx = -1; dx <= 1; dx++) {
+                    const int x = (cell[0] + (dx * static_cast<int>(step)) + static_cast<int>(N - 1)) %
+                                  static_cast<int>(N - 1);
+
+                    if (disagree[x + (y * N)]) {
+                        return true;
+                    }
+                }
+            }
+
+            return false;
+        };
+
+        std::vector<qvec2i> refined;
+        const int half = static_cast<int>(step / 2);
+
+        for (const qvec2i &cell : cells) {
+            if (!needs_refining(cell)) {
+                continue;
+            }
+
+            for (int sy = 0; sy < 2; sy++) {
+                for (int sx = 0; sx < 2; sx++) {
+                    const qvec2i sub{cell[0] + (sx * half), cell[1] + (sy * half)};
 
-    for (int i = 0; i < N2; i++) {
-        const vec_t &dist = rs.getPushedRayHitDist(i);
-        const qvec3d &dir = rs.getPushedRayDir(i);
+                    push(sub[0], sub[1]);
+                    push(sub[0] + half, sub[1]);
+                    push(sub[0], sub[1] + half);
+                    push(sub[0] + half, sub[1] + half);
+
+                    refined.push_back(sub);
+                }
+            }
+        }
 
-        // get the intersection point
-        qvec3d stop = point + (dir * dist);
+        step /= 2;
+        cells = std::move(refined);
 
-        bounds += stop;
+        trace();
+    }
+
+    return bounds;
+}
+
+aabb3d EstimateVisibleBoundsAtPoint(const qvec3d &point)
+{
+    aabb3d bounds;
+
+    if (auto it = visible_bounds_cache.find(point); it != visible_bounds_cache.end()) {
+        bounds = it->second;
+    } else {
+        // another thread may trace the same point in the meantime; it gets the same result
+        bounds = TraceVisibleBoundsAtPoint(point);
+        visible_bounds_cache.emplace(point, bounds);
     }
 
     // grow it by 25% in each direction
@@ -1164,7 +1322,8 @@ aabb3d EstimateVisibleBoundsAtPoint(const qvec3d &point)
 
 inline void EstimateLightAABB(const std::unique_ptr<light_t> &light)
 {
-    light->bounds = EstimateVisibleBoundsAtPoint(light->origin.value());
+    // soft lights are traced from anywhere in the deviance cube
+    light->bounds = EstimateVisibleBoundsAtPoint(light->origin.value()).grow(qvec3d(light->deviance.value()));
 }
 
 void EstimateLightVisibility(void)
@@ -1174,6 +1333,57 @@ void EstimateLightVisibility(void)
     logging::parallel_for_each(all_lights, EstimateLightAABB);
 }
 
+/*
+ * =============
+ * GroupLights
+ *
+ * Groups lights/suns that would trace the exact same shadow rays, so
+ * e.g. a flickering torch duplicated per style is only traced once.
+ * =============
+ */
+static void GroupLights()
+{
+    light_groups.clear();
+    sun_groups.clear();
+
+    std::map<std::tuple<qvec3d, int32_t, bool, vec_t, int32_t>, size_t> light_group_index;
+
+    for (auto &entity : all_lights) {
+        if (entity->getFormula() == LF_LOCALMIN || entity->nostaticlight.value() || !entity->light.value()) {
+            continue;
+        }
+
+        auto key = std::make_tuple(entity->origin.value(), entity->shadow_channel_mask.value(),
+            entity->light.value() > 0, entity->deviance.value(), entity->samples.value());
+        auto [it, inserted] = light_group_index.try_emplace(key, light_groups.size());
+
+        if (inserted) {
+            light_groups.emplace_back();
+        }
+
+        light_groups[it->second].lights.push_back(entity.get());
+    }
+
+    std::map<std::tuple<qvec3d, const img::texture *, bool>, size_t> sun_group_index;
+
+    for (auto &sun : all_suns) {
+        if (!sun.sunlight) {
+            continue;
+        }
+
+        auto key = std::make_tuple(qv::normalize(sun.sunvec), sun.suntexture_value, sun.sunlight > 0);
+        auto [it, inserted] = sun_group_index.try_emplace(key, sun_groups.size());
+
+        if (inserted) {
+            sun_groups.emplace_back();
+        }
+
+        sun_groups[it->second].suns.push_back(&sun);
+    }
+
+    logging::print("{} light groups, {} sun groups\n", light_groups.size(), sun_groups.size());
+}
+
 void SetupLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
 {
     logging::print("SetupLights: {} initial lights\n", all_lights.size());
@@ -1202,6 +1412,8 @@ void SetupLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
 
     logging::print("Final count: {} lights, {} suns in use.\n", all_lights.size(), all_suns.size());
 
+    GroupLights();
+
     Q_assert(final_lightcount == all_lights.size());
 }
 
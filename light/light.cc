@@ -30,6 +30,7 @@
 #include <light/entities.hh>
 #include <light/ltface.hh>
 #include <light/litfile.hh> // for facesup_t
+#include <light/arena.hh>
 #include <light/trace_embree.hh>
 
 #include <common/log.hh>
@@ -94,34 +95,28 @@ bool IsOutputtingSupplementaryData()
     return !faces_sup.empty();
 }
 
-/// start of lightmap data
-std::vector<uint8_t> filebase;
-/// offset of start of free space after data (should be kept a multiple of 4)
-static int file_p;
-/// offset of end of free space for lightmap data
-static int file_end;
-
-/// start of litfile data
-std::vector<uint8_t> lit_filebase;
-/// offset of start of free space after litfile data (should be kept a multiple of 12)
-static int lit_file_p;
-/// offset of end of space for litfile data
-static int lit_file_end;
-
-/// start of luxfile data
-std::vector<uint8_t> lux_filebase;
-/// offset of start of free space after luxfile data (should be kept a multiple of 12)
-static int lux_file_p;
-/// offset of end of space for luxfile data
-static int lux_file_end;
-
-static std::unordered_map<int, std::vector<uint8_t>> all_uncompressed_vis;
-
-const std::unordered_map<int, std::vector<uint8_t>> &UncompressedVis()
+/// lightmap, litfile and luxfile data of all faces
+static lightmap_arena_t lightmap_arena;
+
+static pvs_matrix_t all_uncompressed_vis;
+
+const lightmap_arena_t &LightmapArena()
+{
+    return lightmap_arena;
+}
+
+const pvs_matrix_t &UncompressedVis()
 {
     return all_uncompressed_vis;
 }
 
+static leaf_locator_t world_leaf_locator;
+
+const leaf_locator_t &WorldLeafLocator()
+{
+    return world_leaf_locator;
+}
+
 std::vector<modelinfo_t *> modelinfo;
 std::vector<const modelinfo_t *> tracelist;
 std::vector<const modelinfo_t *> selfshadowlist;
@@ -310,6 +305,10 @@ light_settings::light_settings()
       novanilla{this, "novanilla", false, &experimental_group, "implies -bspxlit; don't write vanilla lighting"},
       gate{this, "gate", LIGHT_EQUAL_EPSILON, &performance_group, "cutoff lights at this brightness level"},
       sunsamples{this, "sunsamples", 64, 8, 2048, &performance_group, "set samples for _sunlight2, default 64"},
+      sortrays{this, "sortrays", false, &performance_group,
+          "sort each batch of rays by direction and origin before tracing, for better cache coherence"},
+      noshareluxels{this, "noshareluxels", false, &performance_group,
+          "light every face's samples separately, even where coplanar faces have samples at the same point"},
       arghradcompat{this, "arghradcompat", false, &output_group, "enable compatibility for Arghrad-specific keys"},
       nolighting{this, "nolighting", false, &output_group, "don't output main world lighting (Q2RTX)"},
       debugface{this, "debugface", std::numeric_limits<vec_t>::quiet_NaN(), std::numeric_limits<vec_t>::quiet_NaN(),
@@ -554,55 +553,23 @@ void FixupGlobalSettings()
     }
 }
 
-static std::mutex light_mutex;
-
 /*
  * Return space for the lightmap and colourmap at the same time so it can
  * be done in a thread-safe manner.
  *
  * size is the number of greyscale pixels = number of bytes to allocate
- * and return in *lightdata
+ * and return in *lightdata; returns the offset of the space in greyscale
+ * pixels.
  */
-void GetFileSpace(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int size)
+int GetFileSpace(uint8_t **lightdata, uint8_t **colordata, uint8_t **deluxdata, int size)
 {
-    light_mutex.lock();
-
-    *lightdata = *colordata = *deluxdata = nullptr;
-
-    if (!filebase.empty()) {
-        *lightdata = filebase.data() + file_p;
-    }
-    if (!lit_filebase.empty()) {
-        *colordata = lit_filebase.data() + lit_file_p;
-    }
-    if (!lux_filebase.empty()) {
-        *deluxdata = lux_filebase.data() + lux_file_p;
-    }
-
-    // if size isn't a multiple of 4, round up to the next multiple of 4
-    if ((size % 4) != 0) {
-        size += (4 - (size % 4));
-    }
-
-    // increment the next writing offsets, aligning them to 4 uint8_t boundaries (file_p)
-    // and 12-uint8_t boundaries (lit_file_p/lux_file_p)
-    if (!filebase.empty()) {
-        file_p += size;
-    }
-    if (!lit_filebase.empty()) {
-        lit_file_p += 3 * size;
-    }
-    if (!lux_filebase.empty()) {
-        lux_file_p += 3 * size;
-    }
+    auto span = lightmap_arena.reserve(size);
 
-    light_mutex.unlock();
+    *lightdata = span.mono;
+    *colordata = span.lit;
+    *deluxdata = span.lux;
 
-    if (file_p > file_end)
-        FError("overrun");
-
-    if (lit_file_p > lit_file_end)
-        FError("overrun");
+    return span.offset;
 }
 
 /**
@@ -613,21 +580,17 @@ void GetFileSpace_PreserveOffsetInBsp(uint8_t **lightdata, uint8_t **colordata,
 {
     Q_assert(lightofs >= 0);
 
-    *lightdata = *colordata = *deluxdata = nullptr;
+    auto span = lightmap_arena.at(lightofs);
 
-    if (!filebase.empty()) {
-        *lightdata = filebase.data() + lightofs;
-    }
+    *lightdata = span.mono;
 
-    if (colordata && !lit_filebase.empty()) {
-        *colordata = lit_filebase.data() + (lightofs * 3);
+    if (colordata) {
+        *colordata = span.lit;
     }
 
-    if (deluxdata && !lux_filebase.empty()) {
-        *deluxdata = lux_filebase.data() + (lightofs * 3);
+    if (deluxdata) {
+        *deluxdata = span.lux;
     }
-
-    // NOTE: file_p et. al. are not updated, since we're not dynamically allocating the lightmaps
 }
 
 const modelinfo_t *ModelInfoForModel(const mbsp_t *bsp, int modelnum)
@@ -852,11 +815,6 @@ static void FindModelInfo(const mbsp_t *bsp)
     Q_assert(modelinfo.size() == bsp->dmodels.size());
 }
 
-// FIXME: in theory can't we calculate the exact amount of
-// storage required? we'd have to expand it by 4 to account for
-// lightstyles though
-static constexpr size_t MAX_MAP_LIGHTING = 0x8000000;
-
 /*
  * =============
  *  LightWorld
@@ -869,29 +827,14 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
     mbsp_t &bsp = std::get<mbsp_t>(bspdata->bsp);
 
     light_surfaces.clear();
-    filebase.clear();
-    lit_filebase.clear();
-    lux_filebase.clear();
-
-    if (!bsp.loadversion->game->has_rgb_lightmap) {
-        /* greyscale data stored in a separate buffer */
-        filebase.resize(MAX_MAP_LIGHTING);
-        file_p = 0;
-        file_end = MAX_MAP_LIGHTING;
-    }
-
-    if (bsp.loadversion->game->has_rgb_lightmap || light_options.write_litfile) {
-        /* litfile data stored in a separate buffer */
-        lit_filebase.resize(MAX_MAP_LIGHTING * 3);
-        lit_file_p = 0;
-        lit_file_end = (MAX_MAP_LIGHTING * 3);
-    }
+    /* greyscale data is only stored if it's going into the bsp */
+    lightmap_arena.reset(!bsp.loadversion->game->has_rgb_lightmap,
+        bsp.loadversion->game->has_rgb_lightmap || light_options.write_litfile,
+        static_cast<bool>(light_options.write_luxfile));
 
-    if (light_options.write_luxfile) {
-        /* lux data stored in a separate buffer */
-        lux_filebase.resize(MAX_MAP_LIGHTING * 3);
-        lux_file_p = 0;
-        lux_file_end = (MAX_MAP_LIGHTING * 3);
+    if (light_options.litonly.value()) {
+        // the existing offsets are reused, so cover all of them with one reservation
+        lightmap_arena.reserve(bsp.dlightdata.size());
     }
 
     if (forcedscale) {
@@ -939,6 +882,13 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
     // create lightmap surfaces
     CreateLightmapSurfaces(&bsp);
 
+    // debug modes write every sample themselves
+    const bool share_samples = !light_options.noshareluxels.value() && light_options.debugmode == debugmodes::none;
+
+    if (share_samples) {
+        ShareLightmapSurfaceSamples(&bsp, light_surfaces);
+    }
+
     const bool bouncerequired =
         light_options.bounce.value() &&
         (light_options.debugmode == debugmodes::none || light_options.debugmode == debugmodes::bounce ||
@@ -958,6 +908,10 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
         }
     });
 
+    if (share_samples) {
+        GatherSharedSamples(&bsp, light_surfaces);
+    }
+
     if (bouncerequired && !light_options.nolighting.value()) {
 
         for (size_t i = 0; i < light_options.bounce.value(); i++) {
@@ -979,6 +933,10 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
                     IndirectLightFace(&bsp, *light_surfaces[f].get(), light_options, i);
                 }
             });
+
+            if (share_samples) {
+                GatherSharedSamples(&bsp, light_surfaces);
+            }
         }
     }
 
@@ -1002,11 +960,9 @@ static void LightWorld(bspdata_t *bspdata, bool forcedscale)
     // Transfer greyscale lightmap (or color lightmap for Q2/HL) to the bsp and update lightdatasize
     if (!light_options.litonly.value()) {
         if (bsp.loadversion->game->has_rgb_lightmap) {
-            bsp.dlightdata.resize(lit_file_p);
-            memcpy(bsp.dlightdata.data(), lit_filebase.data(), bsp.dlightdata.size());
+            bsp.dlightdata = lightmap_arena.compact(lightmap_arena_t::plane_t::lit, lightmap_arena.size());
         } else {
-            bsp.dlightdata.resize(file_p);
-            memcpy(bsp.dlightdata.data(), filebase.data(), bsp.dlightdata.size());
+            bsp.dlightdata = lightmap_arena.compact(lightmap_arena_t::plane_t::mono, lightmap_arena.size());
         }
     } else {
         // NOTE: bsp.lightdatasize is already valid in the -litonly case
@@ -1475,19 +1431,10 @@ static void ResetLight()
     faces_sup.clear();
     facesup_decoupled_global.clear();
 
-    filebase.clear();
-    file_p = 0;
-    file_end = 0;
-
-    lit_filebase.clear();
-    lit_file_p = 0;
-    lit_file_end = 0;
+    lightmap_arena.clear();
 
-    lux_filebase.clear();
-    lux_file_p = 0;
-    lux_file_end = 0;
-
-    all_uncompressed_vis.clear();
+    all_uncompressed_vis = {};
+    world_leaf_locator = {};
     modelinfo.clear();
     tracelist.clear();
     selfshadowlist.clear();
@@ -1600,7 +1547,15 @@ int light_main(int argc, const char **argv)
 
     light_options.postinitialize(argc, argv);
 
-    all_uncompressed_vis = DecompressAllVis(&bsp, true);
+    all_uncompressed_vis = pvs_matrix_t(&bsp);
+    world_leaf_locator = leaf_locator_t(&bsp, &bsp.dmodels[0]);
+
+    // the locator points into `bsp`, which is gone once light_main returns
+    struct leaf_locator_reset_t
+    {
+        ~leaf_locator_reset_t() { world_leaf_locator = {}; }
+    } leaf_locator_reset;
+
     FindModelInfo(&bsp);
 
     FindDebugFace(&bsp);
@@ -1655,15 +1610,15 @@ int light_main(int argc, const char **argv)
             WriteLitFile(&bsp, faces_sup, source, LIT_VERSION);
         }
         if (light_options.write_litfile & lightfile::bspx) {
-            lit_filebase.resize(bsp.dlightdata.size() * 3);
-            bspdata.bspx.transfer("RGBLIGHTING", lit_filebase);
+            bspdata.bspx.transfer(
+                "RGBLIGHTING", lightmap_arena.compact(lightmap_arena_t::plane_t::lit, bsp.dlightdata.size()));
         }
         if (light_options.write_luxfile & lightfile::external) {
             WriteLuxFile(&bsp, source, LIT_VERSION);
         }
         if (light_options.write_luxfile & lightfile::bspx) {
-            lux_filebase.resize(bsp.dlightdata.size() * 3);
-            bspdata.bspx.transfer("LIGHTINGDIR", lux_filebase);
+            bspdata.bspx.transfer(
+                "LIGHTINGDIR", lightmap_arena.compact(lightmap_arena_t::plane_t::lux, bsp.dlightdata.size()));
         }
     }
 
@@ -1677,11 +1632,21 @@ int light_main(int argc, const char **argv)
     }
 
     WriteEntitiesToString(light_options, &bsp);
-    /* Convert data format back if necessary */
-    ConvertBSPFormat(&bspdata, bspdata.loadversion);
 
-    if (!light_options.litonly.value()) {
-        WriteBSPFile(source, &bspdata);
+    if (light_options.onlyents.value()) {
+        // only the entities changed, so patch them into the file rather than rewriting all of it
+        if (!light_options.litonly.value()) {
+            bsp_patch_t patch;
+            patch.entities = bsp.dentdata;
+            PatchBSPFile(source, patch);
+        }
+    } else {
+        /* Convert data format back if necessary */
+        ConvertBSPFormat(&bspdata, bspdata.loadversion);
+
+        if (!light_options.litonly.value()) {
+            WriteBSPFile(source, &bspdata);
+        }
     }
 
     auto end = I_FloatTime();
@@ -30,6 +30,7 @@
 #include <light/light.hh>
 #include <light/entities.hh>
 #include <light/ltface.hh>
+#include <light/trace.hh> // for Light_PointsInLeafs
 
 #include <common/prtfile.hh>
 #include <common/parallel.hh>
@@ -369,7 +370,8 @@ static std::vector<uint8_t> MakeOctreeLump(const mbsp_t &bsp, const lightgrid_ra
     return vec;
 }
 
-std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp, qvec3d world_point)
+std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(
+    const mbsp_t *bsp, qvec3d world_point, const mleaf_t *leaf)
 {
     bool occluded = Light_PointInWorld(bsp, world_point);
     if (occluded) {
@@ -378,13 +380,15 @@ std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp
         if (success) {
             occluded = false;
             world_point = fixed_pos;
+            // moved, so the caller's leaf no longer applies
+            leaf = nullptr;
         }
     }
 
     lightgrid_samples_t samples;
 
     if (!occluded)
-        samples = CalcLightgridAtPoint(bsp, world_point);
+        samples = CalcLightgridAtPoint(bsp, world_point, leaf);
 
     return {samples, occluded};
 }
@@ -415,20 +419,31 @@ void LightGrid(bspdata_t *bspdata)
 
     data.occlusion.resize(data.grid_size[0] * data.grid_size[1] * data.grid_size[2]);
 
-    logging::parallel_for(0, data.grid_size[0] * data.grid_size[1] * data.grid_size[2], [&](int sample_index) {
-        const int z = (sample_index / (data.grid_size[0] * data.grid_size[1]));
-        const int y = (sample_index / data.grid_size[0]) % data.grid_size[1];
-        const int x = sample_index % data.grid_size[0];
+    // one task per row of grid points along x, so the row's leafs can be found in one batch
+    logging::parallel_for(0, data.grid_size[1] * data.grid_size[2], [&](int row_index) {
+        const int z = row_index / data.grid_size[1];
+        const int y = row_index % data.grid_size[1];
 
-        qvec3d world_point = data.grid_mins + (qvec3d{x, y, z} * data.grid_dist);
+        std::vector<qvec3d> row_points(data.grid_size[0]);
+        std::vector<const mleaf_t *> row_leafs(data.grid_size[0]);
 
-        bool occluded;
-        lightgrid_samples_t samples;
+        for (int x = 0; x < data.grid_size[0]; x++) {
+            row_points[x] = data.grid_mins + (qvec3d{x, y, z} * data.grid_dist);
+        }
+
+        Light_PointsInLeafs(&bsp, row_points.data(), row_points.size(), row_leafs.data());
+
+        for (int x = 0; x < data.grid_size[0]; x++) {
+            const int sample_index = data.get_grid_index(x, y, z);
 
-        std::tie(samples, occluded) = FixPointAndCalcLightgrid(&bsp, world_point);
+            bool occluded;
+            lightgrid_samples_t samples;
 
-        data.grid_result[sample_index] = samples;
-        data.occlusion[sample_index] = occluded;
+            std::tie(samples, occluded) = FixPointAndCalcLightgrid(&bsp, row_points[x], row_leafs[x]);
+
+            data.grid_result[sample_index] = samples;
+            data.occlusion[sample_index] = occluded;
+        }
     });
 
     // the maximum used styles across the map.
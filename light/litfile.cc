@@ -22,6 +22,7 @@
 #include <fstream>
 
 #include <light/light.hh>
+#include <light/arena.hh>
 
 #include <common/bspfile.hh>
 #include <common/cmdlib.hh>
@@ -81,10 +82,10 @@ void WriteLitFile(const mbsp_t *bsp, const std::vector<facesup_t> &facesup, cons
                 j++;
             litfile <= (uint8_t)j;
         }
-        litfile.write((const char *)lit_filebase.data(), bsp->dlightdata.size() * 3);
-        litfile.write((const char *)lux_filebase.data(), bsp->dlightdata.size() * 3);
+        LightmapArena().write(litfile, lightmap_arena_t::plane_t::lit, bsp->dlightdata.size());
+        LightmapArena().write(litfile, lightmap_arena_t::plane_t::lux, bsp->dlightdata.size());
     } else
-        litfile.write((const char *)lit_filebase.data(), bsp->dlightdata.size() * 3);
+        LightmapArena().write(litfile, lightmap_arena_t::plane_t::lit, bsp->dlightdata.size());
 }
 
 void WriteLuxFile(const mbsp_t *bsp, const fs::path &filename, int version)
@@ -98,5 +99,5 @@ void WriteLuxFile(const mbsp_t *bsp, const fs::path &filename, int version)
 
     std::ofstream luxfile(luxname, std::ios_base::out | std::ios_base::binary);
     luxfile <= header.v1;
-    luxfile.write((const char *)lux_filebase.data(), bsp->dlightdata.size() * 3);
+    LightmapArena().write(luxfile, lightmap_arena_t::plane_t::lux, bsp->dlightdata.size());
 }
@@ -27,18 +27,23 @@
 #include <light/lightgrid.hh>
 #include <light/trace.hh>
 #include <light/litfile.hh> // for facesup_t
+#include <light/sampler.hh>
 
 #include <common/imglib.hh>
 #include <common/log.hh>
 #include <common/bsputils.hh>
 #include <common/qvec.hh>
 #include <common/ostream.hh>
+#include <common/parallel.hh>
 
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <cmath>
 #include <algorithm>
 #include <fstream>
+#include <map>
+#include <tuple>
 
 std::atomic<uint32_t> total_light_rays, total_light_ray_hits, total_samplepoints;
 std::atomic<uint32_t> total_bounce_rays, total_bounce_ray_hits;
@@ -457,33 +462,7 @@ static void CalcPoints(
     }
 }
 
-static bool Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf, uint8_t *out)
-{
-    const size_t num_pvsclusterbytes = DecompressedVisSize(bsp);
-
-    // init to all visible
-    memset(out, 0xFF, num_pvsclusterbytes);
-
-    if (bsp->loadversion->game->id == GAME_QUAKE_II) {
-        auto it = UncompressedVis().find(leaf->cluster);
-        if (it == UncompressedVis().end()) {
-            return false;
-        }
-
-        memcpy(out, it->second.data(), num_pvsclusterbytes);
-    } else {
-        auto it = UncompressedVis().find(leaf->visofs);
-        if (it == UncompressedVis().end()) {
-            return false;
-        }
-
-        memcpy(out, it->second.data(), num_pvsclusterbytes);
-    }
-
-    return true;
-}
-
-static const std::vector<uint8_t> *Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf)
+static const uint8_t *Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf)
 {
     if (bsp->loadversion->game->contents_are_liquid({leaf->contents})) {
         // the liquid case is because leaf->contents might be in an opaque liquid,
@@ -492,31 +471,35 @@ static const std::vector<uint8_t> *Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t
         return nullptr;
     }
 
-    const int key = (bsp->loadversion->game->id == GAME_QUAKE_II) ? leaf->cluster : leaf->visofs;
-    if (auto it = UncompressedVis().find(key); it != UncompressedVis().end()) {
-        return &it->second;
-    }
-    return nullptr;
+    return UncompressedVis().leaf_row(leaf - bsp->dleafs.data());
 }
 
 static void CalcPvs(const mbsp_t *bsp, lightsurf_t *lightsurf)
 {
-    const int pvssize = DecompressedVisSize(bsp);
+    const pvs_matrix_t &vis = UncompressedVis();
     const mleaf_t *lastleaf = nullptr;
 
     // set defaults
     lightsurf->pvs.clear();
 
-    if (!bsp->dvis.bits.size()) {
+    if (vis.empty()) {
         return;
     }
 
-    // set lightsurf->pvs
-    uint8_t *pointpvs = (uint8_t *)alloca(pvssize);
-    lightsurf->pvs.resize(pvssize);
+    // set lightsurf->pvs; sized to the row stride so whole rows can be OR'ed in
+    lightsurf->pvs.resize(vis.row_stride());
 
-    for (auto &sample : lightsurf->samples) {
-        const mleaf_t *leaf = Light_PointInLeaf(bsp, sample.point);
+    // locate all of the sample points in one batch
+    std::vector<qvec3d> points(lightsurf->samples.size());
+    std::vector<const mleaf_t *> leafs(lightsurf->samples.size());
+
+    for (size_t i = 0; i < lightsurf->samples.size(); i++) {
+        points[i] = lightsurf->samples[i].point;
+    }
+
+    Light_PointsInLeafs(bsp, points.data(), points.size(), leafs.data());
+
+    for (const mleaf_t *leaf : leafs) {
 
         /* most/all of the surface points are probably in the same leaf */
         if (leaf == lastleaf)
@@ -524,23 +507,20 @@ static void CalcPvs(const mbsp_t *bsp, lightsurf_t *lightsurf)
 
         lastleaf = leaf;
 
-        /* copy the pvs for this leaf into pointpvs */
-        Mod_LeafPvs(bsp, leaf, pointpvs);
+        const uint8_t *pointpvs = vis.leaf_row(leaf - bsp->dleafs.data());
 
-        if (bsp->loadversion->game->contents_are_liquid({leaf->contents})) {
-            // hack for when the sample point might be in an opaque liquid, blocking vis,
+        if (!pointpvs || bsp->loadversion->game->contents_are_liquid({leaf->contents})) {
+            // no visdata for this leaf, so treat everything as visible.
+            //
+            // also a hack for when the sample point might be in an opaque liquid, blocking vis,
             // but we typically want light to pass through these.
             // see also VisCullEntity() which handles the case when the light emitter is in liquid.
-            for (int j = 0; j < pvssize; j++) {
-                lightsurf->pvs[j] |= 0xff;
-            }
+            memset(lightsurf->pvs.data(), 0xff, vis.row_size());
             break;
         }
 
         /* merge the pvs for this sample point into lightsurf->pvs */
-        for (int j = 0; j < pvssize; j++) {
-            lightsurf->pvs[j] |= pointpvs[j];
-        }
+        Pvs_Union(lightsurf->pvs.data(), pointpvs, vis.row_stride());
     }
 }
 
@@ -564,6 +544,8 @@ static std::unique_ptr<lightsurf_t> Lightsurf_Init(const modelinfo_t *modelinfo,
     lightsurf->face = face;
     lightsurf->occlusion_stream = std::make_unique<raystream_occlusion_t>();
     lightsurf->intersection_stream = std::make_unique<raystream_intersection_t>();
+    lightsurf->occlusion_stream->setSortRays(light_options.sortrays.value());
+    lightsurf->intersection_stream->setSortRays(light_options.sortrays.value());
 
     if (Face_IsLightmapped(bsp, face)) {
         /* if liquid doesn't have the TEX_SPECIAL flag set, the map was qbsp'ed with
@@ -937,11 +919,12 @@ static bool LightFace_SampleMipTex(
     return true;
 }
 
-static void GetLightContrib(const settings::worldspawn_keys &cfg, const light_t *entity, const qvec3d &surfnorm,
-    bool use_surfnorm, const qvec3d &surfpoint, bool twosided, qvec3f &color_out, qvec3d &surfpointToLightDir_out,
-    qvec3d &normalmap_addition_out, float *dist_out)
+// light_origin is entity's origin, or a jittered sample of it for soft (_deviance) lights
+static void GetLightContrib(const settings::worldspawn_keys &cfg, const light_t *entity, const qvec3d &light_origin,
+    const qvec3d &surfnorm, bool use_surfnorm, const qvec3d &surfpoint, bool twosided, qvec3f &color_out,
+    qvec3d &surfpointToLightDir_out, qvec3d &normalmap_addition_out, float *dist_out)
 {
-    float dist = GetDir(surfpoint, entity->origin.value(), surfpointToLightDir_out);
+    float dist = GetDir(surfpoint, light_origin, surfpointToLightDir_out);
     if (dist < 0.1) {
         // Catch 0 distance between sample point and light (produces infinite brightness / nan's) and causes
         // problems later
@@ -1092,6 +1075,33 @@ inline vec_t Dirt_GetScaleFactor(const settings::worldspawn_keys &cfg, vec_t occ
     return 1.0f - outDirt;
 }
 
+// how far from its origin a soft (_deviance) light's samples can be
+inline vec_t LightDevianceRadius(const light_t *entity)
+{
+    return entity->deviance.value() * std::sqrt(3.0);
+}
+
+// number of shadow rays per luxel for entity
+inline int LightSampleCount(const light_t *entity)
+{
+    return entity->deviance.value() > 0 ? entity->samples.value() : 1;
+}
+
+/*
+ * Origin of sample `index` of a soft light: a point in the cube of
+ * +-_deviance around the origin, from a per-luxel scrambled Sobol set
+ * (see sampler.hh). This replaces cloning the light entity _samples times.
+ */
+inline qvec3d LightSampleOrigin(const light_t *entity, int index, uint32_t scramble)
+{
+    if (entity->deviance.value() <= 0) {
+        return entity->origin.value();
+    }
+
+    const qvec3d u = sampler::sobol3(index, scramble);
+    return entity->origin.value() + (((u * 2.0) - qvec3d(1.0)) * entity->deviance.value());
+}
+
 /*
  * ================
  * CullLight
@@ -1114,7 +1124,7 @@ inline bool CullLight(const light_t *entity, const lightsurf_t *lightsurf)
     }
 
     qvec3d distvec = entity->origin.value() - lightsurf->extents.origin;
-    const float dist = qv::length(distvec) - lightsurf->extents.radius;
+    const float dist = qv::length(distvec) - lightsurf->extents.radius - LightDevianceRadius(entity);
 
     /* light is inside surface bounding sphere => can't cull */
     if (dist < 0) {
@@ -1127,9 +1137,9 @@ inline bool CullLight(const light_t *entity, const lightsurf_t *lightsurf)
     return fabs(GetLightValue(cfg, entity, dist)) <= light_options.gate.value();
 }
 
-static bool VisCullEntity(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, const mleaf_t *entleaf)
+static bool VisCullEntity(const mbsp_t *bsp, const uint8_t *pvs, const mleaf_t *entleaf)
 {
-    if (pvs.empty()) {
+    if (pvs == nullptr) {
         return false;
     }
     if (entleaf == nullptr) {
@@ -1145,30 +1155,34 @@ static bool VisCullEntity(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, co
         return false;
     }
 
-    return !Pvs_LeafVisible(bsp, pvs, entleaf);
+    return !UncompressedVis().leaf_visible(pvs, entleaf - bsp->dleafs.data());
+}
+
+static bool VisCullEntity(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, const mleaf_t *entleaf)
+{
+    return VisCullEntity(bsp, pvs.empty() ? nullptr : pvs.data(), entleaf);
 }
 
 /*
  * ================
- * LightFace_Entity
+ * LightFace_EntityReaches
+ *
+ * Per-light culling; returns false if entity can't light lightsurf at all.
  * ================
  */
-static void LightFace_Entity(
-    const mbsp_t *bsp, const light_t *entity, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static bool LightFace_EntityReaches(const mbsp_t *bsp, const light_t *entity, const lightsurf_t *lightsurf)
 {
-    const settings::worldspawn_keys &cfg = *lightsurf->cfg;
-    const modelinfo_t *modelinfo = lightsurf->modelinfo;
     const qplane3d *plane = &lightsurf->plane;
 
-    /* vis cull */
+    /* vis cull (soft lights may be sampled from other leafs) */
     if (light_options.visapprox.value() == visapprox_t::VIS &&
         entity->light_channel_mask.value() == CHANNEL_MASK_DEFAULT &&
-        entity->shadow_channel_mask.value() == CHANNEL_MASK_DEFAULT &&
+        entity->shadow_channel_mask.value() == CHANNEL_MASK_DEFAULT && entity->deviance.value() <= 0 &&
         VisCullEntity(bsp, lightsurf->pvs, entity->leaf)) {
-        return;
+        return false;
     }
 
-    const vec_t planedist = plane->distance_to(entity->origin.value());
+    const vec_t planedist = plane->distance_to(entity->origin.value()) + LightDevianceRadius(entity);
 
     /* don't bother with lights behind the surface.
 
@@ -1178,99 +1192,178 @@ static void LightFace_Entity(
        test in the curved case.
     */
     if (planedist < 0 && !entity->bleed.value() && !lightsurf->curved && !lightsurf->twosided) {
-        return;
+        return false;
     }
 
     /* sphere cull surface and light */
     if (CullLight(entity, lightsurf)) {
-        return;
+        return false;
     }
 
     // check lighting channels
     if (!(entity->light_channel_mask.value() & lightsurf->object_channel_mask)) {
+        return false;
+    }
+
+    return true;
+}
+
+// one group member's contribution along a pushed ray
+struct group_contrib_t
+{
+    qvec3f color;
+    qvec3d normalcontrib;
+    bool lit;
+};
+
+/*
+ * ================
+ * LightFace_Entity
+ *
+ * Lights every member of group that reaches lightsurf, sharing one set
+ * of occlusion rays between them.
+ * ================
+ */
+static void LightFace_Entity(
+    const mbsp_t *bsp, const light_group_t &group, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+{
+    const settings::worldspawn_keys &cfg = *lightsurf->cfg;
+    const modelinfo_t *modelinfo = lightsurf->modelinfo;
+
+    thread_local static std::vector<const light_t *> members;
+    thread_local static std::vector<group_contrib_t> contribs;
+
+    members.clear();
+
+    for (const light_t *entity : group.lights) {
+        if (LightFace_EntityReaches(bsp, entity, lightsurf)) {
+            members.push_back(entity);
+        }
+    }
+
+    if (members.empty()) {
         return;
     }
 
+    // all members share origin, deviance + shadow mask, so they share their rays
+    const light_t *first = members.front();
+    const size_t M = members.size();
+    const int num_light_samples = LightSampleCount(first);
+
     /*
      * Check it for real
      */
     raystream_occlusion_t &rs = *lightsurf->occlusion_stream;
     rs.clearPushedRays();
+    rs.reserve(lightsurf->samples.size() * num_light_samples);
+    contribs.resize(lightsurf->samples.size() * num_light_samples * M);
+
+    // negative lights run in post-processing, after shared samples were last gathered
+    const bool skip_shared = group.lights.front()->light.value() >= 0;
 
     for (int i = 0; i < lightsurf->samples.size(); i++) {
         const auto &sample = lightsurf->samples[i];
 
-        if (sample.occluded)
+        if (sample.occluded || (skip_shared && sample.shared()))
             continue;
 
         const qvec3d &surfpoint = sample.point;
         const qvec3d &surfnorm = sample.normal;
 
-        qvec3d surfpointToLightDir;
-        float surfpointToLightDist;
-        qvec3f color;
-        qvec3d normalcontrib;
+        // decorrelate soft light samples between neighbouring luxels
+        const uint32_t scramble =
+            num_light_samples > 1 ? sampler::luxel_scramble(i % lightsurf->width, i / lightsurf->width) : 0;
 
-        GetLightContrib(cfg, entity, surfnorm, true, surfpoint, lightsurf->twosided, color, surfpointToLightDir,
-            normalcontrib, &surfpointToLightDist);
+        for (int s = 0; s < num_light_samples; s++) {
+            const qvec3d light_origin = LightSampleOrigin(first, s, scramble);
 
-        const float occlusion = Dirt_GetScaleFactor(cfg, sample.occlusion, entity, surfpointToLightDist, lightsurf);
-        color *= occlusion;
+            qvec3d surfpointToLightDir;
+            float surfpointToLightDist;
+            group_contrib_t *ray_contribs = &contribs[rs.numPushedRays() * M];
+            bool any_lit = false;
 
-        /* Quick distance check first */
-        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
-            continue;
-        }
+            for (size_t k = 0; k < M; k++) {
+                const light_t *entity = members[k];
+                group_contrib_t &contrib = ray_contribs[k];
+
+                GetLightContrib(cfg, entity, light_origin, surfnorm, true, surfpoint, lightsurf->twosided,
+                    contrib.color, surfpointToLightDir, contrib.normalcontrib, &surfpointToLightDist);
 
-        rs.pushRay(i, surfpoint, surfpointToLightDir, surfpointToLightDist, &color, &normalcontrib);
+                const float occlusion =
+                    Dirt_GetScaleFactor(cfg, sample.occlusion, entity, surfpointToLightDist, lightsurf);
+                contrib.color *= occlusion;
+
+                /* Quick distance check first */
+                contrib.lit = fabs(LightSample_Brightness(contrib.color)) > light_options.gate.value();
+                any_lit |= contrib.lit;
+            }
+
+            if (!any_lit) {
+                continue;
+            }
+
+            rs.pushRay(i, surfpoint, surfpointToLightDir, surfpointToLightDist);
+        }
     }
 
     // don't need closest hit, just checking for occlusion between light and surface point
-    rs.tracePushedRaysOcclusion(modelinfo, entity->shadow_channel_mask.value());
+    rs.tracePushedRaysOcclusion(modelinfo, first->shadow_channel_mask.value());
     total_light_rays += rs.numPushedRays();
 
-    int cached_style = entity->style.value();
-    lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
-
     const int N = rs.numPushedRays();
-    for (int j = 0; j < N; j++) {
-        if (rs.getPushedRayOccluded(j)) {
-            continue;
-        }
 
-        total_light_ray_hits++;
+    for (size_t k = 0; k < M; k++) {
+        const light_t *entity = members[k];
 
-        int i = rs.getPushedRayPointIndex(j);
+        int cached_style = entity->style.value();
+        lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
 
-        // check if we hit a dynamic shadow caster (only applies to style 0 lights)
-        //
-        // note, this still works even though we're doing an occlusion trace - closest
-        // hit doesn't matter. All that matters is whether there is a real (solid) occluder
-        // between the ray start and end.
-        //
-        // If there is, the light is fully blocked and we bail out above, regardless of any
-        // dynamic shadow casters that also might be along the ray.
-        //
-        // If not, then we are guaranteed to detect the dynamic shadow caster in the ray filter
-        // (if any), and handle it here.
-        int desired_style = entity->style.value();
-        if (desired_style == 0) {
-            desired_style = rs.getPushedRayDynamicStyle(j);
-        }
+        for (int j = 0; j < N; j++) {
+            if (rs.getPushedRayOccluded(j)) {
+                continue;
+            }
 
-        // if necessary, switch which lightmap we are writing to.
-        if (desired_style != cached_style) {
-            cached_style = desired_style;
-            cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
-        }
+            const group_contrib_t &contrib = contribs[j * M + k];
 
-        lightsample_t &sample = cached_lightmap->samples[i];
+            if (!contrib.lit) {
+                continue;
+            }
 
-        sample.color += rs.getPushedRayColor(j);
-        cached_lightmap->bounce_color += rs.getPushedRayColor(j);
-        sample.direction += rs.getPushedRayNormalContrib(j);
+            total_light_ray_hits++;
+
+            int i = rs.getPushedRayPointIndex(j);
+
+            // check if we hit a dynamic shadow caster (only applies to style 0 lights)
+            //
+            // note, this still works even though we're doing an occlusion trace - closest
+            // hit doesn't matter. All that matters is whether there is a real (solid) occluder
+            // between the ray start and end.
+            //
+            // If there is, the light is fully blocked and we bail out above, regardless of any
+            // dynamic shadow casters that also might be along the ray.
+            //
+            // If not, then we are guaranteed to detect the dynamic shadow caster in the ray filter
+            // (if any), and handle it here.
+            int desired_style = entity->style.value();
+            if (desired_style == 0) {
+                desired_style = rs.getPushedRayDynamicStyle(j);
+            }
 
-        Lightmap_Save(bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
+            // if necessary, switch which lightmap we are writing to.
+            if (desired_style != cached_style) {
+                cached_style = desired_style;
+                cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
+            }
+
+            lightsample_t &sample = cached_lightmap->samples[i];
+            const qvec3f color = rs.tintPushedRayColor(j, contrib.color);
+
+            sample.color += color;
+            cached_lightmap->bounce_color += color;
+            sample.direction += contrib.normalcontrib;
+
+            Lightmap_Save(bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
+        }
     }
 }
 
@@ -1284,40 +1377,51 @@ static void LightPoint_Entity(const mbsp_t *bsp, raystream_occlusion_t &rs, cons
 {
     rs.clearPushedRays();
 
-    qvec3d surfpointToLightDir;
-    float surfpointToLightDist;
-    qvec3f color{};
+    const int num_light_samples = LightSampleCount(entity);
+    rs.reserve(num_light_samples);
+
+    for (int s = 0; s < num_light_samples; s++) {
+        const qvec3d light_origin = LightSampleOrigin(entity, s, 0);
+
+        qvec3d surfpointToLightDir;
+        float surfpointToLightDist;
+        qvec3f color{};
 
-    for (int axis = 0; axis < 3; ++axis) {
-        for (int sign = -1; sign <= +1; sign += 2) {
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int sign = -1; sign <= +1; sign += 2) {
 
-            qvec3f cube_color;
+                qvec3f cube_color;
 
-            qvec3f cube_normal{};
-            cube_normal[axis] = sign;
+                qvec3f cube_normal{};
+                cube_normal[axis] = sign;
 
-            qvec3d normalcontrib_unused;
+                qvec3d normalcontrib_unused;
 
-            GetLightContrib(light_options, entity, cube_normal, true, surfpoint, false, cube_color, surfpointToLightDir,
-                normalcontrib_unused, &surfpointToLightDist);
+                GetLightContrib(light_options, entity, light_origin, cube_normal, true, surfpoint, false, cube_color,
+                    surfpointToLightDir, normalcontrib_unused, &surfpointToLightDist);
 
 #ifdef LIGHTPOINT_TAKE_MAX
-            if (qv::length2(cube_color) > qv::length2(color)) {
-                color = cube_color;
-            }
+                if (qv::length2(cube_color) > qv::length2(color)) {
+                    color = cube_color;
+                }
 #else
-            color += cube_color / 6.0;
+                color += cube_color / 6.0;
 #endif
+            }
         }
+
+        /* Quick distance check first */
+        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
+            continue;
+        }
+
+        rs.pushRay(s, surfpoint, surfpointToLightDir, surfpointToLightDist, &color);
     }
 
-    /* Quick distance check first */
-    if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
+    if (!rs.numPushedRays()) {
         return;
     }
 
-    rs.pushRay(0, surfpoint, surfpointToLightDir, surfpointToLightDist, &color);
-
     rs.tracePushedRaysOcclusion(nullptr, CHANNEL_MASK_DEFAULT);
 
     // add result
@@ -1334,18 +1438,25 @@ static void LightPoint_Entity(const mbsp_t *bsp, raystream_occlusion_t &rs, cons
 /*
  * =============
  * LightFace_Sky
+ *
+ * Lights every sun in group, sharing one set of sky rays between them.
  * =============
  */
-static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static void LightFace_Sky(
+    const mbsp_t *bsp, const sun_group_t &group, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
     const modelinfo_t *modelinfo = lightsurf->modelinfo;
     const qplane3d *plane = &lightsurf->plane;
 
+    // all suns in the group share direction and suntexture
+    const sun_t *first = group.suns.front();
+    const size_t M = group.suns.size();
+
     // FIXME: Normalized sun vector should be stored in the sun_t. Also clarify which way the vector points (towards or
     // away..)
     // FIXME: Much of this is copied/pasted from LightFace_Entity, should probably be merged
-    qvec3d incoming = qv::normalize(sun->sunvec);
+    qvec3d incoming = qv::normalize(first->sunvec);
 
     /* Don't bother if surface facing away from sun */
     const vec_t dp = qv::dot(incoming, plane->normal);
@@ -1358,14 +1469,20 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
         return;
     }
 
+    thread_local static std::vector<group_contrib_t> contribs;
+
     /* Check each point... */
     raystream_intersection_t &rs = *lightsurf->intersection_stream;
     rs.clearPushedRays();
+    contribs.resize(lightsurf->samples.size() * M);
+
+    // negative suns run in post-processing, after shared samples were last gathered
+    const bool skip_shared = first->sunlight >= 0;
 
     for (int i = 0; i < lightsurf->samples.size(); i++) {
         const auto &sample = lightsurf->samples[i];
 
-        if (sample.occluded)
+        if (sample.occluded || (skip_shared && sample.shared()))
             continue;
 
         const qvec3d &surfpoint = sample.point;
@@ -1380,71 +1497,91 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
 
         angle = std::max(0.0, angle);
 
-        angle = (1.0 - sun->anglescale) + sun->anglescale * angle;
-        vec_t value = angle * sun->sunlight;
+        group_contrib_t *ray_contribs = &contribs[rs.numPushedRays() * M];
+        bool any_lit = false;
 
-        if (sun->dirt) {
-            value *= Dirt_GetScaleFactor(cfg, sample.occlusion, NULL, 0.0, lightsurf);
-        }
+        for (size_t k = 0; k < M; k++) {
+            const sun_t *sun = group.suns[k];
+            group_contrib_t &contrib = ray_contribs[k];
 
-        qvec3f color = sun->sunlight_color * (value / 255.0);
+            vec_t value = ((1.0 - sun->anglescale) + sun->anglescale * angle) * sun->sunlight;
 
-        /* Quick distance check first */
-        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
-            continue;
+            if (sun->dirt) {
+                value *= Dirt_GetScaleFactor(cfg, sample.occlusion, NULL, 0.0, lightsurf);
+            }
+
+            contrib.color = sun->sunlight_color * (value / 255.0);
+            contrib.normalcontrib = incoming * value;
+
+            /* Quick distance check first */
+            contrib.lit = fabs(LightSample_Brightness(contrib.color)) > light_options.gate.value();
+            any_lit |= contrib.lit;
         }
 
-        qvec3d normalcontrib = incoming * value;
+        if (!any_lit) {
+            continue;
+        }
 
-        rs.pushRay(i, surfpoint, incoming, MAX_SKY_DIST, &color, &normalcontrib);
+        rs.pushRay(i, surfpoint, incoming, MAX_SKY_DIST);
     }
 
     // We need to check if the first hit face is a sky face, so we need
     // to test intersection (not occlusion)
     rs.tracePushedRaysIntersection(modelinfo, CHANNEL_MASK_DEFAULT);
 
-    /* if sunlight is set, use a style 0 light map */
-    int cached_style = sun->style;
-    lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
-
     const int N = rs.numPushedRays();
     total_light_rays += N;
 
-    for (int j = 0; j < N; j++) {
-        if (rs.getPushedRayHitType(j) != hittype_t::SKY) {
-            continue;
-        }
+    for (size_t k = 0; k < M; k++) {
+        const sun_t *sun = group.suns[k];
+
+        /* if sunlight is set, use a style 0 light map */
+        int cached_style = sun->style;
+        lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
 
-        // check if we hit the wrong texture
-        if (sun->suntexture_value) {
-            const triinfo *face = rs.getPushedRayHitFaceInfo(j);
-            if (sun->suntexture_value != face->texture) {
+        for (int j = 0; j < N; j++) {
+            if (rs.getPushedRayHitType(j) != hittype_t::SKY) {
                 continue;
             }
-        }
 
-        const int i = rs.getPushedRayPointIndex(j);
+            const group_contrib_t &contrib = contribs[j * M + k];
 
-        // check if we hit a dynamic shadow caster
-        int desired_style = sun->style;
-        if (desired_style == 0) {
-            desired_style = rs.getPushedRayDynamicStyle(j);
-        }
+            if (!contrib.lit) {
+                continue;
+            }
 
-        // if necessary, switch which lightmap we are writing to.
-        if (desired_style != cached_style) {
-            cached_style = desired_style;
-            cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
-        }
+            // check if we hit the wrong texture
+            if (sun->suntexture_value) {
+                const triinfo *face = rs.getPushedRayHitFaceInfo(j);
+                if (sun->suntexture_value != face->texture) {
+                    continue;
+                }
+            }
+
+            const int i = rs.getPushedRayPointIndex(j);
 
-        lightsample_t &sample = cached_lightmap->samples[i];
+            // check if we hit a dynamic shadow caster
+            int desired_style = sun->style;
+            if (desired_style == 0) {
+                desired_style = rs.getPushedRayDynamicStyle(j);
+            }
 
-        sample.color += rs.getPushedRayColor(j);
-        cached_lightmap->bounce_color += rs.getPushedRayColor(j);
-        sample.direction += rs.getPushedRayNormalContrib(j);
-        total_light_ray_hits++;
+            // if necessary, switch which lightmap we are writing to.
+            if (desired_style != cached_style) {
+                cached_style = desired_style;
+                cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
+            }
 
-        Lightmap_Save(bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
+            lightsample_t &sample = cached_lightmap->samples[i];
+            const qvec3f color = rs.tintPushedRayColor(j, contrib.color);
+
+            sample.color += color;
+            cached_lightmap->bounce_color += color;
+            sample.direction += contrib.normalcontrib;
+            total_light_ray_hits++;
+
+            Lightmap_Save(bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
+        }
     }
 }
 
@@ -1690,7 +1827,7 @@ static void LightFace_LocalMin(
         for (int i = 0; i < lightsurf->samples.size(); i++) {
             const auto &surf_sample = lightsurf->samples[i];
 
-            if (surf_sample.occluded)
+            if (surf_sample.occluded || surf_sample.shared())
                 continue;
 
             const lightsample_t &sample = lightmap->samples[i];
@@ -1974,6 +2111,13 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
             else if (SurfaceLight_SphereCull(&vpl, lightsurf, vpl_setting, surflight_gate, hotspot_clamp))
                 continue;
 
+            // none of the leafs containing the surface light's points are in our pvs
+            if (light_options.visapprox.value() == visapprox_t::VIS && !lightsurf->pvs.empty() &&
+                !vpl.leaf_pvs_bits.empty() &&
+                !Pvs_Intersects(lightsurf->pvs.data(), vpl.leaf_pvs_bits.data(), vpl.leaf_pvs_bits.size())) {
+                continue;
+            }
+
             raystream_occlusion_t &rs = *lightsurf->occlusion_stream;
 
             for (int c = 0; c < vpl.points.size(); c++) {
@@ -1987,7 +2131,7 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
                 for (int i = 0; i < lightsurf->samples.size(); i++) {
                     const auto &sample = lightsurf->samples[i];
 
-                    if (sample.occluded)
+                    if (sample.occluded || sample.shared())
                         continue;
 
                     const qvec3d &lightsurf_pos = sample.point;
@@ -2057,7 +2201,7 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
 }
 
 static void // mxd
-LightPoint_SurfaceLight(const mbsp_t *bsp, const std::vector<uint8_t> *pvs, raystream_occlusion_t &rs, bool bounce,
+LightPoint_SurfaceLight(const mbsp_t *bsp, const uint8_t *pvs, raystream_occlusion_t &rs, bool bounce,
     const vec_t &standard_scale, const vec_t &sky_scale, const float &hotspot_clamp, const qvec3d &surfpoint,
     lightgrid_samples_t &result)
 {
@@ -2068,7 +2212,7 @@ LightPoint_SurfaceLight(const mbsp_t *bsp, const std::vector<uint8_t> *pvs, rays
         const surfacelight_t &vpl = *surf->vpl;
 
         for (int c = 0; c < vpl.points.size(); c++) {
-            if (light_options.visapprox.value() == visapprox_t::VIS && pvs && VisCullEntity(bsp, *pvs, vpl.leaves[c])) {
+            if (light_options.visapprox.value() == visapprox_t::VIS && VisCullEntity(bsp, pvs, vpl.leaves[c])) {
                 continue;
             }
 
@@ -2280,14 +2424,18 @@ inline qvec3d TransformToTangentSpace(
 }
 
 // from q3map2
-inline qvec3d GetDirtVector(const settings::worldspawn_keys &cfg, int i)
+// luxel_x/luxel_y decorrelate the "random" (dirtmode 1) vectors between neighbouring luxels
+inline qvec3d GetDirtVector(const settings::worldspawn_keys &cfg, int i, int luxel_x, int luxel_y)
 {
     Q_assert(i < numDirtVectors);
 
     if (cfg.dirtmode.value() == 1) {
-        /* get random vector */
-        float angle = Random() * DEG2RAD(360.0f);
-        float elevation = Random() * DEG2RAD(cfg.dirtangle.value());
+        /* get a vector from the i'th stratum of the hemisphere, at a per-luxel blue noise offset
+           (rotated by a Sobol point so the offset isn't the same in every stratum) */
+        const qvec2f jitter = sampler::rotate(sampler::sobol2(i), sampler::blue_noise2(luxel_x, luxel_y));
+        const qvec2f u = sampler::stratified2(i, numDirtVectors, jitter);
+        float angle = u[0] * DEG2RAD(360.0f);
+        float elevation = u[1] * DEG2RAD(cfg.dirtangle.value());
         return {cos(angle) * sin(elevation), sin(angle) * sin(elevation), cos(elevation)};
     }
 
@@ -2334,10 +2482,10 @@ static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
         for (int i = 0; i < lightsurf->samples.size(); i++) {
             const auto &sample = lightsurf->samples[i];
 
-            if (sample.occluded)
+            if (sample.occluded || sample.shared())
                 continue;
 
-            qvec3d dirtvec = GetDirtVector(cfg, j);
+            qvec3d dirtvec = GetDirtVector(cfg, j, i % lightsurf->width, i / lightsurf->width);
             qvec3d dir = TransformToTangentSpace(sample.normal, myUps[i], myRts[i], dirtvec);
 
             rs.pushRay(i, sample.point, dir, cfg.dirtdepth.value());
@@ -3184,15 +3332,11 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
         return;
 
     uint8_t *out, *lit, *lux;
-    GetFileSpace(&out, &lit, &lux, size * numstyles);
-
-    int lightofs;
+    int lightofs = GetFileSpace(&out, &lit, &lux, size * numstyles);
 
     // Q2/HL native colored lightmaps
     if (bsp->loadversion->game->has_rgb_lightmap) {
-        lightofs = lit - lit_filebase.data();
-    } else {
-        lightofs = out - filebase.data();
+        lightofs *= 3;
     }
 
     if (facesup_decoupled) {
@@ -3228,13 +3372,11 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
     // write vanilla lightmap if -world_units_per_luxel is in use but not -novanilla
     if (facesup_decoupled && !light_options.novanilla.value()) {
         // FIXME: duplicates some code from above
-        GetFileSpace(&out, &lit, &lux, lightsurf->vanilla_extents.numsamples() * numstyles);
+        lightofs = GetFileSpace(&out, &lit, &lux, lightsurf->vanilla_extents.numsamples() * numstyles);
 
         // Q2/HL native colored lightmaps
         if (bsp->loadversion->game->has_rgb_lightmap) {
-            lightofs = lit - lit_filebase.data();
-        } else {
-            lightofs = out - filebase.data();
+            lightofs *= 3;
         }
         face->lightofs = lightofs;
 
@@ -3278,6 +3420,186 @@ std::unique_ptr<lightsurf_t> CreateLightmapSurface(const mbsp_t *bsp, const mfac
     return Lightsurf_Init(modelinfo, cfg, face, bsp, facesup, facesup_decoupled);
 }
 
+/*
+ * ============
+ * ShareLightmapSurfaceSamples
+ *
+ * Lightmap extents (and the extra4 border around them) overlap along seams
+ * between coplanar faces, where the sample points of both faces end up on
+ * the same spot. Faces on the same plane and model with the same texinfo
+ * and lightmap scale light identically, so each such point is only lit by
+ * the first face that has it; the others gather the result in
+ * GatherSharedSamples. The first face's culling sphere and bounds are
+ * grown to cover the points it lights for the others.
+ * ============
+ */
+void ShareLightmapSurfaceSamples(const mbsp_t *bsp, std::vector<std::unique_ptr<lightsurf_t>> &surfaces)
+{
+    logging::funcheader();
+
+    // samples within this distance are considered the same point
+    constexpr vec_t SHARED_POINT_EPSILON = 0.01;
+    constexpr vec_t SHARED_POINT_QUANTIZE = 8;
+
+    using group_key_t = std::tuple<const modelinfo_t *, int32_t, int32_t, int32_t, vec_t>;
+    std::map<group_key_t, std::vector<size_t>> groups;
+
+    for (size_t i = 0; i < surfaces.size(); i++) {
+        const lightsurf_t *surf = surfaces[i].get();
+
+        if (!surf || surf->samples.empty() || !Face_IsLightmapped(bsp, surf->face)) {
+            continue;
+        }
+
+        const mface_t *face = surf->face;
+        groups[{surf->modelinfo, face->planenum, face->side, face->texinfo, surf->lightmapscale}].push_back(i);
+    }
+
+    std::vector<std::vector<size_t> *> shareable;
+
+    for (auto &[key, faces] : groups) {
+        shareable.push_back(&faces);
+    }
+
+    std::atomic<size_t> total_samples = 0, total_shared = 0;
+
+    logging::parallel_for_each(shareable, [&](const std::vector<size_t> *faces) {
+        std::map<std::array<int64_t, 3>, std::pair<int32_t, int32_t>> first_sample_at;
+        size_t samples = 0, shared = 0;
+
+        for (size_t facenum : *faces) {
+            lightsurf_t &surf = *surfaces[facenum];
+
+            for (size_t i = 0; i < surf.samples.size(); i++) {
+                auto &sample = surf.samples[i];
+
+                if (sample.occluded) {
+                    continue;
+                }
+
+                samples++;
+
+                const std::array<int64_t, 3> key{std::llround(sample.point[0] * SHARED_POINT_QUANTIZE),
+                    std::llround(sample.point[1] * SHARED_POINT_QUANTIZE),
+                    std::llround(sample.point[2] * SHARED_POINT_QUANTIZE)};
+
+                auto [it, inserted] = first_sample_at.try_emplace(key, facenum, i);
+
+                if (inserted) {
+                    continue;
+                }
+
+                const auto &source = surfaces[it->second.first]->samples[it->second.second];
+
+                if (!qv::epsilonEqual(source.point, sample.point, SHARED_POINT_EPSILON) ||
+                    !qv::epsilonEqual(source.normal, sample.normal, 0.001)) {
+                    continue;
+                }
+
+                sample.source_facenum = it->second.first;
+                sample.source_index = it->second.second;
+                shared++;
+
+                // the source face now lights this point for us, but its culling sphere and bounds only
+                // cover its own polygon, and border samples can lie outside of it
+                faceextents_t &source_extents = surfaces[it->second.first]->extents;
+                source_extents.radius =
+                    std::max(source_extents.radius, qv::distance(source_extents.origin, sample.point));
+                source_extents.bounds += sample.point;
+            }
+        }
+
+        total_samples += samples;
+        total_shared += shared;
+    });
+
+    logging::print(logging::flag::VERBOSE, "{} of {} sample points shared with coplanar faces\n",
+        total_shared.load(), total_samples.load());
+}
+
+/*
+ * ============
+ * GatherSharedSamples
+ *
+ * Copies the lighting of shared samples from their source samples. Runs
+ * after every lighting pass (the source faces must be finished), so only
+ * the color added since the last gather counts towards bounce_color.
+ * ============
+ */
+void GatherSharedSamples(const mbsp_t *bsp, std::vector<std::unique_ptr<lightsurf_t>> &surfaces)
+{
+    struct gathered_sample_t
+    {
+        int32_t index;
+        int style;
+        lightsample_t value;
+        float occlusion;
+    };
+
+    // a face can be a source and gather from others at the same time, so read
+    // everything first; writing can add lightmaps and invalidate them
+    std::vector<std::vector<gathered_sample_t>> gathered(surfaces.size());
+
+    logging::parallel_for(static_cast<size_t>(0), surfaces.size(), [&](size_t f) {
+        if (!surfaces[f]) {
+            return;
+        }
+
+        const lightsurf_t &lightsurf = *surfaces[f];
+
+        for (size_t i = 0; i < lightsurf.samples.size(); i++) {
+            const auto &sample = lightsurf.samples[i];
+
+            if (!sample.shared()) {
+                continue;
+            }
+
+            const lightsurf_t &source = *surfaces[sample.source_facenum];
+            const float occlusion = source.samples[sample.source_index].occlusion;
+
+            // keep the occlusion even if no style has been lit yet
+            gathered[f].push_back({static_cast<int32_t>(i), INVALID_LIGHTSTYLE, {}, occlusion});
+
+            for (const lightmap_t &lightmap : source.lightmapsByStyle) {
+                if (lightmap.style != INVALID_LIGHTSTYLE) {
+                    gathered[f].push_back(
+                        {static_cast<int32_t>(i), lightmap.style, lightmap.samples[sample.source_index], occlusion});
+                }
+            }
+        }
+    });
+
+    logging::parallel_for(static_cast<size_t>(0), surfaces.size(), [&](size_t f) {
+        if (gathered[f].empty()) {
+            return;
+        }
+
+        lightsurf_t &lightsurf = *surfaces[f];
+        lightmapdict_t *lightmaps = &lightsurf.lightmapsByStyle;
+
+        for (const gathered_sample_t &g : gathered[f]) {
+            lightsurf.samples[g.index].occlusion = g.occlusion;
+
+            if (g.style == INVALID_LIGHTSTYLE) {
+                continue;
+            }
+
+            lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, g.style, &lightsurf);
+
+            if (lightmap->style == INVALID_LIGHTSTYLE && qv::emptyExact(g.value.color)) {
+                // don't start a new style for nothing
+                continue;
+            }
+
+            lightsample_t &dest = lightmap->samples[g.index];
+            lightmap->bounce_color += g.value.color - dest.color;
+            dest = g.value;
+
+            Lightmap_Save(bsp, lightmaps, &lightsurf, lightmap, g.style);
+        }
+    });
+}
+
 /*
  * ============
  * LightFace
@@ -3308,17 +3630,12 @@ void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::
 
         /* positive lights */
         if (!(modelinfo->lightignore.value() || extended_flags.light_ignore)) {
-            for (const auto &entity : GetLights()) {
-                if (entity->getFormula() == LF_LOCALMIN)
-                    continue;
-                if (entity->nostaticlight.value())
-                    continue;
-                if (entity->light.value() > 0)
-                    LightFace_Entity(bsp, entity.get(), &lightsurf, lightmaps);
-            }
-            for (const sun_t &sun : GetSuns())
-                if (sun.sunlight > 0)
-                    LightFace_Sky(bsp, &sun, &lightsurf, lightmaps);
+            for (const light_group_t &group : GetLightGroups())
+                if (group.lights.front()->light.value() > 0)
+                    LightFace_Entity(bsp, group, &lightsurf, lightmaps);
+            for (const sun_group_t &group : GetSunGroups())
+                if (group.suns.front()->sunlight > 0)
+                    LightFace_Sky(bsp, group, &lightsurf, lightmaps);
 
             // mxd. Add surface lights...
             // FIXME: negative surface lights
@@ -3423,17 +3740,12 @@ void PostProcessLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const setti
 
         /* negative lights */
         if (!(modelinfo->lightignore.value() || extended_flags.light_ignore)) {
-            for (const auto &entity : GetLights()) {
-                if (entity->getFormula() == LF_LOCALMIN)
-                    continue;
-                if (entity->nostaticlight.value())
-                    continue;
-                if (entity->light.value() < 0)
-                    LightFace_Entity(bsp, entity.get(), &lightsurf, lightmaps);
-            }
-            for (const sun_t &sun : GetSuns())
-                if (sun.sunlight < 0)
-                    LightFace_Sky(bsp, &sun, &lightsurf, lightmaps);
+            for (const light_group_t &group : GetLightGroups())
+                if (group.lights.front()->light.value() < 0)
+                    LightFace_Entity(bsp, group, &lightsurf, lightmaps);
+            for (const sun_group_t &group : GetSunGroups())
+                if (group.suns.front()->sunlight < 0)
+                    LightFace_Sky(bsp, group, &lightsurf, lightmaps);
         }
     }
 
@@ -3563,13 +3875,17 @@ bool lightgrid_samples_t::operator==(const lightgrid_samples_t &other) const
     return samples_by_style == other.samples_by_style;
 }
 
-lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3d &world_point)
+lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3d &world_point, const mleaf_t *leaf)
 {
     // TODO: use more than 1 ray for better performance
     raystream_occlusion_t rs(1);
     raystream_intersection_t rsi(1);
 
-    const auto *pvs = Mod_LeafPvs(bsp, BSP_FindLeafAtPoint(bsp, &bsp->dmodels[0], world_point));
+    if (!leaf) {
+        leaf = Light_PointInLeaf(bsp, world_point);
+    }
+
+    const auto *pvs = Mod_LeafPvs(bsp, leaf);
 
     auto &cfg = light_options;
 
@@ -0,0 +1,218 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <light/sampler.hh>
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <common/log.hh>
+#include <common/mathlib.hh>
+
+namespace sampler
+{
+using direction_numbers_t = std::array<std::array<uint32_t, 32>, SOBOL_DIMENSIONS>;
+
+/*
+ * direction numbers for the first three dimensions, from Joe & Kuo's
+ * new-joe-kuo-6.21201 table:
+ *   dim 0: van der Corput
+ *   dim 1: s = 1, a = 0, m = {1}
+ *   dim 2: s = 2, a = 1, m = {1, 3}
+ */
+static constexpr direction_numbers_t MakeSobolDirections()
+{
+    direction_numbers_t v{};
+
+    for (int k = 0; k < 32; k++) {
+        v[0][k] = 1u << (31 - k);
+    }
+
+    v[1][0] = 1u << 31;
+    for (int k = 1; k < 32; k++) {
+        v[1][k] = v[1][k - 1] ^ (v[1][k - 1] >> 1);
+    }
+
+    v[2][0] = 1u << 31;
+    v[2][1] = 3u << 30;
+    for (int k = 2; k < 32; k++) {
+        v[2][k] = v[2][k - 1] ^ v[2][k - 2] ^ (v[2][k - 2] >> 2);
+    }
+
+    return v;
+}
+
+static constexpr direction_numbers_t sobol_directions = MakeSobolDirections();
+
+// converts 32 fixed point bits to a float strictly below 1
+inline float BitsToUnitFloat(uint32_t bits)
+{
+    return (bits >> 8) * (1.0f / (1u << 24));
+}
+
+float sobol(uint32_t index, int dim, uint32_t scramble)
+{
+    Q_assert(dim >= 0 && dim < SOBOL_DIMENSIONS);
+
+    uint32_t result = scramble;
+
+    for (int k = 0; index; index >>= 1, k++) {
+        if (index & 1) {
+            result ^= sobol_directions[dim][k];
+        }
+    }
+
+    return BitsToUnitFloat(result);
+}
+
+qvec2f sobol2(uint32_t index, uint32_t scramble)
+{
+    // use different scrambles per dimension so they don't shift together
+    return {sobol(index, 0, scramble), sobol(index, 1, scramble * 0x9E3779B9u)};
+}
+
+qvec3f sobol3(uint32_t index, uint32_t scramble)
+{
+    return {sobol(index, 0, scramble), sobol(index, 1, scramble * 0x9E3779B9u),
+        sobol(index, 2, scramble * 0x85EBCA6Bu)};
+}
+
+qvec2f stratified2(uint32_t index, uint32_t count, const qvec2f &jitter)
+{
+    Q_assert(index < count);
+
+    const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(count))));
+    const uint32_t rows = (count + columns - 1) / columns;
+
+    return {(static_cast<float>(index % columns) + jitter[0]) / columns,
+        (static_cast<float>(index / columns) + jitter[1]) / rows};
+}
+
+/*
+ * Builds the mask by Mitchell's best candidate algorithm over the (toroidal)
+ * tile: each cell's value is the order it was picked in, where each pick is
+ * the candidate furthest from all previous picks. Any threshold of the mask
+ * is then a well spaced point set.
+ */
+static std::vector<uint16_t> MakeBlueNoise()
+{
+    constexpr int N = BLUE_NOISE_SIZE;
+    constexpr int CANDIDATES = 10;
+
+    std::vector<uint16_t> rank(N * N);
+    std::vector<int> free_cells(N * N);
+    std::vector<int> dist2(N * N, std::numeric_limits<int>::max());
+
+    for (int i = 0; i < N * N; i++) {
+        free_cells[i] = i;
+    }
+
+    // fixed seed, so output is the same on every run and platform
+    std::minstd_rand rng(0x5eed);
+
+    for (int picked = 0; picked < N * N; picked++) {
+        size_t best = 0;
+
+        for (int c = 0; c < CANDIDATES; c++) {
+            const size_t candidate = rng() % free_cells.size();
+
+            if (dist2[free_cells[candidate]] > dist2[free_cells[best]]) {
+                best = candidate;
+            }
+        }
+
+        const int cell = free_cells[best];
+        free_cells[best] = free_cells.back();
+        free_cells.pop_back();
+
+        rank[cell] = picked;
+
+        const int px = cell % N, py = cell / N;
+
+        for (int y = 0; y < N; y++) {
+            const int dy = std::min(std::abs(y - py), N - std::abs(y - py));
+
+            for (int x = 0; x < N; x++) {
+                const int dx = std::min(std::abs(x - px), N - std::abs(x - px));
+                int &d = dist2[(y * N) + x];
+                d = std::min(d, (dx * dx) + (dy * dy));
+            }
+        }
+    }
+
+    return rank;
+}
+
+static uint16_t BlueNoiseRank(int x, int y)
+{
+    static const std::vector<uint16_t> mask = MakeBlueNoise();
+
+    // & also wraps negative coordinates, since the size is a power of two
+    static_assert((BLUE_NOISE_SIZE & (BLUE_NOISE_SIZE - 1)) == 0);
+    return mask[((y & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE) + (x & (BLUE_NOISE_SIZE - 1))];
+}
+
+float blue_noise(int x, int y)
+{
+    return (BlueNoiseRank(x, y) + 0.5f) / (BLUE_NOISE_SIZE * BLUE_NOISE_SIZE);
+}
+
+qvec2f blue_noise2(int x, int y)
+{
+    // a far away offset into the tile is uncorrelated with the original
+    return {blue_noise(x, y), blue_noise(x + (BLUE_NOISE_SIZE / 2), y + (BLUE_NOISE_SIZE / 3))};
+}
+
+uint32_t luxel_scramble(int x, int y)
+{
+    // the high bits pick which stratum the first sample lands in, so take
+    // those from the blue noise; fill the rest with a hash
+    uint32_t hash = (static_cast<uint32_t>(x) * 0x8DA6B343u) ^ (static_cast<uint32_t>(y) * 0xD8163841u);
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+
+    return (static_cast<uint32_t>(BlueNoiseRank(x, y)) << 20) | (hash & 0xFFFFFu);
+}
+
+qvec2f concentric_disk(const qvec2f &u)
+{
+    const float a = (2.0f * u[0]) - 1.0f;
+    const float b = (2.0f * u[1]) - 1.0f;
+
+    if (a == 0 && b == 0) {
+        return {};
+    }
+
+    float r, phi;
+
+    if (std::abs(a) > std::abs(b)) {
+        r = a;
+        phi = (Q_PI / 4) * (b / a);
+    } else {
+        r = b;
+        phi = (Q_PI / 2) - ((Q_PI / 4) * (a / b));
+    }
+
+    return {r * std::cos(phi), r * std::sin(phi)};
+}
+} // namespace sampler
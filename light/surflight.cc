@@ -23,7 +23,7 @@ See file, 'COPYING', for details.
 #include <cassert>
 
 #include <light/entities.hh> // for FixLightOnFace
-#include <light/trace.hh> // for Light_PointInLeaf
+#include <light/trace.hh> // for Light_PointsInLeafs
 #include <light/light.hh>
 #include <light/ltface.hh>
 
@@ -51,6 +51,34 @@ size_t GetSurflightPoints()
 
 int LightStyleForTargetname(const settings::worldspawn_keys &cfg, const std::string &targetname);
 
+void SurfaceLight_SetupLeafPvsBits(const mbsp_t *bsp, surfacelight_t &l)
+{
+    const pvs_matrix_t &vis = UncompressedVis();
+
+    l.leaf_pvs_bits.clear();
+
+    if (vis.empty() || l.leaves.empty()) {
+        return;
+    }
+
+    std::vector<uint8_t> bits(vis.row_stride());
+
+    for (const mleaf_t *leaf : l.leaves) {
+        // same exemptions as VisCullEntity(); if any point can't be culled, neither can the whole light
+        if (leaf == nullptr || bsp->loadversion->game->contents_are_solid({leaf->contents}) ||
+            bsp->loadversion->game->contents_are_sky({leaf->contents}) ||
+            bsp->loadversion->game->contents_are_liquid({leaf->contents})) {
+            return;
+        }
+
+        if (const int32_t bit = vis.leaf_bit(leaf - bsp->dleafs.data()); bit >= 0) {
+            bits[bit >> 3] |= (1 << (bit & 7));
+        }
+    }
+
+    l.leaf_pvs_bits = std::move(bits);
+}
+
 static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys &cfg, const mface_t *face,
     std::optional<qvec3f> texture_color, bool is_directional, bool is_sky, int32_t style, int32_t light_value)
 {
@@ -174,10 +202,12 @@ static void MakeSurfaceLight(const mbsp_t *bsp, const settings::worldspawn_keys
             l->bounds = EstimateVisibleBoundsAtPoint(l->pos);
         }
 
-        for (auto &pt : l->points) {
-            if (light_options.visapprox.value() == visapprox_t::VIS) {
-                l->leaves.push_back(Light_PointInLeaf(bsp, pt));
-            } else if (light_options.visapprox.value() == visapprox_t::RAYS) {
+        if (light_options.visapprox.value() == visapprox_t::VIS) {
+            l->leaves.resize(l->points.size());
+            Light_PointsInLeafs(bsp, l->points.data(), l->points.size(), l->leaves.data());
+            SurfaceLight_SetupLeafPvsBits(bsp, *l);
+        } else if (light_options.visapprox.value() == visapprox_t::RAYS) {
+            for (auto &pt : l->points) {
                 l->bounds += EstimateVisibleBoundsAtPoint(pt);
             }
         }
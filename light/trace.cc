@@ -21,6 +21,9 @@
 
 #include <common/imglib.hh>
 #include <common/bsputils.hh>
+#include <light/light.hh> // for WorldLeafLocator
+
+#include <algorithm>
 
 /*
 ==============
@@ -31,6 +34,10 @@ from hmap2
 */
 const mleaf_t *Light_PointInLeaf(const mbsp_t *bsp, const qvec3d &point)
 {
+    if (const leaf_locator_t &locator = WorldLeafLocator(); locator.bsp() == bsp) {
+        return locator.find_leaf(point);
+    }
+
     int num = 0;
 
     while (num >= 0)
@@ -39,6 +46,29 @@ const mleaf_t *Light_PointInLeaf(const mbsp_t *bsp, const qvec3d &point)
     return &bsp->dleafs[-1 - num];
 }
 
+template<typename T>
+static void Light_PointsInLeafs_Generic(const mbsp_t *bsp, const qvec<T, 3> *points, size_t count, const mleaf_t **out)
+{
+    if (const leaf_locator_t &locator = WorldLeafLocator(); locator.bsp() == bsp) {
+        locator.find_leafs(points, count, out);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        out[i] = Light_PointInLeaf(bsp, qvec3d(points[i]));
+    }
+}
+
+void Light_PointsInLeafs(const mbsp_t *bsp, const qvec3d *points, size_t count, const mleaf_t **out)
+{
+    Light_PointsInLeafs_Generic(bsp, points, count, out);
+}
+
+void Light_PointsInLeafs(const mbsp_t *bsp, const qvec3f *points, size_t count, const mleaf_t **out)
+{
+    Light_PointsInLeafs_Generic(bsp, points, count, out);
+}
+
 /**
  * Given a float texture coordinate, returns a pixel index to sample in [0, width-1].
  * This assumes the texture repeats and nearest filtering
@@ -68,3 +98,112 @@ qvec4b SampleTexture(
 
     return texture->pixels[(texture->width * y) + x];
 }
+
+static bool IsPowerOfTwo(uint32_t x)
+{
+    return x && !(x & (x - 1));
+}
+
+prepared_texture_t::prepared_texture_t(const img::texture &texture)
+    : m_width_scale(texture.width_scale),
+      m_height_scale(texture.height_scale)
+{
+    if (!texture.width || !texture.height || texture.pixels.empty()) {
+        return;
+    }
+
+    // opacity + alpha bit-plane
+    m_opaque_stride = (texture.width + 63) / 64;
+    m_opaque_bits.resize(static_cast<size_t>(m_opaque_stride) * texture.height);
+
+    size_t num_opaque = 0;
+
+    for (uint32_t y = 0; y < texture.height; y++) {
+        for (uint32_t x = 0; x < texture.width; x++) {
+            if (texture.pixels[(texture.width * y) + x][3] == 255) {
+                m_opaque_bits[(m_opaque_stride * y) + (x / 64)] |= (uint64_t(1) << (x % 64));
+                num_opaque++;
+            }
+        }
+    }
+
+    if (num_opaque == texture.pixels.size()) {
+        m_opacity = texture_opacity_t::OPAQUE;
+    } else if (num_opaque == 0) {
+        m_opacity = texture_opacity_t::TRANSPARENT;
+    } else {
+        m_opacity = texture_opacity_t::MIXED;
+    }
+
+    // mip levels, each a 2x2 box filter of the previous one (clamped at the edges for odd sizes)
+    auto make_level = [](uint32_t width, uint32_t height, const qvec4b *pixels) {
+        level_t level;
+        level.width = width;
+        level.height = height;
+        level.width_mask = IsPowerOfTwo(width) ? width - 1 : 0;
+        level.height_mask = IsPowerOfTwo(height) ? height - 1 : 0;
+        level.pixels = pixels;
+        return level;
+    };
+
+    m_levels.push_back(make_level(texture.width, texture.height, texture.pixels.data()));
+
+    while (m_levels.back().width > 1 || m_levels.back().height > 1) {
+        const level_t &src = m_levels.back();
+        const uint32_t width = std::max(1u, src.width / 2);
+        const uint32_t height = std::max(1u, src.height / 2);
+
+        std::vector<qvec4b> &pixels = m_mip_pixels.emplace_back(static_cast<size_t>(width) * height);
+
+        for (uint32_t y = 0; y < height; y++) {
+            const uint32_t y0 = std::min(y * 2, src.height - 1);
+            const uint32_t y1 = std::min((y * 2) + 1, src.height - 1);
+
+            for (uint32_t x = 0; x < width; x++) {
+                const uint32_t x0 = std::min(x * 2, src.width - 1);
+                const uint32_t x1 = std::min((x * 2) + 1, src.width - 1);
+
+                const qvec4b &p00 = src.pixels[(src.width * y0) + x0];
+                const qvec4b &p10 = src.pixels[(src.width * y0) + x1];
+                const qvec4b &p01 = src.pixels[(src.width * y1) + x0];
+                const qvec4b &p11 = src.pixels[(src.width * y1) + x1];
+                qvec4b &out = pixels[(width * y) + x];
+
+                for (int c = 0; c < 4; c++) {
+                    out[c] = static_cast<uint8_t>((p00[c] + p10[c] + p01[c] + p11[c] + 2) / 4);
+                }
+            }
+        }
+
+        m_levels.push_back(make_level(width, height, pixels.data()));
+    }
+}
+
+bool prepared_texture_t::opaque_at(const qvec2d &texcoord) const
+{
+    if (m_opacity != texture_opacity_t::MIXED) {
+        return m_opacity == texture_opacity_t::OPAQUE;
+    }
+
+    const level_t &level = m_levels[0];
+    const uint32_t x = level.wrap_x(texcoord[0] * m_width_scale);
+    const uint32_t y = level.wrap_y(texcoord[1] * m_height_scale);
+
+    return (m_opaque_bits[(m_opaque_stride * y) + (x / 64)] >> (x % 64)) & 1;
+}
+
+qvec4b prepared_texture_t::sample(const qvec2d &texcoord, int level_index) const
+{
+    if (m_levels.empty()) {
+        return {};
+    }
+
+    level_index = std::clamp(level_index, 0, num_levels() - 1);
+
+    const level_t &level = m_levels[level_index];
+    const vec_t scale = 1.0 / static_cast<vec_t>(1 << level_index);
+    const uint32_t x = level.wrap_x(texcoord[0] * m_width_scale * scale);
+    const uint32_t y = level.wrap_y(texcoord[1] * m_height_scale * scale);
+
+    return level.pixels[(level.width * y) + x];
+}
@@ -20,12 +20,15 @@
 #include <light/trace_embree.hh>
 
 #include <light/light.hh>
-#include <light/trace.hh> // for SampleTexture
+#include <light/trace.hh> // for prepared_texture_t
 
 #include <common/bsputils.hh>
+#include <common/imglib.hh>
 #include <common/polylib.hh>
+#include <algorithm>
 #include <vector>
 #include <climits>
+#include <unordered_map>
 
 sceneinfo skygeom; // sky. always occludes.
 sceneinfo solidgeom; // solids. always occludes.
@@ -36,11 +39,19 @@ RTCScene scene;
 
 static const mbsp_t *bsp_static;
 
+// prepared versions of the textures on fence/glass faces, for Embree_FilterFuncN
+static std::unordered_map<const img::texture *, prepared_texture_t> prepared_textures;
+
+// assumed spread of a ray, in world units of width per unit travelled, when picking the
+// mip level to sample glass colors from
+constexpr float RAY_FOOTPRINT_SPREAD = 1.0f / 256.0f;
+
 void ResetEmbree()
 {
     skygeom = {};
     solidgeom = {};
     filtergeom = {};
+    prepared_textures.clear();
 
     if (scene) {
         rtcReleaseScene(scene);
@@ -88,6 +99,17 @@ static float Face_Alpha(const mbsp_t *bsp, const modelinfo_t *modelinfo, const m
     return 1.0f;
 }
 
+static const prepared_texture_t *Embree_PrepareTexture(const img::texture *texture)
+{
+    auto it = prepared_textures.find(texture);
+
+    if (it == prepared_textures.end()) {
+        it = prepared_textures.emplace(texture, texture ? prepared_texture_t(*texture) : prepared_texture_t()).first;
+    }
+
+    return &it->second;
+}
+
 sceneinfo CreateGeometry(
     const mbsp_t *bsp, RTCDevice g_device, RTCScene scene, const std::vector<const mface_t *> &faces)
 {
@@ -164,6 +186,20 @@ sceneinfo CreateGeometry(
             info.is_glass = (info.alpha < 1.0f);
         }
 
+        info.prepared_texture = nullptr;
+        info.pixels_per_unit = 0;
+
+        if (info.is_fence || info.is_glass) {
+            info.prepared_texture = Embree_PrepareTexture(info.texture);
+
+            if (info.texture) {
+                const texvecf &vecs = info.texinfo->vecs;
+                info.pixels_per_unit =
+                    std::max(qv::length(qvec3f(vecs.at(0, 0), vecs.at(0, 1), vecs.at(0, 2))) * info.texture->width_scale,
+                        qv::length(qvec3f(vecs.at(1, 0), vecs.at(1, 1), vecs.at(1, 2))) * info.texture->height_scale);
+            }
+        }
+
         s.triInfo.push_back(info);
     };
 
@@ -369,15 +405,32 @@ static void Embree_FilterFuncN(const struct RTCFilterFunctionNArguments *args)
 
         // test fence textures and glass
         if (hit_triinfo.is_fence || hit_triinfo.is_glass) {
+            const prepared_texture_t &texture = *hit_triinfo.prepared_texture;
+
+            // fully opaque/transparent fence textures don't need the hit point
+            if (!hit_triinfo.is_glass && texture.opacity() != texture_opacity_t::MIXED) {
+                if (texture.opacity() == texture_opacity_t::TRANSPARENT) {
+                    // reject hit
+                    valid[i] = INVALID;
+                }
+                // otherwise accept hit
+                continue;
+            }
+
             qvec3f rayDir =
                 qv::normalize(qvec3f{RTCRayN_dir_x(ray, N, i), RTCRayN_dir_y(ray, N, i), RTCRayN_dir_z(ray, N, i)});
             qvec3f hitpoint = Embree_RayEndpoint(ray, rayDir, N, i);
-            const qvec4b sample = SampleTexture(hit_triinfo.face, hit_triinfo.texinfo, hit_triinfo.texture, bsp_static,
-                hitpoint); // mxd. Palette index -> color_rgba
+            const qvec2d texcoord = WorldToTexCoord(hitpoint, hit_triinfo.texinfo);
 
             if (hit_triinfo.is_glass) {
                 // hit glass...
 
+                // sample the mip level that roughly matches the ray's width at the hit
+                const float footprint =
+                    RTCRayN_tfar(ray, N, i) * RAY_FOOTPRINT_SPREAD * hit_triinfo.pixels_per_unit;
+                const int level = footprint > 1.0f ? static_cast<int>(log2(footprint)) : 0;
+                const qvec4b sample = texture.sample(texcoord, level); // mxd. Palette index -> color_rgba
+
                 // mxd. Adjust alpha by texture alpha?
                 if (sample[3] < 255)
                     alpha = sample[3] / 255.0f;
@@ -399,7 +452,7 @@ static void Embree_FilterFuncN(const struct RTCFilterFunctionNArguments *args)
             }
 
             if (hit_triinfo.is_fence) {
-                if (sample[3] < 255) {
+                if (!texture.opaque_at(texcoord)) {
                     // reject hit
                     valid[i] = INVALID;
                     continue;
@@ -763,4 +816,72 @@ RTCOccludedArguments ray_source_info::setup_occluded_arguments()
 
     return result;
 }
-#endif
\ No newline at end of file
+#endif
+
+// spreads the low 10 bits of v out so that there are 5 zero bits between each
+static uint64_t SpreadBits10By6(uint32_t v)
+{
+    uint64_t result = 0;
+
+    for (int bit = 0; bit < 10; bit++) {
+        result |= static_cast<uint64_t>((v >> bit) & 1) << (bit * 6);
+    }
+
+    return result;
+}
+
+static uint32_t QuantizeUnit10(float f)
+{
+    return static_cast<uint32_t>(std::clamp(f, 0.0f, 1.0f) * 1023.0f);
+}
+
+void Embree_CoherentRayOrder(
+    const RTCRay *rays, size_t stride, size_t count, std::vector<std::pair<uint64_t, uint32_t>> &order)
+{
+    auto ray_at = [&](size_t i) -> const RTCRay & {
+        return *reinterpret_cast<const RTCRay *>(reinterpret_cast<const uint8_t *>(rays) + (i * stride));
+    };
+
+    // origins are quantized relative to the batch's bounds
+    qvec3f mins{std::numeric_limits<float>::max()}, maxs{std::numeric_limits<float>::lowest()};
+
+    for (size_t i = 0; i < count; i++) {
+        const RTCRay &ray = ray_at(i);
+        const qvec3f org{ray.org_x, ray.org_y, ray.org_z};
+        mins = qv::min(mins, org);
+        maxs = qv::max(maxs, org);
+    }
+
+    qvec3f inv_extent;
+    for (int axis = 0; axis < 3; axis++) {
+        inv_extent[axis] = (maxs[axis] > mins[axis]) ? 1.0f / (maxs[axis] - mins[axis]) : 0.0f;
+    }
+
+    order.resize(count);
+
+    for (size_t i = 0; i < count; i++) {
+        const RTCRay &ray = ray_at(i);
+        const qvec3f org{ray.org_x, ray.org_y, ray.org_z};
+        const qvec3f dir = qv::normalize(qvec3f{ray.dir_x, ray.dir_y, ray.dir_z});
+
+        uint64_t octant = 0;
+        uint64_t morton = 0;
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (dir[axis] < 0) {
+                octant |= 1 << axis;
+            }
+
+            // interleave as dir x, org x, dir y, org y, ... so direction is the most significant
+            const uint32_t qdir = QuantizeUnit10((dir[axis] + 1.0f) * 0.5f);
+            const uint32_t qorg = QuantizeUnit10((org[axis] - mins[axis]) * inv_extent[axis]);
+
+            morton |= SpreadBits10By6(qdir) << (5 - (axis * 2));
+            morton |= SpreadBits10By6(qorg) << (4 - (axis * 2));
+        }
+
+        order[i] = {(octant << 60) | morton, static_cast<uint32_t>(i)};
+    }
+
+    std::sort(order.begin(), order.end());
+}
@@ -0,0 +1,326 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+See file, 'COPYING', for details.
+*/
+
+
+#include <maputil/batch.hh>
+#include <maputil/maputil.hh>
+#include <maputil/lua_map.hh>
+
+#include <common/log.hh>
+#include <common/mapfile.hh>
+#include <common/parser.hh>
+
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
+#ifdef USE_LUA
+extern "C"
+{
+    #include <lua.h>
+    #include <lualib.h>
+    #include <lauxlib.h>
+}
+#endif
+
+// * matches any run of characters, ? any single character
+static bool MatchWildcard(std::string_view pattern, std::string_view name)
+{
+    size_t p = 0, n = 0;
+    // where to resume after a mismatch: just past the last *, one character further into name
+    size_t star = std::string_view::npos, star_n = 0;
+
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            p++;
+            n++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            star_n = n;
+        } else if (star != std::string_view::npos) {
+            p = star + 1;
+            n = ++star_n;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+
+    return p == pattern.size();
+}
+
+struct batch_pattern_t
+{
+    fs::path base;
+    bool recursive = false;
+    std::string name;
+};
+
+static batch_pattern_t ParseBatchPattern(const std::string &pattern)
+{
+    batch_pattern_t result;
+    const fs::path path(pattern);
+    fs::path dir = path.parent_path();
+
+    result.name = path.filename().string();
+
+    if (dir.filename() == "**") {
+        result.recursive = true;
+        dir = dir.parent_path();
+    }
+
+    if (dir.string().find_first_of("*?") != std::string::npos) {
+        FError("only the file name and a final ** directory may contain wildcards: {}", pattern);
+    }
+
+    result.base = dir.empty() ? fs::path(".") : dir;
+
+    if (!fs::is_directory(result.base)) {
+        FError("{} isn't a directory", result.base);
+    }
+
+    return result;
+}
+
+static std::vector<fs::path> FindBatchFiles(const batch_pattern_t &pattern)
+{
+    std::vector<fs::path> result;
+
+    auto consider = [&](const fs::directory_entry &entry) {
+        if (entry.is_regular_file() && MatchWildcard(pattern.name, entry.path().filename().string())) {
+            result.push_back(entry.path());
+        }
+    };
+
+    if (pattern.recursive) {
+        for (auto &entry : fs::recursive_directory_iterator(pattern.base)) {
+            consider(entry);
+        }
+    } else {
+        for (auto &entry : fs::directory_iterator(pattern.base)) {
+            consider(entry);
+        }
+    }
+
+    // directory order is unspecified; keep the report stable
+    std::sort(result.begin(), result.end());
+
+    return result;
+}
+
+static map_file_t LoadBatchFile(const fs::path &path)
+{
+    auto file = fs::load(path);
+
+    if (!file) {
+        FError("can't load {}", path);
+    }
+
+    parser_t parser(file, {path.string()});
+
+    map_file_t map;
+    map.parse(parser);
+
+    return map;
+}
+
+static void WriteMapAtomically(map_file_t &map, const fs::path &dest)
+{
+    if (dest.has_parent_path()) {
+        fs::create_directories(dest.parent_path());
+    }
+
+    fs::path temp = dest;
+    temp += ".tmp";
+
+    {
+        std::ofstream stream(temp);
+        map.write(stream);
+
+        if (!stream) {
+            FError("can't write {}", temp);
+        }
+    }
+
+    // rename replaces dest in one step, so an interrupted batch never leaves a half-written map
+    fs::rename(temp, dest);
+}
+
+#ifdef USE_LUA
+// one Lua state per thread; the script is compiled once per state and run once per file
+struct batch_worker_t
+{
+    lua_State *state = nullptr;
+    int script = LUA_NOREF;
+    lua_map_ref_t ref;
+
+    batch_worker_t() = default;
+    batch_worker_t(const batch_worker_t &) = delete;
+
+    ~batch_worker_t()
+    {
+        if (state) {
+            lua_close(state);
+        }
+    }
+
+    void init(const fs::path &path)
+    {
+        state = luaL_newstate();
+        luaL_openlibs(state);
+        maputil_setup_functions(state);
+
+        if (luaL_loadfile(state, path.string().c_str()) != LUA_OK) {
+            std::string error = lua_tostring(state, -1);
+            FError("can't load script: {}", error);
+        }
+
+        script = luaL_ref(state, LUA_REGISTRYINDEX);
+    }
+};
+
+static int batch_traceback(lua_State *state)
+{
+    luaL_traceback(state, state, lua_tostring(state, 1), 1);
+    return 1;
+}
+
+// runs the script on the map `worker.ref` points at; returns the error, if it failed
+static std::optional<std::string> RunBatchScript(batch_worker_t &worker, const fs::path &path)
+{
+    lua_State *state = worker.state;
+
+    lua_pushcfunction(state, batch_traceback);
+    lua_rawgeti(state, LUA_REGISTRYINDEX, worker.script);
+
+    // run each file with its own _ENV, so globals the script sets don't leak into the
+    // next file; everything else still comes from the real globals
+    lua_createtable(state, 0, 2);
+    maputil_push_map(state, &worker.ref);
+    lua_setfield(state, -2, "map");
+    lua_pushstring(state, path.string().c_str());
+    lua_setfield(state, -2, "map_path");
+
+    lua_createtable(state, 0, 1);
+    lua_pushglobaltable(state);
+    lua_setfield(state, -2, "__index");
+    lua_setmetatable(state, -2);
+
+    // a main chunk's only upvalue is its _ENV
+    lua_setupvalue(state, -2, 1);
+
+    std::optional<std::string> error;
+
+    if (lua_pcall(state, 0, 0, -2) != LUA_OK) {
+        error = lua_tostring(state, -1);
+    }
+
+    lua_settop(state, 0);
+
+    return error;
+}
+#endif
+
+enum class batch_status_t
+{
+    unchanged,
+    written,
+    failed
+};
+
+struct batch_file_result_t
+{
+    batch_status_t status = batch_status_t::unchanged;
+    std::string error;
+};
+
+size_t maputil_batch(const maputil_batch_options_t &options)
+{
+#ifdef USE_LUA
+    const batch_pattern_t pattern = ParseBatchPattern(options.pattern);
+    const std::vector<fs::path> files = FindBatchFiles(pattern);
+
+    logging::print("running {} on {} files matching {}\n", options.script, files.size(), options.pattern);
+
+    // catch script syntax errors once, up front
+    batch_worker_t().init(options.script);
+
+    tbb::enumerable_thread_specific<batch_worker_t> workers;
+    std::vector<batch_file_result_t> results(files.size());
+
+    tbb::parallel_for(static_cast<size_t>(0), files.size(), [&](size_t i) {
+        batch_worker_t &worker = workers.local();
+        batch_file_result_t &result = results[i];
+
+        try {
+            if (!worker.state) {
+                worker.init(options.script);
+            }
+
+            map_file_t map = LoadBatchFile(files[i]);
+
+            worker.ref.reset(&map);
+
+            if (auto error = RunBatchScript(worker, files[i])) {
+                result.status = batch_status_t::failed;
+                result.error = std::move(*error);
+            } else if (worker.ref.dirty) {
+                if (options.output_dir.empty()) {
+                    WriteMapAtomically(map, files[i]);
+                } else {
+                    WriteMapAtomically(map, options.output_dir / files[i].lexically_relative(pattern.base));
+                }
+
+                result.status = batch_status_t::written;
+            }
+        } catch (const std::exception &e) {
+            result.status = batch_status_t::failed;
+            result.error = e.what();
+        }
+
+        worker.ref.reset(nullptr);
+    });
+
+    size_t num_written = 0, num_failed = 0;
+
+    for (size_t i = 0; i < files.size(); i++) {
+        if (results[i].status == batch_status_t::written) {
+            num_written++;
+        } else if (results[i].status == batch_status_t::failed) {
+            num_failed++;
+            logging::print("{}: {}\n", files[i], results[i].error);
+        }
+    }
+
+    logging::print("{} changed, {} unchanged, {} failed\n", num_written, files.size() - num_written - num_failed,
+        num_failed);
+
+    return num_failed;
+#else
+    FError("maputil not compiled with Lua support");
+#endif
+}
@@ -0,0 +1,521 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+See file, 'COPYING', for details.
+*/
+
+
+#ifdef USE_LUA
+
+#include <maputil/lua_map.hh>
+
+#include <common/mapfile.hh>
+#include <common/polylib.hh>
+
+extern "C"
+{
+    #include <lua.h>
+    #include <lualib.h>
+    #include <lauxlib.h>
+}
+
+/*
+* Lua userdata layout (indices are 1-based):
+* map = handle
+*  #map = number of entities
+*  map[E] = entity handle, or nil
+*  map:add_entity() = new entity handle
+*  map:remove_entity(E)
+* entity = handle
+*  entity:get(key) = string or nil
+*  entity:set(key, value) (nil value removes the key)
+*  entity:keys() = array of keys, in file order
+*  entity:num_brushes() = number
+*  entity:brush(B) = brush handle, or nil
+*  entity:add_brush(brush) = handle to a copy of brush, added to this entity
+*  entity:remove_brush(B)
+* brush = handle
+*  #brush = number of sides
+*  brush[S] = side handle, or nil
+* side = handle
+*  side.texture = string
+*  side.info = table or nil (.contents, .value, .flags)
+*  side.plane = [ x, y, z, d ] (read-only)
+*  side.plane_points = [ [ x, y, z ] [ x, y, z ] [ x, y, z ] ] (read-only)
+*  side:winding(extents) = [ [ x, y, z ] ... ] or nil
+*
+* Each handle only holds indices, so these functions must not keep
+* anything with a destructor alive across a Lua error. Removing an entity
+* or brush makes the handles whose index may have shifted stale.
+*/
+
+void lua_map_ref_t::reset(map_file_t *new_map)
+{
+    map = new_map;
+    serial++;
+    entities_generation = 0;
+    brushes_generation.assign(new_map ? new_map->entities.size() : 0, 0);
+    dirty = false;
+}
+
+void lua_map_ref_t::entities_replaced()
+{
+    entities_generation++;
+    brushes_generation.assign(map ? map->entities.size() : 0, 0);
+}
+
+struct lua_map_handle_t
+{
+    lua_map_ref_t *ref;
+    uint64_t serial;
+    // the ref's generations when the handle was made
+    uint64_t entities_generation, brushes_generation;
+    size_t entity, brush, side;
+};
+
+static constexpr const char *MAP_TYPE = "maputil.map";
+static constexpr const char *ENTITY_TYPE = "maputil.entity";
+static constexpr const char *BRUSH_TYPE = "maputil.brush";
+static constexpr const char *SIDE_TYPE = "maputil.side";
+
+static void push_handle(
+    lua_State *state, const char *type, lua_map_ref_t *ref, size_t entity = 0, size_t brush = 0, size_t side = 0)
+{
+    auto *handle = static_cast<lua_map_handle_t *>(lua_newuserdatauv(state, sizeof(lua_map_handle_t), 0));
+    const uint64_t brushes_generation = entity < ref->brushes_generation.size() ? ref->brushes_generation[entity] : 0;
+    *handle = {ref, ref->serial, ref->entities_generation, brushes_generation, entity, brush, side};
+    luaL_setmetatable(state, type);
+}
+
+static lua_map_handle_t &check_handle(lua_State *state, int index, const char *type)
+{
+    auto *handle = static_cast<lua_map_handle_t *>(luaL_checkudata(state, index, type));
+
+    if (!handle->ref->map || handle->serial != handle->ref->serial) {
+        luaL_error(state, "%s handle used after its map was closed", type);
+    }
+
+    return *handle;
+}
+
+// 1-based Lua index at `arg` to a 0-based index below `count`, or `count` if it's out of range
+static size_t check_index(lua_State *state, int arg, size_t count)
+{
+    const lua_Integer index = luaL_checkinteger(state, arg);
+
+    if (index < 1 || static_cast<size_t>(index) > count) {
+        return count;
+    }
+
+    return static_cast<size_t>(index - 1);
+}
+
+// the entity an entity, brush or side handle belongs to
+static map_entity_t &handle_entity(lua_State *state, const lua_map_handle_t &handle, const char *type)
+{
+    if (handle.entities_generation != handle.ref->entities_generation) {
+        luaL_error(state, "%s handle is stale: an entity was removed after it was made", type);
+    }
+
+    return handle.ref->map->entities[handle.entity];
+}
+
+static map_entity_t &check_entity(lua_State *state, int index)
+{
+    return handle_entity(state, check_handle(state, index, ENTITY_TYPE), ENTITY_TYPE);
+}
+
+static brush_t &check_brush(lua_State *state, int index, const char *type)
+{
+    lua_map_handle_t &handle = check_handle(state, index, type);
+    map_entity_t &entity = handle_entity(state, handle, type);
+
+    if (handle.brushes_generation != handle.ref->brushes_generation[handle.entity]) {
+        luaL_error(state, "%s handle is stale: a brush of entity %d was removed after it was made", type,
+            static_cast<int>(handle.entity + 1));
+    }
+
+    return entity.brushes[handle.brush];
+}
+
+static brush_side_t &check_side(lua_State *state, int index)
+{
+    brush_t &brush = check_brush(state, index, SIDE_TYPE);
+    lua_map_handle_t &handle = check_handle(state, index, SIDE_TYPE);
+
+    if (handle.side >= brush.faces.size()) {
+        luaL_error(state, "side %d was removed", static_cast<int>(handle.side + 1));
+    }
+
+    return brush.faces[handle.side];
+}
+
+// methods are kept in the metatable; look `key` up there
+static int index_method(lua_State *state)
+{
+    lua_getmetatable(state, 1);
+    lua_pushvalue(state, 2);
+    lua_rawget(state, -2);
+    return 1;
+}
+
+// MARK: - map
+
+static int l_map_len(lua_State *state)
+{
+    lua_map_handle_t &handle = check_handle(state, 1, MAP_TYPE);
+    lua_pushinteger(state, handle.ref->map->entities.size());
+    return 1;
+}
+
+static int l_map_index(lua_State *state)
+{
+    if (lua_type(state, 2) != LUA_TNUMBER) {
+        return index_method(state);
+    }
+
+    lua_map_handle_t &handle = check_handle(state, 1, MAP_TYPE);
+    const size_t count = handle.ref->map->entities.size();
+    const size_t entity = check_index(state, 2, count);
+
+    if (entity == count) {
+        lua_pushnil(state);
+    } else {
+        push_handle(state, ENTITY_TYPE, handle.ref, entity);
+    }
+
+    return 1;
+}
+
+static int l_map_add_entity(lua_State *state)
+{
+    lua_map_handle_t &handle = check_handle(state, 1, MAP_TYPE);
+    auto &entities = handle.ref->map->entities;
+
+    entities.emplace_back();
+    handle.ref->brushes_generation.push_back(0);
+    handle.ref->dirty = true;
+
+    push_handle(state, ENTITY_TYPE, handle.ref, entities.size() - 1);
+    return 1;
+}
+
+static int l_map_remove_entity(lua_State *state)
+{
+    lua_map_handle_t &handle = check_handle(state, 1, MAP_TYPE);
+    auto &entities = handle.ref->map->entities;
+    const size_t entity = check_index(state, 2, entities.size());
+
+    if (entity == entities.size()) {
+        return luaL_argerror(state, 2, "no such entity");
+    }
+
+    entities.erase(entities.begin() + entity);
+    handle.ref->brushes_generation.erase(handle.ref->brushes_generation.begin() + entity);
+    handle.ref->entities_generation++;
+    handle.ref->dirty = true;
+    return 0;
+}
+
+// MARK: - entity
+
+static int l_entity_get(lua_State *state)
+{
+    map_entity_t &entity = check_entity(state, 1);
+    const char *key = luaL_checkstring(state, 2);
+
+    if (auto it = entity.epairs.find(key); it != entity.epairs.end()) {
+        lua_pushlstring(state, it->second.data(), it->second.size());
+    } else {
+        lua_pushnil(state);
+    }
+
+    return 1;
+}
+
+static int l_entity_set(lua_State *state)
+{
+    map_entity_t &entity = check_entity(state, 1);
+    lua_map_handle_t &handle = check_handle(state, 1, ENTITY_TYPE);
+    const char *key = luaL_checkstring(state, 2);
+
+    if (lua_isnoneornil(state, 3)) {
+        entity.epairs.remove(key);
+    } else {
+        entity.epairs.set(key, luaL_checkstring(state, 3));
+    }
+
+    handle.ref->dirty = true;
+    return 0;
+}
+
+static int l_entity_keys(lua_State *state)
+{
+    map_entity_t &entity = check_entity(state, 1);
+
+    lua_createtable(state, entity.epairs.size(), 0);
+
+    lua_Integer i = 1;
+
+    for (auto &[key, value] : entity.epairs) {
+        lua_pushlstring(state, key.data(), key.size());
+        lua_rawseti(state, -2, i++);
+    }
+
+    return 1;
+}
+
+static int l_entity_num_brushes(lua_State *state)
+{
+    lua_pushinteger(state, check_entity(state, 1).brushes.size());
+    return 1;
+}
+
+static int l_entity_brush(lua_State *state)
+{
+    map_entity_t &entity = check_entity(state, 1);
+    lua_map_handle_t &handle = check_handle(state, 1, ENTITY_TYPE);
+    const size_t brush = check_index(state, 2, entity.brushes.size());
+
+    if (brush == entity.brushes.size()) {
+        lua_pushnil(state);
+    } else {
+        push_handle(state, BRUSH_TYPE, handle.ref, handle.entity, brush);
+    }
+
+    return 1;
+}
+
+static int l_entity_add_brush(lua_State *state)
+{
+    map_entity_t &entity = check_entity(state, 1);
+    lua_map_handle_t &handle = check_handle(state, 1, ENTITY_TYPE);
+    const brush_t &brush = check_brush(state, 2, BRUSH_TYPE);
+
+    // push_back copes with brush being one of entity's own brushes
+    entity.brushes.push_back(brush);
+    handle.ref->dirty = true;
+
+    push_handle(state, BRUSH_TYPE, handle.ref, handle.entity, entity.brushes.size() - 1);
+    return 1;
+}
+
+static int l_entity_remove_brush(lua_State *state)
+{
+    map_entity_t &entity = check_entity(state, 1);
+    lua_map_handle_t &handle = check_handle(state, 1, ENTITY_TYPE);
+    const size_t brush = check_index(state, 2, entity.brushes.size());
+
+    if (brush == entity.brushes.size()) {
+        return luaL_argerror(state, 2, "no such brush");
+    }
+
+    entity.brushes.erase(entity.brushes.begin() + brush);
+    handle.ref->brushes_generation[handle.entity]++;
+    handle.ref->dirty = true;
+    return 0;
+}
+
+// MARK: - brush
+
+static int l_brush_len(lua_State *state)
+{
+    lua_pushinteger(state, check_brush(state, 1, BRUSH_TYPE).faces.size());
+    return 1;
+}
+
+static int l_brush_index(lua_State *state)
+{
+    brush_t &brush = check_brush(state, 1, BRUSH_TYPE);
+    lua_map_handle_t &handle = check_handle(state, 1, BRUSH_TYPE);
+    const size_t side = check_index(state, 2, brush.faces.size());
+
+    if (side == brush.faces.size()) {
+        lua_pushnil(state);
+    } else {
+        push_handle(state, SIDE_TYPE, handle.ref, handle.entity, handle.brush, side);
+    }
+
+    return 1;
+}
+
+// MARK: - side
+
+template<typename T>
+static void push_numbers(lua_State *state, const T &values, size_t count)
+{
+    lua_createtable(state, count, 0);
+
+    for (size_t i = 0; i < count; i++) {
+        lua_pushnumber(state, values[i]);
+        lua_rawseti(state, -2, i + 1);
+    }
+}
+
+static int l_side_winding(lua_State *state)
+{
+    brush_t &brush = check_brush(state, 1, SIDE_TYPE);
+    brush_side_t &side = check_side(state, 1);
+    const vec_t extents = luaL_checknumber(state, 2);
+
+    using winding_t = polylib::winding_base_t<polylib::winding_storage_hybrid_t<16>>;
+    std::optional<winding_t> winding = winding_t::from_plane(side.plane, extents);
+
+    for (auto &other : brush.faces) {
+        if (&other != &side && winding) {
+            winding = winding->clip_front(-other.plane, 0.0f);
+        }
+    }
+
+    if (!winding) {
+        lua_pushnil(state);
+        return 1;
+    }
+
+    lua_createtable(state, winding->size(), 0);
+
+    for (size_t i = 0; i < winding->size(); i++) {
+        push_numbers(state, winding->at(i), 3);
+        lua_rawseti(state, -2, i + 1);
+    }
+
+    return 1;
+}
+
+static int l_side_index(lua_State *state)
+{
+    brush_side_t &side = check_side(state, 1);
+    const char *key = luaL_checkstring(state, 2);
+
+    if (!strcmp(key, "texture")) {
+        lua_pushlstring(state, side.texture.data(), side.texture.size());
+    } else if (!strcmp(key, "info")) {
+        if (!side.extended_info) {
+            lua_pushnil(state);
+        } else {
+            lua_createtable(state, 0, 3);
+            lua_pushnumber(state, side.extended_info->contents.native);
+            lua_setfield(state, -2, "contents");
+            lua_pushnumber(state, side.extended_info->value);
+            lua_setfield(state, -2, "value");
+            lua_pushnumber(state, side.extended_info->flags.native);
+            lua_setfield(state, -2, "flags");
+        }
+    } else if (!strcmp(key, "plane")) {
+        push_numbers(state, side.plane.normal, 3);
+        lua_pushnumber(state, side.plane.dist);
+        lua_rawseti(state, -2, 4);
+    } else if (!strcmp(key, "plane_points")) {
+        lua_createtable(state, 3, 0);
+
+        for (size_t i = 0; i < 3; i++) {
+            push_numbers(state, side.planepts[i], 3);
+            lua_rawseti(state, -2, i + 1);
+        }
+    } else {
+        return index_method(state);
+    }
+
+    return 1;
+}
+
+static int l_side_newindex(lua_State *state)
+{
+    brush_side_t &side = check_side(state, 1);
+    lua_map_handle_t &handle = check_handle(state, 1, SIDE_TYPE);
+    const char *key = luaL_checkstring(state, 2);
+
+    if (!strcmp(key, "texture")) {
+        side.texture = luaL_checkstring(state, 3);
+    } else if (!strcmp(key, "info")) {
+        if (lua_isnoneornil(state, 3)) {
+            side.extended_info = std::nullopt;
+        } else {
+            luaL_checktype(state, 3, LUA_TTABLE);
+
+            texinfo_quake2_t info{};
+
+            lua_getfield(state, 3, "contents");
+            info.contents.native = lua_tointeger(state, -1);
+            lua_getfield(state, 3, "value");
+            info.value = lua_tointeger(state, -1);
+            lua_getfield(state, 3, "flags");
+            info.flags.native = lua_tointeger(state, -1);
+            lua_pop(state, 3);
+
+            side.extended_info = info;
+        }
+    } else {
+        return luaL_error(state, "side.%s can't be set", key);
+    }
+
+    handle.ref->dirty = true;
+    return 0;
+}
+
+// MARK: -
+
+static void register_type(lua_State *state, const char *type, const luaL_Reg *functions)
+{
+    luaL_newmetatable(state, type);
+    luaL_setfuncs(state, functions, 0);
+    lua_pop(state, 1);
+}
+
+void maputil_register_map_types(lua_State *state)
+{
+    static constexpr luaL_Reg map_functions[] = {
+        {"__len", l_map_len},
+        {"__index", l_map_index},
+        {"add_entity", l_map_add_entity},
+        {"remove_entity", l_map_remove_entity},
+        {nullptr, nullptr},
+    };
+    static constexpr luaL_Reg entity_functions[] = {
+        {"__index", index_method},
+        {"get", l_entity_get},
+        {"set", l_entity_set},
+        {"keys", l_entity_keys},
+        {"num_brushes", l_entity_num_brushes},
+        {"brush", l_entity_brush},
+        {"add_brush", l_entity_add_brush},
+        {"remove_brush", l_entity_remove_brush},
+        {nullptr, nullptr},
+    };
+    static constexpr luaL_Reg brush_functions[] = {
+        {"__len", l_brush_len},
+        {"__index", l_brush_index},
+        {nullptr, nullptr},
+    };
+    static constexpr luaL_Reg side_functions[] = {
+        {"__index", l_side_index},
+        {"__newindex", l_side_newindex},
+        {"winding", l_side_winding},
+        {nullptr, nullptr},
+    };
+
+    register_type(state, MAP_TYPE, map_functions);
+    register_type(state, ENTITY_TYPE, entity_functions);
+    register_type(state, BRUSH_TYPE, brush_functions);
+    register_type(state, SIDE_TYPE, side_functions);
+}
+
+void maputil_push_map(lua_State *state, lua_map_ref_t *ref)
+{
+    push_handle(state, MAP_TYPE, ref);
+}
+
+#endif
@@ -18,6 +18,11 @@ See file, 'COPYING', for details.
 */
 
 #include <cstdint>
+#include <fstream>
+
+#include <maputil/maputil.hh>
+#include <maputil/batch.hh>
+#include <maputil/lua_map.hh>
 
 #include <common/entdata.h>
 #include <common/parser.hh>
@@ -42,7 +47,7 @@ map_file_t map_file;
 const gamedef_t *current_game = nullptr;
 settings::common_settings common_options;
 
-map_file_t LoadMapOrEntFile(const fs::path &source)
+static map_file_t LoadMapOrEntFile(const fs::path &source)
 {
     logging::funcheader();
 
@@ -62,7 +67,8 @@ map_file_t LoadMapOrEntFile(const fs::path &source)
 }
 
 constexpr const char *usage = R"(
-usage: maputil [operations...]
+usage: maputil <map file> [operations...]
+       maputil --batch "<pattern>" --script "<path to Lua script file>" [--output-dir "<dir>"]
 
 --script "<path to Lua script file>"
   execute the given Lua script.
@@ -81,6 +87,14 @@ valid operations:
 --game <quake | quake2 | hexen2 | halflife>
   set the current game; used for certain conversions
   or operations.
+
+batch mode:
+--batch "<pattern>"
+  run --script on every .map/.ent file matching the pattern
+  (e.g. "maps/*.map", or "maps/**/*.ent" to include subdirectories),
+  in parallel, and save the ones it changed in place.
+--output-dir "<dir>"
+  save changed files under this directory instead.
 )";
 
 #ifdef USE_LUA
@@ -591,10 +605,11 @@ static void maputil_copy_brushes(lua_State *state, map_entity_t &entity)
     lua_pop(state, 1);
 }
 
+// handles to the global map
+static lua_map_ref_t map_file_ref;
+
 static int l_commit_map(lua_State *state)
 {
-    map_file.entities.clear();
-
     // verify entities global
     lua_getglobal(state, "entities");
 
@@ -604,7 +619,10 @@ static int l_commit_map(lua_State *state)
     size_t num_entities = lua_count_array(state);
 
     // create entities
+    map_file.entities.clear();
     map_file.entities.resize(num_entities);
+    // the old entities are gone, so are any handles to them
+    map_file_ref.entities_replaced();
 
     for (size_t i = 0; i < num_entities; i++) {
         auto &entity = map_file.entities[i];
@@ -730,14 +748,11 @@ static int l_load_texture_meta(lua_State *state)
     return 1;
 }
 
-static void maputil_setup_globals(lua_State *state)
+void maputil_setup_functions(lua_State *state)
 {
     lua_pushcfunction(state, l_load_json);
     lua_setglobal(state, "load_json");
 
-    lua_pushcfunction(state, l_commit_map);
-    lua_setglobal(state, "commit_map");
-
     lua_pushcfunction(state, l_create_winding);
     lua_setglobal(state, "create_winding");
 
@@ -754,6 +769,22 @@ static void maputil_setup_globals(lua_State *state)
     lua_pushnumber(state, (int32_t) texcoord_style_t::brush_primitives);
     lua_setglobal(state, "TEXCOORD_BP");
 
+    maputil_register_map_types(state);
+}
+
+static void maputil_setup_globals(lua_State *state)
+{
+    maputil_setup_functions(state);
+
+    lua_pushcfunction(state, l_commit_map);
+    lua_setglobal(state, "commit_map");
+
+    // the map is available both through handles and as tables;
+    // edits to the tables only take effect after commit_map()
+    map_file_ref.reset(&map_file);
+    maputil_push_map(state, &map_file_ref);
+    lua_setglobal(state, "map");
+
     // convert map to a Lua representation.
     lua_createtable(state, map_file.entities.size(), 0);
     
@@ -929,6 +960,30 @@ int maputil_main(int argc, char **argv)
         exit(1);
     }
 
+    if (!strcmp(argv[1], "--batch")) {
+        maputil_batch_options_t options;
+
+        for (int32_t i = 1; i < argc; i++) {
+            if (i + 1 >= argc) {
+                FError("{} requires an argument", argv[i]);
+            } else if (!strcmp(argv[i], "--batch")) {
+                options.pattern = argv[++i];
+            } else if (!strcmp(argv[i], "--script")) {
+                options.script = argv[++i];
+            } else if (!strcmp(argv[i], "--output-dir")) {
+                options.output_dir = argv[++i];
+            } else {
+                FError("unknown batch option {}", argv[i]);
+            }
+        }
+
+        if (options.script.empty()) {
+            FError("--batch requires --script");
+        }
+
+        return maputil_batch(options) ? 1 : 0;
+    }
+
     fs::path source = argv[1];
 
     if (!fs::exists(source)) {
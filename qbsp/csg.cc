@@ -230,7 +230,7 @@ static void ClipInside(
         bool spurious_onplane = false;
         {
             std::array<size_t, SIDE_TOTAL> counts =
-                face.w.calc_sides(splitplane, nullptr, nullptr, qbsp_options.epsilon.value());
+                face.w.calc_sides(splitplane, nullptr, qbsp_options.epsilon.value());
 
             if (counts[SIDE_ON] && !counts[SIDE_FRONT] && !counts[SIDE_BACK]) {
                 spurious_onplane = true;
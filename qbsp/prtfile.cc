@@ -29,6 +29,8 @@
 #include <qbsp/tree.hh>
 
 #include <fstream>
+#include <map>
+#include <queue>
 
 /*
 ==============================================================================
@@ -82,6 +84,10 @@ static void WritePortals_r(node_t *node, std::ofstream &portalFile, bool cluster
                 back_contents.to_string(qbsp_options.target_game), w->center());
         }
 
+        // both sides were merged into the same cluster by MergeClusters
+        if (clusters && front == back)
+            continue;
+
         /*
          * sometimes planes get turned around when they are very near the
          * changeover point between different axis.  interpret the plane the
@@ -135,6 +141,7 @@ struct portal_state_t : logging::stat_tracker_t
     stat &num_visleafs = register_stat("player-occupiable leaves");
     stat &num_visclusters = register_stat("clusters of leaves");
     stat &num_visportals = register_stat("vis portals");
+    stat &num_mergedclusters = register_stat("clusters merged to reach -clustertarget");
     bool uses_detail;
 };
 
@@ -192,6 +199,253 @@ static void NumberLeafs_r(node_t *node, portal_state_t &state, int cluster)
     CountPortals(node, state);
 }
 
+/*
+==============================================================================
+
+CLUSTER MERGING
+
+==============================================================================
+*/
+
+struct cluster_link_t
+{
+    vec_t area = 0; // total area of the portals between the two clusters
+    int count = 0;
+};
+
+struct merge_cluster_t
+{
+    int parent;
+    int stamp = 0; // bumped on every merge, to spot stale queue entries
+    vec_t volume = 0;
+    vec_t openarea = 0; // total area of all of the cluster's portals
+    bool mergeable = true;
+    std::optional<int32_t> area; // Q2 area
+    std::map<int, cluster_link_t> links; // keyed by neighbouring cluster
+};
+
+struct cluster_edge_t
+{
+    int front, back;
+    vec_t area;
+};
+
+static void GatherClusterLeafs_r(const node_t *node, merge_cluster_t &cluster)
+{
+    if (!node->is_leaf) {
+        GatherClusterLeafs_r(node->children[0], cluster);
+        GatherClusterLeafs_r(node->children[1], cluster);
+        return;
+    }
+    if (node->contents.is_any_solid(qbsp_options.target_game))
+        return;
+
+    cluster.volume += node->bounds.volume();
+
+    // areaportals have to stay their own clusters, and clusters can't
+    // span areas
+    if (node->contents.native & Q2_CONTENTS_AREAPORTAL) {
+        cluster.mergeable = false;
+    } else if (!cluster.area) {
+        cluster.area = node->area;
+    } else if (*cluster.area != node->area) {
+        cluster.mergeable = false;
+    }
+}
+
+static void GatherClusters_r(
+    const node_t *node, std::vector<merge_cluster_t> &clusters, std::vector<cluster_edge_t> &edges)
+{
+    if (!node->is_leaf && !node->detail_separator) {
+        GatherClusters_r(node->children[0], clusters, edges);
+        GatherClusters_r(node->children[1], clusters, edges);
+        return;
+    }
+    // at this point, `node` may be a leaf or a cluster
+    if (node->is_leaf && node->contents.is_any_solid(qbsp_options.target_game))
+        return;
+
+    GatherClusterLeafs_r(node, clusters[node->viscluster]);
+
+    const portal_t *p, *next;
+    for (p = node->portals; p; p = next) {
+        next = (p->nodes[0] == node) ? p->next[0] : p->next[1];
+        if (!p->winding || p->nodes[0] != node)
+            continue;
+        if (!Portal_VisFlood(p))
+            continue;
+
+        edges.push_back({p->nodes[0]->viscluster, p->nodes[1]->viscluster, p->winding.area()});
+    }
+}
+
+static void RemapClusters_r(node_t *node, const std::vector<int> &remap)
+{
+    if (node->viscluster >= 0)
+        node->viscluster = remap[node->viscluster];
+
+    if (!node->is_leaf) {
+        RemapClusters_r(node->children[0], remap);
+        RemapClusters_r(node->children[1], remap);
+    }
+}
+
+static int FindCluster(std::vector<merge_cluster_t> &clusters, int i)
+{
+    while (clusters[i].parent != i) {
+        clusters[i].parent = clusters[clusters[i].parent].parent;
+        i = clusters[i].parent;
+    }
+    return i;
+}
+
+/*
+ * Estimated cost of merging two neighbouring clusters; the cheapest pair is
+ * merged first.
+ *
+ * Every leaf in the merged cluster sees everything either half saw, so small
+ * clusters cost the least. The PVS loss is guessed from how much of the
+ * smaller cluster's portal area leads into the other one: a cluster that is
+ * mostly open to its neighbour already sees what the neighbour sees. Each
+ * portal between them also disappears from the .prt, which is what vis time
+ * scales with.
+ */
+static vec_t ClusterMergeCost(const merge_cluster_t &a, const merge_cluster_t &b, const cluster_link_t &link)
+{
+    const vec_t open = std::min(a.openarea, b.openarea);
+    const vec_t loss = open > 0 ? std::clamp(1.0 - link.area / open, 0.0, 1.0) : 1.0;
+
+    return (a.volume + b.volume) * (1.0 + 3.0 * loss) / (1.0 + link.count);
+}
+
+/*
+================
+MergeClusters
+
+Greedily merges neighbouring clusters, cheapest first, until there are at
+most `target` of them, then renumbers the clusters in tree order.
+================
+*/
+static void MergeClusters(node_t *headnode, portal_state_t &state, int target)
+{
+    const int numclusters = state.num_visclusters.count.load();
+
+    std::vector<merge_cluster_t> clusters(numclusters);
+    std::vector<cluster_edge_t> edges;
+
+    for (int i = 0; i < numclusters; i++) {
+        clusters[i].parent = i;
+    }
+
+    GatherClusters_r(headnode, clusters, edges);
+
+    for (const cluster_edge_t &edge : edges) {
+        for (auto [a, b] : {std::pair{edge.front, edge.back}, std::pair{edge.back, edge.front}}) {
+            cluster_link_t &link = clusters[a].links[b];
+            link.area += edge.area;
+            link.count++;
+            clusters[a].openarea += edge.area;
+        }
+    }
+
+    struct merge_t
+    {
+        vec_t cost;
+        int a, b;
+        int stamp_a, stamp_b;
+
+        bool operator>(const merge_t &other) const
+        {
+            return std::tie(cost, a, b) > std::tie(other.cost, other.a, other.b);
+        }
+    };
+
+    std::priority_queue<merge_t, std::vector<merge_t>, std::greater<>> queue;
+
+    auto push_merge = [&](int a, int b) {
+        const merge_cluster_t &ca = clusters[a], &cb = clusters[b];
+        if (!ca.mergeable || !cb.mergeable || ca.area != cb.area)
+            return;
+        queue.push({ClusterMergeCost(ca, cb, ca.links.at(b)), a, b, ca.stamp, cb.stamp});
+    };
+
+    for (int a = 0; a < numclusters; a++) {
+        for (auto &[b, link] : clusters[a].links) {
+            if (a < b)
+                push_merge(a, b);
+        }
+    }
+
+    int remaining = numclusters;
+
+    while (remaining > target && !queue.empty()) {
+        const merge_t merge = queue.top();
+        queue.pop();
+
+        if (clusters[merge.a].parent != merge.a || clusters[merge.b].parent != merge.b ||
+            clusters[merge.a].stamp != merge.stamp_a || clusters[merge.b].stamp != merge.stamp_b)
+            continue;
+
+        // keep the one with more neighbours, so fewer links move
+        int keep = merge.a, drop = merge.b;
+        if (clusters[drop].links.size() > clusters[keep].links.size())
+            std::swap(keep, drop);
+
+        merge_cluster_t &k = clusters[keep], &d = clusters[drop];
+        const cluster_link_t shared = k.links.at(drop);
+
+        d.parent = keep;
+        k.volume += d.volume;
+        k.openarea += d.openarea - 2 * shared.area;
+        k.links.erase(drop);
+
+        for (auto &[n, link] : d.links) {
+            if (n == keep)
+                continue;
+
+            cluster_link_t &to_keep = k.links[n];
+            to_keep.area += link.area;
+            to_keep.count += link.count;
+
+            auto &nlinks = clusters[n].links;
+            nlinks.erase(drop);
+            nlinks[keep] = to_keep;
+        }
+
+        d.links.clear();
+        k.stamp++;
+        d.stamp++;
+        remaining--;
+
+        for (auto &[n, link] : k.links) {
+            push_merge(std::min(keep, n), std::max(keep, n));
+        }
+    }
+
+    // renumber in tree order, which is the order the clusters were first numbered in
+    std::vector<int> newnum(numclusters, -1), remap(numclusters);
+    int next = 0;
+
+    for (int i = 0; i < numclusters; i++) {
+        const int root = FindCluster(clusters, i);
+        if (newnum[root] < 0)
+            newnum[root] = next++;
+        remap[i] = newnum[root];
+    }
+
+    RemapClusters_r(headnode, remap);
+
+    size_t numportals = 0;
+    for (const cluster_edge_t &edge : edges) {
+        if (remap[edge.front] != remap[edge.back])
+            numportals++;
+    }
+
+    state.num_mergedclusters += numclusters - next;
+    state.num_visclusters.count = next;
+    state.num_visportals.count = numportals;
+}
+
 /*
 ================
 WritePortalfile
@@ -207,6 +461,14 @@ static void WritePortalfile(node_t *headnode, portal_state_t &state)
      */
     NumberLeafs_r(headnode, state, -1);
 
+    if (const int target = qbsp_options.clustertarget.value(); target > 0) {
+        if (qbsp_options.target_game->id != GAME_QUAKE_II) {
+            logging::print("WARNING: -clustertarget is only supported for Q2, ignoring\n");
+        } else if (state.num_visclusters.count.load() > target) {
+            MergeClusters(headnode, state, target);
+        }
+    }
+
     // write the file
     fs::path name = qbsp_options.bsp_path;
     name.replace_extension("prt");
@@ -512,6 +512,8 @@ qbsp_settings::qbsp_settings()
       leakdist{this, "leakdist", 0, &debugging_group, "space between leakfile points (default 0: no inbetween points)"},
       forceprt1{
           this, "forceprt1", false, &debugging_group, "force a PRT1 output file even if PRT2 is required for vis"},
+      clustertarget{this, "clustertarget", 0, 0, std::numeric_limits<int32_t>::max(), &common_format_group,
+          "Q2: merge small neighbouring clusters until there are at most this many (0 to disable)"},
       tjunc{this, {"tjunc", "notjunc"}, tjunclevel_t::MWT,
           {{"none", tjunclevel_t::NONE}, {"rotate", tjunclevel_t::ROTATE}, {"retopologize", tjunclevel_t::RETOPOLOGIZE},
               {"mwt", tjunclevel_t::MWT}},
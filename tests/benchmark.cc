@@ -2,7 +2,14 @@
 #include <doctest/doctest.h>
 #include <vis/vis.hh>
 #include <common/qvec.hh>
+#include <common/qvec_simd.hh>
 #include <common/polylib.hh>
+#include <common/bsputils.hh>
+#include <light/trace.hh>
+#include <light/light.hh>
+#include <testmaps.hh>
+
+#include "test_qbsp.hh"
 
 #include <array>
 #include <vector>
@@ -164,3 +171,223 @@ TEST_CASE("vector math")
     b.doNotOptimizeAway(vec0);
     b.doNotOptimizeAway(vec1);
 }
+
+template<typename T>
+static void bench_plane_distances(const char *type_name)
+{
+    ankerl::nanobench::Rng rng;
+    std::vector<qvec<T, 3>> points(4096);
+    for (auto &point : points) {
+        for (int i = 0; i < 3; i++) {
+            point[i] = static_cast<T>(rng.uniform01() * 8192.0 - 4096.0);
+        }
+    }
+    // an odd count, to exercise the scalar tail
+    points.resize(points.size() - 3);
+
+    const qplane3<T> plane{qv::normalize(qvec<T, 3>{1, 2, 3}), static_cast<T>(100)};
+    const qv::points_soa_t<T> soa(points.begin(), points.end());
+
+    std::vector<T> expected(points.size()), dists(points.size());
+
+    ankerl::nanobench::Bench b;
+    b.relative(true);
+    b.batch(points.size());
+
+    b.run(fmt::format("qplane3<{}>::distance_to", type_name), [&]() {
+        for (size_t i = 0; i < points.size(); i++) {
+            expected[i] = plane.distance_to(points[i]);
+        }
+        ankerl::nanobench::doNotOptimizeAway(expected);
+    });
+    b.run(fmt::format("qv::plane_distances<{}> (points)", type_name), [&]() {
+        qv::plane_distances(plane, points.data(), points.size(), dists.data());
+        ankerl::nanobench::doNotOptimizeAway(dists);
+    });
+    CHECK(dists == expected);
+
+    b.run(fmt::format("qv::plane_distances<{}> (soa)", type_name), [&]() {
+        qv::plane_distances(plane, soa, dists.data());
+        ankerl::nanobench::doNotOptimizeAway(dists);
+    });
+    CHECK(dists == expected);
+
+    aabb<T, 3> expected_bounds, bounds;
+
+    b.run(fmt::format("aabb<{}, 3> += point", type_name), [&]() {
+        expected_bounds = {};
+        for (auto &point : points) {
+            expected_bounds += point;
+        }
+        ankerl::nanobench::doNotOptimizeAway(expected_bounds);
+    });
+    b.run(fmt::format("qv::bounds<{}>", type_name), [&]() {
+        bounds = qv::bounds(points.data(), points.size());
+        ankerl::nanobench::doNotOptimizeAway(bounds);
+    });
+    CHECK(bounds == expected_bounds);
+
+    // short inputs are all tail
+    for (size_t count = 0; count < 10; count++) {
+        aabb<T, 3> small;
+        for (size_t i = 0; i < count; i++) {
+            small += points[i];
+        }
+        CHECK(qv::bounds(points.data(), count) == small);
+    }
+}
+
+TEST_CASE("plane distances" * doctest::test_suite("benchmark"))
+{
+    bench_plane_distances<float>("float");
+    bench_plane_distances<double>("double");
+}
+
+// correctness is checked by "classify_points matches classify_distance" in test_common.cc
+TEST_CASE("classify points" * doctest::test_suite("benchmark"))
+{
+    ankerl::nanobench::Rng rng;
+    const qplane3d plane{qv::normalize(qvec3d{1, 2, 3}), 100};
+
+    std::vector<qvec3d> points(4096);
+    for (auto &point : points) {
+        for (int i = 0; i < 3; i++) {
+            point[i] = rng.uniform01() * 8192.0 - 4096.0;
+        }
+    }
+
+    std::vector<planeside_t> sides(points.size());
+
+    ankerl::nanobench::Bench b;
+    b.batch(points.size());
+
+    b.run("classify_points", [&]() {
+        auto counts = qv::classify_points(plane, points.data(), points.size(), DEFAULT_ON_EPSILON, sides.data());
+        ankerl::nanobench::doNotOptimizeAway(counts);
+        ankerl::nanobench::doNotOptimizeAway(sides);
+    });
+
+    polylib::winding_t w(24);
+    for (size_t i = 0; i < w.size(); i++) {
+        const double angle = 2.0 * Q_PI * i / w.size();
+        w[i] = {std::cos(angle) * 256.0, std::sin(angle) * 256.0, 16.0};
+    }
+
+    std::vector<qplane3d> planes;
+    for (int i = 0; i < 64; i++) {
+        planes.emplace_back(qv::normalize(qvec3d{rng.uniform01() - 0.5, rng.uniform01() - 0.5, 0.0}),
+            rng.uniform01() * 512.0 - 256.0);
+    }
+
+    b.batch(planes.size());
+
+    b.run("winding clip_front", [&]() {
+        for (const auto &clip_plane : planes) {
+            auto front = w.clone().clip_front(clip_plane);
+            ankerl::nanobench::doNotOptimizeAway(front);
+        }
+    });
+}
+
+TEST_CASE("point in leaf" * doctest::test_suite("benchmark"))
+{
+    const auto [bsp, bspx, prt] = LoadTestmapQ1("q1_mountain.map");
+    const dmodelh2_t &world = bsp.dmodels[0];
+    const leaf_locator_t locator(&bsp, &world);
+
+    ankerl::nanobench::Rng rng;
+    std::vector<qvec3d> points(4096);
+    for (auto &point : points) {
+        for (int i = 0; i < 3; i++) {
+            point[i] = world.mins[i] + (rng.uniform01() * (world.maxs[i] - world.mins[i]));
+        }
+    }
+
+    std::vector<const mleaf_t *> leafs(points.size());
+
+    ankerl::nanobench::Bench b;
+    b.relative(true);
+    b.batch(points.size());
+
+    b.run("BSP_FindLeafAtPoint (recursive)", [&]() {
+        for (size_t i = 0; i < points.size(); i++) {
+            leafs[i] = BSP_FindLeafAtPoint(&bsp, &world, points[i]);
+        }
+        ankerl::nanobench::doNotOptimizeAway(leafs);
+    });
+    b.run("Light_PointInLeaf", [&]() {
+        for (size_t i = 0; i < points.size(); i++) {
+            leafs[i] = Light_PointInLeaf(&bsp, points[i]);
+        }
+        ankerl::nanobench::doNotOptimizeAway(leafs);
+    });
+    b.run("leaf_locator_t::find_leaf", [&]() {
+        for (size_t i = 0; i < points.size(); i++) {
+            leafs[i] = locator.find_leaf(points[i]);
+        }
+        ankerl::nanobench::doNotOptimizeAway(leafs);
+    });
+    b.run("leaf_locator_t::find_leafs", [&]() {
+        locator.find_leafs(points.data(), points.size(), leafs.data());
+        ankerl::nanobench::doNotOptimizeAway(leafs);
+    });
+}
+
+// runs light on an already compiled map, with or without -sortrays, with dirt
+// and bounce enabled so there are plenty of incoherent rays
+static std::vector<uint8_t> light_with_ray_sorting(fs::path bsp_path, bool sortrays)
+{
+    const auto wal_metadata_path = std::filesystem::path(testmaps_dir) / "q2_wal_metadata";
+
+    std::vector<std::string> args{
+        "", "-nodefaultpaths", "-path", wal_metadata_path.string(), "-dirt", "1", "-bounce", "1"};
+    if (sortrays) {
+        args.push_back("-sortrays");
+    }
+    args.push_back(bsp_path.string());
+
+    light_main(args);
+
+    bspdata_t bspdata;
+    LoadBSPFile(bsp_path, &bspdata);
+    ConvertBSPFormat(&bspdata, &bspver_generic);
+
+    return std::get<mbsp_t>(bspdata.bsp).dlightdata;
+}
+
+static void test_ray_sorting(const std::filesystem::path &name, bool is_q2)
+{
+    if (is_q2) {
+        QbspVisLight_Q2(name, {});
+    } else {
+        QbspVisLight_Q1(name, {"-lit"});
+    }
+
+    fs::path bsp_dir = is_q2 ? test_quake2_maps_dir : test_quake_maps_dir;
+    bsp_dir = bsp_dir.empty() ? fs::current_path() : fs::weakly_canonical(bsp_dir);
+    const fs::path bsp_path = (bsp_dir / name.filename()).replace_extension(".bsp");
+
+    ankerl::nanobench::Bench b;
+    b.relative(true);
+    b.epochs(1);
+
+    std::vector<uint8_t> unsorted_lightdata, sorted_lightdata;
+
+    b.run("light", [&]() { unsorted_lightdata = light_with_ray_sorting(bsp_path, false); });
+    b.run("light -sortrays", [&]() { sorted_lightdata = light_with_ray_sorting(bsp_path, true); });
+
+    // rays are scattered back to their original slots, so sorting must not change the output
+    CHECK(unsorted_lightdata == sorted_lightdata);
+}
+
+TEST_CASE("ray sorting" * doctest::test_suite("benchmark"))
+{
+    for (const auto &[map, is_q2] : std::vector<std::pair<std::string, bool>>{
+             {"q1_minlight_nobounce.map", false}, {"q2_light_origin_brush_shadow.map", true},
+             {"q2_dirt.map", true}}) {
+        SUBCASE(map.c_str())
+        {
+            test_ray_sorting(map, is_q2);
+        }
+    }
+}
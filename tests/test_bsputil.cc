@@ -3,10 +3,14 @@
 #include <common/fs.hh>
 #include <common/decompile.hh>
 #include <common/bsputils.hh>
+#include <common/entdata.h>
 #include <qbsp/map.hh>
 #include <bsputil/bsputil.hh>
+#include <bsputil/check.hh>
+#include <bsputil/compare.hh>
 
 #include <fstream>
+#include <sstream>
 
 #include "testmaps.hh"
 #include "test_qbsp.hh"
@@ -50,6 +54,46 @@ TEST_SUITE("bsputil")
         }
     }
 
+    TEST_CASE("decompile cache")
+    {
+        for (const char *map : {"q1_decompiler_test.map", "q2_dirt.map"}) {
+            CAPTURE(map);
+
+            const auto [bsp, bspx, prt] = map[1] == '1' ? LoadTestmapQ1(map) : LoadTestmapQ2(map);
+
+            auto decompile = [&bsp](decomp_cache_t *cache) {
+                decomp_options options;
+                options.cache = cache;
+
+                std::ostringstream stream;
+                DecompileBSP(&bsp, options, stream);
+                return stream.str();
+            };
+
+            const std::string uncached = decompile(nullptr);
+
+            decomp_cache_t cache;
+            CHECK(decompile(&cache) == uncached);
+            CHECK(cache.hits() == 0);
+            CHECK(cache.size() > 0);
+
+            // nothing changed, so every leaf/brush comes from the cache
+            CHECK(decompile(&cache) == uncached);
+            CHECK(cache.hits() == cache.misses());
+
+            auto path = fs::temp_directory_path() / "decompile-cache-test.bin";
+            cache.save(path);
+
+            decomp_cache_t loaded;
+            REQUIRE(loaded.load(path));
+            CHECK(loaded.size() == cache.size());
+            CHECK(decompile(&loaded) == uncached);
+            CHECK(loaded.misses() == 0);
+
+            fs::remove(path);
+        }
+    }
+
     TEST_CASE("extract-textures")
     {
         const auto [bsp, bspx, prt] = LoadTestmapQ1("q1_extract_textures.map");
@@ -73,4 +117,72 @@ TEST_SUITE("bsputil")
             CHECK(loaded_tex);
         }
     }
+
+    TEST_CASE("compare")
+    {
+        const auto [bsp, bspx, prt] = LoadTestmapQ1("q1_extract_textures.map");
+
+        // a bsp matches itself
+        const auto same = CompareBSPs(bsp, bspx, bsp, bspx);
+        CHECK(same.identical());
+        CHECK(same.models.compared == bsp.dmodels.size());
+        CHECK(same.faces.compared == bsp.dfaces.size());
+        CHECK(same.leafs.compared > 0);
+        CHECK(same.entities.compared > 0);
+
+        // drop a world face, and change an entity
+        mbsp_t modified = bsp;
+        modified.dfaces[modified.dmodels[0].firstface].numedges = 0;
+
+        auto ents = EntData_Parse(modified);
+        ents[0].set("message", "modified");
+        modified.dentdata = EntData_Write(ents);
+
+        const auto diff = CompareBSPs(bsp, bspx, modified, bspx);
+        CHECK_FALSE(diff.identical());
+        CHECK(diff.faces.mismatched == 1);
+        CHECK(diff.faces.differences[0]["kind"] == "missing");
+        CHECK(diff.entities.mismatched == 1);
+        CHECK(diff.entities.differences[0]["keys"]["message"][1] == "modified");
+        CHECK(diff.models.mismatched == 0);
+        CHECK(diff.leafs.mismatched == 0);
+
+        // the report round trips through json
+        const json report = json::parse(diff.to_json().dump());
+        CHECK(report["identical"] == false);
+        CHECK(report["faces"]["mismatched"] == 1);
+    }
+
+    TEST_CASE("check")
+    {
+        const auto [bsp, bspx, prt] = LoadTestmapQ1("q1_extract_textures.map");
+
+        const auto clean = CheckBSP(bsp, bspx);
+        CHECK(clean.passed());
+        CHECK(clean.results.size() == BSPChecks().size());
+
+        for (auto &result : clean.results) {
+            CAPTURE(result.name);
+            CHECK(result.errors == 0);
+        }
+
+        // corrupt a face and a node
+        mbsp_t modified = bsp;
+        modified.dfaces[0].texinfo = modified.texinfo.size();
+        modified.dnodes[0].children[1] = modified.dnodes.size();
+
+        const auto corrupt = CheckBSP(modified, bspx, {"faces", "nodes"});
+        CHECK_FALSE(corrupt.passed());
+        REQUIRE(corrupt.results.size() == 2);
+        CHECK(corrupt.results[0].name == "faces");
+        CHECK(corrupt.results[0].errors == 1);
+        CHECK(corrupt.results[1].name == "nodes");
+        CHECK(corrupt.results[1].errors == 1);
+
+        // the report round trips through json
+        const json report = json::parse(corrupt.to_json().dump());
+        CHECK(report["passed"] == false);
+        CHECK(report["checks"]["faces"]["errors"] == 1);
+        CHECK(report["checks"]["faces"]["issues"][0]["severity"] == "error");
+    }
 }
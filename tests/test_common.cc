@@ -1,16 +1,139 @@
 #include <doctest/doctest.h>
 
 #include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <common/atlas.hh>
 #include <common/bspfile.hh>
 #include <common/bspfile_q1.hh>
 #include <common/bspfile_q2.hh>
+#include <common/bspinfo.hh>
+#include <common/bsputils.hh>
 #include <common/imglib.hh>
+#include <common/json_stream.hh>
+#include <common/polylib.hh>
+#include <common/qvec_simd.hh>
 #include <common/settings.hh>
 #include <testmaps.hh>
+#include "test_qbsp.hh"
+
+static std::vector<char> ReadFileBytes(const std::filesystem::path &path)
+{
+    std::ifstream f(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+}
+
+// loads a .bsp, optionally round trips it through the generic format, and
+// checks writing it back out reproduces the file exactly
+static void CheckBSPRoundTrip(const std::filesystem::path &name, bool via_generic)
+{
+    auto bsp_path = std::filesystem::path(testmaps_dir) / name;
+    bsp_path.replace_extension(".bsp");
+    auto out_path = bsp_path;
+    out_path.replace_extension(".roundtrip.bsp");
+
+    bspdata_t bspdata;
+    LoadBSPFile(bsp_path, &bspdata);
+
+    const bspversion_t *version = bspdata.version;
+
+    if (via_generic) {
+        REQUIRE(ConvertBSPFormat(&bspdata, &bspver_generic));
+        REQUIRE(ConvertBSPFormat(&bspdata, version));
+    }
+
+    WriteBSPFile(out_path, &bspdata);
+
+    CHECK(ReadFileBytes(out_path) == ReadFileBytes(bsp_path));
+
+    std::filesystem::remove(out_path);
+}
 
 TEST_SUITE("common")
 {
 
+    TEST_CASE("classify_points matches classify_distance")
+    {
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<double> coord(-4096.0, 4096.0);
+        const qplane3d plane{qv::normalize(qvec3d{1, 2, 3}), 100};
+
+        // counts that aren't a multiple of any lane width exercise the scalar tails too
+        std::vector<qvec3d> points(1027);
+        for (auto &point : points) {
+            point = {coord(rng), coord(rng), coord(rng)};
+        }
+
+        // points right at, and a hair either side of, the epsilon
+        for (size_t i = 0; i < points.size(); i += 7) {
+            const double offset = (i % 3 == 0) ? 0.0 : (i % 3 == 1) ? 1e-9 : -1e-9;
+            const double sign = (i % 2) ? 1.0 : -1.0;
+            points[i] += plane.normal * (sign * (DEFAULT_ON_EPSILON + offset) - plane.distance_to(points[i]));
+        }
+
+        // a NaN and an overflow
+        points[3] = {std::numeric_limits<double>::quiet_NaN(), 0, 0};
+        points[5] = {1e300, 1e300, 1e300};
+
+        std::vector<planeside_t> expected(points.size());
+        for (size_t i = 0; i < points.size(); i++) {
+            expected[i] = qv::classify_distance(plane.distance_to(points[i]), DEFAULT_ON_EPSILON);
+        }
+
+        std::vector<planeside_t> sides(points.size());
+        const auto counts =
+            qv::classify_points(plane, points.data(), points.size(), DEFAULT_ON_EPSILON, sides.data());
+
+        CHECK(sides == expected);
+        CHECK(counts[SIDE_FRONT] == static_cast<size_t>(std::count(expected.begin(), expected.end(), SIDE_FRONT)));
+        CHECK(counts[SIDE_BACK] == static_cast<size_t>(std::count(expected.begin(), expected.end(), SIDE_BACK)));
+        CHECK(counts[SIDE_ON] > 0);
+        CHECK(counts[SIDE_FRONT] + counts[SIDE_BACK] + counts[SIDE_ON] == points.size());
+
+        // clipping a winding keeps each side's points on that side, and clip_front agrees with clip
+        polylib::winding_t w(24);
+        for (size_t i = 0; i < w.size(); i++) {
+            const double angle = 2.0 * Q_PI * i / w.size();
+            w[i] = {std::cos(angle) * 256.0, std::sin(angle) * 256.0, 16.0};
+        }
+
+        for (int i = 0; i < 64; i++) {
+            const qplane3d clip_plane{qv::normalize(qvec3d{coord(rng), coord(rng), 0.0}), coord(rng) / 16.0};
+
+            bool any_front = false, any_back = false;
+            for (auto &point : w) {
+                const planeside_t side = qv::classify_distance(clip_plane.distance_to(point), DEFAULT_ON_EPSILON);
+                any_front |= side == SIDE_FRONT;
+                any_back |= side == SIDE_BACK;
+            }
+
+            auto clipped = w.clip(clip_plane);
+            REQUIRE(clipped[SIDE_FRONT].has_value() == any_front);
+            REQUIRE(clipped[SIDE_BACK].has_value() == any_back);
+
+            if (clipped[SIDE_FRONT]) {
+                for (auto &point : *clipped[SIDE_FRONT]) {
+                    CHECK(clip_plane.distance_to(point) > -DEFAULT_ON_EPSILON);
+                }
+            }
+            if (clipped[SIDE_BACK]) {
+                for (auto &point : *clipped[SIDE_BACK]) {
+                    CHECK(clip_plane.distance_to(point) < DEFAULT_ON_EPSILON);
+                }
+            }
+
+            auto front = w.clone().clip_front(clip_plane);
+            REQUIRE(front.has_value() == any_front);
+            if (front) {
+                CHECK(std::equal(front->begin(), front->end(), clipped[SIDE_FRONT]->begin(),
+                    clipped[SIDE_FRONT]->end()));
+            }
+        }
+    }
+
     TEST_CASE("StripFilename")
     {
         REQUIRE("/home/foo" == fs::path("/home/foo/bar.txt").parent_path());
@@ -293,6 +416,260 @@ TEST_SUITE("common")
         CHECK(texture->width_scale == 1);
         CHECK(texture->height_scale == 1);
     }
+
+    TEST_CASE("imglib texture cache")
+    {
+        auto *game = bspver_q2.game;
+        auto wal_metadata_path = std::filesystem::path(testmaps_dir) / "q2_wal_metadata";
+        auto cache_path = std::filesystem::temp_directory_path() / "ericw-tools-texturecache-test";
+        std::filesystem::remove_all(cache_path);
+
+        settings::common_settings settings;
+        settings.paths.add_value(wal_metadata_path.string(), settings::source::COMMANDLINE);
+        settings.texturecache.set_value(cache_path, settings::source::COMMANDLINE);
+
+        game->init_filesystem("placeholder.map", settings);
+
+        // first load decodes and populates the cache, second load is served from it
+        auto [decoded, decoded_resolve, decoded_data] = img::load_texture("e1u1/yellow32x32", false, game, settings);
+        REQUIRE(decoded);
+        CHECK(std::distance(std::filesystem::directory_iterator(cache_path), {}) == 1);
+
+        auto [cached, cached_resolve, cached_data] = img::load_texture("e1u1/yellow32x32", false, game, settings);
+        REQUIRE(cached);
+
+        CHECK(cached->meta.name == "e1u1/yellow32x32");
+        CHECK(cached->meta.extension.value() == img::ext::STB);
+        CHECK(cached->width == decoded->width);
+        CHECK(cached->height == decoded->height);
+        CHECK(cached->pixels == decoded->pixels);
+        CHECK(cached_data);
+
+        // meta-only loads drop the pixels
+        auto [meta, meta_resolve, meta_data] = img::load_texture("e1u1/yellow32x32", true, game, settings);
+        REQUIRE(meta);
+        CHECK(meta->meta.width == 32);
+        CHECK(meta->pixels.empty());
+
+        std::filesystem::remove_all(cache_path);
+    }
+}
+
+TEST_SUITE("bspfile")
+{
+    TEST_CASE("q1 bsp round trips through LoadBSPFile/WriteBSPFile")
+    {
+        LoadTestmapQ1("q1_extract_textures.map");
+
+        CheckBSPRoundTrip("q1_extract_textures.map", false);
+        CheckBSPRoundTrip("q1_extract_textures.map", true);
+    }
+
+    TEST_CASE("q2 bsp round trips through LoadBSPFile/WriteBSPFile")
+    {
+        LoadTestmapQ2("q2_dirt.map");
+
+        CheckBSPRoundTrip("q2_dirt.map", false);
+        CheckBSPRoundTrip("q2_dirt.map", true);
+    }
+
+    TEST_CASE("PatchBSPFile")
+    {
+        LoadTestmapQ1("q1_extract_textures.map");
+
+        auto bsp_path = std::filesystem::path(testmaps_dir) / "q1_extract_textures.bsp";
+        auto patched_path = std::filesystem::path(testmaps_dir) / "q1_extract_textures.patched.bsp";
+        auto expected_path = std::filesystem::path(testmaps_dir) / "q1_extract_textures.expected.bsp";
+
+        bspdata_t original;
+        LoadBSPFile(bsp_path, &original);
+        const std::string &entities = std::get<bsp29_t>(original.bsp).dentdata;
+
+        auto load_patched = [&]() {
+            bspdata_t bspdata;
+            LoadBSPFile(patched_path, &bspdata);
+            return bspdata;
+        };
+
+        SUBCASE("shorter entities are written in place")
+        {
+            std::filesystem::copy_file(bsp_path, patched_path, std::filesystem::copy_options::overwrite_existing);
+
+            bsp_patch_t patch;
+            patch.entities = "{\n\"classname\" \"worldspawn\"\n}\n";
+            CHECK(PatchBSPFile(patched_path, patch));
+            CHECK(std::filesystem::file_size(patched_path) == std::filesystem::file_size(bsp_path));
+
+            bspdata_t bspdata = load_patched();
+            const bsp29_t &bsp = std::get<bsp29_t>(bspdata.bsp);
+            CHECK(bsp.dentdata == *patch.entities);
+            CHECK(bsp.dfaces.size() == std::get<bsp29_t>(original.bsp).dfaces.size());
+            CHECK(bsp.dlightdata == std::get<bsp29_t>(original.bsp).dlightdata);
+        }
+
+        SUBCASE("longer entities repack the file the way WriteBSPFile lays it out")
+        {
+            std::filesystem::copy_file(bsp_path, patched_path, std::filesystem::copy_options::overwrite_existing);
+
+            bsp_patch_t patch;
+            patch.entities = entities + "{\n\"classname\" \"info_null\"\n}\n";
+            CHECK_FALSE(PatchBSPFile(patched_path, patch));
+
+            bspdata_t expected;
+            LoadBSPFile(bsp_path, &expected);
+            std::get<bsp29_t>(expected.bsp).dentdata = *patch.entities;
+            WriteBSPFile(expected_path, &expected);
+
+            CHECK(ReadFileBytes(patched_path) == ReadFileBytes(expected_path));
+            std::filesystem::remove(expected_path);
+        }
+
+        SUBCASE("BSPX lumps can be added and removed")
+        {
+            std::filesystem::copy_file(bsp_path, patched_path, std::filesystem::copy_options::overwrite_existing);
+
+            bsp_patch_t add;
+            add.bspx["TESTLUMP"] = std::vector<uint8_t>{1, 2, 3, 4, 5};
+            CHECK_FALSE(PatchBSPFile(patched_path, add));
+
+            bspdata_t bspdata = load_patched();
+            CHECK(bspdata.bspx.entries.at("TESTLUMP") == *add.bspx.at("TESTLUMP"));
+            CHECK(std::get<bsp29_t>(bspdata.bsp).dentdata == entities);
+
+            bsp_patch_t remove;
+            remove.bspx["TESTLUMP"] = std::nullopt;
+            CHECK_FALSE(PatchBSPFile(patched_path, remove));
+
+            CHECK(ReadFileBytes(patched_path) == ReadFileBytes(bsp_path));
+            CHECK_THROWS(PatchBSPFile(patched_path, remove));
+        }
+
+        std::filesystem::remove(patched_path);
+    }
+}
+
+TEST_SUITE("json_stream")
+{
+    TEST_CASE("writer matches json's own pretty printing")
+    {
+        const json expected = {{"a", json::array()}, {"b", {{"c", {1, 2, {{"d", "e"}}}}, {"f", json::object()}}},
+            {"g", "hex"}, {"h", {json::array({1.5, nullptr}), true, "x"}}};
+
+        std::ostringstream stream;
+        json_stream_writer_t writer(stream);
+
+        writer.begin_object();
+        writer.key("a");
+        writer.begin_array();
+        writer.end_array();
+        writer.key("b");
+        writer.value(expected["b"]);
+        writer.key("g");
+        writer.hex_value(reinterpret_cast<const uint8_t *>("\x0a\xbc"), 2);
+        writer.key("h");
+        writer.begin_array();
+        writer.elements(3, 2, [&](size_t i) { return expected["h"][i]; });
+        writer.end_array();
+        writer.end_object();
+
+        json with_hex = expected;
+        with_hex["g"] = "0abc";
+
+        std::ostringstream reference;
+        reference << std::setw(4) << with_hex;
+
+        CHECK(stream.str() == reference.str());
+    }
+
+    TEST_CASE("reader reads single members of serialize_bsp output")
+    {
+        const auto [bsp, bspx, prt] = LoadTestmapQ2("q2_dirt.map");
+
+        bspdata_t bspdata;
+        bspdata.loadversion = bspdata.version = bsp.loadversion;
+        bspdata.bspx.entries = bspx;
+
+        const auto path = std::filesystem::path(testmaps_dir) / "q2_dirt.stream.json";
+
+        {
+            std::ofstream stream(path);
+            serialize_bsp(bspdata, bsp, stream);
+        }
+
+        json_stream_reader_t reader(path);
+
+        const auto keys = reader.keys();
+        CHECK(std::is_sorted(keys.begin(), keys.end()));
+        CHECK(std::find(keys.begin(), keys.end(), "faces") != keys.end());
+
+        // a whole member
+        const auto models = reader.read("models");
+        REQUIRE(models);
+        REQUIRE(models->size() == bsp.dmodels.size());
+        CHECK((*models)[0]["numfaces"] == bsp.dmodels[0].numfaces);
+        CHECK_FALSE(reader.read("nonexistent"));
+
+        // element by element
+        size_t count = 0;
+        CHECK(reader.for_each_element("faces", [&](json &&face) {
+            CHECK(face["planenum"] == bsp.dfaces[count].planenum);
+            CHECK(face["vertices"].size() == bsp.dfaces[count].numedges);
+            count++;
+        }));
+        CHECK(count == bsp.dfaces.size());
+
+        // hex strings round trip
+        const auto lightdata = reader.read("lightdata");
+        if (!bsp.dlightdata.empty()) {
+            REQUIRE(lightdata);
+            CHECK(lightdata->get<std::string>().size() == bsp.dlightdata.size() * 2);
+        }
+
+        // only the selected lumps are written
+        std::ostringstream filtered;
+        serialize_bsp(bspdata, bsp, filtered, {{"planes", "leafs"}});
+        const json j = json::parse(filtered.str());
+        CHECK(j.size() == 2);
+        CHECK(j["planes"].size() == bsp.dplanes.size());
+        CHECK(j["leafs"].size() == bsp.dleafs.size());
+
+        std::filesystem::remove(path);
+    }
+
+    TEST_CASE("serialize_bsp writes bspx lumps in sorted order")
+    {
+        const auto [bsp, bspx, prt] = LoadTestmapQ2("q2_dirt.map", {"-wrbrushes"});
+        REQUIRE(!bsp.dbrushes.empty());
+        REQUIRE(bspx.contains("BRUSHLIST"));
+
+        bspdata_t bspdata;
+        bspdata.loadversion = bspdata.version = bsp.loadversion;
+        bspdata.bspx.entries = bspx;
+
+        std::ostringstream stream;
+        serialize_bsp(bspdata, bsp, stream);
+
+        const json j = json::parse(stream.str());
+        CHECK(j.contains("bspxentries"));
+
+        std::vector<std::string> keys;
+        for (auto &[key, value] : j.items()) {
+            keys.push_back(key);
+        }
+
+        // json::items() visits keys in sorted order, so compare against the raw text instead
+        std::vector<size_t> positions;
+        for (auto &key : keys) {
+            positions.push_back(stream.str().find(fmt::format("\n    \"{}\":", key)));
+            CHECK(positions.back() != std::string::npos);
+        }
+        CHECK(std::is_sorted(positions.begin(), positions.end()));
+
+        // the same bytes a pretty printed json value (with its std::map members) would give
+        std::ostringstream reference;
+        reference << std::setw(4) << j;
+        CHECK(stream.str() == reference.str());
+    }
 }
 
 TEST_SUITE("qmat")
@@ -312,3 +689,90 @@ TEST_SUITE("qmat")
         CHECK(in.transpose() == exp);
     }
 }
+
+TEST_SUITE("atlas")
+{
+    TEST_CASE("packed rects don't overlap")
+    {
+        std::mt19937 rng(1234);
+        std::uniform_int_distribution<int> size(1, 100);
+
+        std::vector<atlas_rect_t> rects(500);
+        for (auto &rect : rects) {
+            rect.width = size(rng);
+            rect.height = size(rng);
+        }
+        // bigger than a page
+        rects.push_back({700, 20});
+
+        const auto layout = PackAtlas(rects, 256);
+        CHECK(layout.page_size == 1024);
+
+        int64_t area = 0;
+        for (size_t i = 0; i < rects.size(); i++) {
+            const auto &a = rects[i];
+            REQUIRE(a.page >= 0);
+            REQUIRE(a.page < layout.num_pages);
+            CHECK(a.x >= 0);
+            CHECK(a.y >= 0);
+            CHECK(a.x + a.width <= layout.page_size);
+            CHECK(a.y + a.height <= layout.page_size);
+            area += a.width * a.height;
+
+            for (size_t j = i + 1; j < rects.size(); j++) {
+                const auto &b = rects[j];
+                const bool overlap = a.page == b.page && a.x < b.x + b.width && b.x < a.x + a.width &&
+                                     a.y < b.y + b.height && b.y < a.y + a.height;
+                CHECK_FALSE(overlap);
+            }
+        }
+
+        // every page but the last is mostly full
+        CHECK(layout.num_pages >= 2);
+        CHECK(int64_t(layout.num_pages - 1) * layout.page_size * layout.page_size * 0.9 < area);
+    }
+
+    TEST_CASE("lightmap atlas matches decoupled lightmaps")
+    {
+        auto [bsp, bspx] = QbspVisLight_Q2("q2_dirt.map", {"-world_units_per_luxel", "8"});
+
+        const auto atlas = build_lightmap_atlas(bsp, bspx, {}, false, true);
+        REQUIRE(atlas.style_to_lightmap_atlas.count(0));
+
+        const img::texture &style0 = atlas.style_to_lightmap_atlas.at(0);
+        size_t checked = 0;
+
+        for (size_t i = 0; i < bsp.dfaces.size(); i++) {
+            const mface_t &face = bsp.dfaces[i];
+            const auto lm_info = BSPX_DecoupledLM(bspx, i);
+
+            if (face.styles[0] != 0 || lm_info.offset < 0) {
+                continue;
+            }
+
+            const faceextents_t extents(face, bsp, lm_info.lmwidth, lm_info.lmheight, lm_info.world_to_lm_space);
+            const auto &uvs = atlas.facenum_to_lightmap_uvs.at(i);
+            REQUIRE(uvs.size() == face.numedges);
+
+            for (auto &uv : uvs) {
+                CHECK(uv[0] >= 0);
+                CHECK(uv[0] <= 1);
+                CHECK(uv[1] >= 0);
+                CHECK(uv[1] <= 1);
+            }
+
+            // where the face's luxel (0, 0) landed in the atlas
+            const qvec2f lm = extents.worldToLMCoord(Face_PointAtIndex(&bsp, &face, 0));
+            const int x = std::round(uvs[0][0] * style0.width - 0.5f - lm[0]);
+            const int y = std::round(uvs[0][1] * style0.height - 0.5f - lm[1]);
+
+            const qvec4b &pixel = style0.pixels[y * style0.width + x];
+            CHECK(pixel[0] == bsp.dlightdata[lm_info.offset]);
+            CHECK(pixel[1] == bsp.dlightdata[lm_info.offset + 1]);
+            CHECK(pixel[2] == bsp.dlightdata[lm_info.offset + 2]);
+            checked++;
+        }
+
+        CHECK(checked > 0);
+    }
+}
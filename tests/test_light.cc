@@ -2,11 +2,18 @@
 
 #include <light/light.hh>
 #include <light/trace.hh> // for clamp_texcoord
+#include <common/imglib.hh>
 #include <light/entities.hh>
+#include <light/sampler.hh>
+#include <light/arena.hh>
 
 #include <random>
+#include <sstream>
+#include <set>
 #include <algorithm> // for std::sort
 
+#include <tbb/parallel_for.h>
+
 #include <common/qvec.hh>
 
 #include <common/aabb.hh>
@@ -978,6 +985,230 @@ TEST_SUITE("trace")
         CHECK(0 == clamp_texcoord(-128.0f, 128));
         CHECK(127 == clamp_texcoord(-129.0f, 128));
     }
+
+    TEST_CASE("prepared_texture_t")
+    {
+        auto make_texture = [](uint32_t width, uint32_t height) {
+            img::texture texture;
+            texture.width = width;
+            texture.height = height;
+            for (uint32_t i = 0; i < width * height; i++) {
+                texture.pixels.emplace_back(i * 10, 0, 0, (i % 3) ? 255 : 0);
+            }
+            return texture;
+        };
+
+        // power of two (mask wrapping) and not (clamp_texcoord wrapping)
+        for (const auto &texture : {make_texture(4, 2), make_texture(3, 3)}) {
+            const prepared_texture_t prepared(texture);
+            CHECK(prepared.opacity() == texture_opacity_t::MIXED);
+
+            for (double s = -10.0; s <= 10.0; s += 0.25) {
+                for (double t = -10.0; t <= 10.0; t += 0.25) {
+                    const qvec4b expected = texture.pixels[(texture.width * clamp_texcoord(t, texture.height)) +
+                                                           clamp_texcoord(s, texture.width)];
+
+                    CHECK(prepared.sample({s, t}) == expected);
+                    CHECK(prepared.opaque_at({s, t}) == (expected[3] == 255));
+                }
+            }
+        }
+
+        // box filtered mips
+        img::texture gradient = make_texture(2, 2);
+        const prepared_texture_t prepared(gradient);
+        REQUIRE(prepared.num_levels() == 2);
+        CHECK(prepared.sample({0, 0}, 1) == qvec4b(15, 0, 0, 128));
+        CHECK(prepared.sample({0, 0}, 5) == qvec4b(15, 0, 0, 128));
+
+        // opaque/transparent fast paths
+        img::texture opaque = make_texture(2, 2);
+        for (auto &pixel : opaque.pixels) {
+            pixel[3] = 255;
+        }
+        CHECK(prepared_texture_t(opaque).opacity() == texture_opacity_t::OPAQUE);
+
+        img::texture transparent = make_texture(2, 2);
+        for (auto &pixel : transparent.pixels) {
+            pixel[3] = 254;
+        }
+        CHECK(prepared_texture_t(transparent).opacity() == texture_opacity_t::TRANSPARENT);
+
+        // missing texture samples as {0, 0, 0, 0}, like SampleTexture
+        CHECK(prepared_texture_t().opacity() == texture_opacity_t::TRANSPARENT);
+        CHECK(prepared_texture_t().sample({0, 0}) == qvec4b{});
+    }
+}
+
+TEST_SUITE("sampler")
+{
+    TEST_CASE("sobol")
+    {
+        const std::vector<float> dim0{0.0f, 0.5f, 0.25f, 0.75f};
+        const std::vector<float> dim1{0.0f, 0.5f, 0.75f, 0.25f};
+        const std::vector<float> dim2{0.0f, 0.5f, 0.75f, 0.25f};
+
+        for (uint32_t i = 0; i < 4; i++) {
+            CHECK(sampler::sobol(i, 0) == dim0[i]);
+            CHECK(sampler::sobol(i, 1) == dim1[i]);
+            CHECK(sampler::sobol(i, 2) == dim2[i]);
+        }
+    }
+
+    TEST_CASE("sobol2 stratifies with any scramble")
+    {
+        for (uint32_t scramble : {0u, 1u, 0xdeadbeefu, sampler::luxel_scramble(3, 5)}) {
+            // each of the first 16 points lands in its own cell of a 4x4 grid
+            std::set<std::pair<int, int>> cells;
+
+            for (uint32_t i = 0; i < 16; i++) {
+                const qvec2f p = sampler::sobol2(i, scramble);
+                REQUIRE(p[0] >= 0.0f);
+                REQUIRE(p[0] < 1.0f);
+                REQUIRE(p[1] >= 0.0f);
+                REQUIRE(p[1] < 1.0f);
+                cells.emplace(static_cast<int>(p[0] * 4), static_cast<int>(p[1] * 4));
+            }
+
+            CHECK(cells.size() == 16);
+        }
+    }
+
+    TEST_CASE("stratified2")
+    {
+        CHECK(sampler::stratified2(0, 4, {0.5f, 0.5f}) == qvec2f(0.25f, 0.25f));
+        CHECK(sampler::stratified2(3, 4, {0.5f, 0.5f}) == qvec2f(0.75f, 0.75f));
+
+        // non-square counts still cover the whole square
+        CHECK(sampler::stratified2(5, 6, {0.0f, 0.0f}) == qvec2f(2.0f / 3.0f, 0.5f));
+    }
+
+    TEST_CASE("blue_noise")
+    {
+        constexpr int N = sampler::BLUE_NOISE_SIZE;
+
+        std::set<float> values;
+        for (int y = 0; y < N; y++) {
+            for (int x = 0; x < N; x++) {
+                const float v = sampler::blue_noise(x, y);
+                REQUIRE(v > 0.0f);
+                REQUIRE(v < 1.0f);
+                values.insert(v);
+            }
+        }
+
+        // every value is distinct, and the tile wraps
+        CHECK(values.size() == N * N);
+        CHECK(sampler::blue_noise(-1, -1) == sampler::blue_noise(N - 1, N - 1));
+        CHECK(sampler::blue_noise(N + 2, 3) == sampler::blue_noise(2, 3));
+
+        // the lowest 1/64 of the mask is evenly spread: no two points closer than half the average spacing
+        std::vector<qvec2i> points;
+        for (int y = 0; y < N; y++) {
+            for (int x = 0; x < N; x++) {
+                if (sampler::blue_noise(x, y) < 1.0f / 64.0f) {
+                    points.emplace_back(x, y);
+                }
+            }
+        }
+
+        REQUIRE(points.size() == N * N / 64);
+
+        for (size_t i = 0; i < points.size(); i++) {
+            for (size_t j = i + 1; j < points.size(); j++) {
+                const int dx = std::min(std::abs(points[i][0] - points[j][0]), N - std::abs(points[i][0] - points[j][0]));
+                const int dy = std::min(std::abs(points[i][1] - points[j][1]), N - std::abs(points[i][1] - points[j][1]));
+                CHECK((dx * dx) + (dy * dy) >= 16);
+            }
+        }
+    }
+
+    TEST_CASE("concentric_disk")
+    {
+        CHECK(sampler::concentric_disk({0.5f, 0.5f}) == qvec2f(0, 0));
+
+        for (uint32_t i = 0; i < 64; i++) {
+            CHECK(qv::length(sampler::concentric_disk(sampler::sobol2(i))) <= 1.0f + 1e-6f);
+        }
+    }
+}
+
+TEST_SUITE("arena")
+{
+    TEST_CASE("reservations are contiguous across chunks")
+    {
+        lightmap_arena_t arena;
+        arena.reset(true, true, false, 64);
+
+        std::vector<lightmap_arena_t::span_t> spans;
+        // 40 doesn't divide the chunk size, so chunks get sealed partially full;
+        // 100 doesn't fit in a chunk at all
+        for (size_t size : {40, 40, 100, 3, 40}) {
+            auto span = arena.reserve(size);
+            REQUIRE(span.mono);
+            REQUIRE(span.lit);
+            CHECK(!span.lux);
+
+            for (size_t i = 0; i < size; i++) {
+                span.mono[i] = static_cast<uint8_t>(spans.size() + 1);
+                span.lit[i * 3] = static_cast<uint8_t>(spans.size() + 1);
+            }
+            spans.push_back(span);
+        }
+
+        CHECK(spans[0].offset == 0);
+        CHECK(spans[1].offset == 40);
+        CHECK(spans[2].offset == 80);
+        CHECK(spans[3].offset == 180);
+        CHECK(spans[4].offset == 184);
+        CHECK(arena.size() == 224);
+
+        auto mono = arena.compact(lightmap_arena_t::plane_t::mono, arena.size());
+        REQUIRE(mono.size() == 224);
+        auto lit = arena.compact(lightmap_arena_t::plane_t::lit, arena.size());
+        REQUIRE(lit.size() == 224 * 3);
+
+        for (size_t i = 0; i < spans.size(); i++) {
+            CHECK(mono[spans[i].offset] == i + 1);
+            CHECK(lit[spans[i].offset * 3] == i + 1);
+            CHECK(arena.at(spans[i].offset).mono == spans[i].mono);
+        }
+        // rounding padding is zeroed
+        CHECK(mono[183] == 0);
+
+        // streamed output matches, zero padded to the requested size
+        std::ostringstream stream;
+        arena.write(stream, lightmap_arena_t::plane_t::mono, 230);
+        auto str = stream.str();
+        REQUIRE(str.size() == 230);
+        CHECK(std::equal(mono.begin(), mono.end(), str.begin()));
+        CHECK(str[229] == 0);
+    }
+
+    TEST_CASE("parallel reservations don't overlap")
+    {
+        lightmap_arena_t arena;
+        arena.reset(true, false, false, 1024);
+
+        std::vector<int> offsets(10000);
+        tbb::parallel_for(static_cast<size_t>(0), offsets.size(), [&](size_t i) {
+            auto span = arena.reserve(4 + (i % 7) * 4);
+            std::fill_n(span.mono, 4 + (i % 7) * 4, static_cast<uint8_t>(i % 7 + 1));
+            offsets[i] = span.offset;
+        });
+
+        auto mono = arena.compact(lightmap_arena_t::plane_t::mono, arena.size());
+
+        size_t total = 0;
+        for (size_t i = 0; i < offsets.size(); i++) {
+            const size_t size = 4 + (i % 7) * 4;
+            total += size;
+            for (size_t j = 0; j < size; j++) {
+                REQUIRE(mono[offsets[i] + j] == i % 7 + 1);
+            }
+        }
+        CHECK(arena.size() == total);
+    }
 }
 
 TEST_SUITE("settings")
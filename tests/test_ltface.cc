@@ -1,5 +1,6 @@
 #include <doctest/doctest.h>
 
+#include <light/entities.hh>
 #include <light/light.hh>
 #include <light/ltface.hh>
 #include <light/surflight.hh>
@@ -9,6 +10,8 @@
 #include <vis/vis.hh>
 #include "test_qbsp.hh"
 
+#include <random>
+
 static testresults_t QbspVisLight_Common(const std::filesystem::path &name, std::vector<std::string> extra_qbsp_args,
     std::vector<std::string> extra_light_args, runvis_t run_vis)
 {
@@ -464,6 +467,46 @@ TEST_CASE("negative lights work")
     }
 }
 
+TEST_CASE("lights differing only by style share their rays")
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_light_style_group.map", {});
+
+    auto *floor = BSP_FindFaceAtPoint(&bsp, &bsp.dmodels[0], {768, 1280, 944}, {0, 0, 1});
+    REQUIRE(floor);
+
+    // one lightmap per style, in the order they were allocated
+    const faceextents_t extents(*floor, bsp, LMSCALE_DEFAULT);
+    const size_t style_size = extents.numsamples() * 3;
+    std::map<int, int> style_index;
+
+    for (int i = 0; i < MAXLIGHTMAPS && floor->styles[i] != INVALID_LIGHTSTYLE_OLD; i++) {
+        style_index[floor->styles[i]] = i;
+    }
+
+    REQUIRE(style_index.size() == 3);
+    REQUIRE(style_index.contains(0));
+    REQUIRE(style_index.contains(1));
+    REQUIRE(style_index.contains(2));
+
+    for (int x = 0; x < extents.width(); ++x) {
+        for (int y = 0; y < extents.height(); ++y) {
+            INFO("sample ", x, ", ", y);
+
+            auto style_sample = [&](int style) {
+                return LM_Sample(&bsp, nullptr, extents, floor->lightofs + style_index[style] * style_size, {x, y});
+            };
+
+            const qvec3b white = style_sample(0);
+            const qvec3b styled_white = style_sample(1);
+            const qvec3b styled_red = style_sample(2);
+
+            CHECK(white[0] > 0);
+            CHECK(white == styled_white);
+            CHECK(styled_red == qvec3b(white[0], 0, 0));
+        }
+    }
+}
+
 TEST_CASE("light channel mask (_object_channel_mask, _light_channel_mask, _shadow_channel_mask)")
 {
     auto [bsp, bspx] = QbspVisLight_Q2("q2_light_group.map", {});
@@ -682,6 +725,56 @@ TEST_CASE("q2_light_origin_brush_shadow")
     CheckFaceLuxelAtPoint(&bsp, &bsp.dmodels[0], {100, 100, 100}, at_origin);
 }
 
+// lights map with and without sharing sample points between coplanar faces, and checks every lightmap matches
+static void CheckSharedSamplesMatchSeparate(const std::filesystem::path &name)
+{
+    auto [shared_bsp, shared_bspx] = QbspVisLight_Q2(name, {"-extra4"});
+    auto [separate_bsp, separate_bspx] = QbspVisLight_Q2(name, {"-extra4", "-noshareluxels", "1"});
+
+    REQUIRE(shared_bsp.dfaces.size() == separate_bsp.dfaces.size());
+
+    for (size_t i = 0; i < shared_bsp.dfaces.size(); i++) {
+        INFO("face ", i);
+
+        const mface_t &shared_face = shared_bsp.dfaces[i];
+        const mface_t &separate_face = separate_bsp.dfaces[i];
+
+        CHECK(shared_face.styles == separate_face.styles);
+
+        if (shared_face.lightofs == -1 || separate_face.lightofs == -1) {
+            CHECK(shared_face.lightofs == separate_face.lightofs);
+            continue;
+        }
+
+        const faceextents_t extents(shared_face, shared_bsp, LMSCALE_DEFAULT);
+        const size_t numstyles = std::count_if(shared_face.styles.begin(), shared_face.styles.end(),
+            [](uint8_t style) { return style != INVALID_LIGHTSTYLE_OLD; });
+        const size_t size = extents.numsamples() * 3 * numstyles;
+
+        CHECK(std::equal(shared_bsp.dlightdata.begin() + shared_face.lightofs,
+            shared_bsp.dlightdata.begin() + shared_face.lightofs + size,
+            separate_bsp.dlightdata.begin() + separate_face.lightofs));
+    }
+}
+
+TEST_CASE("coplanar faces sharing sample points light the same as lighting them separately")
+{
+    CheckSharedSamplesMatchSeparate("q2_light_origin_brush_shadow.map");
+}
+
+TEST_CASE("negative lights reach sample points shared between coplanar faces")
+{
+    // negative lights are applied in post-processing, after shared samples were last gathered
+    const std::vector<std::string> maps{"q2_light_negative.map", "q2_light_negative_bounce.map"};
+
+    for (const auto &map : maps) {
+        SUBCASE(map.c_str())
+        {
+            CheckSharedSamplesMatchSeparate(map);
+        }
+    }
+}
+
 TEST_CASE("q2_surface_lights_culling" * doctest::may_fail())
 {
     auto [bsp, bspx] = QbspVisLight_Q2("q2_surface_lights_culling.map", {});
@@ -852,3 +945,88 @@ TEST_CASE("q1_sunlight")
     auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_sunlight.map", {"-lit"});
     CheckFaceLuxelAtPoint(&bsp, &bsp.dmodels[0], {49, 49, 49}, {0, 0, 0}, {0, 0, 1}, &lit);
 }
+
+TEST_CASE("leaf_locator_t matches BSP_FindLeafAtPoint")
+{
+    auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_sunlight.map", {"-lit"});
+
+    INFO("light_main must not leave the locator pointing at its destroyed bsp");
+    CHECK(WorldLeafLocator().empty());
+
+    const dmodelh2_t &world = bsp.dmodels[0];
+    const leaf_locator_t locator(&bsp, &world);
+
+    std::mt19937 rng(1234);
+    std::vector<qvec3d> points(4096);
+    for (auto &point : points) {
+        for (int i = 0; i < 3; i++) {
+            point[i] = std::uniform_real_distribution<double>(world.mins[i] - 16, world.maxs[i] + 16)(rng);
+        }
+    }
+
+    // points exactly on axial node planes go to the front
+    for (const auto &node : bsp.dnodes) {
+        const dplane_t &plane = bsp.dplanes[node.planenum];
+        if (plane.type <= static_cast<int32_t>(plane_type_t::PLANE_Z)) {
+            qvec3d on_plane = (qvec3d(node.mins) + qvec3d(node.maxs)) * 0.5;
+            on_plane[plane.type] = plane.dist;
+            points.push_back(on_plane);
+        }
+    }
+
+    std::vector<const mleaf_t *> leafs(points.size());
+    locator.find_leafs(points.data(), points.size(), leafs.data());
+
+    for (size_t i = 0; i < points.size(); i++) {
+        const mleaf_t *expected = BSP_FindLeafAtPoint(&bsp, &world, points[i]);
+        CHECK(leafs[i] == expected);
+        CHECK(locator.find_leaf(points[i]) == expected);
+    }
+}
+
+TEST_CASE("light bounds are estimated from what each light sees")
+{
+    auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_light_visible_bounds.map", {"-lit"});
+
+    const auto &lights = GetLights();
+    REQUIRE(lights.size() == 4);
+
+    auto check_bounds = [](const light_t &light, const aabb3d &visible) {
+        INFO("light at ", light.origin.value());
+
+        // what the light sees, grown by 25% of its size in each direction
+        const aabb3d expected = visible.grow(visible.size() * 0.25);
+
+        for (int i = 0; i < 3; i++) {
+            CHECK(light.bounds.mins()[i] == doctest::Approx(expected.mins()[i]).epsilon(0.005));
+            CHECK(light.bounds.maxs()[i] == doctest::Approx(expected.maxs()[i]).epsilon(0.005));
+        }
+    };
+
+    // the room's interior
+    const aabb3d room{qvec3d{-256, -208, 0}, qvec3d{288, 256, 240}};
+
+    check_bounds(*lights[0], room);
+    check_bounds(*lights[2], room);
+    // the second light is shut inside a small func_wall box, right next to the first one;
+    // whichever of the two is estimated first, each only gets what it sees itself
+    check_bounds(*lights[1], aabb3d{qvec3d{10, 10, 114}, qvec3d{22, 22, 126}});
+
+    INFO("lights at the same point share their estimate");
+    CHECK(lights[3]->bounds.mins() == lights[0]->bounds.mins());
+    CHECK(lights[3]->bounds.maxs() == lights[0]->bounds.maxs());
+}
+
+TEST_CASE("light bounds include a narrow doorway between coarse rays")
+{
+    // the light sees into a second room through a 24 unit doorway, 22.5 degrees around and
+    // a little above it. The rays 45 degrees apart on either side of the doorway all hit the
+    // same wall at similar distances, so it's only found by tracing between them.
+    auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_light_visible_doorway.map", {"-lit"});
+
+    const auto &lights = GetLights();
+    REQUIRE(lights.size() == 1);
+
+    // the first room ends at x = 256, the second at x = 1024
+    CHECK(lights[0]->bounds.maxs()[0] > 1024);
+}
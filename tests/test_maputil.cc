@@ -0,0 +1,194 @@
+#include <doctest/doctest.h>
+
+#include <common/fs.hh>
+#include <common/mapfile.hh>
+#include <common/parser.hh>
+#include <maputil/batch.hh>
+
+#include <fstream>
+
+#include <tbb/task_arena.h>
+
+#ifdef USE_LUA
+
+// a worldspawn with two brushes, and a light
+static constexpr const char *BATCH_TEST_MAP = R"({
+"classname" "worldspawn"
+{
+( 0 0 0 ) ( 0 1 0 ) ( 0 0 1 ) first 0 0 0 1 1
+( 0 0 0 ) ( 0 0 1 ) ( 1 0 0 ) first 0 0 0 1 1
+( 0 0 0 ) ( 1 0 0 ) ( 0 1 0 ) first 0 0 0 1 1
+( 64 64 64 ) ( 64 65 64 ) ( 65 64 64 ) first 0 0 0 1 1
+( 64 64 64 ) ( 65 64 64 ) ( 64 64 65 ) first 0 0 0 1 1
+( 64 64 64 ) ( 64 64 65 ) ( 64 65 64 ) first 0 0 0 1 1
+}
+{
+( 128 0 0 ) ( 128 1 0 ) ( 128 0 1 ) second 0 0 0 1 1
+( 128 0 0 ) ( 128 0 1 ) ( 129 0 0 ) second 0 0 0 1 1
+( 128 0 0 ) ( 129 0 0 ) ( 128 1 0 ) second 0 0 0 1 1
+( 192 64 64 ) ( 192 65 64 ) ( 193 64 64 ) second 0 0 0 1 1
+( 192 64 64 ) ( 193 64 64 ) ( 192 64 65 ) second 0 0 0 1 1
+( 192 64 64 ) ( 192 64 65 ) ( 192 65 64 ) second 0 0 0 1 1
+}
+}
+{
+"classname" "light"
+"origin" "32 32 96"
+"delay" "2"
+}
+)";
+
+struct batch_test_dir_t
+{
+    fs::path dir = fs::temp_directory_path() / "ericw-tools-maputil-batch-test";
+
+    batch_test_dir_t()
+    {
+        fs::remove_all(dir);
+        fs::create_directories(dir / "in");
+    }
+
+    ~batch_test_dir_t() { fs::remove_all(dir); }
+
+    void write(const fs::path &name, const char *contents)
+    {
+        std::ofstream stream(dir / name);
+        stream << contents;
+    }
+
+    // runs script on in/*.map, writing changed maps to out/; returns the number of files it failed on
+    size_t run(const char *script)
+    {
+        write("script.lua", script);
+
+        maputil_batch_options_t options;
+        options.pattern = (dir / "in" / "*.map").string();
+        options.script = dir / "script.lua";
+        options.output_dir = dir / "out";
+
+        return maputil_batch(options);
+    }
+
+    map_file_t load_output(const fs::path &name)
+    {
+        const fs::path path = dir / "out" / name;
+        auto file = fs::load(path);
+        REQUIRE(file);
+
+        parser_t parser(file, {path.string()});
+
+        map_file_t map;
+        map.parse(parser);
+        return map;
+    }
+};
+
+TEST_SUITE("maputil")
+{
+    TEST_CASE("batch: get and set entity keys")
+    {
+        batch_test_dir_t test;
+        test.write("in/a.map", BATCH_TEST_MAP);
+
+        REQUIRE(0 == test.run(R"(
+            local light = map[2]
+            assert(light:get("classname") == "light")
+            assert(light:get("missing") == nil)
+            light:set("light", "300")
+            light:set("delay", nil)
+            assert(light:get("light") == "300")
+            assert(light:get("delay") == nil)
+        )"));
+
+        const map_file_t map = test.load_output("a.map");
+        REQUIRE(map.entities.size() == 2);
+        CHECK(map.entities[1].epairs.get("light") == "300");
+        CHECK(!map.entities[1].epairs.has("delay"));
+        CHECK(map.entities[1].epairs.get("origin") == "32 32 96");
+    }
+
+    TEST_CASE("batch: add and remove brushes")
+    {
+        batch_test_dir_t test;
+        test.write("in/a.map", BATCH_TEST_MAP);
+
+        REQUIRE(0 == test.run(R"(
+            local world = map[1]
+            assert(world:num_brushes() == 2)
+            local copy = world:add_brush(world:brush(1))
+            assert(world:num_brushes() == 3)
+            assert(#copy == 6 and copy[1].texture == "first")
+            world:remove_brush(2)
+            assert(world:num_brushes() == 2)
+            assert(world:brush(2)[1].texture == "first")
+        )"));
+
+        const map_file_t map = test.load_output("a.map");
+        REQUIRE(map.entities[0].brushes.size() == 2);
+        for (auto &brush : map.entities[0].brushes) {
+            REQUIRE(brush.faces.size() == 6);
+            CHECK(brush.faces[0].texture == "first");
+        }
+    }
+
+    TEST_CASE("batch: handles held across a removal go stale")
+    {
+        batch_test_dir_t test;
+        test.write("in/a.map", BATCH_TEST_MAP);
+
+        REQUIRE(0 == test.run(R"(
+            local function check_stale(f)
+                local ok, err = pcall(f)
+                assert(not ok, "stale handle still worked")
+                assert(err:find("stale"), err)
+            end
+
+            local world = map[1]
+            local light = map[2]
+            local second = world:brush(2)
+            local side = second[1]
+
+            -- the second brush is now the first; its old handle must not pick up a neighbour
+            world:remove_brush(1)
+            check_stale(function() return #second end)
+            check_stale(function() return side.texture end)
+            assert(world:num_brushes() == 1)
+            assert(world:brush(1)[1].texture == "second")
+
+            -- same for entities; handles made afterwards work
+            map:remove_entity(1)
+            check_stale(function() return light:get("classname") end)
+            check_stale(function() return world:num_brushes() end)
+            assert(map[1]:get("classname") == "light")
+        )"));
+
+        const map_file_t map = test.load_output("a.map");
+        REQUIRE(map.entities.size() == 1);
+        CHECK(map.entities[0].epairs.get("classname") == "light");
+    }
+
+    TEST_CASE("batch: globals don't leak between files")
+    {
+        batch_test_dir_t test;
+        test.write("in/a.map", BATCH_TEST_MAP);
+        test.write("in/b.map", BATCH_TEST_MAP);
+
+        // one thread, so both files run in the same Lua state
+        tbb::task_arena arena(1);
+        size_t failed = 0;
+
+        arena.execute([&]() {
+            failed = test.run(R"(
+                assert(seen == nil, "global leaked from " .. tostring(seen))
+                seen = map_path
+                map[1]:set("_visited", "1")
+            )");
+        });
+
+        CHECK(failed == 0);
+        CHECK(test.load_output("a.map").entities[0].epairs.get("_visited") == "1");
+        CHECK(test.load_output("b.map").entities[0].epairs.get("_visited") == "1");
+    }
+}
+
+#endif
@@ -804,3 +804,45 @@ TEST_CASE("q2_detail_fence" * doctest::test_suite("testmaps_q2"))
         }
     }
 }
+
+TEST_CASE("q2 -clustertarget" * doctest::test_suite("testmaps_q2"))
+{
+    const auto [bsp, bspx, prt] = LoadTestmapQ2("q2_light_translucency.map");
+    REQUIRE(prt);
+
+    const int target = prt->portalleafs / 2;
+    REQUIRE(target > 1);
+
+    const auto [merged_bsp, merged_bspx, merged_prt] =
+        LoadTestmapQ2("q2_light_translucency.map", {"-clustertarget", std::to_string(target)});
+    REQUIRE(merged_prt);
+
+    CHECK(merged_prt->portalleafs <= target);
+    CHECK(merged_prt->portals.size() < prt->portals.size());
+
+    for (auto &portal : merged_prt->portals) {
+        CHECK(portal.leafnums[0] != portal.leafnums[1]);
+    }
+
+    // merging only changes cluster numbers, so the leafs line up
+    REQUIRE(merged_bsp.dleafs.size() == bsp.dleafs.size());
+
+    std::map<int, int> old_to_new;
+    std::map<int, int> area_of_cluster;
+
+    for (size_t i = 1; i < bsp.dleafs.size(); ++i) {
+        const auto &leaf = merged_bsp.dleafs[i];
+        if (leaf.cluster == CLUSTER_INVALID)
+            continue;
+
+        CHECK(leaf.cluster < merged_prt->portalleafs);
+
+        // whole clusters were merged, never split up
+        CHECK(old_to_new.emplace(bsp.dleafs[i].cluster, leaf.cluster).first->second == leaf.cluster);
+
+        // and never across areas
+        CHECK(area_of_cluster.emplace(leaf.cluster, leaf.area).first->second == leaf.area);
+    }
+
+    CHECK(area_of_cluster.size() == static_cast<size_t>(merged_prt->portalleafs));
+}
@@ -1,6 +1,11 @@
 #include <common/bsputils.hh>
+#include <common/ostream.hh>
+#include <common/prtfile.hh>
 #include <common/qvec.hh>
+#include <qbsp/qbsp.hh>
 
+#include <bit>
+#include <fstream>
 #include <stdexcept>
 #include <vis/vis.hh>
 
@@ -48,6 +53,51 @@ TEST_CASE("q2_detail_leak_test.map" * doctest::may_fail())
     }
 }
 
+TEST_CASE("pvs_matrix_t matches DecompressAllVis")
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_detail_leak_test.map", {}, runvis_t::yes);
+    const auto vis = DecompressAllVis(&bsp);
+    const pvs_matrix_t matrix(&bsp);
+
+    REQUIRE(!matrix.empty());
+    CHECK(matrix.row_size() == DecompressedVisSize(&bsp));
+    CHECK(matrix.row_stride() % PVS_ROW_ALIGNMENT == 0);
+    CHECK(reinterpret_cast<uintptr_t>(matrix.leaf_row(1)) % PVS_ROW_ALIGNMENT == 0);
+
+    for (size_t leafnum = 0; leafnum < bsp.dleafs.size(); ++leafnum) {
+        const mleaf_t &leaf = bsp.dleafs[leafnum];
+        const uint8_t *row = matrix.leaf_row(leafnum);
+
+        if (leaf.cluster < 0) {
+            CHECK(row == nullptr);
+            continue;
+        }
+
+        REQUIRE(row != nullptr);
+        const auto &expected = vis.at(leaf.cluster);
+        CHECK(std::equal(expected.begin(), expected.end(), row));
+
+        for (size_t other = 0; other < bsp.dleafs.size(); ++other) {
+            CHECK(matrix.leaf_visible(row, other) == Pvs_LeafVisible(&bsp, expected, &bsp.dleafs[other]));
+        }
+    }
+}
+
+TEST_CASE("Pvs_Union / Pvs_Intersects")
+{
+    std::vector<uint8_t> a(70), b(70);
+    a[3] = 0x01;
+    b[65] = 0x80;
+
+    CHECK(!Pvs_Intersects(a.data(), b.data(), a.size()));
+
+    Pvs_Union(a.data(), b.data(), a.size());
+    CHECK(a[3] == 0x01);
+    CHECK(a[65] == 0x80);
+    CHECK(Pvs_Intersects(a.data(), b.data(), a.size()));
+    CHECK(!Pvs_Intersects(a.data(), b.data(), 64));
+}
+
 TEST_CASE("ClipStackWinding") {
     pstack_t stack{};
     visstats_t stats{};
@@ -69,3 +119,186 @@ TEST_CASE("ClipStackWinding") {
 
     FreeStackWinding(w1, stack);
 }
+
+TEST_CASE("vis -approx")
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_detail_leak_test.map", {}, runvis_t::yes);
+    const auto exact = DecompressAllVis(&bsp);
+
+    auto approx_vis = [&]() {
+        vis_main(std::vector<std::string>{"", "-approx", qbsp_options.bsp_path.string()});
+
+        bspdata_t bspdata;
+        LoadBSPFile(qbsp_options.bsp_path, &bspdata);
+        ConvertBSPFormat(&bspdata, &bspver_generic);
+
+        return DecompressAllVis(&std::get<mbsp_t>(bspdata.bsp));
+    };
+
+    const auto approx = approx_vis();
+    REQUIRE(approx.size() == exact.size());
+
+    size_t exact_count = 0, approx_count = 0, missed_count = 0;
+
+    for (auto &[cluster, row] : exact) {
+        const auto &approx_row = approx.at(cluster);
+
+        for (size_t i = 0; i < row.size(); i++) {
+            exact_count += std::popcount(row[i]);
+            approx_count += std::popcount(approx_row[i]);
+            missed_count += std::popcount(static_cast<uint8_t>(row[i] & ~approx_row[i]));
+        }
+    }
+
+    CAPTURE(exact_count);
+    CAPTURE(approx_count);
+    CAPTURE(missed_count);
+
+    // sampling can miss clusters seen through small gaps, but only a few of them
+    CHECK(missed_count * 10 <= exact_count);
+
+    // and it's still a useful bound, not every cluster seeing every other one
+    CHECK(approx_count < exact.size() * exact.size());
+
+    // and it doesn't depend on thread scheduling
+    CHECK(approx_vis() == approx);
+
+    // -fast is a different replacement for the full vis
+    CHECK_THROWS_AS(vis_main(std::vector<std::string>{"", "-approx", "-fast", qbsp_options.bsp_path.string()}),
+        ericwtools_error);
+}
+
+TEST_CASE("SimplifyPortals")
+{
+    vis_options.reset();
+
+    prtfile_t prtfile{};
+
+    // two touching squares on x = 0 between leafs 0 and 1, one of them listed the other way round
+    prtfile.portals.push_back({prtfile_winding_t{{0, 0, 0}, {0, 0, 64}, {0, 64, 64}, {0, 64, 0}}, {0, 1}});
+    prtfile.portals.push_back(
+        {prtfile_winding_t{{0, 64, 0}, {0, 64, 64}, {0, 128, 64}, {0, 128, 0}}.flip(), {1, 0}});
+    // same plane, other leafs
+    prtfile.portals.push_back({prtfile_winding_t{{0, 128, 0}, {0, 128, 64}, {0, 192, 64}, {0, 192, 0}}, {0, 2}});
+    // no area
+    prtfile.portals.push_back({prtfile_winding_t{{0, 0, 0}, {0, 0, 32}, {0, 0, 64}}, {1, 2}});
+
+    const qvec3d normal = prtfile.portals[0].winding.plane().normal;
+
+    SimplifyPortals(prtfile);
+
+    REQUIRE(prtfile.portals.size() == 2);
+
+    const prtfile_portal_t &merged = prtfile.portals[0];
+    CHECK(merged.leafnums[0] == 0);
+    CHECK(merged.leafnums[1] == 1);
+    CHECK(merged.winding.size() == 4);
+    CHECK(merged.winding.area() == doctest::Approx(64 * 128));
+    CHECK(qv::epsilonEqual(merged.winding.plane().normal, normal, NORMAL_EPSILON));
+
+    CHECK(prtfile.portals[1].leafnums[1] == 2);
+    CHECK(prtfile.portals[1].winding.size() == 4);
+}
+
+TEST_CASE("vis -simplifyportals")
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_light_translucency.map", {});
+    const fs::path prt_path = fs::path(qbsp_options.bsp_path).replace_extension("prt");
+
+    auto run_vis = [&](std::vector<std::string> args) {
+        args.insert(args.begin(), "");
+        args.push_back(qbsp_options.bsp_path.string());
+        vis_main(args);
+
+        bspdata_t bspdata;
+        LoadBSPFile(qbsp_options.bsp_path, &bspdata);
+        ConvertBSPFormat(&bspdata, &bspver_generic);
+        return DecompressAllVis(&std::get<mbsp_t>(bspdata.bsp));
+    };
+
+    const auto original = run_vis({});
+
+    // qbsp never writes two coplanar portals between the same clusters, so cut every portal in half
+    // across its first edge to give -simplifyportals something to merge
+    prtfile_t prtfile = LoadPrtFile(prt_path, bsp.loadversion);
+    const size_t original_count = prtfile.portals.size();
+    std::vector<prtfile_portal_t> halves;
+
+    for (auto &portal : prtfile.portals) {
+        const qvec3d across = qv::normalize(portal.winding[1] - portal.winding[0]);
+        auto clipped = portal.winding.clip(qplane3d{across, qv::dot(across, portal.winding.center())});
+        REQUIRE(clipped[SIDE_FRONT]);
+        REQUIRE(clipped[SIDE_BACK]);
+
+        for (auto &half : clipped) {
+            halves.push_back({std::move(*half), {portal.leafnums[0], portal.leafnums[1]}});
+        }
+    }
+
+    {
+        std::ofstream stream(prt_path);
+        ewt::print(stream, "PRT1\n{}\n{}\n", prtfile.portalleafs, halves.size());
+
+        for (auto &portal : halves) {
+            ewt::print(stream, "{} {} {}", portal.winding.size(), portal.leafnums[0], portal.leafnums[1]);
+            for (auto &point : portal.winding) {
+                ewt::print(stream, " ({} {} {})", point[0], point[1], point[2]);
+            }
+            ewt::print(stream, "\n");
+        }
+    }
+
+    // the halves merge back into the original portals
+    prtfile_t split = LoadPrtFile(prt_path, bsp.loadversion);
+    REQUIRE(split.portals.size() == original_count * 2);
+    SimplifyPortals(split);
+    CHECK(split.portals.size() == original_count);
+
+    const auto simplified = run_vis({"-simplifyportals"});
+
+    REQUIRE(simplified.size() == original.size());
+
+    // the merged portals cover the same openings as qbsp's, so nothing the full vis of the map's own portals
+    // sees is lost. (a full vis of the halves isn't the reference: the flow sees a few extra leafs through
+    // portals that are cut in two, though the openings are the same)
+    for (auto &[cluster, row] : original) {
+        INFO("cluster ", cluster);
+        const auto &simplified_row = simplified.at(cluster);
+
+        for (size_t i = 0; i < row.size(); i++) {
+            CHECK((row[i] & ~simplified_row[i]) == 0);
+        }
+    }
+}
+
+TEST_CASE("vis -portalbudget")
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_detail_leak_test.map", {}, runvis_t::yes);
+    const auto exact = DecompressAllVis(&bsp);
+
+    vis_main(std::vector<std::string>{"", "-portalbudget", "2", qbsp_options.bsp_path.string()});
+
+    bspdata_t bspdata;
+    LoadBSPFile(qbsp_options.bsp_path, &bspdata);
+    ConvertBSPFormat(&bspdata, &bspver_generic);
+    const auto budgeted = DecompressAllVis(&std::get<mbsp_t>(bspdata.bsp));
+
+    REQUIRE(budgeted.size() == exact.size());
+
+    size_t exact_count = 0, budgeted_count = 0;
+
+    // capping the flow only ever adds leafs
+    for (auto &[cluster, row] : exact) {
+        INFO("cluster ", cluster);
+        const auto &budgeted_row = budgeted.at(cluster);
+
+        for (size_t i = 0; i < row.size(); i++) {
+            CHECK((row[i] & ~budgeted_row[i]) == 0);
+
+            exact_count += std::popcount(row[i]);
+            budgeted_count += std::popcount(budgeted_row[i]);
+        }
+    }
+
+    CHECK(budgeted_count > exact_count);
+}
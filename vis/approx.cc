@@ -0,0 +1,292 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <vis/vis.hh>
+
+#include <vis/leafbits.hh>
+#include <common/log.hh>
+#include <common/bsputils.hh>
+#include <common/parallel.hh>
+
+#include <bit> // for std::countr_zero
+
+/*
+
+Approximate vis: rather than flowing through the portals, shoot rays out of
+every portal and mark each cluster a ray passes through before it reaches
+solid. A ray only finds clusters that really are visible, and growing the
+result one portal hop picks up most of what the sampling misses, but not
+everything: clusters only seen through small gaps can still be missed.
+
+The rays are traced through the bsp's own node tree, which already splits the
+world into the solid and empty leafs we need, front to back.
+
+*/
+
+struct approx_tracer_t
+{
+    const mbsp_t *bsp;
+    std::vector<qplane3d> planes;
+    std::vector<int> leafclusters; // -1 for leafs rays can't pass through
+};
+
+static approx_tracer_t MakeTracer(const mbsp_t *bsp)
+{
+    approx_tracer_t tracer{bsp};
+
+    tracer.planes.reserve(bsp->dplanes.size());
+    for (const dplane_t &plane : bsp->dplanes) {
+        tracer.planes.emplace_back(plane.normal, plane.dist);
+    }
+
+    tracer.leafclusters.resize(bsp->dleafs.size());
+    for (size_t i = 0; i < bsp->dleafs.size(); i++) {
+        if (bsp->loadversion->game->id == GAME_QUAKE_II) {
+            tracer.leafclusters[i] = bsp->dleafs[i].cluster;
+        } else if (i == 0 || i > portalleafs_real) {
+            // leaf 0 is the shared solid leaf; leafs past the vis leafs aren't in any cluster
+            tracer.leafclusters[i] = -1;
+        } else {
+            tracer.leafclusters[i] = bsp->dleafs[i].cluster;
+        }
+    }
+
+    return tracer;
+}
+
+/*
+  ==============
+  TraceClusters
+
+  Walks the segment through the bsp tree front to back, marking the cluster of
+  every leaf it passes through. Returns true once it reaches an opaque leaf.
+  ==============
+*/
+static bool TraceClusters(
+    const approx_tracer_t &tracer, int nodenum, const qvec3d &start, const qvec3d &end, leafbits_t &hits)
+{
+    while (nodenum >= 0) {
+        const bsp2_dnode_t &node = tracer.bsp->dnodes[nodenum];
+        const qplane3d &plane = tracer.planes[node.planenum];
+        const vec_t d1 = plane.distance_to(start);
+        const vec_t d2 = plane.distance_to(end);
+
+        if (d1 >= 0 && d2 >= 0) {
+            nodenum = node.children[0];
+            continue;
+        }
+        if (d1 < 0 && d2 < 0) {
+            nodenum = node.children[1];
+            continue;
+        }
+
+        const int side = d1 < 0;
+        const qvec3d mid = start + (end - start) * (d1 / (d1 - d2));
+
+        if (TraceClusters(tracer, node.children[side], start, mid, hits)) {
+            return true;
+        }
+
+        return TraceClusters(tracer, node.children[!side], mid, end, hits);
+    }
+
+    const int cluster = tracer.leafclusters[-(nodenum + 1)];
+
+    if (cluster < 0) {
+        return true;
+    }
+
+    hits[cluster] = true;
+    return false;
+}
+
+// radical inverse of index in a prime base, one dimension of a Halton sequence
+static vec_t RadicalInverse(uint32_t index, uint32_t base)
+{
+    vec_t result = 0;
+    vec_t scale = 1.0 / base;
+
+    for (; index; index /= base, scale /= base) {
+        result += (index % base) * scale;
+    }
+
+    return result;
+}
+
+// per-portal offset for each dimension, so neighbouring portals don't shoot
+// the same pattern of rays
+static vec_t SequenceOffset(uint64_t seed)
+{
+    // splitmix64
+    seed += 0x9e3779b97f4a7c15;
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111eb;
+    seed ^= seed >> 31;
+
+    return (seed >> 11) * 0x1.0p-53;
+}
+
+/*
+  ==============
+  PortalRays
+
+  Marks the clusters seen by rays leaving through the portal. The ray origins
+  are spread over the portal by area, and the directions are cosine weighted
+  about its normal, which samples the lines through the portal evenly.
+  ==============
+*/
+static void PortalRays(const approx_tracer_t &tracer, visportal_t &p, int numrays, vec_t raylength)
+{
+    const viswinding_t &w = *p.winding;
+
+    // fan the winding into triangles, and pick from them by area
+    std::vector<vec_t> areas(w.size() - 2);
+    vec_t totalarea = 0;
+
+    for (size_t i = 0; i < areas.size(); i++) {
+        totalarea += qv::length(qv::cross(w[i + 1] - w[0], w[i + 2] - w[0]));
+        areas[i] = totalarea;
+    }
+
+    const qvec3d &normal = p.plane.normal;
+    const qvec3d tangent =
+        qv::normalize(qv::cross(normal, fabs(normal[0]) < 0.9 ? qvec3d(1, 0, 0) : qvec3d(0, 1, 0)));
+    const qvec3d bitangent = qv::cross(normal, tangent);
+
+    constexpr uint32_t bases[5] = {2, 3, 5, 7, 11};
+    vec_t offsets[5];
+    const uint64_t portalnum = &p - portals.data();
+
+    for (size_t i = 0; i < 5; i++) {
+        offsets[i] = SequenceOffset(portalnum * 5 + i);
+    }
+
+    const int headnode = tracer.bsp->dmodels[0].headnode[0];
+
+    for (int ray = 0; ray < numrays; ray++) {
+        vec_t u[5];
+        for (size_t i = 0; i < 5; i++) {
+            u[i] = RadicalInverse(ray + 1, bases[i]) + offsets[i];
+            u[i] -= floor(u[i]);
+        }
+
+        const size_t tri = std::min(
+            static_cast<size_t>(std::upper_bound(areas.begin(), areas.end(), u[0] * totalarea) - areas.begin()),
+            areas.size() - 1);
+
+        // uniform point in the triangle
+        vec_t a = u[1], b = u[2];
+        if (a + b > 1) {
+            a = 1 - a;
+            b = 1 - b;
+        }
+        const qvec3d origin = w[0] + (w[tri + 1] - w[0]) * a + (w[tri + 2] - w[0]) * b;
+
+        const vec_t r = sqrt(u[3]);
+        const vec_t phi = 2.0 * Q_PI * u[4];
+        const qvec3d dir =
+            tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + normal * sqrt(std::max(0.0, 1.0 - u[3]));
+
+        // nudge off the portal so the ray starts in the neighbour leaf
+        const qvec3d start = origin + normal * VIS_ON_EPSILON;
+
+        TraceClusters(tracer, headnode, start, start + dir * raylength, p.visbits);
+    }
+}
+
+/*
+  ==============
+  ApproximatePortalVis
+
+  Fills in every portal's visbits with the clusters visible from the leaf it
+  belongs to, by ray casting instead of the full portal flow.
+  ==============
+*/
+void ApproximatePortalVis(const mbsp_t *bsp)
+{
+    const approx_tracer_t tracer = MakeTracer(bsp);
+
+    vec_t raylength = qv::distance(qvec3d(bsp->dmodels[0].mins), qvec3d(bsp->dmodels[0].maxs));
+    if (vis_options.visdist.value() > 0) {
+        raylength = std::min(raylength, vis_options.visdist.value());
+    }
+
+    const int numrays = vis_options.approxrays.value();
+
+    logging::parallel_for(static_cast<size_t>(0), portals.size(), [&](size_t i) {
+        visportal_t &p = portals[i];
+
+        p.visbits = leafbits_t(portalleafs);
+        p.visbits[p.leaf] = true;
+
+        if (p.winding->size() >= 3) {
+            PortalRays(tracer, p, numrays, raylength);
+        }
+    });
+
+    const int numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+
+    // gather the portals' hits by cluster; seeing is mutual, so mirror them too
+    std::vector<leafbits_t> clustervis(portalleafs, leafbits_t(portalleafs));
+
+    for (int i = 0; i < portalleafs; i++) {
+        for (const visportal_t *p : leafs[i].portals) {
+            for (int j = 0; j < numblocks; j++) {
+                clustervis[i].data()[j] |= p->visbits.data()[j];
+            }
+        }
+    }
+
+    for (int i = 0; i < portalleafs; i++) {
+        for (int j = 0; j < numblocks; j++) {
+            uint32_t bits = clustervis[i].data()[j];
+            while (bits) {
+                const int bit = std::countr_zero(bits);
+                bits &= ~nth_bit(bit);
+                clustervis[(j << leafbits_t::shift) + bit][i] = true;
+            }
+        }
+    }
+
+    // grow by one portal hop, to cover what the rays missed
+    std::vector<leafbits_t> dilated(clustervis);
+
+    logging::parallel_for(0, portalleafs, [&](int i) {
+        for (int j = 0; j < numblocks; j++) {
+            uint32_t bits = clustervis[i].data()[j];
+            while (bits) {
+                const int bit = std::countr_zero(bits);
+                bits &= ~nth_bit(bit);
+                for (const visportal_t *p : leafs[(j << leafbits_t::shift) + bit].portals) {
+                    dilated[i][p->leaf] = true;
+                }
+            }
+        }
+
+        // ClusterFlow adds the cluster itself
+        dilated[i][i] = false;
+    });
+
+    for (int i = 0; i < portalleafs; i++) {
+        for (visportal_t *p : leafs[i].portals) {
+            p->visbits = dilated[i];
+            p->status = pstat_done;
+        }
+    }
+}
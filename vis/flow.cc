@@ -2,6 +2,9 @@
 #include <vis/leafbits.hh>
 #include <common/log.hh>
 #include <common/parallel.hh>
+#include <common/qvec_simd.hh>
+
+#include <bit> // for std::popcount
 
 /*
   ==============
@@ -26,6 +29,18 @@
 static void ClipToSeparators(visstats_t &stats, const viswinding_t *source, const qplane3d src_pl, const viswinding_t *pass,
     viswinding_t *&target, unsigned int test, pstack_t &stack)
 {
+    // which side of the source portal each point of pass is on doesn't depend on i
+    planeside_t stack_sides[MAX_WINDING];
+    std::vector<planeside_t> heap_sides;
+    planeside_t *pass_sides = stack_sides;
+
+    if (pass->size() > MAX_WINDING) {
+        heap_sides.resize(pass->size());
+        pass_sides = heap_sides.data();
+    }
+
+    qv::classify_points(src_pl, pass->points, pass->size(), VIS_ON_EPSILON, pass_sides);
+
     // check all combinations
     for (size_t i = 0; i < source->size(); i++) {
         const size_t l = (i + 1) % source->size();
@@ -40,10 +55,9 @@ static void ClipToSeparators(visstats_t &stats, const viswinding_t *source, cons
             // This also tells us which side of the separating plane has
             //  the source portal.
             bool fliptest;
-            vec_t d = src_pl.distance_to(pass->at(j));
-            if (d < -VIS_ON_EPSILON)
+            if (pass_sides[j] == SIDE_BACK)
                 fliptest = true;
-            else if (d > VIS_ON_EPSILON)
+            else if (pass_sides[j] == SIDE_FRONT)
                 fliptest = false;
             else
                 continue; // Point lies in source plane
@@ -76,7 +90,7 @@ static void ClipToSeparators(visstats_t &stats, const viswinding_t *source, cons
             for (; k < pass->size(); k++) {
                 if (k == j)
                     continue;
-                d = sep.distance_to(pass->at(k));
+                const vec_t d = sep.distance_to(pass->at(k));
                 if (d < -VIS_ON_EPSILON)
                     break;
                 else if (d > VIS_ON_EPSILON)
@@ -150,6 +164,22 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         thread->base->numcansee++;
     }
 
+    /*
+     * Over budget: everything this chain might still reach counts as seen,
+     * which keeps the result conservative.
+     */
+    if (vis_options.portalbudget.value() && thread->stats.c_chains > vis_options.portalbudget.value()) {
+        thread->stats.c_overbudget = 1;
+
+        const int numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+        for (int j = 0; j < numblocks; j++) {
+            const uint32_t added = prevstack.mightsee->data()[j] & ~thread->leafvis.data()[j];
+            thread->leafvis.data()[j] |= added;
+            thread->base->numcansee += std::popcount(added);
+        }
+        return;
+    }
+
     prevstack.next = &stack;
 
     stack.next = nullptr;
@@ -0,0 +1,371 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <vis/vis.hh>
+
+#include <common/log.hh>
+#include <common/prtfile.hh>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <optional>
+
+/*
+
+Portal simplification, run on the .prt portals before vis.
+
+Every change here only ever grows the openings between two leafs, never
+shrinks them, and only by less than the flow can resolve, so nothing that
+can be seen through the original portals is lost:
+
+- coplanar portals between the same pair of leafs are replaced by their convex
+  hull, when that adds no more than a thin band around them, below what the
+  flow can resolve. Touching portals whose union is already convex merge for
+  free; slivers alongside a bigger portal fold in.
+- colinear points are dropped.
+- portals with no area at all are dropped; nothing can be seen through them.
+
+*/
+
+namespace
+{
+// a portal projected on to its group's plane
+struct planar_portal_t
+{
+    std::vector<qvec3d> points;
+    std::vector<qvec2d> points2d;
+    vec_t area;
+    vec_t perimeter;
+    size_t source; // index in the .prt
+    bool changed = false;
+    bool removed = false;
+};
+
+struct plane_basis_t
+{
+    qvec3d origin, s, t;
+
+    explicit plane_basis_t(const qplane3d &plane)
+        : origin(plane.normal * plane.dist),
+          s(qv::normalize(qv::cross(plane.normal, fabs(plane.normal[0]) < 0.9 ? qvec3d(1, 0, 0) : qvec3d(0, 1, 0)))),
+          t(qv::cross(plane.normal, s))
+    {
+    }
+
+    qvec2d project(const qvec3d &point) const { return {qv::dot(point - origin, s), qv::dot(point - origin, t)}; }
+};
+} // namespace
+
+static vec_t Cross2D(const qvec2d &o, const qvec2d &a, const qvec2d &b)
+{
+    return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+// shoelace area of a counter-clockwise polygon
+static vec_t PolygonArea(const std::vector<qvec2d> &points)
+{
+    vec_t total = 0;
+
+    for (size_t i = 0; i < points.size(); i++) {
+        const qvec2d &a = points[i];
+        const qvec2d &b = points[(i + 1) % points.size()];
+        total += a[0] * b[1] - a[1] * b[0];
+    }
+
+    return total * 0.5;
+}
+
+static vec_t PolygonPerimeter(const std::vector<qvec2d> &points)
+{
+    vec_t total = 0;
+
+    for (size_t i = 0; i < points.size(); i++) {
+        total += qv::distance(points[i], points[(i + 1) % points.size()]);
+    }
+
+    return total;
+}
+
+/*
+  ==============
+  PlanarHull
+
+  Counter-clockwise convex hull (Andrew's monotone chain) of the points, as
+  indices. Points within DIST_EPSILON of a hull edge are left out.
+  ==============
+*/
+static std::vector<size_t> PlanarHull(const std::vector<qvec2d> &points)
+{
+    std::vector<size_t> order(points.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return points[a][0] < points[b][0] || (points[a][0] == points[b][0] && points[a][1] < points[b][1]);
+    });
+
+    // is c a strict left turn from a -> b
+    auto left_turn = [&](size_t a, size_t b, size_t c) {
+        const vec_t length = qv::distance(points[a], points[c]);
+        return Cross2D(points[a], points[b], points[c]) > DIST_EPSILON * length;
+    };
+
+    std::vector<size_t> hull(order.size() * 2);
+    size_t k = 0;
+
+    for (size_t i : order) {
+        while (k >= 2 && !left_turn(hull[k - 2], hull[k - 1], i)) {
+            k--;
+        }
+        hull[k++] = i;
+    }
+
+    for (size_t n = order.size() - 1, lower = k + 1; n > 0; n--) {
+        const size_t i = order[n - 1];
+        while (k >= lower && !left_turn(hull[k - 2], hull[k - 1], i)) {
+            k--;
+        }
+        hull[k++] = i;
+    }
+
+    hull.resize(k > 1 ? k - 1 : k);
+    return hull;
+}
+
+static void SetHull(planar_portal_t &portal, const std::vector<qvec3d> &points, const std::vector<qvec2d> &points2d,
+    const std::vector<size_t> &hull)
+{
+    portal.points.clear();
+    portal.points2d.clear();
+
+    for (size_t i : hull) {
+        portal.points.push_back(points[i]);
+        portal.points2d.push_back(points2d[i]);
+    }
+
+    portal.area = PolygonArea(portal.points2d);
+    portal.perimeter = PolygonPerimeter(portal.points2d);
+}
+
+/*
+  ==============
+  MergeCoplanarPortals
+
+  Greedily merges the portals, all on one plane between the same two leafs,
+  smallest growth first.
+  ==============
+*/
+static void MergeCoplanarPortals(std::vector<planar_portal_t> &group)
+{
+    while (true) {
+        size_t best_i = 0, best_j = 0;
+        vec_t best_growth = std::numeric_limits<vec_t>::max();
+        std::vector<size_t> best_hull;
+        std::vector<qvec3d> points;
+        std::vector<qvec2d> points2d;
+        std::vector<qvec3d> best_points;
+        std::vector<qvec2d> best_points2d;
+
+        for (size_t i = 0; i < group.size(); i++) {
+            if (group[i].removed) {
+                continue;
+            }
+            for (size_t j = i + 1; j < group.size(); j++) {
+                if (group[j].removed) {
+                    continue;
+                }
+
+                const planar_portal_t &a = group[i];
+                const planar_portal_t &b = group[j];
+
+                points = a.points;
+                points.insert(points.end(), b.points.begin(), b.points.end());
+                points2d = a.points2d;
+                points2d.insert(points2d.end(), b.points2d.begin(), b.points2d.end());
+
+                std::vector<size_t> hull = PlanarHull(points2d);
+                if (hull.size() < 3 || hull.size() > MAX_WINDING_FIXED) {
+                    continue;
+                }
+
+                std::vector<qvec2d> hull2d;
+                for (size_t k : hull) {
+                    hull2d.push_back(points2d[k]);
+                }
+
+                // a band VIS_ON_EPSILON wide around the smaller portal is below what the flow can resolve
+                const vec_t growth = PolygonArea(hull2d) - a.area - b.area;
+                const vec_t allowed = VIS_ON_EPSILON * std::min(a.perimeter, b.perimeter);
+
+                if (growth <= allowed && growth < best_growth) {
+                    best_i = i;
+                    best_j = j;
+                    best_growth = growth;
+                    best_hull = std::move(hull);
+                    best_points = points;
+                    best_points2d = points2d;
+                }
+            }
+        }
+
+        if (best_hull.empty()) {
+            return;
+        }
+
+        SetHull(group[best_i], best_points, best_points2d, best_hull);
+        group[best_i].changed = true;
+        group[best_j].removed = true;
+    }
+}
+
+/*
+  ==============
+  SimplifyPortals
+
+  Merges, simplifies and drops portals in place; see the top of the file.
+  Portals that don't change are left exactly as they were, in their original
+  order, since the flow's results depend a little on both.
+  ==============
+*/
+void SimplifyPortals(prtfile_t &prtfile)
+{
+    const size_t numportals = prtfile.portals.size();
+
+    // group by the pair of leafs, facing from the lower numbered one
+    std::map<std::pair<int, int>, std::vector<size_t>> pairs;
+    std::vector<prtfile_winding_t> facing(numportals);
+
+    for (size_t i = 0; i < numportals; i++) {
+        const prtfile_portal_t &portal = prtfile.portals[i];
+
+        if (portal.leafnums[0] > portal.leafnums[1]) {
+            facing[i] = portal.winding.flip();
+            pairs[{portal.leafnums[1], portal.leafnums[0]}].push_back(i);
+        } else {
+            facing[i] = portal.winding.clone();
+            pairs[{portal.leafnums[0], portal.leafnums[1]}].push_back(i);
+        }
+    }
+
+    std::vector<bool> keep(numportals, true);
+    std::vector<std::optional<prtfile_winding_t>> replaced(numportals);
+    size_t degenerate = 0;
+
+    for (auto &[leafnums, indices] : pairs) {
+        // split into planes
+        std::vector<std::pair<qplane3d, std::vector<size_t>>> planes;
+
+        for (size_t i : indices) {
+            if (facing[i].size() < 3) {
+                keep[i] = false;
+                degenerate++;
+                continue;
+            }
+
+            const qplane3d plane = facing[i].plane();
+            auto it = std::find_if(planes.begin(), planes.end(), [&](const auto &entry) {
+                return qv::dot(entry.first.normal, plane.normal) > 1.0 - NORMAL_EPSILON &&
+                       fabs(entry.first.dist - plane.dist) < DIST_EPSILON;
+            });
+
+            if (it == planes.end()) {
+                planes.emplace_back(plane, std::vector<size_t>{i});
+            } else {
+                it->second.push_back(i);
+            }
+        }
+
+        for (auto &[plane, members] : planes) {
+            const plane_basis_t basis(plane);
+            std::vector<planar_portal_t> group;
+
+            for (size_t i : members) {
+                std::vector<qvec3d> points(facing[i].begin(), facing[i].end());
+                std::vector<qvec2d> points2d;
+
+                for (const qvec3d &point : points) {
+                    points2d.push_back(basis.project(point));
+                }
+
+                const std::vector<size_t> hull = PlanarHull(points2d);
+
+                if (hull.size() < 3) {
+                    keep[i] = false;
+                    degenerate++;
+                    continue;
+                }
+
+                planar_portal_t &portal = group.emplace_back();
+                SetHull(portal, points, points2d, hull);
+                portal.source = i;
+                portal.changed = hull.size() != points.size();
+            }
+
+            MergeCoplanarPortals(group);
+
+            for (planar_portal_t &portal : group) {
+                if (portal.removed) {
+                    keep[portal.source] = false;
+                    continue;
+                }
+
+                if (!portal.changed) {
+                    continue;
+                }
+
+                prtfile_winding_t winding(portal.points.begin(), portal.points.end());
+
+                // the hull runs counter-clockwise about the plane normal; windings run the other way
+                if (qv::dot(winding.plane().normal, plane.normal) < 0) {
+                    winding = winding.flip();
+                }
+
+                replaced[portal.source] = std::move(winding);
+            }
+        }
+    }
+
+    std::vector<prtfile_portal_t> result;
+    size_t points_before = 0, points_after = 0;
+
+    for (size_t i = 0; i < numportals; i++) {
+        prtfile_portal_t &portal = prtfile.portals[i];
+        points_before += portal.winding.size();
+
+        if (!keep[i]) {
+            continue;
+        }
+
+        if (replaced[i]) {
+            portal.winding = std::move(*replaced[i]);
+            if (portal.leafnums[0] > portal.leafnums[1]) {
+                std::swap(portal.leafnums[0], portal.leafnums[1]);
+            }
+        }
+
+        points_after += portal.winding.size();
+        result.push_back(std::move(portal));
+    }
+
+    logging::print("{:6} portals simplified to {} ({} degenerate dropped), {} points to {}\n", numportals,
+        result.size(), degenerate, points_before, points_after);
+
+    prtfile.portals = std::move(result);
+}
@@ -21,6 +21,10 @@
 #include <vis/vis.hh>
 #include <common/bsputils.hh>
 #include <common/parallel.hh>
+
+#include <bit> // for std::countr_zero
+#include <optional>
+
 /*
 
 Some textures (sky, water, slime, lava) are considered ambien sound emiters.
@@ -51,6 +55,30 @@ static aabb3d SurfaceBBox(const mbsp_t *bsp, const mface_t *surf)
     return bounds;
 }
 
+// the ambient channel a texture emits on, if any
+static std::optional<ambient_type_t> TextureAmbientType(const char *name)
+{
+    if (!Q_strncasecmp(name, "sky", 3) && !vis_options.noambientsky.value())
+        return AMBIENT_SKY;
+    else if (!Q_strncasecmp(name, "*water", 6) && !vis_options.noambientwater.value())
+        return AMBIENT_WATER;
+    else if (!Q_strncasecmp(name, "*04water", 8) && !vis_options.noambientwater.value())
+        return AMBIENT_WATER;
+    else if (!Q_strncasecmp(name, "*slime", 6) && !vis_options.noambientslime.value())
+        return AMBIENT_WATER; // AMBIENT_SLIME;
+    else if (!Q_strncasecmp(name, "*lava", 5) && !vis_options.noambientlava.value())
+        return AMBIENT_LAVA;
+
+    return std::nullopt;
+}
+
+// sound emitting faces in one leaf
+struct leaf_ambient_t
+{
+    uint8_t channels = 0; // bit per ambient_type_t with a source in the leaf
+    std::array<aabb3d, NUM_AMBIENTS> bounds; // of the sources on each channel
+};
+
 /*
   ====================
   CalcAmbientSounds
@@ -72,7 +100,41 @@ void CalcAmbientSounds(mbsp_t *bsp)
         return;
     }
 
-    logging::parallel_for(0, portalleafs_real, [&bsp](int i) {
+    //
+    // classify each texture, then summarize the sources in each leaf, once
+    //
+    std::vector<std::optional<ambient_type_t>> miptex_ambients(bsp->dtex.textures.size());
+    for (size_t i = 0; i < bsp->dtex.textures.size(); i++) {
+        miptex_ambients[i] = TextureAmbientType(bsp->dtex.textures[i].name.data());
+    }
+
+    std::vector<leaf_ambient_t> sources(portalleafs_real);
+
+    logging::parallel_for(0, portalleafs_real, [&](int i) {
+        const mleaf_t *leaf = &bsp->dleafs[i + 1];
+        leaf_ambient_t &source = sources[i];
+
+        for (int k = 0; k < leaf->nummarksurfaces; k++) {
+            const mface_t *surf = BSP_GetFace(bsp, bsp->dleaffaces[leaf->firstmarksurface + k]);
+            const std::optional<ambient_type_t> ambient_type = miptex_ambients[bsp->texinfo[surf->texinfo].miptex];
+
+            if (!ambient_type) {
+                continue;
+            }
+
+            source.channels |= nth_bit(*ambient_type);
+            source.bounds[*ambient_type] += SurfaceBBox(bsp, surf);
+        }
+    });
+
+    uint8_t map_channels = 0;
+    for (const leaf_ambient_t &source : sources) {
+        map_channels |= source.channels;
+    }
+
+    const int visbytes = (portalleafs_real + 7) >> 3;
+
+    logging::parallel_for(0, portalleafs_real, [&](int i) {
         mleaf_t *leaf = &bsp->dleafs[i + 1];
 
         float dists[NUM_AMBIENTS];
@@ -90,52 +152,41 @@ void CalcAmbientSounds(mbsp_t *bsp)
             vis = &uncompressed[i * leafbytes_real];
         }
 
-        for (int j = 0; j < portalleafs_real; j++) {
-            if (!(vis[j >> 3] & nth_bit(j & 7)))
-                continue;
-
-            //
-            // check this leaf for sound textures
-            //
-            mleaf_t *hit = &bsp->dleafs[j + 1];
-
-            for (int k = 0; k < hit->nummarksurfaces; k++) {
-                const mface_t *surf = BSP_GetFace(bsp, bsp->dleaffaces[hit->firstmarksurface + k]);
-                const mtexinfo_t *info = &bsp->texinfo[surf->texinfo];
-                const auto &miptex = bsp->dtex.textures[info->miptex];
-
-                ambient_type_t ambient_type;
-                if (!Q_strncasecmp(miptex.name.data(), "sky", 3) && !vis_options.noambientsky.value())
-                    ambient_type = AMBIENT_SKY;
-                else if (!Q_strncasecmp(miptex.name.data(), "*water", 6) && !vis_options.noambientwater.value())
-                    ambient_type = AMBIENT_WATER;
-                else if (!Q_strncasecmp(miptex.name.data(), "*04water", 8) && !vis_options.noambientwater.value())
-                    ambient_type = AMBIENT_WATER;
-                else if (!Q_strncasecmp(miptex.name.data(), "*slime", 6) && !vis_options.noambientslime.value())
-                    ambient_type = AMBIENT_WATER; // AMBIENT_SLIME;
-                else if (!Q_strncasecmp(miptex.name.data(), "*lava", 5) && !vis_options.noambientlava.value())
-                    ambient_type = AMBIENT_LAVA;
-                else
-                    continue;
-
-                // find distance from source leaf to polygon
-                aabb3d bounds = SurfaceBBox(bsp, surf);
-                float maxd = 0;
-                for (int l = 0; l < 3; l++) {
-                    float d;
-                    if (bounds.mins()[l] > leaf->maxs[l])
-                        d = bounds.mins()[l] - leaf->maxs[l];
-                    else if (bounds.maxs()[l] < leaf->mins[l])
-                        d = leaf->mins[l] - bounds.mins()[l];
-                    else
-                        d = 0;
-                    if (d > maxd)
-                        maxd = d;
+        // channels already at full volume
+        uint8_t loud = 0;
+
+        for (int b = 0; b < visbytes && loud != map_channels; b++) {
+            for (uint32_t bits = vis[b]; bits; bits &= bits - 1) {
+                const int j = (b << 3) + std::countr_zero(bits);
+                if (j >= portalleafs_real)
+                    break;
+
+                const leaf_ambient_t &source = sources[j];
+
+                for (uint32_t channels = source.channels; channels; channels &= channels - 1) {
+                    const int ambient_type = std::countr_zero(channels);
+                    const aabb3d &bounds = source.bounds[ambient_type];
+
+                    // find distance from source leaf to polygon
+                    float maxd = 0;
+                    for (int l = 0; l < 3; l++) {
+                        float d;
+                        if (bounds.mins()[l] > leaf->maxs[l])
+                            d = bounds.mins()[l] - leaf->maxs[l];
+                        else if (bounds.maxs()[l] < leaf->mins[l])
+                            d = leaf->mins[l] - bounds.maxs()[l];
+                        else
+                            d = 0;
+                        if (d > maxd)
+                            maxd = d;
+                    }
+
+                    maxd = 0.25;
+                    if (maxd < dists[ambient_type])
+                        dists[ambient_type] = maxd;
+                    if (dists[ambient_type] < 100)
+                        loud |= nth_bit(ambient_type);
                 }
-
-                maxd = 0.25;
-                if (maxd < dists[ambient_type])
-                    dists[ambient_type] = maxd;
             }
         }
 
@@ -5,6 +5,7 @@
 #include <common/bsputils.hh>
 #include <common/fs.hh>
 #include <common/parallel.hh>
+#include <common/qvec_simd.hh>
 
 #include <climits>
 #include <cstdint>
@@ -115,7 +116,7 @@ void FreeStackWinding(viswinding_t *&w, pstack_t &stack)
 viswinding_t *ClipStackWinding(visstats_t &stats, viswinding_t *in, pstack_t &stack, const qplane3d &split)
 {
     vec_t dists[MAX_WINDING + 1];
-    int sides[MAX_WINDING + 1];
+    planeside_t sides[MAX_WINDING + 1];
     size_t i;
 
     /* Fast test first */
@@ -130,23 +131,10 @@ viswinding_t *ClipStackWinding(visstats_t &stats, viswinding_t *in, pstack_t &st
     if (in->size() > MAX_WINDING)
         FError("in->numpoints > MAX_WINDING ({} > {})", in->size(), MAX_WINDING);
 
-    int counts[3] = {0, 0, 0};
-
     /* determine sides for each point */
-    for (i = 0; i < in->size(); i++) {
-        dot = split.distance_to((*in)[i]);
-        dists[i] = dot;
-        if (dot > VIS_ON_EPSILON)
-            sides[i] = SIDE_FRONT;
-        else if (dot < -VIS_ON_EPSILON)
-            sides[i] = SIDE_BACK;
-        else {
-            sides[i] = SIDE_ON;
-        }
-        counts[sides[i]]++;
-    }
-    sides[i] = sides[0];
-    dists[i] = dists[0];
+    const std::array<size_t, SIDE_TOTAL> counts =
+        qv::classify_points(split, in->points, in->size(), VIS_ON_EPSILON, sides);
+    sides[in->size()] = sides[0];
 
     // ericw -- coplanar portals: return without clipping. Otherwise when two portals are less than ON_EPSILON apart,
     // one will get fully clipped away and we can't see through it causing
@@ -162,6 +150,10 @@ viswinding_t *ClipStackWinding(visstats_t &stats, viswinding_t *in, pstack_t &st
     if (!counts[1])
         return in;
 
+    /* the winding is split, so the exact distances are needed for the new points */
+    qv::plane_distances(split, in->points, in->size(), dists);
+    dists[in->size()] = dists[0];
+
     auto *neww = AllocStackWinding(stack);
     neww->numpoints = 0;
     neww->origin = in->origin;
@@ -373,6 +365,11 @@ static visstats_t LeafThread()
 
     PortalCompleted(stats, p);
 
+    if (stats.c_overbudget) {
+        logging::print("portal {:4} hit -portalbudget (mightsee {}, cansee {}), the rest of its flow used mightsee\n",
+            (ptrdiff_t)(p - portals.data()), p->nummightsee, p->numcansee);
+    }
+
     logging::print(logging::flag::VERBOSE, "portal:{:4}  mightsee:{:4}  cansee:{:4}\n", (ptrdiff_t)(p - portals.data()),
         p->nummightsee, p->numcansee);
 
@@ -520,6 +517,11 @@ visstats_t CalcPortalVis(const mbsp_t *bsp)
 
     SaveVisState();
 
+    if (stats.c_overbudget) {
+        logging::print("{} of {} portals hit -portalbudget {}\n", stats.c_overbudget, numportals * 2 - startcount,
+            vis_options.portalbudget.value());
+    }
+
     logging::print(logging::flag::VERBOSE, "portalcheck: {}  portaltest: {}  portalpass: {}\n", stats.c_portalcheck,
         stats.c_portaltest, stats.c_portalpass);
     logging::print(logging::flag::VERBOSE, "c_vistest: {}  c_mighttest: {}  c_mightseeupdate {}\n", stats.c_vistest,
@@ -535,15 +537,37 @@ visstats_t CalcPortalVis(const mbsp_t *bsp)
 */
 visstats_t CalcVis(mbsp_t *bsp)
 {
-    if (LoadVisState()) {
-        logging::print("Loaded previous state. Resuming progress...\n");
+    visstats_t stats{};
+
+    if (vis_options.approx.value()) {
+        // the options below only apply to the portal flow
+        if (vis_options.fast.value()) {
+            FError("-approx and -fast are both replacements for the full vis, use only one of them");
+        }
+        if (vis_options.level.is_changed()) {
+            logging::print("WARNING: -level has no effect with -approx\n");
+        }
+        if (vis_options.portalbudget.is_changed()) {
+            logging::print("WARNING: -portalbudget has no effect with -approx\n");
+        }
+        if (!vis_options.nostate.value() && (fs::exists(statefile) || fs::exists(statetmpfile))) {
+            logging::print("WARNING: -approx doesn't resume from saved state, ignoring {}\n",
+                fs::exists(statefile) ? statefile : statetmpfile);
+        }
+
+        logging::print("Calculating Approximate Vis:\n");
+        ApproximatePortalVis(bsp);
     } else {
-        logging::print("Calculating Base Vis:\n");
-        BasePortalVis();
-    }
+        if (LoadVisState()) {
+            logging::print("Loaded previous state. Resuming progress...\n");
+        } else {
+            logging::print("Calculating Base Vis:\n");
+            BasePortalVis();
+        }
 
-    logging::print("Calculating Full Vis:\n");
-    auto stats = CalcPortalVis(bsp);
+        logging::print("Calculating Full Vis:\n");
+        stats = CalcPortalVis(bsp);
+    }
 
     //
     // assemble the leaf vis lists by oring and compressing the portal lists
@@ -582,7 +606,11 @@ visstats_t CalcVis(mbsp_t *bsp)
 */
 static void LoadPortals(const fs::path &name, mbsp_t *bsp)
 {
-    const prtfile_t prtfile = LoadPrtFile(name, bsp->loadversion);
+    prtfile_t prtfile = LoadPrtFile(name, bsp->loadversion);
+
+    if (vis_options.simplifyportals.value()) {
+        SimplifyPortals(prtfile);
+    }
 
     portalleafs = prtfile.portalleafs;
     portalleafs_real = prtfile.portalleafs_real;
@@ -676,7 +704,11 @@ static void LoadPortals(const fs::path &name, mbsp_t *bsp)
 
 void vis_reset()
 {
-    // FIXME: clear other data
+    portals.clear();
+    leafs.clear();
+    vismap.clear();
+    uncompressed.clear();
+    totalvis = 0;
 
     vis_options.reset();
 }